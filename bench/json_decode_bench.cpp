@@ -0,0 +1,100 @@
+#include "json_utils.hh"
+#include "types.hh"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <string>
+#include <vector>
+
+// Compares request-decode throughput of rapidjson's default DOM parse + GetFloat() against
+// parseJsonRequest (in-situ SAX with std::from_chars) for typical embedding sizes.
+
+using namespace vdb;
+
+namespace
+{
+
+std::string makeSearchRequest(i32 dim, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<f32> dist(-1.0f, 1.0f);
+    rapidjson::Document doc;
+    doc.SetObject();
+    auto &allocator = doc.GetAllocator();
+    rapidjson::Value vectors(rapidjson::kArrayType);
+    for (i32 i = 0; i < dim; ++i)
+    {
+        vectors.PushBack(dist(rng), allocator);
+    }
+    doc.AddMember("vectors", vectors, allocator);
+    doc.AddMember("k", 10, allocator);
+    doc.AddMember("indexType", "HNSW", allocator);
+
+    rapidjson::StringBuffer buffer;
+    JsonWriter<rapidjson::StringBuffer> writer(buffer);
+    doc.Accept(writer);
+    return buffer.GetString();
+}
+
+template <typename Decode>
+f64 measure(const std::vector<std::string> &bodies, i32 rounds, Decode &&decode)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (i32 r = 0; r < rounds; ++r)
+    {
+        for (const auto &body : bodies)
+        {
+            decode(body);
+        }
+    }
+    std::chrono::duration<f64> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const i32 requests = 256;
+    const i32 rounds = argc > 1 ? std::atoi(argv[1]) : 20;
+    std::mt19937 rng(42);
+
+    std::printf("%-6s %-22s %12s %12s\n", "dim", "decoder", "req/s", "MB/s");
+    for (i32 dim : {128, 384, 768, 1536})
+    {
+        std::vector<std::string> bodies;
+        size_t total_bytes = 0;
+        for (i32 i = 0; i < requests; ++i)
+        {
+            bodies.push_back(makeSearchRequest(dim, rng));
+            total_bytes += bodies.back().size();
+        }
+
+        volatile f32 sink = 0.0f;
+        std::vector<f32> query;
+
+        f64 dom_seconds = measure(bodies, rounds, [&](const std::string &body) {
+            rapidjson::Document doc;
+            doc.Parse(body.c_str());
+            getVectorFromJson(doc["vectors"], query);
+            sink = sink + query[0];
+        });
+
+        f64 insitu_seconds = measure(bodies, rounds, [&](const std::string &body) {
+            std::string buffer = body;
+            rapidjson::Document doc;
+            parseJsonRequest(buffer, doc, &query);
+            sink = sink + query[0];
+        });
+
+        f64 total_requests = static_cast<f64>(requests) * rounds;
+        f64 total_mb = static_cast<f64>(total_bytes) * rounds / (1024.0 * 1024.0);
+        std::printf("%-6d %-22s %12.0f %12.1f\n", dim, "Parse+GetFloat", total_requests / dom_seconds,
+                    total_mb / dom_seconds);
+        std::printf("%-6d %-22s %12.0f %12.1f\n", dim, "parseJsonRequest", total_requests / insitu_seconds,
+                    total_mb / insitu_seconds);
+    }
+    return 0;
+}
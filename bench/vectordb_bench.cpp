@@ -0,0 +1,794 @@
+#include "faiss_index.hh"
+#include "filter_index.hh"
+#include "id_map.hh"
+#include "index_factory.hh"
+#include "logger.hh"
+#include "metrics.hh"
+#include "parallelism.hh"
+#include "persistence.hh"
+#include "scalar_storage.hh"
+#include "sparse_index.hh"
+#include "types.hh"
+#include "vector_file.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <random>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <roaring/roaring.h>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// In-process benchmarks for FaissIndex, FilterIndex, Persistence and ScalarStorage.
+// Results are written as one JSON document so runs can be diffed between releases.
+// The "validation" section checks SparseIndex search against brute force and IdMap snapshots
+// and ordinal reuse; a failed check makes the run exit with status 1.
+//
+//   vectordb_bench [--dim 128] [--count 100000] [--queries 1000] [--k 10] [--shards 1] [--insert-threads 1]
+//                  [--write-buffer 0] [--cardinality 10,100,1000] [--base sift_base.fvecs] [--query sift_query.fvecs]
+//                  [--search-threads 0] [--workdir bench_data] [--output result.json]
+
+using namespace vdb;
+
+namespace
+{
+
+struct BenchConfig
+{
+    i32 dim = 128;
+    i32 count = 100000;
+    i32 queries = 1000;
+    i32 k = 10;
+    i32 shards = 1;
+    i32 insert_threads = 1;
+    i32 write_buffer = 0;
+    // concurrent searchers of the OpenMP policy comparison, 0 skips it
+    i32 search_threads = 0;
+    std::vector<i32> cardinalities = {10, 100, 1000};
+    std::string base_path;
+    std::string query_path;
+    std::string workdir = "bench_data";
+    std::string output_path;
+};
+
+struct Dataset
+{
+    i32 dim = 0;
+    std::vector<f32> base;
+    std::vector<f32> queries;
+
+    i64 baseCount() const
+    {
+        return static_cast<i64>(base.size() / dim);
+    }
+
+    i64 queryCount() const
+    {
+        return static_cast<i64>(queries.size() / dim);
+    }
+};
+
+std::vector<i32> parseIntList(const std::string &value)
+{
+    std::vector<i32> result;
+    std::stringstream ss(value);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        result.push_back(std::stoi(item));
+    }
+    return result;
+}
+
+BenchConfig parseArgs(int argc, char **argv)
+{
+    BenchConfig config;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--dim")
+            config.dim = std::stoi(value);
+        else if (key == "--count")
+            config.count = std::stoi(value);
+        else if (key == "--queries")
+            config.queries = std::stoi(value);
+        else if (key == "--k")
+            config.k = std::stoi(value);
+        else if (key == "--shards")
+            config.shards = std::stoi(value);
+        else if (key == "--insert-threads")
+            config.insert_threads = std::stoi(value);
+        else if (key == "--write-buffer")
+            config.write_buffer = std::stoi(value);
+        else if (key == "--search-threads")
+            config.search_threads = std::stoi(value);
+        else if (key == "--cardinality")
+            config.cardinalities = parseIntList(value);
+        else if (key == "--base")
+            config.base_path = value;
+        else if (key == "--query")
+            config.query_path = value;
+        else if (key == "--workdir")
+            config.workdir = value;
+        else if (key == "--output")
+            config.output_path = value;
+        else
+            throw std::invalid_argument("Unknown option " + key);
+    }
+    return config;
+}
+
+/// Read up to `limit` vectors (all when <= 0) from a .fvecs file.
+std::vector<f32> readFvecs(const std::string &path, i32 limit, i32 *dim)
+{
+    FvecsReader reader(path);
+    std::vector<f32> data;
+    reader.read(data, limit > 0 ? static_cast<size_t>(limit) : std::numeric_limits<size_t>::max());
+    *dim = reader.dim();
+    return data;
+}
+
+Dataset loadDataset(const BenchConfig &config)
+{
+    Dataset dataset;
+    if (!config.base_path.empty())
+    {
+        dataset.base = readFvecs(config.base_path, config.count, &dataset.dim);
+        i32 query_dim = dataset.dim;
+        if (!config.query_path.empty())
+        {
+            dataset.queries = readFvecs(config.query_path, config.queries, &query_dim);
+        }
+        if (query_dim != dataset.dim)
+        {
+            throw std::runtime_error("Base and query dimensions differ");
+        }
+    }
+    else
+    {
+        dataset.dim = config.dim;
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<f32> dist(0.0f, 1.0f);
+        dataset.base.resize(static_cast<size_t>(config.count) * config.dim);
+        for (auto &v : dataset.base)
+        {
+            v = dist(rng);
+        }
+    }
+
+    if (dataset.queries.empty())
+    {
+        // perturbed copies of random base vectors
+        std::mt19937 rng(4321);
+        std::uniform_int_distribution<i64> pick(0, dataset.baseCount() - 1);
+        std::normal_distribution<f32> noise(0.0f, 0.01f);
+        dataset.queries.resize(static_cast<size_t>(config.queries) * dataset.dim);
+        for (i32 q = 0; q < config.queries; ++q)
+        {
+            i64 src = pick(rng);
+            for (i32 j = 0; j < dataset.dim; ++j)
+            {
+                dataset.queries[q * dataset.dim + j] = dataset.base[src * dataset.dim + j] + noise(rng);
+            }
+        }
+    }
+    return dataset;
+}
+
+std::vector<f32> row(const std::vector<f32> &data, i64 i, i32 dim)
+{
+    return std::vector<f32>(data.begin() + i * dim, data.begin() + (i + 1) * dim);
+}
+
+f64 secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+}
+
+using Writer = rapidjson::PrettyWriter<rapidjson::StringBuffer>;
+
+void writeLatency(Writer &writer, const Histogram &latency, f64 seconds, i64 operations)
+{
+    writer.Key("qps");
+    writer.Double(operations / seconds);
+    writer.Key("p50_us");
+    writer.Double(latency.percentile(0.50) / 1e3);
+    writer.Key("p95_us");
+    writer.Double(latency.percentile(0.95) / 1e3);
+    writer.Key("p99_us");
+    writer.Double(latency.percentile(0.99) / 1e3);
+    writer.Key("p999_us");
+    writer.Double(latency.percentile(0.999) / 1e3);
+}
+
+/// Run every query once; returns the labels (queries x k) and fills `latency`.
+std::vector<i64> runQueries(FaissIndex *index, const Dataset &dataset, i32 k, const roaring_bitmap_t *bitmap,
+                            Histogram &latency, f64 *seconds)
+{
+    std::vector<i64> labels;
+    labels.reserve(dataset.queryCount() * k);
+    auto start = std::chrono::steady_clock::now();
+    for (i64 q = 0; q < dataset.queryCount(); ++q)
+    {
+        std::vector<f32> query = row(dataset.queries, q, dataset.dim);
+        auto query_start = std::chrono::steady_clock::now();
+        auto result = index->search_vectors(query, k, bitmap);
+        latency.record(elapsedNsSince(query_start));
+        labels.insert(labels.end(), result.first.begin(), result.first.end());
+    }
+    *seconds = secondsSince(start);
+    return labels;
+}
+
+f64 recallAtK(const std::vector<i64> &result, const std::vector<i64> &truth, i64 queries, i32 k)
+{
+    i64 hits = 0;
+    i64 expected = 0;
+    for (i64 q = 0; q < queries; ++q)
+    {
+        std::unordered_set<i64> truth_set;
+        for (i32 j = 0; j < k; ++j)
+        {
+            if (truth[q * k + j] != -1)
+            {
+                truth_set.insert(truth[q * k + j]);
+            }
+        }
+        expected += truth_set.size();
+        for (i32 j = 0; j < k; ++j)
+        {
+            hits += truth_set.count(result[q * k + j]);
+        }
+    }
+    return expected == 0 ? 1.0 : static_cast<f64>(hits) / expected;
+}
+
+void benchIndexes(Writer &writer, const BenchConfig &config, const Dataset &dataset, IndexFactory &factory)
+{
+    FaissIndex *flat = factory.getFaissIndex(IndexFactory::IndexType::FLAT);
+    FaissIndex *hnsw = factory.getFaissIndex(IndexFactory::IndexType::HNSW);
+    FilterIndex *filter = factory.getFilterIndex();
+
+    writer.Key("insert");
+    writer.StartObject();
+    for (auto [name, index] : {std::pair{"FLAT", flat}, std::pair{"HNSW", hnsw}})
+    {
+        Histogram latency;
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> inserters;
+        for (i32 t = 0; t < config.insert_threads; ++t)
+        {
+            inserters.emplace_back([&, t, index = index]() {
+                for (i64 i = t; i < dataset.baseCount(); i += config.insert_threads)
+                {
+                    std::vector<f32> vector = row(dataset.base, i, dataset.dim);
+                    auto insert_start = std::chrono::steady_clock::now();
+                    index->insert_vectors(vector, static_cast<u64>(i));
+                    latency.record(elapsedNsSince(insert_start));
+                }
+            });
+        }
+        for (auto &inserter : inserters)
+        {
+            inserter.join();
+        }
+        f64 seconds = secondsSince(start);
+        writer.Key(name);
+        writer.StartObject();
+        writeLatency(writer, latency, seconds, dataset.baseCount());
+        writer.EndObject();
+    }
+    writer.EndObject();
+
+    // ground truth from FLAT
+    Histogram flat_latency;
+    f64 flat_seconds = 0.0;
+    std::vector<i64> truth = runQueries(flat, dataset, config.k, nullptr, flat_latency, &flat_seconds);
+
+    writer.Key("search");
+    writer.StartObject();
+    writer.Key("FLAT");
+    writer.StartObject();
+    writeLatency(writer, flat_latency, flat_seconds, dataset.queryCount());
+    writer.EndObject();
+
+    Histogram hnsw_latency;
+    f64 hnsw_seconds = 0.0;
+    std::vector<i64> hnsw_result = runQueries(hnsw, dataset, config.k, nullptr, hnsw_latency, &hnsw_seconds);
+    writer.Key("HNSW");
+    writer.StartObject();
+    writeLatency(writer, hnsw_latency, hnsw_seconds, dataset.queryCount());
+    writer.Key("recall_at_k");
+    writer.Double(recallAtK(hnsw_result, truth, dataset.queryCount(), config.k));
+    writer.EndObject();
+    writer.EndObject();
+
+    // filtered search: field "c<cardinality>" = id % cardinality, filter on value 0
+    writer.Key("filtered_search");
+    writer.StartArray();
+    for (i32 cardinality : config.cardinalities)
+    {
+        std::string field = "c" + std::to_string(cardinality);
+        for (i64 i = 0; i < dataset.baseCount(); ++i)
+        {
+            filter->updateIntFieldFilter(field, i % cardinality, static_cast<u32>(i));
+        }
+
+        for (auto op : {FilterIndex::Operation::EQUAL, FilterIndex::Operation::NOT_EQUAL})
+        {
+            roaring_bitmap_t *bitmap = roaring_bitmap_create();
+            auto bitmap_start = std::chrono::steady_clock::now();
+            filter->getIntFieldFilterBitmap(field, op, 0, bitmap);
+            f64 bitmap_us = elapsedNsSince(bitmap_start) / 1e3;
+            f64 selectivity = static_cast<f64>(roaring_bitmap_get_cardinality(bitmap)) / dataset.baseCount();
+
+            Histogram filtered_flat_latency;
+            f64 filtered_flat_seconds = 0.0;
+            std::vector<i64> filtered_truth =
+                runQueries(flat, dataset, config.k, bitmap, filtered_flat_latency, &filtered_flat_seconds);
+            Histogram filtered_hnsw_latency;
+            f64 filtered_hnsw_seconds = 0.0;
+            std::vector<i64> filtered_result =
+                runQueries(hnsw, dataset, config.k, bitmap, filtered_hnsw_latency, &filtered_hnsw_seconds);
+
+            writer.StartObject();
+            writer.Key("field");
+            writer.String(field.c_str());
+            writer.Key("op");
+            writer.String(op == FilterIndex::Operation::EQUAL ? "=" : "!=");
+            writer.Key("selectivity");
+            writer.Double(selectivity);
+            writer.Key("bitmap_build_us");
+            writer.Double(bitmap_us);
+            writer.Key("FLAT");
+            writer.StartObject();
+            writeLatency(writer, filtered_flat_latency, filtered_flat_seconds, dataset.queryCount());
+            writer.EndObject();
+            writer.Key("HNSW");
+            writer.StartObject();
+            writeLatency(writer, filtered_hnsw_latency, filtered_hnsw_seconds, dataset.queryCount());
+            writer.Key("recall_at_k");
+            writer.Double(recallAtK(filtered_result, filtered_truth, dataset.queryCount(), config.k));
+            writer.EndObject();
+            writer.EndObject();
+
+            roaring_bitmap_free(bitmap);
+        }
+    }
+    writer.EndArray();
+}
+
+/// QPS and latency of `search_threads` concurrent single-vector searchers, and the throughput of
+/// one search with all queries at once, under each OpenMP policy
+void benchParallelism(Writer &writer, const BenchConfig &config, const Dataset &dataset, IndexFactory &factory)
+{
+    FaissIndex *flat = factory.getFaissIndex(IndexFactory::IndexType::FLAT);
+    FaissIndex *hnsw = factory.getFaissIndex(IndexFactory::IndexType::HNSW);
+
+    writer.Key("parallelism");
+    writer.StartObject();
+    writer.Key("search_threads");
+    writer.Int(config.search_threads);
+    for (ParallelismPolicy policy : {ParallelismPolicy::WIDE, ParallelismPolicy::SINGLE, ParallelismPolicy::ADAPTIVE})
+    {
+        setParallelismPolicy(policy);
+        writer.Key(parallelismPolicyName(policy));
+        writer.StartObject();
+        for (auto [name, index] : {std::pair{"FLAT", flat}, std::pair{"HNSW", hnsw}})
+        {
+            Histogram latency;
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> searchers;
+            for (i32 t = 0; t < config.search_threads; ++t)
+            {
+                searchers.emplace_back([&, t, index = index]() {
+                    for (i64 q = t; q < dataset.queryCount(); q += config.search_threads)
+                    {
+                        std::vector<f32> query = row(dataset.queries, q, dataset.dim);
+                        auto query_start = std::chrono::steady_clock::now();
+                        index->search_vectors(query, config.k);
+                        latency.record(elapsedNsSince(query_start));
+                    }
+                });
+            }
+            for (auto &searcher : searchers)
+            {
+                searcher.join();
+            }
+            f64 seconds = secondsSince(start);
+
+            auto batch_start = std::chrono::steady_clock::now();
+            index->search_vectors(dataset.queries, config.k);
+            f64 batch_seconds = secondsSince(batch_start);
+
+            writer.Key(name);
+            writer.StartObject();
+            writeLatency(writer, latency, seconds, dataset.queryCount());
+            writer.Key("batch_qps");
+            writer.Double(dataset.queryCount() / batch_seconds);
+            writer.EndObject();
+        }
+        writer.EndObject();
+    }
+    writer.EndObject();
+    setParallelismPolicy(ParallelismPolicy::WIDE);
+}
+
+void benchWal(Writer &writer, const Dataset &dataset)
+{
+    const std::string wal_path = "bench.wal";
+    std::filesystem::remove(wal_path);
+    i64 entries = dataset.baseCount();
+
+    f64 append_seconds = 0.0;
+    {
+        Persistence persistence;
+        persistence.init(wal_path);
+        auto start = std::chrono::steady_clock::now();
+        for (i64 i = 0; i < entries; ++i)
+        {
+            rapidjson::Document doc;
+            doc.SetObject();
+            auto &allocator = doc.GetAllocator();
+            rapidjson::Value vectors(rapidjson::kArrayType);
+            for (i32 j = 0; j < dataset.dim; ++j)
+            {
+                vectors.PushBack(dataset.base[i * dataset.dim + j], allocator);
+            }
+            doc.AddMember("vectors", vectors, allocator);
+            doc.AddMember("id", static_cast<u64>(i), allocator);
+            doc.AddMember("indexType", "FLAT", allocator);
+            persistence.writeWALLog("upsert", doc, "1.0");
+        }
+        append_seconds = secondsSince(start);
+    }
+
+    f64 replay_seconds = 0.0;
+    i64 replayed = 0;
+    {
+        Persistence persistence;
+        persistence.init(wal_path);
+        auto start = std::chrono::steady_clock::now();
+        std::string operation_type;
+        rapidjson::Document doc;
+        std::vector<f32> vector;
+        persistence.readNextWALLog(&operation_type, &doc, &vector);
+        while (!operation_type.empty())
+        {
+            ++replayed;
+            operation_type.clear();
+            persistence.readNextWALLog(&operation_type, &doc, &vector);
+        }
+        replay_seconds = secondsSince(start);
+    }
+
+    writer.Key("wal");
+    writer.StartObject();
+    writer.Key("bytes");
+    writer.Uint64(std::filesystem::file_size(wal_path));
+    writer.Key("append_per_sec");
+    writer.Double(entries / append_seconds);
+    writer.Key("replay_per_sec");
+    writer.Double(replayed / replay_seconds);
+    writer.EndObject();
+}
+
+void benchSnapshot(Writer &writer, IndexFactory &factory, const BenchConfig &config)
+{
+    ScalarStorage scalar_storage("bench_rocksdb");
+
+    auto save_start = std::chrono::steady_clock::now();
+    factory.saveIndex("bench.snapshot", scalar_storage);
+    f64 save_seconds = secondsSince(save_start);
+
+    IndexFactory::IndexParams params;
+    params.shards = config.shards;
+    params.hnsw_write_buffer = config.write_buffer;
+    IndexFactory loaded;
+    loaded.init(IndexFactory::IndexType::FLAT, config.dim, IndexFactory::MetricType::L2, params);
+    loaded.init(IndexFactory::IndexType::HNSW, config.dim, IndexFactory::MetricType::L2, params);
+    loaded.init(IndexFactory::IndexType::FILTER, config.dim);
+    auto load_start = std::chrono::steady_clock::now();
+    loaded.loadIndex("bench.snapshot", scalar_storage);
+    f64 load_seconds = secondsSince(load_start);
+
+    writer.Key("snapshot");
+    writer.StartObject();
+    writer.Key("save_seconds");
+    writer.Double(save_seconds);
+    writer.Key("load_seconds");
+    writer.Double(load_seconds);
+    writer.EndObject();
+}
+
+/// MaxScore results of a SparseIndex against an exact dot product over the f32 weights, with and
+/// without a filter. Scores may differ by the 8-bit quantization of the postings, nothing more.
+bool checkSparse(Writer &writer, const BenchConfig &config)
+{
+    constexpr u32 kVocabulary = 2000;
+    constexpr i32 kTermsPerDocument = 40;
+    constexpr i32 kTermsPerQuery = 8;
+    i32 documents = std::min(config.count, 20000);
+    i32 queries = std::min(config.queries, 200);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<u32> term_dist(0, kVocabulary - 1);
+    std::uniform_real_distribution<f32> weight_dist(0.01f, 1.0f);
+
+    SparseIndex index;
+    std::vector<std::unordered_map<u32, f32>> truth(documents);
+    auto insert = [&](i32 document) {
+        std::vector<u32> terms;
+        std::vector<f32> weights;
+        truth[document].clear();
+        for (i32 j = 0; j < kTermsPerDocument; ++j)
+        {
+            terms.push_back(term_dist(rng));
+            weights.push_back(weight_dist(rng));
+            truth[document][terms.back()] += weights.back();
+        }
+        index.insert_vector(terms, weights, static_cast<u32>(document));
+    };
+    // ascending labels grow the open last block of each list, like newly allocated ordinals
+    auto insert_start = std::chrono::steady_clock::now();
+    for (i32 document = 0; document < documents; ++document)
+    {
+        insert(document);
+    }
+    f64 insert_seconds = secondsSince(insert_start);
+    // removals and overwrites re-encode sealed blocks
+    for (i32 document = 0; document < documents; document += 10)
+    {
+        index.remove_vectors({document});
+        truth[document].clear();
+        if (document + 5 < documents)
+        {
+            insert(document + 5);
+        }
+    }
+
+    // repeated terms add up, so a posting can exceed the largest drawn weight
+    f32 max_weight = 0.0f;
+    for (const auto &weights : truth)
+    {
+        for (const auto &[term, weight] : weights)
+        {
+            max_weight = std::max(max_weight, weight);
+        }
+    }
+    roaring_bitmap_t *filter = roaring_bitmap_create();
+    for (i32 document = 0; document < documents; document += 3)
+    {
+        roaring_bitmap_add(filter, static_cast<u32>(document));
+    }
+
+    u64 mismatches = 0;
+    f64 max_error = 0.0;
+    f64 search_seconds = 0.0;
+    for (i32 q = 0; q < queries; ++q)
+    {
+        std::vector<u32> terms;
+        std::vector<f32> weights;
+        f32 tolerance = 1e-4f;
+        for (i32 j = 0; j < kTermsPerQuery; ++j)
+        {
+            terms.push_back(term_dist(rng));
+            weights.push_back(weight_dist(rng));
+            // half a quantization step of the largest block weight, per query term
+            tolerance += weights.back() * max_weight / 510.0f * 1.01f;
+        }
+        auto score = [&](i32 document) {
+            f32 total = 0.0f;
+            for (size_t j = 0; j < terms.size(); ++j)
+            {
+                auto it = truth[document].find(terms[j]);
+                total += it != truth[document].end() ? weights[j] * it->second : 0.0f;
+            }
+            return total;
+        };
+        for (const roaring_bitmap_t *bitmap : {static_cast<const roaring_bitmap_t *>(nullptr),
+                                               static_cast<const roaring_bitmap_t *>(filter)})
+        {
+            auto search_start = std::chrono::steady_clock::now();
+            auto [labels, scores] = index.search_vector(terms, weights, config.k, bitmap);
+            search_seconds += secondsSince(search_start);
+
+            std::vector<f32> expected;
+            for (i32 document = 0; document < documents; ++document)
+            {
+                f32 value = score(document);
+                if (value > 0.0f &&
+                    (bitmap == nullptr || roaring_bitmap_contains(bitmap, static_cast<u32>(document))))
+                {
+                    expected.push_back(value);
+                }
+            }
+            std::sort(expected.rbegin(), expected.rend());
+            for (i32 i = 0; i < config.k; ++i)
+            {
+                i64 label = labels[i];
+                if (static_cast<size_t>(i) >= expected.size())
+                {
+                    mismatches += label != -1;
+                    continue;
+                }
+                if (label < 0 || label >= documents ||
+                    (bitmap != nullptr && !roaring_bitmap_contains(bitmap, static_cast<u32>(label))))
+                {
+                    ++mismatches;
+                    continue;
+                }
+                // the reported score is the document's, and no better document was left out
+                f32 exact = score(static_cast<i32>(label));
+                f64 error = std::abs(scores[i] - exact);
+                max_error = std::max(max_error, error);
+                if (error > tolerance || exact < expected[i] - 2 * tolerance)
+                {
+                    ++mismatches;
+                }
+            }
+        }
+    }
+    roaring_bitmap_free(filter);
+
+    writer.Key("sparse");
+    writer.StartObject();
+    writer.Key("documents");
+    writer.Int(documents);
+    writer.Key("insert_per_sec");
+    writer.Double(documents / insert_seconds);
+    writer.Key("search_qps");
+    writer.Double(2 * queries / search_seconds);
+    writer.Key("max_score_error");
+    writer.Double(max_error);
+    writer.Key("mismatches");
+    writer.Uint64(mismatches);
+    writer.EndObject();
+    return mismatches == 0;
+}
+
+/// IdMap ordinals survive a save and load, and a released ordinal is handed out again only on the
+/// second recycle() after its release, also across the snapshot.
+bool checkIdMap(Writer &writer)
+{
+    constexpr u64 kIds = 10000;
+    // external ids far from the ordinals, so a missed translation shows
+    auto external = [](u64 i) { return (u64(1) << 40) + i * 7919; };
+    u64 failures = 0;
+
+    IdMap map;
+    for (u64 i = 0; i < kIds; ++i)
+    {
+        failures += map.assign(external(i)) != i;
+    }
+    std::unordered_set<u32> released;
+    for (u64 i = 0; i < kIds; i += 4)
+    {
+        std::optional<u32> ordinal = map.release(external(i));
+        failures += !ordinal.has_value();
+        released.insert(ordinal.value_or(0));
+    }
+    map.recycle();
+    // one pass is not enough: this id takes a new ordinal
+    failures += map.assign(external(kIds)) != kIds;
+
+    ScalarStorage scalar_storage("bench_idmap_rocksdb");
+    map.saveIndex(scalar_storage, "bench.idmap");
+    IdMap loaded;
+    failures += !loaded.loadIndex(scalar_storage, "bench.idmap");
+    failures += loaded.size() != map.size();
+    for (u64 i = 0; i <= kIds; ++i)
+    {
+        failures += loaded.find(external(i)) != map.find(external(i));
+    }
+
+    loaded.recycle();
+    u32 reused = loaded.assign(external(kIds + 1));
+    failures += released.count(reused) == 0;
+    std::vector<i64> labels = {static_cast<i64>(reused), static_cast<i64>(loaded.assign(external(1))), -1};
+    loaded.toExternal(labels);
+    failures += labels != std::vector<i64>{static_cast<i64>(external(kIds + 1)), static_cast<i64>(external(1)), -1};
+
+    writer.Key("id_map");
+    writer.StartObject();
+    writer.Key("ids");
+    writer.Uint64(kIds);
+    writer.Key("failures");
+    writer.Uint64(failures);
+    writer.EndObject();
+    return failures == 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    init_global_logger();
+    set_log_level(spdlog::level::critical);
+
+    BenchConfig config = parseArgs(argc, argv);
+    Dataset dataset = loadDataset(config);
+    config.dim = dataset.dim;
+
+    if (!config.output_path.empty())
+    {
+        config.output_path = std::filesystem::absolute(config.output_path).string();
+    }
+    std::filesystem::create_directories(config.workdir);
+    std::filesystem::current_path(config.workdir);
+
+    IndexFactory::IndexParams params;
+    params.shards = config.shards;
+    params.hnsw_write_buffer = config.write_buffer;
+    IndexFactory factory;
+    factory.init(IndexFactory::IndexType::FLAT, dataset.dim, IndexFactory::MetricType::L2, params);
+    factory.init(IndexFactory::IndexType::HNSW, dataset.dim, IndexFactory::MetricType::L2, params);
+    factory.init(IndexFactory::IndexType::FILTER, dataset.dim);
+
+    rapidjson::StringBuffer buffer;
+    Writer writer(buffer);
+    writer.StartObject();
+    writer.Key("dataset");
+    writer.StartObject();
+    writer.Key("dim");
+    writer.Int(dataset.dim);
+    writer.Key("count");
+    writer.Int64(dataset.baseCount());
+    writer.Key("queries");
+    writer.Int64(dataset.queryCount());
+    writer.Key("k");
+    writer.Int(config.k);
+    writer.Key("shards");
+    writer.Int(config.shards);
+    writer.Key("write_buffer");
+    writer.Int(config.write_buffer);
+    writer.Key("insert_threads");
+    writer.Int(config.insert_threads);
+    writer.Key("source");
+    writer.String(config.base_path.empty() ? "synthetic" : config.base_path.c_str());
+    writer.EndObject();
+
+    benchIndexes(writer, config, dataset, factory);
+    if (config.search_threads > 0)
+    {
+        benchParallelism(writer, config, dataset, factory);
+    }
+    benchWal(writer, dataset);
+    benchSnapshot(writer, factory, config);
+    writer.Key("validation");
+    writer.StartObject();
+    bool sparse_passed = checkSparse(writer, config);
+    bool id_map_passed = checkIdMap(writer);
+    writer.EndObject();
+    writer.EndObject();
+
+    if (config.output_path.empty())
+    {
+        std::printf("%s\n", buffer.GetString());
+    }
+    else
+    {
+        std::ofstream out(config.output_path);
+        out << buffer.GetString() << std::endl;
+    }
+    if (!sparse_passed || !id_map_passed)
+    {
+        std::fprintf(stderr, "validation failed:%s%s\n", sparse_passed ? "" : " sparse",
+                     id_map_passed ? "" : " id_map");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,406 @@
+#include "json_utils.hh"
+#include "metrics.hh"
+#include "types.hh"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <httplib.h>
+#include <memory>
+#include <random>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// HTTP load generator for a running vectordb server.
+//
+// Open-loop mode (--rate > 0) issues requests on a fixed arrival schedule and measures every
+// latency from the request's *intended* start time, so a stalled server shows up as latency
+// instead of silently lowering the offered load (coordinated omission). Closed-loop mode
+// (--rate 0) keeps --connections requests in flight.
+//
+//   vectordb_loadgen [--host localhost] [--port 8080] [--rate 1000] [--connections 32]
+//                    [--duration 30] [--dim 128] [--k 10] [--index HNSW] [--collection name]
+//                    [--search 0.8] [--upsert 0.15] [--query 0.05] [--filter 0.3]
+//                    [--cardinality 100] [--ids 100000] [--keep-alive 1] [--output report.json]
+//                    [--expect-batching 0]
+//
+// The report includes the server's search micro-batching over the run. With --expect-batching 1
+// the run fails when concurrent searches were not coalesced into batches of more than one query.
+
+using namespace vdb;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+struct LoadConfig
+{
+    std::string host = "localhost";
+    i32 port = 8080;
+    f64 rate = 1000.0;
+    i32 connections = 32;
+    f64 duration = 30.0;
+    i32 dim = 128;
+    i32 k = 10;
+    std::string index_type = "HNSW";
+    std::string collection;
+    f64 search_ratio = 0.8;
+    f64 upsert_ratio = 0.15;
+    f64 query_ratio = 0.05;
+    f64 filter_ratio = 0.0;
+    i32 cardinality = 100;
+    u64 id_space = 100000;
+    bool keep_alive = true;
+    std::string output_path;
+    bool expect_batching = false;
+};
+
+LoadConfig parseArgs(int argc, char **argv)
+{
+    LoadConfig config;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--host")
+            config.host = value;
+        else if (key == "--port")
+            config.port = std::stoi(value);
+        else if (key == "--rate")
+            config.rate = std::stod(value);
+        else if (key == "--connections")
+            config.connections = std::stoi(value);
+        else if (key == "--duration")
+            config.duration = std::stod(value);
+        else if (key == "--dim")
+            config.dim = std::stoi(value);
+        else if (key == "--k")
+            config.k = std::stoi(value);
+        else if (key == "--index")
+            config.index_type = value;
+        else if (key == "--collection")
+            config.collection = value;
+        else if (key == "--search")
+            config.search_ratio = std::stod(value);
+        else if (key == "--upsert")
+            config.upsert_ratio = std::stod(value);
+        else if (key == "--query")
+            config.query_ratio = std::stod(value);
+        else if (key == "--filter")
+            config.filter_ratio = std::stod(value);
+        else if (key == "--cardinality")
+            config.cardinality = std::stoi(value);
+        else if (key == "--ids")
+            config.id_space = std::stoull(value);
+        else if (key == "--keep-alive")
+            config.keep_alive = value != "0";
+        else if (key == "--output")
+            config.output_path = value;
+        else if (key == "--expect-batching")
+            config.expect_batching = value != "0";
+        else
+            throw std::invalid_argument("Unknown option " + key);
+    }
+    return config;
+}
+
+enum class Operation
+{
+    SEARCH,
+    UPSERT,
+    QUERY,
+    COUNT
+};
+
+const char *operationName(Operation op)
+{
+    switch (op)
+    {
+    case Operation::SEARCH:
+        return "search";
+    case Operation::UPSERT:
+        return "upsert";
+    case Operation::QUERY:
+        return "query";
+    default:
+        return "unknown";
+    }
+}
+
+struct OperationStats
+{
+    Histogram latency;
+    Counter ok;
+    Counter errors;
+};
+
+/// Builds request bodies; one per worker thread.
+class RequestGenerator
+{
+  public:
+    RequestGenerator(const LoadConfig &config, u32 seed) : m_config(config), m_rng(seed)
+    {
+    }
+
+    Operation nextOperation()
+    {
+        f64 total = m_config.search_ratio + m_config.upsert_ratio + m_config.query_ratio;
+        f64 pick = std::uniform_real_distribution<f64>(0.0, total)(m_rng);
+        if (pick < m_config.search_ratio)
+        {
+            return Operation::SEARCH;
+        }
+        if (pick < m_config.search_ratio + m_config.upsert_ratio)
+        {
+            return Operation::UPSERT;
+        }
+        return Operation::QUERY;
+    }
+
+    std::string body(Operation op)
+    {
+        rapidjson::StringBuffer buffer;
+        JsonWriter<rapidjson::StringBuffer> writer(buffer);
+        u64 id = std::uniform_int_distribution<u64>(0, m_config.id_space - 1)(m_rng);
+
+        writer.StartObject();
+        if (!m_config.collection.empty())
+        {
+            writer.Key("collection");
+            writer.String(m_config.collection.c_str());
+        }
+        if (op == Operation::SEARCH || op == Operation::UPSERT)
+        {
+            writer.Key("vectors");
+            writer.StartArray();
+            std::uniform_real_distribution<f32> dist(0.0f, 1.0f);
+            for (i32 i = 0; i < m_config.dim; ++i)
+            {
+                writer.Double(dist(m_rng));
+            }
+            writer.EndArray();
+            writer.Key("indexType");
+            writer.String(m_config.index_type.c_str());
+        }
+
+        if (op == Operation::SEARCH)
+        {
+            writer.Key("k");
+            writer.Int(m_config.k);
+            if (std::uniform_real_distribution<f64>(0.0, 1.0)(m_rng) < m_config.filter_ratio)
+            {
+                writer.Key("filter");
+                writer.StartObject();
+                writer.Key("fieldName");
+                writer.String("category");
+                writer.Key("op");
+                writer.String("=");
+                writer.Key("value");
+                writer.Int(std::uniform_int_distribution<i32>(0, m_config.cardinality - 1)(m_rng));
+                writer.EndObject();
+            }
+        }
+        else
+        {
+            writer.Key("id");
+            writer.Uint64(id);
+            if (op == Operation::UPSERT)
+            {
+                writer.Key("category");
+                writer.Int(static_cast<i32>(id % m_config.cardinality));
+            }
+        }
+        writer.EndObject();
+        return buffer.GetString();
+    }
+
+  private:
+    const LoadConfig &m_config;
+    std::mt19937 m_rng;
+};
+
+const std::pair<const char *, f64> kPercentiles[] = {{"p50", 0.5},     {"p75", 0.75},     {"p90", 0.9},
+                                                      {"p95", 0.95},    {"p99", 0.99},     {"p99.9", 0.999},
+                                                      {"p99.99", 0.9999}, {"max", 1.0}};
+
+void writeStats(rapidjson::PrettyWriter<rapidjson::StringBuffer> &writer, const OperationStats &stats, f64 seconds)
+{
+    writer.StartObject();
+    writer.Key("ok");
+    writer.Uint64(stats.ok.value());
+    writer.Key("errors");
+    writer.Uint64(stats.errors.value());
+    writer.Key("throughput");
+    writer.Double((stats.ok.value() + stats.errors.value()) / seconds);
+    writer.Key("latency_us");
+    writer.StartObject();
+    for (auto [name, q] : kPercentiles)
+    {
+        writer.Key(name);
+        writer.Double(stats.latency.percentile(q) / 1e3);
+    }
+    writer.EndObject();
+    writer.EndObject();
+}
+
+/// value of an unlabelled counter on the server's /metrics page, 0 before it is first exported
+f64 scrapeCounter(httplib::Client &client, const std::string &name)
+{
+    auto result = client.Get("/metrics");
+    if (!result || result->status != 200)
+    {
+        return 0.0;
+    }
+    std::string prefix = "\n" + name + " ";
+    size_t position = result->body.find(prefix);
+    return position == std::string::npos ? 0.0 : std::strtod(result->body.c_str() + position + prefix.size(), nullptr);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    LoadConfig config = parseArgs(argc, argv);
+    std::array<OperationStats, static_cast<size_t>(Operation::COUNT)> stats;
+
+    const bool open_loop = config.rate > 0.0;
+    const i64 scheduled = open_loop ? static_cast<i64>(config.rate * config.duration) : 0;
+    const auto interval = open_loop ? std::chrono::duration<f64>(1.0 / config.rate) : std::chrono::duration<f64>(0);
+    std::atomic<i64> next_request{0};
+
+    httplib::Client metrics_client(config.host, config.port);
+    f64 batches_before = scrapeCounter(metrics_client, "vdb_search_batches_total");
+    f64 batched_before = scrapeCounter(metrics_client, "vdb_search_batched_queries_total");
+
+    auto start = Clock::now();
+    auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f64>(config.duration));
+
+    std::vector<std::thread> workers;
+    for (i32 w = 0; w < config.connections; ++w)
+    {
+        workers.emplace_back([&, w]() {
+            httplib::Client client(config.host, config.port);
+            client.set_keep_alive(config.keep_alive);
+            RequestGenerator generator(config, 7919u * (w + 1));
+
+            while (true)
+            {
+                Clock::time_point intended;
+                if (open_loop)
+                {
+                    i64 i = next_request.fetch_add(1, std::memory_order_relaxed);
+                    if (i >= scheduled)
+                    {
+                        break;
+                    }
+                    intended = start + std::chrono::duration_cast<Clock::duration>(interval * static_cast<f64>(i));
+                    std::this_thread::sleep_until(intended);
+                }
+                else
+                {
+                    intended = Clock::now();
+                    if (intended >= deadline)
+                    {
+                        break;
+                    }
+                }
+
+                Operation op = generator.nextOperation();
+                std::string body = generator.body(op);
+                std::string path = std::string("/") + operationName(op);
+                auto result = client.Post(path, body, "application/json");
+
+                OperationStats &op_stats = stats[static_cast<size_t>(op)];
+                op_stats.latency.record(elapsedNsSince(intended));
+                if (result && result->status == 200)
+                {
+                    op_stats.ok.inc();
+                }
+                else
+                {
+                    op_stats.errors.inc();
+                }
+            }
+        });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    f64 seconds = std::chrono::duration<f64>(Clock::now() - start).count();
+    f64 batches = scrapeCounter(metrics_client, "vdb_search_batches_total") - batches_before;
+    f64 batched = scrapeCounter(metrics_client, "vdb_search_batched_queries_total") - batched_before;
+    f64 average_batch = batches > 0 ? batched / batches : 0.0;
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("mode");
+    writer.String(open_loop ? "open_loop" : "closed_loop");
+    writer.Key("target_rate");
+    writer.Double(config.rate);
+    writer.Key("connections");
+    writer.Int(config.connections);
+    writer.Key("seconds");
+    writer.Double(seconds);
+
+    Histogram overall;
+    u64 total = 0;
+    for (i32 op = 0; op < static_cast<i32>(Operation::COUNT); ++op)
+    {
+        const OperationStats &op_stats = stats[op];
+        overall.merge(op_stats.latency);
+        total += op_stats.ok.value() + op_stats.errors.value();
+        writer.Key(operationName(static_cast<Operation>(op)));
+        writeStats(writer, op_stats, seconds);
+    }
+    writer.Key("achieved_rate");
+    writer.Double(total / seconds);
+    writer.Key("search_batching");
+    writer.StartObject();
+    writer.Key("batches");
+    writer.Double(batches);
+    writer.Key("batched_queries");
+    writer.Double(batched);
+    writer.Key("average_batch_size");
+    writer.Double(average_batch);
+    writer.EndObject();
+    writer.Key("overall_latency_us");
+    writer.StartObject();
+    for (auto [name, q] : kPercentiles)
+    {
+        writer.Key(name);
+        writer.Double(overall.percentile(q) / 1e3);
+    }
+    writer.EndObject();
+    writer.EndObject();
+
+    if (config.output_path.empty())
+    {
+        std::printf("%s\n", buffer.GetString());
+    }
+    else
+    {
+        std::ofstream out(config.output_path);
+        out << buffer.GetString() << std::endl;
+    }
+
+    // every unfiltered single-vector search goes through the batcher, so an average of one means
+    // the concurrent ones ran alone
+    u64 searches = stats[static_cast<size_t>(Operation::SEARCH)].ok.value();
+    if (config.expect_batching && searches > 0 && average_batch <= 1.0)
+    {
+        std::fprintf(stderr, "%llu searches but no batching (%.0f batches of %.0f queries); is searchBatch set?\n",
+                     static_cast<unsigned long long>(searches), batches, batched);
+        return 1;
+    }
+    return 0;
+}
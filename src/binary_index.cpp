@@ -0,0 +1,421 @@
+#include "binary_index.hh"
+#include "logger.hh"
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/IndexBinaryHNSW.h>
+#include <faiss/index_io.h>
+#include <faiss/utils/hamming.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+
+namespace vdb
+{
+
+namespace
+{
+
+// a filter whose labels are at most 1/kScanRatio of an HNSW index is scanned rather than
+// searched: each member costs one distance, a widened graph search many more
+constexpr u64 kScanRatio = 16;
+// faiss is first asked for this many candidates per result, then four times more per round
+constexpr i64 kInitialFetchFactor = 2;
+
+std::string tombstonePath(const std::string &file_path)
+{
+    return file_path + ".tombstones";
+}
+
+faiss::IndexBinaryIDMap *wrap(faiss::IndexBinary *index)
+{
+    auto *id_map = new faiss::IndexBinaryIDMap(index);
+    id_map->own_fields = true;
+    return id_map;
+}
+
+} // namespace
+
+BinaryIndex::BinaryIndex(std::function<faiss::IndexBinary *()> make_index)
+    : m_make_index(std::move(make_index)), m_index(wrap(m_make_index())), m_tombstones(roaring_bitmap_create())
+{
+}
+
+BinaryIndex::~BinaryIndex()
+{
+    delete m_index;
+    roaring_bitmap_free(m_tombstones);
+}
+
+void BinaryIndex::insert_vectors(const std::vector<u8> &code, u64 label)
+{
+    i64 id = static_cast<i64>(label);
+    std::unique_lock lock(m_mutex);
+    auto it = m_positions.find(id);
+    if (it != m_positions.end())
+    {
+        roaring_bitmap_add(m_tombstones, static_cast<u32>(it->second));
+    }
+    m_index->add_with_ids(1, code.data(), &id);
+    m_positions[id] = m_index->ntotal - 1;
+    if (m_compacting)
+    {
+        m_pending_writes.emplace_back(id, code);
+    }
+}
+
+u64 BinaryIndex::remove_vectors(const std::vector<i64> &ids)
+{
+    std::unique_lock lock(m_mutex);
+    u64 removed = 0;
+    for (i64 id : ids)
+    {
+        auto it = m_positions.find(id);
+        if (it != m_positions.end())
+        {
+            roaring_bitmap_add(m_tombstones, static_cast<u32>(it->second));
+            m_positions.erase(it);
+            ++removed;
+            if (m_compacting)
+            {
+                m_pending_writes.emplace_back(id, std::vector<u8>());
+            }
+        }
+    }
+    return removed;
+}
+
+CompactionReport BinaryIndex::compact(f64 threshold)
+{
+    std::lock_guard<std::mutex> compaction_lock(m_compaction_mutex);
+    auto start = std::chrono::steady_clock::now();
+    CompactionReport report;
+    u64 memory_before = getMemoryBreakdown().total();
+    size_t code_size = static_cast<size_t>(getCodeSize());
+    std::vector<u8> live;
+    std::vector<faiss::idx_t> labels;
+    u64 deleted = 0;
+    {
+        // copying the live codes is cheap next to building the index, which runs unlocked
+        std::unique_lock lock(m_mutex);
+        deleted = roaring_bitmap_get_cardinality(m_tombstones);
+        i64 ntotal = m_index->ntotal;
+        if (deleted == 0 || static_cast<f64>(deleted) < threshold * static_cast<f64>(ntotal))
+        {
+            return report;
+        }
+        const u8 *data = codes();
+        live.reserve((ntotal - deleted) * code_size);
+        labels.reserve(ntotal - deleted);
+        for (i64 position = 0; position < ntotal; ++position)
+        {
+            if (!roaring_bitmap_contains(m_tombstones, static_cast<u32>(position)))
+            {
+                live.insert(live.end(), data + position * code_size, data + (position + 1) * code_size);
+                labels.push_back(m_index->id_map[position]);
+            }
+        }
+        m_compacting = true;
+        m_pending_writes.clear();
+    }
+
+    faiss::IndexBinaryIDMap *index = nullptr;
+    std::unordered_map<i64, i64> positions;
+    try
+    {
+        index = wrap(m_make_index());
+        index->add_with_ids(static_cast<faiss::idx_t>(labels.size()), live.data(), labels.data());
+        positions.reserve(labels.size());
+        for (size_t i = 0; i < labels.size(); ++i)
+        {
+            positions[labels[i]] = static_cast<i64>(i);
+        }
+    }
+    catch (...)
+    {
+        delete index;
+        std::unique_lock lock(m_mutex);
+        m_compacting = false;
+        m_pending_writes.clear();
+        throw;
+    }
+
+    faiss::IndexBinaryIDMap *old_index = nullptr;
+    roaring_bitmap_t *old_tombstones = nullptr;
+    {
+        std::unique_lock lock(m_mutex);
+        roaring_bitmap_t *tombstones = roaring_bitmap_create();
+        for (auto &[label, code] : m_pending_writes)
+        {
+            auto it = positions.find(label);
+            if (it != positions.end())
+            {
+                roaring_bitmap_add(tombstones, static_cast<u32>(it->second));
+                positions.erase(it);
+            }
+            if (!code.empty())
+            {
+                positions[label] = index->ntotal;
+                index->add_with_ids(1, code.data(), &label);
+            }
+        }
+        report.replayed_writes = m_pending_writes.size();
+
+        old_index = m_index;
+        old_tombstones = m_tombstones;
+        m_index = index;
+        m_tombstones = tombstones;
+        m_positions = std::move(positions);
+        m_compacting = false;
+        std::vector<std::pair<i64, std::vector<u8>>>().swap(m_pending_writes);
+    }
+    delete old_index;
+    roaring_bitmap_free(old_tombstones);
+
+    report.shards_compacted = 1;
+    report.vectors = labels.size();
+    report.tombstones_removed = deleted;
+    report.memory_before_bytes = memory_before;
+    report.memory_after_bytes = getMemoryBreakdown().total();
+    report.duration_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> BinaryIndex::search_vectors(const std::vector<u8> &queries, i32 k,
+                                                                          const roaring_bitmap_t *bitmap) const
+{
+    i64 query_num = static_cast<i64>(queries.size()) / getCodeSize();
+    std::vector<i64> labels(query_num * k, -1);
+    std::vector<f32> distances(query_num * k, std::numeric_limits<f32>::max());
+
+    std::shared_lock lock(m_mutex);
+    i64 ntotal = m_index->index->ntotal;
+    if (ntotal == 0 || k <= 0)
+    {
+        return {labels, distances};
+    }
+    if (bitmap != nullptr && (dynamic_cast<faiss::IndexBinaryFlat *>(m_index->index) != nullptr ||
+                              roaring_bitmap_get_cardinality(bitmap) * kScanRatio <= static_cast<u64>(ntotal)))
+    {
+        return scanFiltered(queries.data(), query_num, k, bitmap);
+    }
+
+    bool has_tombstones = !roaring_bitmap_is_empty(m_tombstones);
+    i64 fetch = std::min<i64>(has_tombstones || bitmap != nullptr ? k * kInitialFetchFactor : k, ntotal);
+    std::vector<faiss::idx_t> positions;
+    std::vector<i32> hamming;
+    while (true)
+    {
+        positions.resize(query_num * fetch);
+        hamming.resize(query_num * fetch);
+        m_index->index->search(query_num, queries.data(), fetch, hamming.data(), positions.data());
+
+        bool complete = true;
+        for (i64 q = 0; q < query_num; ++q)
+        {
+            // a wider HNSW search may rank differently, so every round refills the row
+            std::fill_n(labels.begin() + q * k, k, -1);
+            std::fill_n(distances.begin() + q * k, k, std::numeric_limits<f32>::max());
+            i32 found = 0;
+            for (i64 j = 0; j < fetch && found < k; ++j)
+            {
+                faiss::idx_t position = positions[q * fetch + j];
+                if (position < 0)
+                {
+                    break;
+                }
+                if (has_tombstones && roaring_bitmap_contains(m_tombstones, static_cast<u32>(position)))
+                {
+                    continue;
+                }
+                i64 label = m_index->id_map[position];
+                if (bitmap != nullptr && !roaring_bitmap_contains(bitmap, static_cast<u32>(label)))
+                {
+                    continue;
+                }
+                labels[q * k + found] = label;
+                distances[q * k + found] = static_cast<f32>(hamming[q * fetch + j]);
+                ++found;
+            }
+            complete = complete && found == k;
+        }
+        if (complete || fetch >= ntotal)
+        {
+            break;
+        }
+        fetch = std::min(fetch * 4, ntotal);
+    }
+    return {labels, distances};
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> BinaryIndex::scanFiltered(const u8 *queries, i64 query_num, i32 k,
+                                                                        const roaring_bitmap_t *bitmap) const
+{
+    std::vector<u32> members(roaring_bitmap_get_cardinality(bitmap));
+    roaring_bitmap_to_uint32_array(bitmap, members.data());
+    std::vector<std::pair<i64, const u8 *>> candidates;
+    candidates.reserve(members.size());
+    size_t code_size = static_cast<size_t>(getCodeSize());
+    const u8 *data = codes();
+    for (u32 member : members)
+    {
+        auto it = m_positions.find(member);
+        if (it != m_positions.end())
+        {
+            candidates.emplace_back(member, data + it->second * code_size);
+        }
+    }
+
+    std::vector<i64> labels(query_num * k, -1);
+    std::vector<f32> distances(query_num * k, std::numeric_limits<f32>::max());
+    for (i64 q = 0; q < query_num; ++q)
+    {
+        faiss::HammingComputerDefault computer(queries + q * code_size, static_cast<int>(code_size));
+        // max-heap of the k best (distance, label) so far
+        std::priority_queue<std::pair<i32, i64>> heap;
+        for (const auto &[label, code] : candidates)
+        {
+            i32 distance = computer.hamming(code);
+            if (heap.size() < static_cast<size_t>(k))
+            {
+                heap.emplace(distance, label);
+            }
+            else if (distance < heap.top().first)
+            {
+                heap.pop();
+                heap.emplace(distance, label);
+            }
+        }
+        for (size_t i = heap.size(); i-- > 0;)
+        {
+            labels[q * k + i] = heap.top().second;
+            distances[q * k + i] = static_cast<f32>(heap.top().first);
+            heap.pop();
+        }
+    }
+    return {labels, distances};
+}
+
+i32 BinaryIndex::getDim() const
+{
+    return m_index->d;
+}
+
+i32 BinaryIndex::getCodeSize() const
+{
+    return m_index->code_size;
+}
+
+u64 BinaryIndex::getVectorCount() const
+{
+    std::shared_lock lock(m_mutex);
+    return m_positions.size();
+}
+
+u64 BinaryIndex::getDeletedCount() const
+{
+    std::shared_lock lock(m_mutex);
+    return roaring_bitmap_get_cardinality(m_tombstones);
+}
+
+IndexMemoryUsage BinaryIndex::getMemoryBreakdown() const
+{
+    IndexMemoryUsage usage;
+    std::shared_lock lock(m_mutex);
+    usage.vectors = static_cast<u64>(m_index->ntotal) * m_index->code_size;
+    if (auto *hnsw_index = dynamic_cast<faiss::IndexBinaryHNSW *>(m_index->index))
+    {
+        const faiss::HNSW &hnsw = hnsw_index->hnsw;
+        usage.graph += hnsw.neighbors.size() * sizeof(faiss::HNSW::storage_idx_t);
+        usage.graph += hnsw.offsets.size() * sizeof(size_t);
+        usage.graph += hnsw.levels.size() * sizeof(i32);
+    }
+    usage.ids += m_index->id_map.size() * sizeof(faiss::idx_t);
+    usage.ids += m_positions.size() * (sizeof(std::pair<const i64, i64>) + sizeof(void *)) +
+                 m_positions.bucket_count() * sizeof(void *);
+    usage.ids += roaring_bitmap_size_in_bytes(m_tombstones);
+    return usage;
+}
+
+void BinaryIndex::saveIndex(const std::string &file_path)
+{
+    std::shared_lock lock(m_mutex);
+    faiss::write_index_binary(m_index, file_path.c_str());
+    if (!roaring_bitmap_is_empty(m_tombstones))
+    {
+        writeBitmap(tombstonePath(file_path), m_tombstones);
+    }
+    else
+    {
+        // left over from an earlier snapshot
+        std::error_code ec;
+        std::filesystem::remove(tombstonePath(file_path), ec);
+    }
+}
+
+void BinaryIndex::loadIndex(const std::string &file_path)
+{
+    if (!std::filesystem::exists(file_path))
+    {
+        GlobalLogger->warn("<BinaryIndex> File not found: {}, Skipping loading index.", file_path);
+        return;
+    }
+    faiss::IndexBinary *loaded = faiss::read_index_binary(file_path.c_str());
+    auto *index = dynamic_cast<faiss::IndexBinaryIDMap *>(loaded);
+    if (index == nullptr)
+    {
+        delete loaded;
+        throw std::runtime_error("<BinaryIndex> " + file_path + " does not hold an IndexBinaryIDMap");
+    }
+    roaring_bitmap_t *tombstones = readBitmap(tombstonePath(file_path));
+    if (tombstones == nullptr)
+    {
+        tombstones = roaring_bitmap_create();
+    }
+
+    // a compaction in flight would swap its rebuild of the old codes over the loaded ones
+    std::lock_guard<std::mutex> compaction_lock(m_compaction_mutex);
+    std::unique_lock lock(m_mutex);
+    delete m_index;
+    roaring_bitmap_free(m_tombstones);
+    m_index = index;
+    m_tombstones = tombstones;
+    rebuildPositions();
+}
+
+std::vector<std::string> BinaryIndex::getSnapshotFiles(const std::string &file_path) const
+{
+    return {file_path, tombstonePath(file_path)};
+}
+
+const u8 *BinaryIndex::codes() const
+{
+    faiss::IndexBinary *storage = m_index->index;
+    if (auto *hnsw_index = dynamic_cast<faiss::IndexBinaryHNSW *>(storage))
+    {
+        storage = hnsw_index->storage;
+    }
+    auto *flat_index = dynamic_cast<faiss::IndexBinaryFlat *>(storage);
+    if (flat_index == nullptr)
+    {
+        throw std::logic_error("<BinaryIndex> Codes are only kept by flat and HNSW binary indexes");
+    }
+    return flat_index->xb.data();
+}
+
+void BinaryIndex::rebuildPositions()
+{
+    m_positions.clear();
+    for (i64 position = 0; position < m_index->ntotal; ++position)
+    {
+        if (!roaring_bitmap_contains(m_tombstones, static_cast<u32>(position)))
+        {
+            m_positions[m_index->id_map[position]] = position;
+        }
+    }
+}
+
+} // namespace vdb
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "faiss_index.hh"
+#include "types.hh"
+#include <faiss/IndexBinary.h>
+#include <faiss/IndexIDMap.h>
+#include <functional>
+#include <mutex>
+#include <roaring/roaring.h>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vdb
+{
+
+/// Bit-packed vectors of `dim` bits (dim / 8 bytes each) compared by Hamming distance, held by a
+/// faiss IndexBinaryFlat or IndexBinaryHNSW wrapped in an IndexBinaryIDMap. Labels are IdMap
+/// ordinals, like in FaissIndex.
+///
+/// As in a FaissIndex shard, deleting or overwriting a label tombstones its position, and
+/// compact() rebuilds the index from its live codes. Faiss binary indexes take no IDSelector, so
+/// a search applies the tombstone and filter bitmaps to the candidates itself: it asks faiss for
+/// more than k and widens the search until k candidates pass or the index is exhausted. A filter
+/// matching few codes is instead answered by scanning the codes of its labels directly.
+class BinaryIndex
+{
+  public:
+    /// `make_index` builds an empty index of the configured type, also used by compaction
+    explicit BinaryIndex(std::function<faiss::IndexBinary *()> make_index);
+    ~BinaryIndex();
+    BinaryIndex(const BinaryIndex &) = delete;
+    BinaryIndex &operator=(const BinaryIndex &) = delete;
+
+    /// modify
+    /// `code` holds getCodeSize() bytes; a label that is already present is overwritten
+    void insert_vectors(const std::vector<u8> &code, u64 label);
+    /// tombstone the codes of `ids`, returns how many were present
+    u64 remove_vectors(const std::vector<i64> &ids);
+    /// Rebuild the index from its live codes when tombstones make up at least `threshold` of it
+    /// (any tombstone when 0). Like a FaissIndex shard, the rebuild runs off the index lock while
+    /// writes are logged, then the new index is swapped in and the log replayed under a short
+    /// exclusive lock. The report counts the index as one shard and leaves recall unmeasured.
+    CompactionReport compact(f64 threshold);
+
+    /// observe
+    /// k nearest codes for each query of `queries` (concatenated codes), distances in bits
+    std::pair<std::vector<i64>, std::vector<f32>> search_vectors(const std::vector<u8> &queries, i32 k,
+                                                                 const roaring_bitmap_t *bitmap = nullptr) const;
+    /// in bits
+    i32 getDim() const;
+    i32 getCodeSize() const;
+    /// live codes, tombstones excluded
+    u64 getVectorCount() const;
+    u64 getDeletedCount() const;
+    IndexMemoryUsage getMemoryBreakdown() const;
+
+    /// Snapshot
+    /// the index goes to `file_path`, its tombstones to `<file_path>.tombstones`
+    void saveIndex(const std::string &file_path);
+    void loadIndex(const std::string &file_path);
+    std::vector<std::string> getSnapshotFiles(const std::string &file_path) const;
+
+  private:
+    /// codes of the wrapped index in position order; the caller holds m_mutex
+    const u8 *codes() const;
+    void rebuildPositions();
+    /// exact k-NN over the positions of the labels in `bitmap`; the caller holds m_mutex
+    std::pair<std::vector<i64>, std::vector<f32>> scanFiltered(const u8 *queries, i64 query_num, i32 k,
+                                                               const roaring_bitmap_t *bitmap) const;
+
+  private:
+    std::function<faiss::IndexBinary *()> m_make_index;
+    faiss::IndexBinaryIDMap *m_index;
+    // position of each live label in the wrapped index
+    std::unordered_map<i64, i64> m_positions;
+    // positions of deleted and overwritten codes
+    roaring_bitmap_t *m_tombstones;
+    // searches share it, writes, loads and the start and end of a compaction take it exclusively
+    mutable std::shared_mutex m_mutex;
+    // one compaction at a time, and no load during one
+    std::mutex m_compaction_mutex;
+    // while compacting, writes are also recorded for replay onto the rebuilt index
+    bool m_compacting = false;
+    // (label, code) in arrival order, an empty code marks a removal
+    std::vector<std::pair<i64, std::vector<u8>>> m_pending_writes;
+};
+
+} // namespace vdb
@@ -0,0 +1,379 @@
+#include "collection_manager.hh"
+#include "constants.hh"
+#include "json_utils.hh"
+#include "logger.hh"
+#include "metrics.hh"
+#include <algorithm>
+#include <cctype>
+#include <malloc.h>
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rocksdb/options.h>
+#include <stdexcept>
+
+namespace vdb
+{
+
+bool isValidCollectionName(const std::string &name)
+{
+    if (name.empty() || name.size() > 64 || name[0] == '_')
+    {
+        return false;
+    }
+    return std::all_of(name.begin(), name.end(),
+                       [](unsigned char c) { return std::isalnum(c) || c == '_' || c == '-'; });
+}
+
+CollectionManager::CollectionManager(const ServerConfig &config)
+    : m_wal_path(config.wal_path), m_snapshot_path(config.snapshot_path),
+      m_memory_budget_bytes(config.memory_budget_mb * 1024 * 1024)
+{
+    rocksdb::Options options;
+    options.create_if_missing = true;
+    options.create_missing_column_families = true;
+
+    std::vector<std::string> column_family_names;
+    rocksdb::Status status = rocksdb::DB::ListColumnFamilies(options, config.db_path, &column_family_names);
+    if (!status.ok())
+    {
+        // new database
+        column_family_names = {rocksdb::kDefaultColumnFamilyName};
+    }
+    if (std::find(column_family_names.begin(), column_family_names.end(), CATALOG_COLUMN_FAMILY) ==
+        column_family_names.end())
+    {
+        column_family_names.push_back(CATALOG_COLUMN_FAMILY);
+    }
+
+    std::vector<rocksdb::ColumnFamilyDescriptor> descriptors;
+    for (const std::string &name : column_family_names)
+    {
+        descriptors.emplace_back(name, rocksdb::ColumnFamilyOptions(options));
+    }
+    std::vector<rocksdb::ColumnFamilyHandle *> handles;
+    status = rocksdb::DB::Open(options, config.db_path, descriptors, &handles, &m_db);
+    if (!status.ok())
+    {
+        throw std::runtime_error("<RocksDB> Failed to open RocksDB: " + status.ToString());
+    }
+
+    auto catalog_it = std::find(column_family_names.begin(), column_family_names.end(), CATALOG_COLUMN_FAMILY);
+    m_catalog = handles[catalog_it - column_family_names.begin()];
+
+    for (size_t i = 0; i < column_family_names.size(); ++i)
+    {
+        const std::string &name = column_family_names[i];
+        if (name == CATALOG_COLUMN_FAMILY)
+        {
+            continue;
+        }
+        if (name == rocksdb::kDefaultColumnFamilyName)
+        {
+            CollectionConfig default_config = config.default_collection;
+            default_config.name = DEFAULT_COLLECTION_NAME;
+            m_collections[name] = std::make_shared<VectorDB>(default_config, m_db, handles[i], walPath(name),
+                                                             snapshotPath(name));
+            continue;
+        }
+
+        std::string catalog_entry;
+        status = m_db->Get(rocksdb::ReadOptions(), m_catalog, name, &catalog_entry);
+        if (!status.ok())
+        {
+            GlobalLogger->warn("<CollectionManager> Column family {} has no catalog entry, ignoring it", name);
+            m_db->DestroyColumnFamilyHandle(handles[i]);
+            continue;
+        }
+
+        rapidjson::Document json_config;
+        CollectionConfig collection_config;
+        collection_config.name = name;
+        if (!parseJsonRequest(catalog_entry, json_config) || !json_config.IsObject())
+        {
+            throw std::runtime_error("<CollectionManager> Corrupted catalog entry for collection " + name);
+        }
+        readCollectionConfig(json_config, collection_config);
+        m_collections[name] =
+            std::make_shared<VectorDB>(collection_config, m_db, handles[i], walPath(name), snapshotPath(name));
+    }
+
+    for (auto &[name, collection] : m_collections)
+    {
+        collection->reloadDataBase();
+        GlobalLogger->info("<CollectionManager> Collection {} opened", name);
+    }
+
+    sampleRss();
+    if (config.compaction_interval_sec > 0 || m_memory_budget_bytes > 0)
+    {
+        m_compaction_thread = std::thread(&CollectionManager::compactionLoop, this, config.compaction_threshold,
+                                          std::chrono::seconds(config.compaction_interval_sec));
+    }
+}
+
+CollectionManager::~CollectionManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_compaction_mutex);
+        m_stop = true;
+    }
+    m_compaction_cv.notify_all();
+    if (m_compaction_thread.joinable())
+    {
+        m_compaction_thread.join();
+    }
+
+    // collections release their column family handles before the database goes away
+    m_collections.clear();
+    if (m_catalog != nullptr)
+    {
+        m_db->DestroyColumnFamilyHandle(m_catalog);
+    }
+    delete m_db;
+}
+
+std::shared_ptr<VectorDB> CollectionManager::createCollection(const CollectionConfig &config)
+{
+    if (!isValidCollectionName(config.name))
+    {
+        throw std::invalid_argument("Invalid collection name " + config.name);
+    }
+    validateCollectionConfig(config);
+
+    std::lock_guard<std::mutex> admin_lock(m_admin_mutex);
+    if (getCollection(config.name) != nullptr)
+    {
+        throw std::invalid_argument("Collection " + config.name + " already exists");
+    }
+
+    rocksdb::ColumnFamilyHandle *column_family = nullptr;
+    rocksdb::Status status = m_db->CreateColumnFamily(rocksdb::ColumnFamilyOptions(), config.name, &column_family);
+    if (!status.ok())
+    {
+        throw std::runtime_error("<RocksDB> Failed to create column family: " + status.ToString());
+    }
+
+    rapidjson::StringBuffer buffer;
+    JsonWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writeCollectionConfig(writer, config);
+    writer.EndObject();
+    rocksdb::WriteOptions write_options;
+    write_options.sync = true;
+    status = m_db->Put(write_options, m_catalog, config.name, buffer.GetString());
+    if (!status.ok())
+    {
+        m_db->DropColumnFamily(column_family);
+        m_db->DestroyColumnFamilyHandle(column_family);
+        throw std::runtime_error("<RocksDB> Failed to write catalog entry: " + status.ToString());
+    }
+
+    auto collection =
+        std::make_shared<VectorDB>(config, m_db, column_family, walPath(config.name), snapshotPath(config.name));
+    {
+        std::unique_lock lock(m_mutex);
+        m_collections[config.name] = collection;
+    }
+    GlobalLogger->info("<CollectionManager> Collection {} created, dim={}", config.name, config.dim);
+    return collection;
+}
+
+void CollectionManager::dropCollection(const std::string &name)
+{
+    if (name == DEFAULT_COLLECTION_NAME)
+    {
+        throw std::invalid_argument("The default collection cannot be dropped");
+    }
+
+    std::lock_guard<std::mutex> admin_lock(m_admin_mutex);
+    std::shared_ptr<VectorDB> collection;
+    {
+        std::unique_lock lock(m_mutex);
+        auto it = m_collections.find(name);
+        if (it == m_collections.end())
+        {
+            throw std::invalid_argument("Collection " + name + " does not exist");
+        }
+        collection = std::move(it->second);
+        m_collections.erase(it);
+    }
+
+    rocksdb::WriteOptions write_options;
+    write_options.sync = true;
+    rocksdb::Status status = m_db->Delete(write_options, m_catalog, name);
+    if (!status.ok())
+    {
+        GlobalLogger->error("<RocksDB> Failed to delete catalog entry of {} : {}", name, status.ToString());
+    }
+    // waits for requests still running against the collection
+    collection->drop();
+    GlobalLogger->info("<CollectionManager> Collection {} dropped", name);
+}
+
+std::shared_ptr<VectorDB> CollectionManager::getCollection(const std::string &name) const
+{
+    std::shared_lock lock(m_mutex);
+    auto it = m_collections.find(name);
+    return it != m_collections.end() ? it->second : nullptr;
+}
+
+std::vector<std::shared_ptr<VectorDB>> CollectionManager::listCollections() const
+{
+    std::shared_lock lock(m_mutex);
+    std::vector<std::shared_ptr<VectorDB>> collections;
+    for (const auto &[name, collection] : m_collections)
+    {
+        collections.push_back(collection);
+    }
+    return collections;
+}
+
+RocksDBMemoryUsage CollectionManager::getRocksDBMemoryUsage() const
+{
+    RocksDBMemoryUsage usage;
+    m_db->GetAggregatedIntProperty(rocksdb::DB::Properties::kSizeAllMemTables, &usage.memtables);
+    m_db->GetAggregatedIntProperty(rocksdb::DB::Properties::kEstimateTableReadersMem, &usage.table_readers);
+    // the column families share one block cache, so it is read once rather than aggregated
+    m_db->GetIntProperty(rocksdb::DB::Properties::kBlockCacheUsage, &usage.block_cache);
+    m_db->GetIntProperty(rocksdb::DB::Properties::kBlockCachePinnedUsage, &usage.block_cache_pinned);
+    return usage;
+}
+
+u64 CollectionManager::getMemoryBudgetBytes() const
+{
+    return m_memory_budget_bytes;
+}
+
+bool CollectionManager::isOverMemoryBudget() const
+{
+    return m_over_memory_budget.load(std::memory_order_relaxed);
+}
+
+void CollectionManager::sampleRss()
+{
+    u64 rss = getProcessRssBytes();
+    m_rss_bytes.store(rss, std::memory_order_relaxed);
+    if (m_memory_budget_bytes == 0)
+    {
+        return;
+    }
+    bool over = rss > m_memory_budget_bytes;
+    if (over == m_over_memory_budget.exchange(over))
+    {
+        return;
+    }
+    if (over)
+    {
+        GlobalLogger->warn("<CollectionManager> RSS {} bytes is above the memory budget of {} bytes, rejecting writes "
+                           "and compacting",
+                           rss, m_memory_budget_bytes);
+        {
+            std::lock_guard<std::mutex> lock(m_compaction_mutex);
+            m_memory_compaction_requested = true;
+        }
+        m_compaction_cv.notify_all();
+    }
+    else
+    {
+        GlobalLogger->info("<CollectionManager> RSS {} bytes is back within the memory budget", rss);
+    }
+}
+
+void CollectionManager::updateMetrics()
+{
+    for (auto &collection : listCollections())
+    {
+        collection->updateMetrics();
+    }
+
+    MetricsRegistry *metrics = getGlobalMetrics();
+    sampleRss();
+    metrics->gauge("vdb_process_rss_bytes", "Resident set size of the process")
+        .set(static_cast<i64>(m_rss_bytes.load(std::memory_order_relaxed)));
+    RocksDBMemoryUsage rocksdb_usage = getRocksDBMemoryUsage();
+    const char *help = "Memory reported by RocksDB";
+    metrics->gauge("vdb_rocksdb_memory_bytes", help, {{"component", "memtables"}})
+        .set(static_cast<i64>(rocksdb_usage.memtables));
+    metrics->gauge("vdb_rocksdb_memory_bytes", help, {{"component", "table_readers"}})
+        .set(static_cast<i64>(rocksdb_usage.table_readers));
+    metrics->gauge("vdb_rocksdb_memory_bytes", help, {{"component", "block_cache"}})
+        .set(static_cast<i64>(rocksdb_usage.block_cache));
+}
+
+void CollectionManager::compactionLoop(f64 threshold, std::chrono::seconds interval)
+{
+    using Clock = std::chrono::steady_clock;
+    auto woken = [this]() { return m_stop || m_memory_compaction_requested; };
+    auto next_compaction = interval.count() > 0 ? Clock::now() + interval : Clock::time_point::max();
+    std::unique_lock lock(m_compaction_mutex);
+    while (true)
+    {
+        // with a budget the loop also wakes to sample the RSS, writers only read the sample
+        auto wake = next_compaction;
+        if (m_memory_budget_bytes > 0)
+        {
+            wake = std::min(wake, Clock::now() + kRssSampleInterval);
+        }
+        if (wake == Clock::time_point::max())
+        {
+            m_compaction_cv.wait(lock, woken);
+        }
+        else
+        {
+            m_compaction_cv.wait_until(lock, wake, woken);
+        }
+        if (m_stop)
+        {
+            break;
+        }
+        if (m_memory_budget_bytes > 0)
+        {
+            lock.unlock();
+            sampleRss();
+            lock.lock();
+        }
+        bool memory_pressure = m_memory_compaction_requested;
+        if (!memory_pressure && Clock::now() < next_compaction)
+        {
+            continue;
+        }
+        m_memory_compaction_requested = false;
+        if (interval.count() > 0)
+        {
+            next_compaction = Clock::now() + interval;
+        }
+        lock.unlock();
+
+        for (auto &collection : listCollections())
+        {
+            try
+            {
+                collection->compact(memory_pressure ? 0.0 : threshold);
+            }
+            catch (const std::exception &e)
+            {
+                GlobalLogger->error("<CollectionManager> Compaction of collection {} failed: {}",
+                                    collection->getConfig().name, e.what());
+            }
+        }
+        if (memory_pressure)
+        {
+            // hand the freed shard memory back to the kernel, so RSS reflects the compaction
+            malloc_trim(0);
+            sampleRss();
+        }
+        lock.lock();
+    }
+}
+
+std::string CollectionManager::walPath(const std::string &name) const
+{
+    return name == DEFAULT_COLLECTION_NAME ? m_wal_path : m_wal_path + "." + name;
+}
+
+std::string CollectionManager::snapshotPath(const std::string &name) const
+{
+    return name == DEFAULT_COLLECTION_NAME ? m_snapshot_path : m_snapshot_path + "." + name;
+}
+
+} // namespace vdb
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "config.hh"
+#include "vectordb.hh"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <rocksdb/db.h>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace vdb
+{
+
+/// Memory RocksDB reports for the whole database, every column family included.
+struct RocksDBMemoryUsage
+{
+    u64 memtables = 0;
+    u64 table_readers = 0;
+    u64 block_cache = 0;
+    // block cache entries pinned by iterators and table readers, part of block_cache
+    u64 block_cache_pinned = 0;
+};
+
+/// Owns every collection of the process and the RocksDB instance they share. Each collection
+/// lives in a column family named after it (the default collection keeps the default column
+/// family); their definitions are recorded in the CATALOG_COLUMN_FAMILY column family so they
+/// are reopened on restart. A background thread compacts the indexes of every collection.
+///
+/// With a memory budget, the compaction thread samples the process RSS every kRssSampleInterval
+/// and writers ask isOverMemoryBudget() for the last sample before accepting data; crossing the
+/// budget wakes the compaction thread for a pass that reclaims every tombstone.
+class CollectionManager
+{
+  public:
+    static constexpr std::chrono::milliseconds kRssSampleInterval{1000};
+
+    /// Opens the database, the default collection described by `config` and every collection in
+    /// the catalog, replaying their snapshots and WALs. Throws std::runtime_error on failure.
+    explicit CollectionManager(const ServerConfig &config);
+    ~CollectionManager();
+    CollectionManager(const CollectionManager &) = delete;
+    CollectionManager &operator=(const CollectionManager &) = delete;
+
+    /// modify
+    /// throws std::invalid_argument on a bad name or config, or if the collection exists
+    std::shared_ptr<VectorDB> createCollection(const CollectionConfig &config);
+    /// throws std::invalid_argument for unknown collections and for the default collection
+    void dropCollection(const std::string &name);
+
+    /// observe
+    /// nullptr when there is no such collection
+    std::shared_ptr<VectorDB> getCollection(const std::string &name) const;
+    std::vector<std::shared_ptr<VectorDB>> listCollections() const;
+    RocksDBMemoryUsage getRocksDBMemoryUsage() const;
+    /// 0 without a budget
+    u64 getMemoryBudgetBytes() const;
+    /// whether the last RSS sample was above the budget, always false without one
+    bool isOverMemoryBudget() const;
+
+    /// Metrics
+    void updateMetrics();
+
+  private:
+    /// every `interval` (never when 0), and whenever the memory budget is crossed
+    void compactionLoop(f64 threshold, std::chrono::seconds interval);
+    /// read the RSS and compare it with the budget; the caller does not hold m_compaction_mutex
+    void sampleRss();
+    std::string walPath(const std::string &name) const;
+    std::string snapshotPath(const std::string &name) const;
+
+  private:
+    std::string m_wal_path;
+    std::string m_snapshot_path;
+    rocksdb::DB *m_db = nullptr;
+    rocksdb::ColumnFamilyHandle *m_catalog = nullptr;
+    std::map<std::string, std::shared_ptr<VectorDB>> m_collections;
+    // guards m_collections; held only for lookups and map updates
+    mutable std::shared_mutex m_mutex;
+    // serializes create and drop
+    std::mutex m_admin_mutex;
+
+    std::thread m_compaction_thread;
+    std::mutex m_compaction_mutex;
+    std::condition_variable m_compaction_cv;
+    bool m_stop = false;
+    // the next pass runs with threshold 0
+    bool m_memory_compaction_requested = false;
+
+    u64 m_memory_budget_bytes = 0;
+    std::atomic<bool> m_over_memory_budget{false};
+    std::atomic<u64> m_rss_bytes{0};
+};
+
+/// 1-64 characters from [A-Za-z0-9_-], not starting with '_' (reserved for internal column families)
+bool isValidCollectionName(const std::string &name);
+
+} // namespace vdb
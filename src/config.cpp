@@ -0,0 +1,444 @@
+#include "config.hh"
+#include "constants.hh"
+#include <algorithm>
+#include <format>
+#include <fstream>
+#include <rapidjson/document.h>
+#include <rapidjson/error/en.h>
+#include <sstream>
+#include <stdexcept>
+
+namespace vdb
+{
+
+namespace
+{
+
+IndexFactory::IndexType parseIndexType(const std::string &index_type_str)
+{
+    IndexFactory::IndexType index_type = getIndexTypeFromString(index_type_str);
+    if (index_type == IndexFactory::IndexType::UNKNOWN)
+    {
+        throw std::invalid_argument("Unknown index type " + index_type_str);
+    }
+    return index_type;
+}
+
+/// "FLAT,HNSW,FILTER" -> index types
+std::vector<IndexFactory::IndexType> parseIndexTypes(const std::string &list)
+{
+    std::vector<IndexFactory::IndexType> index_types;
+    std::istringstream iss(list);
+    std::string item;
+    while (std::getline(iss, item, ','))
+    {
+        index_types.push_back(parseIndexType(item));
+    }
+    return index_types;
+}
+
+const char *metricTypeName(IndexFactory::MetricType metric)
+{
+    switch (metric)
+    {
+    case IndexFactory::MetricType::IP:
+        return METRIC_TYPE_IP;
+    case IndexFactory::MetricType::COSINE:
+        return METRIC_TYPE_COSINE;
+    default:
+        return METRIC_TYPE_L2;
+    }
+}
+
+void getInt(const rapidjson::Value &object, const char *key, i32 &value)
+{
+    if (object.HasMember(key) && object[key].IsInt())
+    {
+        value = object[key].GetInt();
+    }
+}
+
+void getUint64(const rapidjson::Value &object, const char *key, u64 &value)
+{
+    if (object.HasMember(key) && object[key].IsUint64())
+    {
+        value = object[key].GetUint64();
+    }
+}
+
+void getDouble(const rapidjson::Value &object, const char *key, f64 &value)
+{
+    if (object.HasMember(key) && object[key].IsNumber())
+    {
+        value = object[key].GetDouble();
+    }
+}
+
+void getBool(const rapidjson::Value &object, const char *key, bool &value)
+{
+    if (object.HasMember(key) && object[key].IsBool())
+    {
+        value = object[key].GetBool();
+    }
+}
+
+void getString(const rapidjson::Value &object, const char *key, std::string &value)
+{
+    if (object.HasMember(key) && object[key].IsString())
+    {
+        value = object[key].GetString();
+    }
+}
+
+} // namespace
+
+void readCollectionConfig(const rapidjson::Value &json, CollectionConfig &config)
+{
+    getInt(json, CONFIG_DIM, config.dim);
+    getInt(json, CONFIG_SHARDS, config.index_params.shards);
+    getInt(json, CONFIG_RERANK_OVERSAMPLE, config.index_params.rerank_oversample);
+    getBool(json, CONFIG_SHARED_VECTORS, config.index_params.shared_vectors);
+
+    if (json.HasMember(CONFIG_METRIC) && json[CONFIG_METRIC].IsString())
+    {
+        config.metric = getMetricTypeFromString(json[CONFIG_METRIC].GetString());
+    }
+
+    if (json.HasMember(CONFIG_INDEX_TYPES) && json[CONFIG_INDEX_TYPES].IsArray())
+    {
+        config.index_types.clear();
+        for (const auto &item : json[CONFIG_INDEX_TYPES].GetArray())
+        {
+            if (!item.IsString())
+            {
+                throw std::invalid_argument(std::string(CONFIG_INDEX_TYPES) + " must be an array of strings");
+            }
+            config.index_types.push_back(parseIndexType(item.GetString()));
+        }
+    }
+
+    if (json.HasMember(CONFIG_HNSW) && json[CONFIG_HNSW].IsObject())
+    {
+        const auto &hnsw = json[CONFIG_HNSW];
+        getInt(hnsw, CONFIG_HNSW_M, config.index_params.hnsw_m);
+        getInt(hnsw, CONFIG_HNSW_EF_CONSTRUCTION, config.index_params.hnsw_ef_construction);
+        getInt(hnsw, CONFIG_HNSW_EF_SEARCH, config.index_params.hnsw_ef_search);
+        getInt(hnsw, CONFIG_HNSW_WRITE_BUFFER, config.index_params.hnsw_write_buffer);
+    }
+
+    if (json.HasMember(CONFIG_IVF) && json[CONFIG_IVF].IsObject())
+    {
+        const auto &ivf = json[CONFIG_IVF];
+        getInt(ivf, CONFIG_IVF_NLIST, config.index_params.ivf_nlist);
+        getInt(ivf, CONFIG_IVF_NPROBE, config.index_params.ivf_nprobe);
+    }
+
+    if (json.HasMember(CONFIG_PQ) && json[CONFIG_PQ].IsObject())
+    {
+        getInt(json[CONFIG_PQ], CONFIG_PQ_M, config.index_params.pq_m);
+    }
+
+    if (json.HasMember(CONFIG_SEARCH_BATCH) && json[CONFIG_SEARCH_BATCH].IsObject())
+    {
+        const auto &search_batch = json[CONFIG_SEARCH_BATCH];
+        getInt(search_batch, CONFIG_SEARCH_BATCH_WINDOW_US, config.index_params.search_batch_window_us);
+        getInt(search_batch, CONFIG_SEARCH_BATCH_MAX, config.index_params.search_batch_max);
+    }
+
+    if (json.HasMember(CONFIG_RESULT_CACHE) && json[CONFIG_RESULT_CACHE].IsObject())
+    {
+        const auto &result_cache = json[CONFIG_RESULT_CACHE];
+        getInt(result_cache, CONFIG_RESULT_CACHE_MB, config.result_cache_mb);
+        getInt(result_cache, CONFIG_RESULT_CACHE_TTL_MS, config.result_cache_ttl_ms);
+    }
+}
+
+void writeCollectionConfig(JsonWriter<rapidjson::StringBuffer> &writer, const CollectionConfig &config)
+{
+    writer.Key(CONFIG_DIM);
+    writer.Int(config.dim);
+    writer.Key(CONFIG_METRIC);
+    writer.String(metricTypeName(config.metric));
+    writer.Key(CONFIG_SHARDS);
+    writer.Int(config.index_params.shards);
+    writer.Key(CONFIG_SHARED_VECTORS);
+    writer.Bool(config.index_params.shared_vectors);
+    writer.Key(CONFIG_INDEX_TYPES);
+    writer.StartArray();
+    for (IndexFactory::IndexType index_type : config.index_types)
+    {
+        std::string index_type_str = std::format("{}", index_type);
+        writer.String(index_type_str.c_str(), static_cast<rapidjson::SizeType>(index_type_str.size()));
+    }
+    writer.EndArray();
+    writer.Key(CONFIG_HNSW);
+    writer.StartObject();
+    writer.Key(CONFIG_HNSW_M);
+    writer.Int(config.index_params.hnsw_m);
+    writer.Key(CONFIG_HNSW_EF_CONSTRUCTION);
+    writer.Int(config.index_params.hnsw_ef_construction);
+    writer.Key(CONFIG_HNSW_EF_SEARCH);
+    writer.Int(config.index_params.hnsw_ef_search);
+    writer.Key(CONFIG_HNSW_WRITE_BUFFER);
+    writer.Int(config.index_params.hnsw_write_buffer);
+    writer.EndObject();
+    writer.Key(CONFIG_IVF);
+    writer.StartObject();
+    writer.Key(CONFIG_IVF_NLIST);
+    writer.Int(config.index_params.ivf_nlist);
+    writer.Key(CONFIG_IVF_NPROBE);
+    writer.Int(config.index_params.ivf_nprobe);
+    writer.EndObject();
+    writer.Key(CONFIG_PQ);
+    writer.StartObject();
+    writer.Key(CONFIG_PQ_M);
+    writer.Int(config.index_params.pq_m);
+    writer.EndObject();
+    writer.Key(CONFIG_RERANK_OVERSAMPLE);
+    writer.Int(config.index_params.rerank_oversample);
+    writer.Key(CONFIG_SEARCH_BATCH);
+    writer.StartObject();
+    writer.Key(CONFIG_SEARCH_BATCH_WINDOW_US);
+    writer.Int(config.index_params.search_batch_window_us);
+    writer.Key(CONFIG_SEARCH_BATCH_MAX);
+    writer.Int(config.index_params.search_batch_max);
+    writer.EndObject();
+    writer.Key(CONFIG_RESULT_CACHE);
+    writer.StartObject();
+    writer.Key(CONFIG_RESULT_CACHE_MB);
+    writer.Int(config.result_cache_mb);
+    writer.Key(CONFIG_RESULT_CACHE_TTL_MS);
+    writer.Int(config.result_cache_ttl_ms);
+    writer.EndObject();
+}
+
+void validateCollectionConfig(const CollectionConfig &config)
+{
+    if (config.dim <= 0)
+    {
+        throw std::invalid_argument(std::format("Invalid dimension {}", config.dim));
+    }
+    if (config.index_types.empty())
+    {
+        throw std::invalid_argument("At least one index type must be configured");
+    }
+    const IndexFactory::IndexParams &params = config.index_params;
+    if (params.hnsw_m <= 0 || params.hnsw_ef_construction <= 0 || params.hnsw_ef_search <= 0 ||
+        params.hnsw_write_buffer < 0)
+    {
+        throw std::invalid_argument("HNSW parameters must be positive");
+    }
+    if (params.ivf_nlist <= 0 || params.ivf_nprobe <= 0 || params.ivf_nprobe > params.ivf_nlist)
+    {
+        throw std::invalid_argument("IVF nlist must be positive and nprobe within [1, nlist]");
+    }
+    bool uses_pq = std::find(config.index_types.begin(), config.index_types.end(), IndexFactory::IndexType::PQ) !=
+                       config.index_types.end() ||
+                   std::find(config.index_types.begin(), config.index_types.end(),
+                             IndexFactory::IndexType::IVFPQ) != config.index_types.end();
+    if (params.pq_m <= 0 || (uses_pq && config.dim % params.pq_m != 0))
+    {
+        throw std::invalid_argument(
+            std::format("PQ sub-quantizers ({}) must be positive and divide the dimension {}", params.pq_m, config.dim));
+    }
+    bool uses_binary = std::any_of(config.index_types.begin(), config.index_types.end(), isBinaryIndexType);
+    if (uses_binary && config.dim % 8 != 0)
+    {
+        throw std::invalid_argument(
+            std::format("Binary indexes pack {} bits into bytes, the dimension must be a multiple of 8", config.dim));
+    }
+    if (params.rerank_oversample < 0)
+    {
+        throw std::invalid_argument("Re-rank oversample factor must not be negative");
+    }
+    if (params.search_batch_window_us < 0 || params.search_batch_max <= 0)
+    {
+        throw std::invalid_argument("Search batch window must not be negative and the batch size must be positive");
+    }
+    if (config.result_cache_mb < 0 || config.result_cache_ttl_ms <= 0)
+    {
+        throw std::invalid_argument("Result cache size must not be negative and its TTL must be positive");
+    }
+    if (params.shards <= 0)
+    {
+        throw std::invalid_argument(std::format("Invalid shard count {}", params.shards));
+    }
+}
+
+void loadServerConfigFile(const std::string &file_path, ServerConfig &config)
+{
+    std::ifstream file(file_path);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("<Config> Failed to open config file: " + file_path);
+    }
+    std::stringstream content;
+    content << file.rdbuf();
+
+    rapidjson::Document json_config;
+    json_config.Parse(content.str().c_str());
+    if (json_config.HasParseError() || !json_config.IsObject())
+    {
+        throw std::runtime_error(std::format("<Config> Invalid config file {}: {}", file_path,
+                                             rapidjson::GetParseError_En(json_config.GetParseError())));
+    }
+
+    getString(json_config, CONFIG_HOST, config.host);
+    getInt(json_config, CONFIG_PORT, config.port);
+    getInt(json_config, CONFIG_HTTP_THREADS, config.http_threads);
+    getInt(json_config, CONFIG_OMP_THREADS, config.omp_threads);
+    if (json_config.HasMember(CONFIG_OMP_POLICY) && json_config[CONFIG_OMP_POLICY].IsString())
+    {
+        config.omp_policy = getParallelismPolicyFromString(json_config[CONFIG_OMP_POLICY].GetString());
+    }
+    getBool(json_config, CONFIG_PIN_THREADS, config.pin_threads);
+    readCollectionConfig(json_config, config.default_collection);
+    getString(json_config, CONFIG_DB_PATH, config.db_path);
+    getString(json_config, CONFIG_WAL_PATH, config.wal_path);
+    getString(json_config, CONFIG_SNAPSHOT_PATH, config.snapshot_path);
+    getDouble(json_config, CONFIG_COMPACTION_THRESHOLD, config.compaction_threshold);
+    getInt(json_config, CONFIG_COMPACTION_INTERVAL, config.compaction_interval_sec);
+    getUint64(json_config, CONFIG_MEMORY_BUDGET_MB, config.memory_budget_mb);
+    getString(json_config, CONFIG_LOG_LEVEL, config.log_level);
+    getString(json_config, CONFIG_SLOW_QUERY_LOG, config.slow_query_log_path);
+    getUint64(json_config, CONFIG_SLOW_QUERY_THRESHOLD_MS, config.slow_query_threshold_ms);
+    getUint64(json_config, CONFIG_MAX_QUEUED_REQUESTS, config.max_queued_requests);
+    getInt(json_config, CONFIG_WRITE_THREADS, config.write_threads);
+    getUint64(json_config, CONFIG_MAX_QUEUED_WRITES, config.max_queued_writes);
+    getInt(json_config, CONFIG_ADMIN_THREADS, config.admin_threads);
+    getUint64(json_config, CONFIG_MAX_QUEUED_ADMIN, config.max_queued_admin);
+    getUint64(json_config, CONFIG_REQUEST_TIMEOUT_MS, config.request_timeout_ms);
+    getUint64(json_config, CONFIG_MAX_CONNECTIONS, config.max_connections);
+}
+
+ServerConfig loadServerConfig(int argc, char **argv)
+{
+    ServerConfig config;
+
+    // the config file goes first so that flags override it regardless of their position
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (std::string(argv[i]) == "--config")
+        {
+            loadServerConfigFile(argv[i + 1], config);
+        }
+    }
+
+    if (argc % 2 == 0)
+    {
+        throw std::invalid_argument(std::format("Missing value for option {}", argv[argc - 1]));
+    }
+    CollectionConfig &collection = config.default_collection;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if (key == "--config")
+            continue;
+        else if (key == "--host")
+            config.host = value;
+        else if (key == "--port")
+            config.port = std::stoi(value);
+        else if (key == "--http-threads")
+            config.http_threads = std::stoi(value);
+        else if (key == "--omp-threads")
+            config.omp_threads = std::stoi(value);
+        else if (key == "--omp-policy")
+            config.omp_policy = getParallelismPolicyFromString(value);
+        else if (key == "--pin-threads")
+            config.pin_threads = value == "true" || value == "1";
+        else if (key == "--max-queued-requests")
+            config.max_queued_requests = std::stoull(value);
+        else if (key == "--write-threads")
+            config.write_threads = std::stoi(value);
+        else if (key == "--max-queued-writes")
+            config.max_queued_writes = std::stoull(value);
+        else if (key == "--admin-threads")
+            config.admin_threads = std::stoi(value);
+        else if (key == "--max-queued-admin")
+            config.max_queued_admin = std::stoull(value);
+        else if (key == "--request-timeout-ms")
+            config.request_timeout_ms = std::stoull(value);
+        else if (key == "--max-connections")
+            config.max_connections = std::stoull(value);
+        else if (key == "--dim")
+            collection.dim = std::stoi(value);
+        else if (key == "--metric")
+            collection.metric = getMetricTypeFromString(value);
+        else if (key == "--indexes")
+            collection.index_types = parseIndexTypes(value);
+        else if (key == "--shards")
+            collection.index_params.shards = std::stoi(value);
+        else if (key == "--hnsw-m")
+            collection.index_params.hnsw_m = std::stoi(value);
+        else if (key == "--hnsw-ef-construction")
+            collection.index_params.hnsw_ef_construction = std::stoi(value);
+        else if (key == "--hnsw-ef-search")
+            collection.index_params.hnsw_ef_search = std::stoi(value);
+        else if (key == "--hnsw-write-buffer")
+            collection.index_params.hnsw_write_buffer = std::stoi(value);
+        else if (key == "--ivf-nlist")
+            collection.index_params.ivf_nlist = std::stoi(value);
+        else if (key == "--ivf-nprobe")
+            collection.index_params.ivf_nprobe = std::stoi(value);
+        else if (key == "--pq-m")
+            collection.index_params.pq_m = std::stoi(value);
+        else if (key == "--rerank-oversample")
+            collection.index_params.rerank_oversample = std::stoi(value);
+        else if (key == "--shared-vectors")
+            collection.index_params.shared_vectors = value == "true" || value == "1";
+        else if (key == "--search-batch-window-us")
+            collection.index_params.search_batch_window_us = std::stoi(value);
+        else if (key == "--search-batch-max")
+            collection.index_params.search_batch_max = std::stoi(value);
+        else if (key == "--result-cache-mb")
+            collection.result_cache_mb = std::stoi(value);
+        else if (key == "--result-cache-ttl-ms")
+            collection.result_cache_ttl_ms = std::stoi(value);
+        else if (key == "--db-path")
+            config.db_path = value;
+        else if (key == "--wal-path")
+            config.wal_path = value;
+        else if (key == "--snapshot-path")
+            config.snapshot_path = value;
+        else if (key == "--compaction-threshold")
+            config.compaction_threshold = std::stod(value);
+        else if (key == "--compaction-interval")
+            config.compaction_interval_sec = std::stoi(value);
+        else if (key == "--memory-budget-mb")
+            config.memory_budget_mb = std::stoull(value);
+        else if (key == "--log-level")
+            config.log_level = value;
+        else if (key == "--slow-query-log")
+            config.slow_query_log_path = value;
+        else if (key == "--slow-query-ms")
+            config.slow_query_threshold_ms = std::stoull(value);
+        else
+            throw std::invalid_argument("Unknown option " + key);
+    }
+
+    if (config.port <= 0 || config.port > 65535)
+    {
+        throw std::invalid_argument(std::format("Invalid port {}", config.port));
+    }
+    if (config.max_queued_requests == 0 || config.max_queued_writes == 0 || config.max_queued_admin == 0 ||
+        config.max_connections == 0)
+    {
+        throw std::invalid_argument("The request queue and connection limits must be positive");
+    }
+    if (config.compaction_threshold < 0.0 || config.compaction_threshold > 1.0 || config.compaction_interval_sec < 0)
+    {
+        throw std::invalid_argument("Compaction threshold must be within [0, 1] and the interval not negative");
+    }
+    // spdlog reads any other name as "off", which would silence the log without a word
+    static const std::vector<std::string> log_levels = {"trace", "debug", "info",     "warn", "warning",
+                                                        "err",   "error", "critical", "off"};
+    if (std::find(log_levels.begin(), log_levels.end(), config.log_level) == log_levels.end())
+    {
+        throw std::invalid_argument("Unknown log level " + config.log_level);
+    }
+    validateCollectionConfig(collection);
+    return config;
+}
+
+} // namespace vdb
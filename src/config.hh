@@ -0,0 +1,91 @@
+#pragma once
+
+#include "constants.hh"
+#include "index_factory.hh"
+#include "json_utils.hh"
+#include "parallelism.hh"
+#include "types.hh"
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <string>
+#include <vector>
+
+namespace vdb
+{
+
+/// Shape of one collection: everything needed to rebuild its indexes.
+struct CollectionConfig
+{
+    std::string name = DEFAULT_COLLECTION_NAME;
+    i32 dim = 1;
+    IndexFactory::MetricType metric = IndexFactory::MetricType::L2;
+    std::vector<IndexFactory::IndexType> index_types = {IndexFactory::IndexType::FLAT, IndexFactory::IndexType::HNSW,
+                                                        IndexFactory::IndexType::FILTER};
+    IndexFactory::IndexParams index_params;
+    // search result cache, 0 disables it
+    i32 result_cache_mb = 0;
+    i32 result_cache_ttl_ms = 60000;
+};
+
+/// Startup configuration of the server. Defaults reproduce the former hard-coded setup.
+struct ServerConfig
+{
+    /// network
+    std::string host = "localhost";
+    i32 port = 8080;
+    i32 omp_threads = 0; // 0: OpenMP default
+    ParallelismPolicy omp_policy = ParallelismPolicy::ADAPTIVE;
+    // pin request workers to NUMA nodes
+    bool pin_threads = false;
+
+    /// request scheduling: searches, writes and admin jobs each have their own workers and queue.
+    /// Requests beyond the queue limit of their class or past their deadline are answered with 503
+    /// without running a handler
+    i32 http_threads = 0; // search workers, 0: one per hardware thread
+    u64 max_queued_requests = 1024;
+    i32 write_threads = 4;
+    u64 max_queued_writes = 256;
+    i32 admin_threads = 2;
+    u64 max_queued_admin = 16;
+    u64 request_timeout_ms = 0; // 0: no deadline unless the request sets X-Request-Timeout-Ms
+    u64 max_connections = 10000;
+
+    /// the collection requests go to when they do not name one
+    CollectionConfig default_collection;
+
+    /// storage; other collections derive their WAL and snapshot paths from these
+    std::string db_path = "VectorDB";
+    std::string wal_path = "WALStorage";
+    std::string snapshot_path = "vdb.snapshot";
+
+    /// background compaction: every interval, indexes are rebuilt shard by shard where tombstones
+    /// make up at least `compaction_threshold` of the vectors
+    f64 compaction_threshold = 0.2;
+    i32 compaction_interval_sec = 60; // 0: disabled
+
+    /// memory budget: while the process RSS is above it, inserts, upserts and bulk builds are
+    /// answered with 503 and compaction reclaims every tombstone
+    u64 memory_budget_mb = 0; // 0: unlimited
+
+    /// logging
+    std::string log_level = "debug";
+    std::string slow_query_log_path = "slow_query.log";
+    u64 slow_query_threshold_ms = 100;
+};
+
+/// Defaults, overridden by the JSON file given with `--config <file>`, overridden in turn by
+/// the other command line flags. Throws std::invalid_argument on unknown options or bad values.
+ServerConfig loadServerConfig(int argc, char **argv);
+
+/// Apply a JSON config file on top of `config`. Throws std::runtime_error if the file cannot be read.
+void loadServerConfigFile(const std::string &file_path, ServerConfig &config);
+
+/// Read the dim, metric, indexTypes and hnsw members of `json`; absent members keep their value.
+/// Throws std::invalid_argument on unknown metric or index type names.
+void readCollectionConfig(const rapidjson::Value &json, CollectionConfig &config);
+/// Write the same members into an object the caller has already started.
+void writeCollectionConfig(JsonWriter<rapidjson::StringBuffer> &writer, const CollectionConfig &config);
+/// Throws std::invalid_argument when the dimension, index set or HNSW parameters are unusable.
+void validateCollectionConfig(const CollectionConfig &config);
+
+} // namespace vdb
@@ -7,27 +7,121 @@ namespace vdb
 #define LOGGER_NAME "GlobalLogger"
 #define RESPONSE_VECTORS "vectors"
 #define RESPONSE_DISTANCES "distances"
+#define RESPONSE_SCORES "scores"
+#define RESPONSE_PROFILE "profile"
+#define RESPONSE_COLLECTIONS "collections"
+#define RESPONSE_DELETED "deleted"
+#define RESPONSE_COMPACTIONS "compactions"
+#define RESPONSE_RESULTS "results"
+#define RESPONSE_TOTAL "total"
+#define RESPONSE_NEXT_OFFSET "nextOffset"
 #define REQUEST_VECTORS "vectors"
 #define REQUEST_K "k"
 #define REQUEST_ID "id"
+#define REQUEST_IDS "ids"
 #define REQUEST_INDEX_TYPE "indexType"
 #define REQUEST_FILTER "filter"
 #define REQUEST_FILTER_NAME "fieldName"
 #define REQUEST_FILTER_OP "op"
 #define REQUEST_FILTER_VALUE "value"
+#define REQUEST_PROFILE "profile"
+#define REQUEST_COLLECTION "collection"
+#define REQUEST_THRESHOLD "threshold"
+#define REQUEST_NPROBE "nprobe"
+#define REQUEST_FILE "file"
+#define REQUEST_START_ID "startId"
+#define REQUEST_OVERSAMPLE "oversample"
+#define REQUEST_RADIUS "radius"
+#define REQUEST_OFFSET "offset"
+#define REQUEST_LIMIT "limit"
+#define REQUEST_BINARY_VECTORS "binaryVectors"
+#define REQUEST_PREFILTER "prefilter"
+#define REQUEST_SPARSE_VECTOR "sparseVector"
+#define REQUEST_SPARSE_INDICES "indices"
+#define REQUEST_SPARSE_VALUES "values"
+#define REQUEST_FUSION "fusion"
+#define REQUEST_DENSE_WEIGHT "denseWeight"
+#define REQUEST_SPARSE_WEIGHT "sparseWeight"
+#define REQUEST_RRF_K "rrfK"
+#define REQUEST_CANDIDATES "candidates"
 
 #define RESPONSE_RETCODE "retCode"
 
 #define RESPONSE_ERROR_MSG "errorMsg"
 
 #define RESPONSE_CONTENT_TYPE_JSON "application/json"
+#define RESPONSE_CONTENT_TYPE_PROMETHEUS "text/plain; version=0.0.4"
 
 #define INDEX_TYPE_FLAT "FLAT"
 #define INDEX_TYPE_HNSW "HNSW"
 #define INDEX_TYPE_FILTER "FILTER"
+#define INDEX_TYPE_IVF "IVF"
+#define INDEX_TYPE_PQ "PQ"
+#define INDEX_TYPE_SQ "SQ"
+#define INDEX_TYPE_IVFPQ "IVFPQ"
+#define INDEX_TYPE_BINARY_FLAT "BINARY_FLAT"
+#define INDEX_TYPE_BINARY_HNSW "BINARY_HNSW"
+#define INDEX_TYPE_SPARSE "SPARSE"
 #define INDEX_TYPE_UNKNOWN "UNKNOWN"
 
+#define DEFAULT_COLLECTION_NAME "default"
+#define CATALOG_COLUMN_FAMILY "_catalog"
+
+#define METRIC_TYPE_L2 "L2"
+#define METRIC_TYPE_IP "IP"
+#define METRIC_TYPE_COSINE "COSINE"
+
+#define FUSION_RRF "rrf"
+#define FUSION_WEIGHTED "weighted"
+
+#define CONFIG_HOST "host"
+#define CONFIG_PORT "port"
+#define CONFIG_HTTP_THREADS "httpThreads"
+#define CONFIG_OMP_THREADS "ompThreads"
+#define CONFIG_OMP_POLICY "ompPolicy"
+#define CONFIG_PIN_THREADS "pinThreads"
+#define CONFIG_MAX_QUEUED_REQUESTS "maxQueuedRequests"
+#define CONFIG_WRITE_THREADS "writeThreads"
+#define CONFIG_MAX_QUEUED_WRITES "maxQueuedWrites"
+#define CONFIG_ADMIN_THREADS "adminThreads"
+#define CONFIG_MAX_QUEUED_ADMIN "maxQueuedAdmin"
+#define CONFIG_REQUEST_TIMEOUT_MS "requestTimeoutMs"
+#define CONFIG_MAX_CONNECTIONS "maxConnections"
+#define CONFIG_DIM "dim"
+#define CONFIG_METRIC "metric"
+#define CONFIG_INDEX_TYPES "indexTypes"
+#define CONFIG_SHARDS "shards"
+#define CONFIG_HNSW "hnsw"
+#define CONFIG_HNSW_M "m"
+#define CONFIG_HNSW_EF_CONSTRUCTION "efConstruction"
+#define CONFIG_HNSW_EF_SEARCH "efSearch"
+#define CONFIG_HNSW_WRITE_BUFFER "writeBuffer"
+#define CONFIG_IVF "ivf"
+#define CONFIG_IVF_NLIST "nlist"
+#define CONFIG_IVF_NPROBE "nprobe"
+#define CONFIG_PQ "pq"
+#define CONFIG_PQ_M "m"
+#define CONFIG_RERANK_OVERSAMPLE "rerankOversample"
+#define CONFIG_SHARED_VECTORS "sharedVectors"
+#define CONFIG_SEARCH_BATCH "searchBatch"
+#define CONFIG_SEARCH_BATCH_WINDOW_US "windowUs"
+#define CONFIG_SEARCH_BATCH_MAX "maxQueries"
+#define CONFIG_RESULT_CACHE "resultCache"
+#define CONFIG_RESULT_CACHE_MB "sizeMb"
+#define CONFIG_RESULT_CACHE_TTL_MS "ttlMs"
+#define CONFIG_DB_PATH "dbPath"
+#define CONFIG_WAL_PATH "walPath"
+#define CONFIG_SNAPSHOT_PATH "snapshotPath"
+#define CONFIG_COMPACTION_THRESHOLD "compactionThreshold"
+#define CONFIG_COMPACTION_INTERVAL "compactionIntervalSec"
+#define CONFIG_MEMORY_BUDGET_MB "memoryBudgetMb"
+#define CONFIG_LOG_LEVEL "logLevel"
+#define CONFIG_SLOW_QUERY_LOG "slowQueryLog"
+#define CONFIG_SLOW_QUERY_THRESHOLD_MS "slowQueryThresholdMs"
+
 const i32 RESPONSE_RETCODE_SUCCESS = 0;
 const i32 RESPONSE_RETCODE_ERROR = -1;
+// hits per query returned by one /range_search page unless the request sets a limit
+const u64 DEFAULT_RANGE_SEARCH_LIMIT = 1000;
 
 } // namespace vdb
@@ -0,0 +1,754 @@
+#include "event_server.hh"
+#include "constants.hh"
+#include "logger.hh"
+#include "metrics.hh"
+#include "parallelism.hh"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <format>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+namespace vdb
+{
+
+namespace
+{
+
+constexpr u64 kListenId = 0;
+constexpr u64 kWakeupId = 1;
+constexpr size_t kMaxHeaderBytes = 64 * 1024;
+// stop handing out requests of a connection whose client does not read its responses
+constexpr size_t kMaxBufferedOutput = 4 * 1024 * 1024;
+constexpr size_t kReadChunk = 64 * 1024;
+
+const char *reasonPhrase(i32 status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 413:
+        return "Payload Too Large";
+    case 429:
+        return "Too Many Requests";
+    case 431:
+        return "Request Header Fields Too Large";
+    case 500:
+        return "Internal Server Error";
+    case 501:
+        return "Not Implemented";
+    case 503:
+        return "Service Unavailable";
+    default:
+        return status < 400 ? "OK" : "Error";
+    }
+}
+
+std::string serializeResponse(const httplib::Response &res, bool keep_alive)
+{
+    // handlers leave the status alone on success
+    i32 status = res.status > 0 ? res.status : 200;
+    std::string out = std::format("HTTP/1.1 {} {}\r\n", status, reasonPhrase(status));
+    for (const auto &[name, value] : res.headers)
+    {
+        out += name;
+        out += ": ";
+        out += value;
+        out += "\r\n";
+    }
+    out += std::format("Content-Length: {}\r\nConnection: {}\r\n\r\n", res.body.size(),
+                       keep_alive ? "keep-alive" : "close");
+    out += res.body;
+    return out;
+}
+
+/// the answers the loop gives on its own, in the handlers' JSON error format
+std::string errorResponse(i32 status, const std::string &error_msg, bool keep_alive)
+{
+    httplib::Response res;
+    res.status = status;
+    if (status == 503 || status == 429)
+    {
+        res.set_header("Retry-After", "1");
+    }
+    res.set_content(std::format("{{\"{}\":{},\"{}\":\"{}\"}}", RESPONSE_RETCODE, RESPONSE_RETCODE_ERROR,
+                                RESPONSE_ERROR_MSG, error_msg),
+                    RESPONSE_CONTENT_TYPE_JSON);
+    return serializeResponse(res, keep_alive);
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+           });
+}
+
+std::string_view trim(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+    {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r'))
+    {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/// lane "all" for sheds that happen before a request is routed
+Counter &shedCounter(const std::string &reason, const std::string &lane = "all")
+{
+    return getGlobalMetrics()->counter("vdb_http_requests_shed_total",
+                                       "HTTP requests answered without running a handler because of overload",
+                                       {{"reason", reason}, {"lane", lane}});
+}
+
+} // namespace
+
+const char *workloadClassName(WorkloadClass workload)
+{
+    switch (workload)
+    {
+    case WorkloadClass::SEARCH:
+        return "search";
+    case WorkloadClass::WRITE:
+        return "write";
+    case WorkloadClass::ADMIN:
+        return "admin";
+    }
+    return "unknown";
+}
+
+EventServer::EventServer(const EventServerOptions &options) : m_options(options)
+{
+}
+
+EventServer::~EventServer()
+{
+    stop();
+}
+
+void EventServer::Get(const std::string &path, Handler handler, WorkloadClass workload)
+{
+    m_routes["GET " + path] = {std::move(handler), workload};
+}
+
+void EventServer::Post(const std::string &path, Handler handler, WorkloadClass workload)
+{
+    m_routes["POST " + path] = {std::move(handler), workload};
+}
+
+void EventServer::setOptions(const EventServerOptions &options)
+{
+    m_options = options;
+}
+
+bool EventServer::listen(const std::string &host, i32 port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *addresses = nullptr;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+    {
+        GlobalLogger->error("<EventServer> Cannot resolve {}", host);
+        return false;
+    }
+    for (addrinfo *address = addresses; address != nullptr && m_listen_fd < 0; address = address->ai_next)
+    {
+        int fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (bind(fd, address->ai_addr, address->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0 &&
+            setNonBlocking(fd))
+        {
+            m_listen_fd = fd;
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+    freeaddrinfo(addresses);
+    if (m_listen_fd < 0)
+    {
+        GlobalLogger->error("<EventServer> Cannot listen on {}:{}: {}", host, port, std::strerror(errno));
+        return false;
+    }
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = kListenId;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &event);
+    event.data.u64 = kWakeupId;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &event);
+
+    MetricsRegistry *metrics = getGlobalMetrics();
+    for (size_t i = 0; i < kWorkloadClasses; ++i)
+    {
+        const LaneOptions &lane_options = m_options.lanes[i];
+        std::string lane_name = workloadClassName(static_cast<WorkloadClass>(i));
+        size_t threads = lane_options.threads > 0 ? static_cast<size_t>(lane_options.threads)
+                                                  : std::thread::hardware_concurrency();
+        Lane &lane = m_lanes[i];
+        std::function<void(size_t)> on_start;
+        if (m_options.pin_threads)
+        {
+            on_start = [](size_t worker) { pinCurrentThreadToNode(worker); };
+        }
+        lane.workers = std::make_unique<ThreadPool>(threads, on_start);
+        lane.max_queued = lane_options.max_queued;
+        lane.queued = &metrics->gauge("vdb_http_queued_requests", "HTTP requests waiting for a worker thread",
+                                      {{"lane", lane_name}});
+        lane.queue_wait = &metrics->histogram("vdb_http_queue_wait_seconds",
+                                              "Time HTTP requests wait for a worker thread", {{"lane", lane_name}});
+        GlobalLogger->info("<EventServer> Lane {}: {} workers, queue limit {}", lane_name, threads,
+                           lane_options.max_queued);
+    }
+    Gauge &connections_gauge = metrics->gauge("vdb_http_connections", "Open HTTP connections");
+    GlobalLogger->info("<EventServer> Listening on {}:{}", host, port);
+
+    std::vector<epoll_event> events(256);
+    auto last_idle_check = std::chrono::steady_clock::now();
+    while (!m_stop)
+    {
+        int count = epoll_wait(m_epoll_fd, events.data(), static_cast<int>(events.size()), 1000);
+        if (count < 0 && errno != EINTR)
+        {
+            GlobalLogger->error("<EventServer> epoll_wait failed: {}", std::strerror(errno));
+            break;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            u64 id = events[i].data.u64;
+            if (id == kListenId)
+            {
+                acceptConnections();
+            }
+            else if (id == kWakeupId)
+            {
+                u64 value;
+                while (read(m_wakeup_fd, &value, sizeof(value)) > 0)
+                {
+                }
+                processCompletions();
+            }
+            else if (events[i].events & (EPOLLHUP | EPOLLERR))
+            {
+                // reset or fully closed: nothing can be written back, a running handler's answer is dropped
+                closeConnection(id);
+            }
+            else
+            {
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+                {
+                    readConnection(id);
+                }
+                if ((events[i].events & EPOLLOUT) && m_connections.count(id))
+                {
+                    writeConnection(id);
+                }
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_idle_check >= std::chrono::seconds(1))
+        {
+            last_idle_check = now;
+            closeIdleConnections();
+            connections_gauge.set(static_cast<i64>(m_connections.size()));
+            for (Lane &lane : m_lanes)
+            {
+                lane.queued->set(static_cast<i64>(lane.workers->queued()));
+            }
+        }
+    }
+
+    // running handlers finish, queued ones run and their answers are dropped
+    for (Lane &lane : m_lanes)
+    {
+        lane.workers.reset();
+    }
+    std::vector<u64> ids;
+    for (const auto &[id, connection] : m_connections)
+    {
+        ids.push_back(id);
+    }
+    for (u64 id : ids)
+    {
+        closeConnection(id);
+    }
+    close(m_listen_fd);
+    close(m_epoll_fd);
+    close(m_wakeup_fd);
+    m_listen_fd = m_epoll_fd = m_wakeup_fd = -1;
+    return true;
+}
+
+void EventServer::stop()
+{
+    m_stop = true;
+    if (m_wakeup_fd >= 0)
+    {
+        u64 one = 1;
+        [[maybe_unused]] ssize_t written = write(m_wakeup_fd, &one, sizeof(one));
+    }
+}
+
+void EventServer::acceptConnections()
+{
+    while (true)
+    {
+        int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                GlobalLogger->warn("<EventServer> accept failed: {}", std::strerror(errno));
+            }
+            return;
+        }
+        if (m_connections.size() >= m_options.max_connections)
+        {
+            shedCounter("connections").inc();
+            std::string response = errorResponse(503, "Too many connections", false);
+            [[maybe_unused]] ssize_t written = send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+            close(fd);
+            continue;
+        }
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        u64 id = m_next_connection_id++;
+        Connection &connection = m_connections[id];
+        connection.fd = fd;
+        connection.last_active = std::chrono::steady_clock::now();
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.u64 = id;
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void EventServer::readConnection(u64 id)
+{
+    auto it = m_connections.find(id);
+    if (it == m_connections.end())
+    {
+        return;
+    }
+    Connection &connection = it->second;
+    char buffer[kReadChunk];
+    // one full request fits; what lies beyond stays in the socket until the parser catches up
+    while (!connection.read_closed && connection.in.size() < m_options.max_request_bytes)
+    {
+        ssize_t n = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (n > 0)
+        {
+            connection.in.append(buffer, static_cast<size_t>(n));
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        // orderly shutdown or error: requests already received are still answered
+        connection.read_closed = true;
+        connection.close_after_write = true;
+    }
+    connection.last_active = std::chrono::steady_clock::now();
+
+    parseRequests(connection);
+    dispatchNext(id, connection);
+    if (m_connections.count(id) == 0)
+    {
+        return; // closed while writing
+    }
+    if (!connection.in_flight && connection.pending.empty() && connection.out_offset >= connection.out.size() &&
+        connection.close_after_write)
+    {
+        closeConnection(id);
+        return;
+    }
+    updateInterest(id, connection);
+}
+
+void EventServer::parseRequests(Connection &connection)
+{
+    size_t consumed = 0;
+    std::string_view data(connection.in);
+    // a full pipeline leaves the rest unparsed, and updateInterest stops reading, until it drains
+    while (consumed < data.size() && connection.pending.size() < m_options.max_pipelined_requests)
+    {
+        std::string_view rest = data.substr(consumed);
+        size_t header_end = rest.find("\r\n\r\n");
+        PendingRequest pending;
+        pending.arrival = std::chrono::steady_clock::now();
+        if (header_end == std::string_view::npos)
+        {
+            if (rest.size() > kMaxHeaderBytes)
+            {
+                pending.error_status = 431;
+                pending.error_msg = "Request headers too large";
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        size_t content_length = 0;
+        if (pending.error_status == 0)
+        {
+            std::string_view head = rest.substr(0, header_end);
+            size_t line_end = head.find("\r\n");
+            std::string_view request_line = head.substr(0, line_end);
+            size_t method_end = request_line.find(' ');
+            size_t target_end = request_line.rfind(' ');
+            if (method_end == std::string_view::npos || target_end == method_end)
+            {
+                pending.error_status = 400;
+                pending.error_msg = "Malformed request line";
+            }
+            else
+            {
+                httplib::Request &request = pending.request;
+                request.method = std::string(request_line.substr(0, method_end));
+                std::string_view target = request_line.substr(method_end + 1, target_end - method_end - 1);
+                request.path = std::string(target.substr(0, target.find('?')));
+                request.version = std::string(request_line.substr(target_end + 1));
+                pending.keep_alive = request.version == "HTTP/1.1";
+
+                std::string_view headers = line_end == std::string_view::npos ? "" : head.substr(line_end + 2);
+                while (!headers.empty())
+                {
+                    size_t end = headers.find("\r\n");
+                    std::string_view line = headers.substr(0, end);
+                    headers = end == std::string_view::npos ? "" : headers.substr(end + 2);
+                    size_t colon = line.find(':');
+                    if (colon == std::string_view::npos)
+                    {
+                        continue;
+                    }
+                    std::string_view name = trim(line.substr(0, colon));
+                    std::string_view value = trim(line.substr(colon + 1));
+                    request.headers.emplace(std::string(name), std::string(value));
+                    if (equalsIgnoreCase(name, "Content-Length"))
+                    {
+                        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), content_length);
+                        if (ec != std::errc() || end != value.data() + value.size())
+                        {
+                            pending.error_status = 400;
+                            pending.error_msg = "Invalid Content-Length";
+                        }
+                    }
+                    else if (equalsIgnoreCase(name, "Connection"))
+                    {
+                        pending.keep_alive = equalsIgnoreCase(value, "keep-alive") ||
+                                             (pending.keep_alive && !equalsIgnoreCase(value, "close"));
+                    }
+                    else if (equalsIgnoreCase(name, "Transfer-Encoding") && !equalsIgnoreCase(value, "identity"))
+                    {
+                        pending.error_status = 501;
+                        pending.error_msg = "Chunked request bodies are not supported";
+                    }
+                    else if (equalsIgnoreCase(name, "X-Request-Timeout-Ms"))
+                    {
+                        u64 timeout_ms = 0;
+                        std::from_chars(value.data(), value.data() + value.size(), timeout_ms);
+                        if (timeout_ms > 0)
+                        {
+                            pending.deadline = pending.arrival + std::chrono::milliseconds(timeout_ms);
+                        }
+                    }
+                }
+                if (pending.deadline == std::chrono::steady_clock::time_point::max() &&
+                    m_options.request_timeout_ms > 0)
+                {
+                    pending.deadline = pending.arrival + std::chrono::milliseconds(m_options.request_timeout_ms);
+                }
+                // compared before adding, a huge Content-Length would wrap the sum
+                if (pending.error_status == 0 && (content_length > m_options.max_request_bytes ||
+                                                  header_end + 4 > m_options.max_request_bytes - content_length))
+                {
+                    pending.error_status = 413;
+                    pending.error_msg = "Request too large";
+                }
+            }
+        }
+
+        if (pending.error_status != 0)
+        {
+            // the rest of the stream cannot be framed: answer in turn, then close
+            pending.keep_alive = false;
+            connection.pending.push_back(std::move(pending));
+            connection.read_closed = true;
+            connection.close_after_write = true;
+            consumed = data.size();
+            break;
+        }
+        if (rest.size() < header_end + 4 + content_length)
+        {
+            break; // body still arriving
+        }
+        pending.request.body = std::string(rest.substr(header_end + 4, content_length));
+        consumed += header_end + 4 + content_length;
+
+        if (!pending.keep_alive)
+        {
+            // nothing after a "Connection: close" request is read
+            connection.pending.push_back(std::move(pending));
+            connection.read_closed = true;
+            connection.close_after_write = true;
+            consumed = data.size();
+            break;
+        }
+        connection.pending.push_back(std::move(pending));
+    }
+    connection.in.erase(0, consumed);
+}
+
+void EventServer::dispatchNext(u64 id, Connection &connection)
+{
+    while (!connection.in_flight && !connection.pending.empty() &&
+           connection.out.size() - connection.out_offset < kMaxBufferedOutput)
+    {
+        PendingRequest pending = std::move(connection.pending.front());
+        connection.pending.pop_front();
+
+        const Route *route = nullptr;
+        if (pending.error_status == 0)
+        {
+            auto it = m_routes.find(pending.request.method + " " + pending.request.path);
+            if (it == m_routes.end())
+            {
+                pending.error_status = 404;
+                pending.error_msg = "No handler for " + pending.request.method + " " + pending.request.path;
+            }
+            else
+            {
+                route = &it->second;
+                const char *lane_name = workloadClassName(route->workload);
+                if (m_lanes[static_cast<size_t>(route->workload)].workers->queued() >=
+                    m_lanes[static_cast<size_t>(route->workload)].max_queued)
+                {
+                    shedCounter("queue_full", lane_name).inc();
+                    pending.error_status = 503;
+                    pending.error_msg = std::format("Server overloaded, {} queue full", lane_name);
+                }
+            }
+        }
+
+        if (pending.error_status != 0)
+        {
+            connection.out += errorResponse(pending.error_status, pending.error_msg, pending.keep_alive);
+            continue;
+        }
+
+        connection.in_flight = true;
+        auto request = std::make_shared<PendingRequest>(std::move(pending));
+        Lane &lane = m_lanes[static_cast<size_t>(route->workload)];
+        lane.workers->submit([this, id, route, &lane, request]() { handleRequest(id, *route, lane, *request); });
+    }
+    if (connection.out_offset < connection.out.size())
+    {
+        writeConnection(id);
+    }
+}
+
+void EventServer::handleRequest(u64 id, const Route &route, Lane &lane, PendingRequest &pending)
+{
+    auto now = std::chrono::steady_clock::now();
+    lane.queue_wait->record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - pending.arrival).count());
+    if (now > pending.deadline)
+    {
+        shedCounter("deadline", workloadClassName(route.workload)).inc();
+        complete(id, errorResponse(503, "Request deadline exceeded while queued", pending.keep_alive),
+                 pending.keep_alive);
+        return;
+    }
+
+    httplib::Response res;
+    try
+    {
+        route.handler(pending.request, res);
+    }
+    catch (const std::exception &e)
+    {
+        GlobalLogger->error("<EventServer> Handler for {} failed: {}", pending.request.path, e.what());
+        complete(id, errorResponse(500, "Internal server error", pending.keep_alive), pending.keep_alive);
+        return;
+    }
+    complete(id, serializeResponse(res, pending.keep_alive), pending.keep_alive);
+}
+
+void EventServer::complete(u64 id, std::string response, bool keep_alive)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_completion_mutex);
+        m_completions.push_back({id, std::move(response), keep_alive});
+    }
+    u64 one = 1;
+    [[maybe_unused]] ssize_t written = write(m_wakeup_fd, &one, sizeof(one));
+}
+
+void EventServer::processCompletions()
+{
+    std::vector<Completion> completions;
+    {
+        std::lock_guard<std::mutex> lock(m_completion_mutex);
+        completions.swap(m_completions);
+    }
+    for (Completion &completion : completions)
+    {
+        auto it = m_connections.find(completion.connection_id);
+        if (it == m_connections.end())
+        {
+            continue; // the client went away meanwhile
+        }
+        Connection &connection = it->second;
+        connection.out += completion.response;
+        connection.in_flight = false;
+        // requests held back by a full pipeline are already buffered, no read event announces them
+        parseRequests(connection);
+        connection.last_active = std::chrono::steady_clock::now();
+        if (!completion.keep_alive)
+        {
+            connection.close_after_write = true;
+        }
+        dispatchNext(completion.connection_id, connection);
+        if (m_connections.count(completion.connection_id))
+        {
+            writeConnection(completion.connection_id);
+        }
+    }
+}
+
+void EventServer::writeConnection(u64 id)
+{
+    auto it = m_connections.find(id);
+    if (it == m_connections.end())
+    {
+        return;
+    }
+    Connection &connection = it->second;
+    while (connection.out_offset < connection.out.size())
+    {
+        ssize_t n = send(connection.fd, connection.out.data() + connection.out_offset,
+                         connection.out.size() - connection.out_offset, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            connection.out_offset += static_cast<size_t>(n);
+            connection.last_active = std::chrono::steady_clock::now();
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            updateInterest(id, connection);
+            return;
+        }
+        closeConnection(id);
+        return;
+    }
+
+    connection.out.clear();
+    connection.out_offset = 0;
+    if (connection.close_after_write && !connection.in_flight && connection.pending.empty())
+    {
+        closeConnection(id);
+        return;
+    }
+    if (!connection.pending.empty())
+    {
+        // resumes a connection paused for buffered output
+        dispatchNext(id, connection);
+    }
+    if (m_connections.count(id))
+    {
+        updateInterest(id, connection);
+    }
+}
+
+void EventServer::updateInterest(u64 id, Connection &connection)
+{
+    bool writing = connection.out_offset < connection.out.size();
+    bool reading = !connection.read_closed && connection.pending.size() < m_options.max_pipelined_requests &&
+                   connection.in.size() < m_options.max_request_bytes;
+    epoll_event event{};
+    event.events = (reading ? EPOLLIN | EPOLLRDHUP : 0) | (writing ? EPOLLOUT : 0);
+    event.data.u64 = id;
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void EventServer::closeConnection(u64 id)
+{
+    auto it = m_connections.find(id);
+    if (it == m_connections.end())
+    {
+        return;
+    }
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    close(it->second.fd);
+    m_connections.erase(it);
+}
+
+void EventServer::closeIdleConnections()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::vector<u64> idle;
+    for (const auto &[id, connection] : m_connections)
+    {
+        if (!connection.in_flight && connection.pending.empty() &&
+            now - connection.last_active > std::chrono::milliseconds(m_options.idle_timeout_ms))
+        {
+            idle.push_back(id);
+        }
+    }
+    for (u64 id : idle)
+    {
+        closeConnection(id);
+    }
+}
+
+} // namespace vdb
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "metrics.hh"
+#include "thread_pool.hh"
+#include "types.hh"
+#include <httplib.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vdb
+{
+
+/// Scheduling class of a route. Each class has its own workers and queue, so a burst of one
+/// class can only delay its own requests.
+enum class WorkloadClass
+{
+    SEARCH, // interactive reads
+    WRITE,  // inserts, upserts, deletes
+    ADMIN,  // snapshots, builds, compaction, collection management
+};
+constexpr size_t kWorkloadClasses = 3;
+const char *workloadClassName(WorkloadClass workload);
+
+struct LaneOptions
+{
+    // workers running handlers of the class, 0: one per hardware thread
+    i32 threads = 0;
+    // requests waiting for a worker; beyond this new requests of the class are shed with 503
+    size_t max_queued = 1024;
+};
+
+/// Limits of the event-driven server core.
+struct EventServerOptions
+{
+    // indexed by WorkloadClass
+    std::array<LaneOptions, kWorkloadClasses> lanes = {
+        LaneOptions{0, 1024}, // search
+        LaneOptions{4, 256},  // write
+        LaneOptions{2, 16},   // admin
+    };
+    // parsed requests one connection may have waiting behind its current one; beyond this the
+    // connection is not read until they drain
+    size_t max_pipelined_requests = 64;
+    // connections beyond this are answered with 503 and closed
+    size_t max_connections = 10000;
+    // a request whose headers and body exceed this gets 413 and its connection is closed
+    size_t max_request_bytes = 64 * 1024 * 1024;
+    // a request still queued this long after it arrived is dropped with 503; an
+    // X-Request-Timeout-Ms header overrides it per request, 0 means no deadline
+    u64 request_timeout_ms = 0;
+    // keep-alive connections idle this long are closed
+    u64 idle_timeout_ms = 60000;
+    // spread the workers of each lane round-robin over the NUMA nodes and keep them there
+    bool pin_threads = false;
+};
+
+/// HTTP/1.1 server on a single epoll loop with non-blocking sockets, keep-alive and pipelining.
+///
+/// The loop thread only accepts, reads, parses and writes. Handlers run on one worker pool per
+/// workload class, each behind a bounded queue, so overload is answered at once (503 when the
+/// queue of the class is full) instead of turning into unbounded latency, and queued requests whose
+/// deadline has passed are dropped before they reach a handler. The requests of one connection are
+/// handled one after another, so pipelined responses go out in request order; a connection with
+/// max_pipelined_requests waiting is not read until they drain, which pushes back on the client.
+///
+/// Handlers take the httplib request and response types; the request carries method, path
+/// (without query string), headers and body. Chunked request bodies are not supported.
+class EventServer
+{
+  public:
+    using Handler = std::function<void(const httplib::Request &, httplib::Response &)>;
+
+    explicit EventServer(const EventServerOptions &options = {});
+    ~EventServer();
+    EventServer(const EventServer &) = delete;
+    EventServer &operator=(const EventServer &) = delete;
+
+    /// routes and options are set before listen()
+    void Get(const std::string &path, Handler handler, WorkloadClass workload = WorkloadClass::SEARCH);
+    void Post(const std::string &path, Handler handler, WorkloadClass workload = WorkloadClass::SEARCH);
+    void setOptions(const EventServerOptions &options);
+
+    /// serve on the calling thread until stop(); false when the address cannot be bound
+    bool listen(const std::string &host, i32 port);
+    /// may be called from any thread
+    void stop();
+
+  private:
+    struct PendingRequest
+    {
+        httplib::Request request;
+        bool keep_alive = true;
+        std::chrono::steady_clock::time_point arrival;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        // set when the loop answers the request itself (parse errors, shedding)
+        i32 error_status = 0;
+        std::string error_msg;
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        // bytes read but not parsed yet
+        std::string in;
+        // response bytes not written yet, from out_offset on
+        std::string out;
+        size_t out_offset = 0;
+        // parsed requests waiting for the one in flight
+        std::deque<PendingRequest> pending;
+        bool in_flight = false;
+        // the peer closed its side or an answer asked to close: no more requests are read
+        bool read_closed = false;
+        bool close_after_write = false;
+        std::chrono::steady_clock::time_point last_active;
+    };
+
+    struct Route
+    {
+        Handler handler;
+        WorkloadClass workload;
+    };
+
+    struct Lane
+    {
+        std::unique_ptr<ThreadPool> workers;
+        size_t max_queued;
+        Gauge *queued;
+        Histogram *queue_wait;
+    };
+
+    struct Completion
+    {
+        u64 connection_id;
+        std::string response;
+        bool keep_alive;
+    };
+
+    void acceptConnections();
+    void readConnection(u64 id);
+    void writeConnection(u64 id);
+    void closeConnection(u64 id);
+    /// split complete requests off the read buffer
+    void parseRequests(Connection &connection);
+    /// hand the next pending request of the connection to a worker, answering shed and
+    /// malformed ones on the way
+    void dispatchNext(u64 id, Connection &connection);
+    void processCompletions();
+    void closeIdleConnections();
+    void updateInterest(u64 id, Connection &connection);
+    /// runs on a worker
+    void handleRequest(u64 id, const Route &route, Lane &lane, PendingRequest &pending);
+    void complete(u64 id, std::string response, bool keep_alive);
+
+  private:
+    EventServerOptions m_options;
+    std::map<std::string, Route> m_routes; // "<METHOD> <path>"
+    std::array<Lane, kWorkloadClasses> m_lanes;
+
+    int m_listen_fd = -1;
+    int m_epoll_fd = -1;
+    int m_wakeup_fd = -1;
+    std::atomic<bool> m_stop{false};
+    // 0 and 1 tag the listening socket and the wakeup eventfd in epoll
+    u64 m_next_connection_id = 2;
+    std::unordered_map<u64, Connection> m_connections;
+
+    std::mutex m_completion_mutex;
+    std::vector<Completion> m_completions;
+};
+
+} // namespace vdb
@@ -1,11 +1,34 @@
 #include "faiss_index.hh"
 #include "logger.hh"
+#include "metrics.hh"
+#include "parallelism.hh"
+#include "thread_pool.hh"
 #include <faiss/Index.h>
+#include <faiss/IndexFlat.h>
+#include <faiss/IndexFlatCodes.h>
+#include <faiss/IndexHNSW.h>
 #include <faiss/IndexIDMap.h>
+#include <faiss/IndexIVF.h>
+#include <faiss/clone_index.h>
+#include <faiss/impl/AuxIndexStructures.h>
 #include <faiss/impl/IDSelector.h>
 #include <faiss/index_io.h>
+#include <faiss/invlists/InvertedLists.h>
+#include <faiss/invlists/OnDiskInvertedLists.h>
+#include <faiss/utils/distances.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <format>
 #include <fstream>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <queue>
 #include <stdexcept>
+#include <tuple>
 #include <vector>
 
 namespace vdb
@@ -20,54 +43,861 @@ bool RoaringBitmapIDSelector::is_member(i64 id) const
     return roaring_bitmap_contains(m_bitmap, static_cast<u32>(id));
 }
 
-FaissIndex::FaissIndex(faiss::Index *index) : m_index(index)
+namespace
 {
+
+/// splitmix64 finalizer: spreads sequential ids evenly over the shards
+u64 mixId(u64 id)
+{
+    id ^= id >> 30;
+    id *= 0xbf58476d1ce4e5b9ULL;
+    id ^= id >> 27;
+    id *= 0x94d049bb133111ebULL;
+    id ^= id >> 31;
+    return id;
+}
+
+/// K-way merge of per-shard results, each sorted best-first with -1 labels at the tail.
+std::pair<std::vector<i64>, std::vector<f32>> mergeShardResults(
+    const std::vector<std::pair<std::vector<i64>, std::vector<f32>>> &shard_results, i32 query_num, i32 k,
+    bool larger_is_better)
+{
+    std::vector<i64> labels(static_cast<size_t>(query_num) * k, -1);
+    std::vector<f32> distances(static_cast<size_t>(query_num) * k,
+                               larger_is_better ? -std::numeric_limits<f32>::max()
+                                                : std::numeric_limits<f32>::max());
+
+    // (distance, shard, position within that shard's list for the query)
+    using Entry = std::tuple<f32, size_t, i32>;
+    auto worse = [larger_is_better](const Entry &a, const Entry &b) {
+        return larger_is_better ? std::get<0>(a) < std::get<0>(b) : std::get<0>(a) > std::get<0>(b);
+    };
+
+    for (i32 q = 0; q < query_num; ++q)
+    {
+        std::priority_queue<Entry, std::vector<Entry>, decltype(worse)> heap(worse);
+        size_t base = static_cast<size_t>(q) * k;
+        for (size_t s = 0; s < shard_results.size(); ++s)
+        {
+            if (shard_results[s].first[base] != -1)
+            {
+                heap.emplace(shard_results[s].second[base], s, 0);
+            }
+        }
+
+        for (i32 out = 0; out < k && !heap.empty(); ++out)
+        {
+            auto [distance, s, pos] = heap.top();
+            heap.pop();
+            labels[base + out] = shard_results[s].first[base + pos];
+            distances[base + out] = distance;
+            if (pos + 1 < k && shard_results[s].first[base + pos + 1] != -1)
+            {
+                heap.emplace(shard_results[s].second[base + pos + 1], s, pos + 1);
+            }
+        }
+    }
+    return {labels, distances};
+}
+
+/// Positions of the index wrapped by an IndexIDMap that a search may return: not tombstoned and,
+/// with a filter, whose label is in the filter bitmap.
+struct ShardIDSelector : faiss::IDSelector
+{
+    ShardIDSelector(const roaring_bitmap_t *tombstones, const roaring_bitmap_t *filter, const faiss::idx_t *labels)
+        : m_tombstones(tombstones), m_filter(filter), m_labels(labels)
+    {
+    }
+
+    bool is_member(faiss::idx_t position) const final
+    {
+        if (m_tombstones != nullptr && roaring_bitmap_contains(m_tombstones, static_cast<u32>(position)))
+        {
+            return false;
+        }
+        return m_filter == nullptr || roaring_bitmap_contains(m_filter, static_cast<u32>(m_labels[position]));
+    }
+
+    const roaring_bitmap_t *m_tombstones;
+    const roaring_bitmap_t *m_filter;
+    const faiss::idx_t *m_labels;
+};
+
+faiss::IndexHNSW *getHNSWIndex(faiss::IndexIDMap *index)
+{
+    return dynamic_cast<faiss::IndexHNSW *>(index->index);
+}
+
+faiss::IndexIVF *getIVFIndex(faiss::IndexIDMap *index)
+{
+    return dynamic_cast<faiss::IndexIVF *>(index->index);
+}
+
+/// the file backing the inverted lists of an IVF shard, empty when they are in memory
+std::string onDiskListsPath(faiss::IndexIDMap *index)
+{
+    faiss::IndexIVF *ivf_index = getIVFIndex(index);
+    if (ivf_index == nullptr)
+    {
+        return {};
+    }
+    auto *lists = dynamic_cast<faiss::OnDiskInvertedLists *>(ivf_index->invlists);
+    return lists != nullptr ? lists->filename : std::string();
+}
+
+u64 flatCodesBytes(const faiss::Index *index)
+{
+    const auto *flat_index = dynamic_cast<const faiss::IndexFlatCodes *>(index);
+    return flat_index != nullptr ? flat_index->codes.size() : 0;
+}
+
+faiss::IndexIDMap *asIDMap(faiss::Index *index)
+{
+    faiss::IndexIDMap *id_map = dynamic_cast<faiss::IndexIDMap *>(index);
+    if (id_map == nullptr)
+    {
+        throw std::runtime_error("Underlying Faiss index is not an IndexIDMap");
+    }
+    return id_map;
+}
+
+/// brute-force buffer for the tiered inserts of a shard shaped like `index`
+faiss::IndexIDMap *makeWriteBuffer(const faiss::Index *index)
+{
+    auto *buffer = new faiss::IndexIDMap(new faiss::IndexFlat(index->d, index->metric_type));
+    buffer->own_fields = true;
+    return buffer;
+}
+
+/// where a FLAT or HNSW shard keeps its flat storage: the HNSW storage, or the index wrapped by
+/// the id map
+faiss::Index **flatStorageHolder(faiss::IndexIDMap *index)
+{
+    if (auto *hnsw_index = dynamic_cast<faiss::IndexHNSW *>(index->index))
+    {
+        return &hnsw_index->storage;
+    }
+    return &index->index;
+}
+
+std::string slotsFilePath(const std::string &shard_path)
+{
+    return shard_path + ".slots";
+}
+
+void writeSlots(const std::string &file_path, const std::vector<u32> &slots)
+{
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char *>(slots.data()), static_cast<std::streamsize>(slots.size() * sizeof(u32)));
+    if (!file)
+    {
+        throw std::runtime_error("<FaissIndex> Failed to write " + file_path);
+    }
+}
+
+/// nullopt when the file does not exist
+std::optional<std::vector<u32>> readSlots(const std::string &file_path)
+{
+    std::ifstream file(file_path, std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        return std::nullopt;
+    }
+    std::vector<u32> slots(static_cast<size_t>(file.tellg()) / sizeof(u32));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(slots.data()), static_cast<std::streamsize>(slots.size() * sizeof(u32)));
+    if (!file)
+    {
+        throw std::runtime_error("<FaissIndex> Failed to read " + file_path);
+    }
+    return slots;
+}
+
+std::string tombstoneFilePath(const std::string &shard_path)
+{
+    return shard_path + ".tombstones";
+}
+
+std::string shardCountFilePath(const std::string &file_path)
+{
+    return file_path + ".shards";
+}
+
+/// Shard count of the snapshot at `file_path`, 0 when there is none. Snapshots from before the
+/// count was saved are recognized by their file names.
+size_t readShardCount(const std::string &file_path)
+{
+    std::ifstream file(shardCountFilePath(file_path));
+    size_t count = 0;
+    if (file.is_open())
+    {
+        if (!(file >> count) || count == 0)
+        {
+            throw std::runtime_error("<FaissIndex> Corrupted shard count file " + shardCountFilePath(file_path));
+        }
+        return count;
+    }
+    if (std::filesystem::exists(file_path))
+    {
+        return 1;
+    }
+    while (std::filesystem::exists(std::format("{}.shard{}", file_path, count)))
+    {
+        ++count;
+    }
+    return count;
+}
+
+// compaction measures recall@kRecallK on up to kRecallQueries live vectors of each shard
+constexpr i32 kRecallK = 10;
+constexpr size_t kRecallQueries = 32;
+
+/// Exact top-k labels of `queries` among `vectors`, whose row i carries labels[i].
+std::vector<i64> bruteForceTopK(const std::vector<f32> &vectors, const std::vector<i64> &labels, const f32 *queries,
+                                i32 query_num, i32 dim, i32 k, bool inner_product)
+{
+    std::vector<i64> result(static_cast<size_t>(query_num) * k, -1);
+    std::vector<std::pair<f32, i64>> scored(labels.size());
+    size_t top = std::min(static_cast<size_t>(k), labels.size());
+    for (i32 q = 0; q < query_num; ++q)
+    {
+        const f32 *query = queries + static_cast<size_t>(q) * dim;
+        for (size_t i = 0; i < labels.size(); ++i)
+        {
+            const f32 *vector = vectors.data() + i * dim;
+            // smaller is better for both
+            f32 distance = inner_product ? -faiss::fvec_inner_product(query, vector, dim)
+                                         : faiss::fvec_L2sqr(query, vector, dim);
+            scored[i] = {distance, labels[i]};
+        }
+        std::partial_sort(scored.begin(), scored.begin() + top, scored.end());
+        for (size_t i = 0; i < top; ++i)
+        {
+            result[static_cast<size_t>(q) * k + i] = scored[i].second;
+        }
+    }
+    return result;
+}
+
+f64 recallAtK(const std::vector<i64> &expected, const std::vector<i64> &found, i32 query_num, i32 k)
+{
+    u64 relevant = 0;
+    u64 hits = 0;
+    for (i32 q = 0; q < query_num; ++q)
+    {
+        auto found_begin = found.begin() + static_cast<size_t>(q) * k;
+        for (i32 i = 0; i < k; ++i)
+        {
+            i64 label = expected[static_cast<size_t>(q) * k + i];
+            if (label == -1)
+            {
+                continue;
+            }
+            ++relevant;
+            if (std::find(found_begin, found_begin + k, label) != found_begin + k)
+            {
+                ++hits;
+            }
+        }
+    }
+    return relevant > 0 ? static_cast<f64>(hits) / relevant : 1.0;
+}
+
+} // namespace
+
+void writeBitmap(const std::string &file_path, const roaring_bitmap_t *bitmap)
+{
+    std::string buffer(roaring_bitmap_portable_size_in_bytes(bitmap), '\0');
+    roaring_bitmap_portable_serialize(bitmap, buffer.data());
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    if (!file)
+    {
+        throw std::runtime_error("<FaissIndex> Failed to write " + file_path);
+    }
+}
+
+roaring_bitmap_t *readBitmap(const std::string &file_path)
+{
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return nullptr;
+    }
+    std::string buffer((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    roaring_bitmap_t *bitmap = roaring_bitmap_portable_deserialize_safe(buffer.data(), buffer.size());
+    if (bitmap == nullptr)
+    {
+        throw std::runtime_error("<FaissIndex> Corrupted bitmap file " + file_path);
+    }
+    return bitmap;
+}
+
+FaissIndex::FaissIndex(std::vector<faiss::Index *> shards, const FaissIndexOptions &options) : m_options(options)
+{
+    if (shards.empty())
+    {
+        throw std::invalid_argument("<FaissIndex> At least one shard is required");
+    }
+    for (faiss::Index *index : shards)
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->index = asIDMap(index);
+        shard->tombstones = roaring_bitmap_create();
+        if (m_options.write_buffer > 0)
+        {
+            shard->buffer = makeWriteBuffer(index);
+        }
+        m_shards.push_back(std::move(shard));
+    }
+    if (m_options.write_buffer > 0)
+    {
+        m_merge_thread = std::thread(&FaissIndex::mergeLoop, this);
+    }
+    if (m_options.search_batch_window_us > 0 && m_options.search_batch_max > 1)
+    {
+        m_batcher = std::make_unique<SearchBatcher>(
+            getDim(), std::chrono::microseconds(m_options.search_batch_window_us),
+            static_cast<size_t>(m_options.search_batch_max),
+            [this](const std::vector<f32> &queries, i32 k, const SearchOptions &search_options) {
+                return searchUnbatched(queries, k, nullptr, nullptr, search_options);
+            });
+    }
 }
 
 FaissIndex::~FaissIndex()
 {
-    delete m_index;
+    if (m_merge_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_merge_mutex);
+            m_stop_merger = true;
+        }
+        m_merge_cv.notify_all();
+        m_merge_thread.join();
+    }
+    for (auto &shard : m_shards)
+    {
+        delete shard->index;
+        delete shard->buffer;
+        delete shard->frozen;
+        roaring_bitmap_free(shard->tombstones);
+    }
+}
+
+FaissIndex::Shard &FaissIndex::shardOf(i64 id)
+{
+    return *m_shards[mixId(static_cast<u64>(id)) % m_shards.size()];
 }
 
 void FaissIndex::insert_vectors(const std::vector<f32> &data, u64 label)
 {
+    static Histogram &insert_histogram = stageHistogram("faiss_insert");
+    ScopedTimer timer(insert_histogram);
     i64 id = static_cast<i64>(label);
-    m_index->add_with_ids(1, data.data(), &id);
+    const f32 *vector = data.data();
+    std::vector<f32> normalized;
+    if (m_options.normalize)
+    {
+        normalized = data;
+        faiss::fvec_renorm_L2(getDim(), 1, normalized.data());
+        vector = normalized.data();
+    }
+
+    Shard &shard = shardOf(id);
+    std::unique_lock lock(shard.mutex);
+    auto it = shard.positions.find(id);
+    if (shard.buffer != nullptr)
+    {
+        if (it != shard.positions.end())
+        {
+            roaring_bitmap_add(shard.tombstones, static_cast<u32>(it->second));
+            shard.positions.erase(it);
+            if (shard.compacting)
+            {
+                shard.pending_writes.emplace_back(id, std::vector<f32>());
+            }
+        }
+        faiss::IDSelectorBatch selector(1, &id);
+        if (!shard.buffered.insert(id).second)
+        {
+            shard.buffer->remove_ids(selector);
+        }
+        else if (shard.frozen_ids.erase(id) > 0)
+        {
+            shard.frozen->remove_ids(selector);
+        }
+        shard.buffer->add_with_ids(1, vector, &id);
+        if (shard.buffer->ntotal >= m_options.write_buffer)
+        {
+            std::lock_guard<std::mutex> merge_lock(m_merge_mutex);
+            m_merge_requested = true;
+            m_merge_cv.notify_one();
+        }
+        return;
+    }
+
+    addToShard(shard, 1, vector, &id);
 }
 
-void FaissIndex::remove_vectors(const std::vector<i64> &ids)
+void FaissIndex::addToShard(Shard &shard, i64 n, const f32 *vectors, const i64 *labels)
 {
-    faiss::IndexIDMap *id_map = dynamic_cast<faiss::IndexIDMap *>(m_index);
-    if (id_map)
+    // HNSW starts an OpenMP team even for a single vector
+    OmpThreadScope omp_threads(n > 1 ? ParallelWork::BULK : ParallelWork::REQUEST);
+    i32 dim = getDim();
+    i64 position = shard.index->ntotal;
+    shard.index->add_with_ids(n, vectors, labels);
+    for (i64 i = 0; i < n; ++i, ++position)
     {
-        faiss::IDSelectorBatch selector(ids.size(), ids.data());
-        id_map->remove_ids(selector);
+        i64 id = labels[i];
+        auto it = shard.positions.find(id);
+        if (it != shard.positions.end())
+        {
+            roaring_bitmap_add(shard.tombstones, static_cast<u32>(it->second));
+        }
+        if (shard.buffer != nullptr && shard.buffered.erase(id) > 0)
+        {
+            faiss::IDSelectorBatch selector(1, &id);
+            shard.buffer->remove_ids(selector);
+        }
+        else if (shard.frozen_ids.erase(id) > 0)
+        {
+            faiss::IDSelectorBatch selector(1, &id);
+            shard.frozen->remove_ids(selector);
+        }
+        shard.positions[id] = position;
+        if (shard.compacting)
+        {
+            shard.pending_writes.emplace_back(id, std::vector<f32>(vectors + i * dim, vectors + (i + 1) * dim));
+        }
     }
-    else
+}
+
+void FaissIndex::add_vectors(const std::vector<f32> &data, const std::vector<i64> &labels)
+{
+    static Histogram &insert_histogram = stageHistogram("faiss_insert");
+    ScopedTimer timer(insert_histogram);
+    size_t dim = getDim();
+    if (data.size() != labels.size() * dim)
     {
-        throw std::runtime_error("Underlying Faiss index is not an IndexIDMap");
+        throw std::invalid_argument("<FaissIndex> Vector data does not match the number of labels");
+    }
+
+    // vectors regrouped by shard, normalized on the way if needed
+    std::vector<std::vector<f32>> shard_vectors(m_shards.size());
+    std::vector<std::vector<i64>> shard_labels(m_shards.size());
+    for (size_t i = 0; i < labels.size(); ++i)
+    {
+        size_t shard = mixId(static_cast<u64>(labels[i])) % m_shards.size();
+        shard_vectors[shard].insert(shard_vectors[shard].end(), data.begin() + i * dim, data.begin() + (i + 1) * dim);
+        shard_labels[shard].push_back(labels[i]);
     }
+
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        if (shard_labels[i].empty())
+        {
+            continue;
+        }
+        futures.push_back(getShardThreadPool()->submit([this, i, &shard_vectors, &shard_labels]() {
+            std::vector<f32> &vectors = shard_vectors[i];
+            if (m_options.normalize)
+            {
+                faiss::fvec_renorm_L2(getDim(), shard_labels[i].size(), vectors.data());
+            }
+            Shard &shard = *m_shards[i];
+            std::unique_lock lock(shard.mutex);
+            addToShard(shard, static_cast<i64>(shard_labels[i].size()), vectors.data(), shard_labels[i].data());
+        }));
+    }
+    for (auto &future : futures)
+    {
+        future.get();
+    }
+}
+
+void FaissIndex::train(const std::vector<f32> &data)
+{
+    i32 dim = getDim();
+    std::vector<f32> normalized;
+    const f32 *vectors = data.data();
+    if (m_options.normalize)
+    {
+        normalized = data;
+        faiss::fvec_renorm_L2(dim, data.size() / dim, normalized.data());
+        vectors = normalized.data();
+    }
+    OmpThreadScope omp_threads(ParallelWork::BULK);
+    for (auto &shard : m_shards)
+    {
+        std::unique_lock lock(shard->mutex);
+        if (!shard->index->is_trained)
+        {
+            shard->index->train(static_cast<faiss::idx_t>(data.size() / dim), vectors);
+        }
+    }
+}
+
+bool FaissIndex::isTrained() const
+{
+    for (const auto &shard : m_shards)
+    {
+        std::shared_lock lock(shard->mutex);
+        if (!shard->index->is_trained)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+u64 FaissIndex::remove_vectors(const std::vector<i64> &ids)
+{
+    u64 removed = 0;
+    std::vector<std::vector<i64>> shard_ids(m_shards.size());
+    for (i64 id : ids)
+    {
+        shard_ids[mixId(static_cast<u64>(id)) % m_shards.size()].push_back(id);
+    }
+
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        if (shard_ids[i].empty())
+        {
+            continue;
+        }
+        Shard &shard = *m_shards[i];
+        std::unique_lock lock(shard.mutex);
+        for (i64 id : shard_ids[i])
+        {
+            auto it = shard.positions.find(id);
+            if (it != shard.positions.end())
+            {
+                roaring_bitmap_add(shard.tombstones, static_cast<u32>(it->second));
+                shard.positions.erase(it);
+                ++removed;
+                if (shard.compacting)
+                {
+                    shard.pending_writes.emplace_back(id, std::vector<f32>());
+                }
+            }
+            else if (shard.buffered.erase(id) > 0)
+            {
+                faiss::IDSelectorBatch selector(1, &id);
+                shard.buffer->remove_ids(selector);
+                ++removed;
+            }
+            else if (shard.frozen_ids.erase(id) > 0)
+            {
+                faiss::IDSelectorBatch selector(1, &id);
+                shard.frozen->remove_ids(selector);
+                ++removed;
+            }
+        }
+    }
+    return removed;
+}
+
+void FaissIndex::mergeBuffer(Shard &shard, i64 min_size)
+{
+    static Histogram &merge_histogram = stageHistogram("faiss_buffer_merge");
+    i32 dim = getDim();
+    std::vector<f32> vectors;
+    std::vector<i64> labels;
+    {
+        // freeze the buffer and hand inserts a fresh one; the frozen copy is only read from here on
+        std::unique_lock lock(shard.mutex);
+        i64 count = shard.buffer != nullptr ? shard.buffer->ntotal : 0;
+        if (count == 0 || count < min_size)
+        {
+            return;
+        }
+        vectors.resize(static_cast<size_t>(count) * dim);
+        shard.buffer->index->reconstruct_n(0, count, vectors.data());
+        labels.assign(shard.buffer->id_map.data(), shard.buffer->id_map.data() + count);
+        shard.frozen = shard.buffer;
+        shard.frozen_ids = std::move(shard.buffered);
+        shard.buffered.clear();
+        shard.buffer = makeWriteBuffer(shard.index);
+    }
+    ScopedTimer timer(merge_histogram);
+    OmpThreadScope omp_threads(ParallelWork::BULK);
+    i64 count = static_cast<i64>(labels.size());
+
+    // the batch goes into a copy of the graph, searches and writes keep using the shard meanwhile;
+    // arena storage cannot be copied, those shards take the batch under the exclusive lock
+    faiss::IndexIDMap *merged = nullptr;
+    i64 base = 0;
+    if (!m_options.arena)
+    {
+        try
+        {
+            {
+                std::shared_lock lock(shard.mutex);
+                merged = asIDMap(faiss::clone_index(shard.index));
+            }
+            base = merged->ntotal;
+            merged->add_with_ids(count, vectors.data(), labels.data());
+        }
+        catch (...)
+        {
+            delete merged;
+            // the frozen vectors that are still live go back to the buffer for the next attempt
+            std::unique_lock lock(shard.mutex);
+            for (i64 i = 0; i < count; ++i)
+            {
+                if (shard.frozen_ids.count(labels[i]) > 0 && shard.buffered.insert(labels[i]).second)
+                {
+                    shard.buffer->add_with_ids(1, vectors.data() + i * dim, &labels[i]);
+                }
+            }
+            delete shard.frozen;
+            shard.frozen = nullptr;
+            shard.frozen_ids.clear();
+            throw;
+        }
+    }
+
+    faiss::IndexIDMap *old_index = nullptr;
+    {
+        std::unique_lock lock(shard.mutex);
+        if (merged == nullptr)
+        {
+            base = shard.index->ntotal;
+            shard.index->add_with_ids(count, vectors.data(), labels.data());
+        }
+        else
+        {
+            // bulk adds that reached the shard after the copy was taken follow the batch in the
+            // copy, their positions and tombstones move up by the batch size
+            i64 tail = shard.index->ntotal - base;
+            if (tail > 0)
+            {
+                std::vector<f32> tail_vectors(static_cast<size_t>(tail) * dim);
+                shard.index->index->reconstruct_n(base, tail, tail_vectors.data());
+                merged->add_with_ids(tail, tail_vectors.data(), shard.index->id_map.data() + base);
+                for (auto &[label, position] : shard.positions)
+                {
+                    if (position >= base)
+                    {
+                        position += count;
+                    }
+                }
+                for (i64 position = base + tail - 1; position >= base; --position)
+                {
+                    if (roaring_bitmap_contains(shard.tombstones, static_cast<u32>(position)))
+                    {
+                        roaring_bitmap_remove(shard.tombstones, static_cast<u32>(position));
+                        roaring_bitmap_add(shard.tombstones, static_cast<u32>(position + count));
+                    }
+                }
+            }
+            old_index = shard.index;
+            shard.index = merged;
+        }
+        // frozen vectors removed or overwritten during the merge are tombstoned right away
+        for (i64 i = 0; i < count; ++i)
+        {
+            if (shard.frozen_ids.count(labels[i]) > 0)
+            {
+                shard.positions[labels[i]] = base + i;
+            }
+            else
+            {
+                roaring_bitmap_add(shard.tombstones, static_cast<u32>(base + i));
+            }
+        }
+        delete shard.frozen;
+        shard.frozen = nullptr;
+        shard.frozen_ids.clear();
+    }
+    delete old_index;
+    GlobalLogger->debug("<FaissIndex> Merged {} buffered vectors", count);
+}
+
+void FaissIndex::mergeLoop()
+{
+    std::unique_lock lock(m_merge_mutex);
+    while (true)
+    {
+        m_merge_cv.wait(lock, [this]() { return m_stop_merger || m_merge_requested; });
+        if (m_stop_merger)
+        {
+            return;
+        }
+        m_merge_requested = false;
+        lock.unlock();
+        try
+        {
+            std::lock_guard<std::mutex> compaction_lock(m_compaction_mutex);
+            for (auto &shard : m_shards)
+            {
+                mergeBuffer(*shard, m_options.write_buffer);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            GlobalLogger->error("<FaissIndex> Failed to merge write buffer: {}", e.what());
+        }
+        lock.lock();
+    }
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> FaissIndex::searchShard(const Shard &shard, i32 query_num,
+                                                                      const f32 *query, i32 k,
+                                                                      const roaring_bitmap_t *bitmap,
+                                                                      const SearchOptions &search_options) const
+{
+    OmpThreadScope omp_threads(ParallelWork::REQUEST);
+    std::shared_lock lock(shard.mutex);
+    auto results = searchIndex(shard.index, shard.tombstones, query_num, query, k, bitmap, search_options);
+    bool larger_is_better = shard.index->metric_type == faiss::METRIC_INNER_PRODUCT;
+    for (const faiss::IndexIDMap *buffer : {shard.buffer, shard.frozen})
+    {
+        if (buffer == nullptr || buffer->ntotal == 0)
+        {
+            continue;
+        }
+        // the buffer's id map hands labels to the selector
+        std::vector<i64> labels(static_cast<size_t>(query_num) * k);
+        std::vector<f32> distances(static_cast<size_t>(query_num) * k);
+        RoaringBitmapIDSelector selector(bitmap);
+        faiss::SearchParameters search_params;
+        search_params.sel = &selector;
+        buffer->search(query_num, query, k, distances.data(), labels.data(),
+                       bitmap != nullptr ? &search_params : nullptr);
+        results = mergeShardResults({results, {labels, distances}}, query_num, k, larger_is_better);
+    }
+    return results;
+}
+
+faiss::SearchParameters *FaissIndex::prepareSearchParams(faiss::IndexIDMap *index,
+                                                        const SearchOptions &search_options,
+                                                        faiss::SearchParametersHNSW &hnsw_params,
+                                                        faiss::SearchParametersIVF &ivf_params) const
+{
+    // HNSW takes efSearch and IVF nprobe from here instead of from the index, IVF rejects
+    // parameters of another type
+    if (faiss::IndexHNSW *hnsw_index = getHNSWIndex(index))
+    {
+        hnsw_params.efSearch = m_options.hnsw_ef_search > 0 ? m_options.hnsw_ef_search : hnsw_index->hnsw.efSearch;
+    }
+    else if (faiss::IndexIVF *ivf_index = getIVFIndex(index))
+    {
+        ivf_params.nprobe = search_options.nprobe > 0 ? search_options.nprobe
+                            : m_options.ivf_nprobe > 0 ? m_options.ivf_nprobe
+                                                       : ivf_index->nprobe;
+        return &ivf_params;
+    }
+    return &hnsw_params;
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> FaissIndex::searchIndex(faiss::IndexIDMap *index,
+                                                                      const roaring_bitmap_t *tombstones,
+                                                                      i32 query_num, const f32 *query, i32 k,
+                                                                      const roaring_bitmap_t *bitmap,
+                                                                      const SearchOptions &search_options) const
+{
+    std::vector<i64> labels(static_cast<size_t>(query_num) * k);
+    std::vector<f32> distances(static_cast<size_t>(query_num) * k);
+    faiss::SearchParametersHNSW hnsw_params;
+    faiss::SearchParametersIVF ivf_params;
+    faiss::SearchParameters *search_params = prepareSearchParams(index, search_options, hnsw_params, ivf_params);
+    // the wrapped index is searched directly so that the selector sees positions, which tell an
+    // overwritten vector apart from the live one carrying the same label
+    const faiss::idx_t *position_labels = index->id_map.data();
+    bool has_tombstones = tombstones != nullptr && !roaring_bitmap_is_empty(tombstones);
+    ShardIDSelector selector(has_tombstones ? tombstones : nullptr, bitmap, position_labels);
+    if (has_tombstones || bitmap != nullptr)
+    {
+        search_params->sel = &selector;
+    }
+
+    index->index->search(query_num, query, k, distances.data(), labels.data(), search_params);
+    for (i64 &label : labels)
+    {
+        if (label >= 0)
+        {
+            label = position_labels[label];
+        }
+    }
+    return {labels, distances};
 }
 
 std::pair<std::vector<i64>, std::vector<f32>> FaissIndex::search_vectors(const std::vector<f32> &query, i32 k,
-                                                                         const roaring_bitmap_t *bitmap)
+                                                                         const roaring_bitmap_t *bitmap,
+                                                                         SearchStats *stats,
+                                                                         const SearchOptions &search_options)
 {
-    i32 dim = m_index->d;
+    // a filter bitmap belongs to its request, and HNSW stats cannot be told apart within a batch
+    if (m_batcher && bitmap == nullptr && stats == nullptr)
+    {
+        return m_batcher->search(query, k, search_options);
+    }
+    return searchUnbatched(query, k, bitmap, stats, search_options);
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> FaissIndex::searchUnbatched(const std::vector<f32> &query, i32 k,
+                                                                          const roaring_bitmap_t *bitmap,
+                                                                          SearchStats *stats,
+                                                                          const SearchOptions &search_options)
+{
+    static Histogram &search_histogram = stageHistogram("faiss_search");
+    ScopedTimer timer(search_histogram);
+    i32 dim = getDim();
     i32 query_num = query.size() / dim;
-    std::vector<i64> labels(query_num * k);
-    std::vector<f32> distances(query_num * k);
 
-    faiss::SearchParameters search_params;
-    RoaringBitmapIDSelector selector(bitmap);
-    if (bitmap != nullptr)
+    const f32 *query_data = query.data();
+    std::vector<f32> normalized;
+    if (m_options.normalize)
     {
-        search_params.sel = &selector;
+        normalized = query;
+        faiss::fvec_renorm_L2(dim, query_num, normalized.data());
+        query_data = normalized.data();
     }
 
-    m_index->search(query_num, query.data(), k, distances.data(), labels.data(), &search_params);
+    bool collect_hnsw_stats = stats != nullptr && getHNSWIndex(m_shards[0]->index) != nullptr;
+    faiss::HNSWStats hnsw_before;
+    if (collect_hnsw_stats)
+    {
+        hnsw_before = faiss::hnsw_stats;
+    }
+
+    std::pair<std::vector<i64>, std::vector<f32>> results;
+    if (m_shards.size() == 1)
+    {
+        results = searchShard(*m_shards[0], query_num, query_data, k, bitmap, search_options);
+    }
+    else
+    {
+        std::vector<std::future<std::pair<std::vector<i64>, std::vector<f32>>>> futures;
+        for (const auto &shard : m_shards)
+        {
+            const Shard *shard_ptr = shard.get();
+            futures.push_back(getShardThreadPool()->submit(
+                [this, shard_ptr, query_num, query_data, k, bitmap, &search_options]() {
+                    return searchShard(*shard_ptr, query_num, query_data, k, bitmap, search_options);
+                }));
+        }
+        std::vector<std::pair<std::vector<i64>, std::vector<f32>>> shard_results;
+        for (auto &future : futures)
+        {
+            shard_results.push_back(future.get());
+        }
+        bool larger_is_better = m_shards[0]->index->metric_type == faiss::METRIC_INNER_PRODUCT;
+        results = mergeShardResults(shard_results, query_num, k, larger_is_better);
+    }
+
+    if (collect_hnsw_stats)
+    {
+        stats->hnsw_ndis = faiss::hnsw_stats.ndis - hnsw_before.ndis;
+        stats->hnsw_nhops = faiss::hnsw_stats.nhops - hnsw_before.nhops;
+    }
 
     GlobalLogger->debug("<FaissIndex> Retrieved values:");
 
+    const auto &[labels, distances] = results;
     for (size_t i = 0; i < labels.size(); ++i)
     {
         if (labels[i] != -1)
@@ -80,30 +910,616 @@ std::pair<std::vector<i64>, std::vector<f32>> FaissIndex::search_vectors(const s
         }
     }
 
-    return {labels, distances};
+    return results;
+}
+
+std::vector<std::vector<std::pair<f32, i64>>> FaissIndex::rangeSearchShard(const Shard &shard, i32 query_num,
+                                                                           const f32 *query, f32 radius,
+                                                                           const roaring_bitmap_t *bitmap,
+                                                                           const SearchOptions &search_options) const
+{
+    OmpThreadScope omp_threads(ParallelWork::REQUEST);
+    std::vector<std::vector<std::pair<f32, i64>>> hits(query_num);
+    std::shared_lock lock(shard.mutex);
+
+    faiss::SearchParametersHNSW hnsw_params;
+    faiss::SearchParametersIVF ivf_params;
+    faiss::SearchParameters *search_params =
+        prepareSearchParams(shard.index, search_options, hnsw_params, ivf_params);
+    // positions again, see searchIndex
+    const faiss::idx_t *position_labels = shard.index->id_map.data();
+    bool has_tombstones = !roaring_bitmap_is_empty(shard.tombstones);
+    ShardIDSelector selector(has_tombstones ? shard.tombstones : nullptr, bitmap, position_labels);
+    if (has_tombstones || bitmap != nullptr)
+    {
+        search_params->sel = &selector;
+    }
+
+    faiss::RangeSearchResult result(query_num);
+    shard.index->index->range_search(query_num, query, radius, &result, search_params);
+    for (i32 q = 0; q < query_num; ++q)
+    {
+        for (size_t j = result.lims[q]; j < result.lims[q + 1]; ++j)
+        {
+            hits[q].emplace_back(result.distances[j], position_labels[result.labels[j]]);
+        }
+    }
+
+    for (const faiss::IndexIDMap *buffer : {shard.buffer, shard.frozen})
+    {
+        if (buffer == nullptr || buffer->ntotal == 0)
+        {
+            continue;
+        }
+        RoaringBitmapIDSelector buffer_selector(bitmap);
+        faiss::SearchParameters buffer_params;
+        buffer_params.sel = &buffer_selector;
+        faiss::RangeSearchResult buffer_result(query_num);
+        buffer->range_search(query_num, query, radius, &buffer_result, bitmap != nullptr ? &buffer_params : nullptr);
+        for (i32 q = 0; q < query_num; ++q)
+        {
+            for (size_t j = buffer_result.lims[q]; j < buffer_result.lims[q + 1]; ++j)
+            {
+                hits[q].emplace_back(buffer_result.distances[j], buffer_result.labels[j]);
+            }
+        }
+    }
+    return hits;
+}
+
+RangeSearchResults FaissIndex::range_search_vectors(const std::vector<f32> &query, f32 radius,
+                                                    const roaring_bitmap_t *bitmap,
+                                                    const SearchOptions &search_options)
+{
+    static Histogram &range_search_histogram = stageHistogram("faiss_range_search");
+    ScopedTimer timer(range_search_histogram);
+    i32 dim = getDim();
+    i32 query_num = query.size() / dim;
+
+    const f32 *query_data = query.data();
+    std::vector<f32> normalized;
+    if (m_options.normalize)
+    {
+        normalized = query;
+        faiss::fvec_renorm_L2(dim, query_num, normalized.data());
+        query_data = normalized.data();
+    }
+
+    std::vector<std::vector<std::vector<std::pair<f32, i64>>>> shard_hits;
+    if (m_shards.size() == 1)
+    {
+        shard_hits.push_back(rangeSearchShard(*m_shards[0], query_num, query_data, radius, bitmap, search_options));
+    }
+    else
+    {
+        std::vector<std::future<std::vector<std::vector<std::pair<f32, i64>>>>> futures;
+        for (const auto &shard : m_shards)
+        {
+            const Shard *shard_ptr = shard.get();
+            futures.push_back(getShardThreadPool()->submit(
+                [this, shard_ptr, query_num, query_data, radius, bitmap, &search_options]() {
+                    return rangeSearchShard(*shard_ptr, query_num, query_data, radius, bitmap, search_options);
+                }));
+        }
+        for (auto &future : futures)
+        {
+            shard_hits.push_back(future.get());
+        }
+    }
+
+    bool larger_is_better = m_shards[0]->index->metric_type == faiss::METRIC_INNER_PRODUCT;
+    RangeSearchResults results;
+    results.lims.push_back(0);
+    std::vector<std::pair<f32, i64>> hits;
+    for (i32 q = 0; q < query_num; ++q)
+    {
+        hits.clear();
+        for (auto &shard_result : shard_hits)
+        {
+            hits.insert(hits.end(), shard_result[q].begin(), shard_result[q].end());
+        }
+        std::sort(hits.begin(), hits.end(), [larger_is_better](const auto &a, const auto &b) {
+            if (a.first != b.first)
+            {
+                return larger_is_better ? a.first > b.first : a.first < b.first;
+            }
+            return a.second < b.second;
+        });
+        for (const auto &[distance, label] : hits)
+        {
+            results.labels.push_back(label);
+            results.distances.push_back(distance);
+        }
+        results.lims.push_back(results.labels.size());
+    }
+    return results;
+}
+
+u64 FaissIndex::getVectorCount() const
+{
+    u64 count = 0;
+    for (const auto &shard : m_shards)
+    {
+        std::shared_lock lock(shard->mutex);
+        count += shard->positions.size() + shard->buffered.size() + shard->frozen_ids.size();
+    }
+    return count;
+}
+
+u64 FaissIndex::getDeletedCount() const
+{
+    u64 count = 0;
+    for (const auto &shard : m_shards)
+    {
+        std::shared_lock lock(shard->mutex);
+        count += roaring_bitmap_get_cardinality(shard->tombstones);
+    }
+    return count;
+}
+
+i32 FaissIndex::getDim() const
+{
+    return m_shards[0]->index->d;
+}
+
+bool FaissIndex::reconstruct_vector(u64 label, std::vector<f32> &vector) const
+{
+    i64 id = static_cast<i64>(label);
+    const Shard &shard = *m_shards[mixId(label) % m_shards.size()];
+    std::shared_lock lock(shard.mutex);
+    vector.resize(getDim());
+    auto it = shard.positions.find(id);
+    if (it != shard.positions.end())
+    {
+        shard.index->index->reconstruct(it->second, vector.data());
+        return true;
+    }
+    const faiss::IndexIDMap *buffer = shard.buffered.count(id) > 0    ? shard.buffer
+                                      : shard.frozen_ids.count(id) > 0 ? shard.frozen
+                                                                       : nullptr;
+    if (buffer != nullptr)
+    {
+        const auto &ids = buffer->id_map;
+        auto position = std::find(ids.begin(), ids.end(), id);
+        if (position != ids.end())
+        {
+            buffer->index->reconstruct(position - ids.begin(), vector.data());
+            return true;
+        }
+    }
+    return false;
+}
+
+void FaissIndex::collectLabels(roaring_bitmap_t *labels) const
+{
+    for (const auto &shard : m_shards)
+    {
+        std::shared_lock lock(shard->mutex);
+        for (const auto &[label, position] : shard->positions)
+        {
+            roaring_bitmap_add(labels, static_cast<u32>(label));
+        }
+        for (i64 label : shard->buffered)
+        {
+            roaring_bitmap_add(labels, static_cast<u32>(label));
+        }
+        for (i64 label : shard->frozen_ids)
+        {
+            roaring_bitmap_add(labels, static_cast<u32>(label));
+        }
+    }
+}
+
+u64 FaissIndex::getMemoryUsage() const
+{
+    return getMemoryBreakdown().total();
+}
+
+IndexMemoryUsage FaissIndex::getMemoryBreakdown() const
+{
+    IndexMemoryUsage usage;
+    for (const auto &shard : m_shards)
+    {
+        std::shared_lock lock(shard->mutex);
+        usage.ids += shard->index->id_map.size() * sizeof(faiss::idx_t);
+        // hash node per label plus the bucket array
+        usage.ids += shard->positions.size() * (sizeof(std::pair<const i64, i64>) + sizeof(void *)) +
+                     shard->positions.bucket_count() * sizeof(void *);
+        usage.ids += roaring_bitmap_size_in_bytes(shard->tombstones);
+        faiss::Index *index = shard->index->index;
+        if (auto *hnsw_index = dynamic_cast<faiss::IndexHNSW *>(index))
+        {
+            const faiss::HNSW &hnsw = hnsw_index->hnsw;
+            usage.graph += hnsw.neighbors.size() * sizeof(faiss::HNSW::storage_idx_t);
+            usage.graph += hnsw.offsets.size() * sizeof(size_t);
+            usage.graph += hnsw.levels.size() * sizeof(i32);
+            index = hnsw_index->storage;
+        }
+        else if (auto *ivf_index = dynamic_cast<faiss::IndexIVF *>(index))
+        {
+            // on-disk lists are left to the page cache
+            if (auto *lists = dynamic_cast<faiss::ArrayInvertedLists *>(ivf_index->invlists))
+            {
+                for (size_t list = 0; list < lists->nlist; ++list)
+                {
+                    usage.lists += lists->codes[list].size() + lists->ids[list].size() * sizeof(faiss::idx_t);
+                }
+            }
+            index = ivf_index->quantizer;
+        }
+        usage.vectors += flatCodesBytes(index);
+        if (shard->buffer != nullptr)
+        {
+            usage.write_buffer +=
+                flatCodesBytes(shard->buffer->index) + shard->buffer->id_map.size() * sizeof(faiss::idx_t);
+            usage.write_buffer += shard->buffered.size() * (sizeof(i64) + sizeof(void *)) +
+                                  shard->buffered.bucket_count() * sizeof(void *);
+        }
+        if (shard->frozen != nullptr)
+        {
+            usage.write_buffer +=
+                flatCodesBytes(shard->frozen->index) + shard->frozen->id_map.size() * sizeof(faiss::idx_t);
+            usage.write_buffer += shard->frozen_ids.size() * (sizeof(i64) + sizeof(void *)) +
+                                  shard->frozen_ids.bucket_count() * sizeof(void *);
+        }
+    }
+    return usage;
+}
+
+size_t FaissIndex::getShardCount() const
+{
+    return m_shards.size();
+}
+
+CompactionReport FaissIndex::compact(f64 threshold)
+{
+    if (!m_options.make_shard)
+    {
+        throw std::logic_error("<FaissIndex> Index cannot be compacted: no shard factory");
+    }
+    std::lock_guard<std::mutex> compaction_lock(m_compaction_mutex);
+    auto start = std::chrono::steady_clock::now();
+
+    CompactionReport report;
+    report.memory_before_bytes = getMemoryUsage();
+    {
+        std::lock_guard<std::mutex> status_lock(m_compaction_status_mutex);
+        m_compaction_status.running = true;
+        m_compaction_status.shards_done = 0;
+        m_compaction_status.shards_total = m_shards.size();
+    }
+
+    try
+    {
+        for (size_t i = 0; i < m_shards.size(); ++i)
+        {
+            if (compactShard(*m_shards[i], i, threshold, report))
+            {
+                ++report.shards_compacted;
+            }
+            std::lock_guard<std::mutex> status_lock(m_compaction_status_mutex);
+            ++m_compaction_status.shards_done;
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard<std::mutex> status_lock(m_compaction_status_mutex);
+        m_compaction_status.running = false;
+        throw;
+    }
+
+    if (report.shards_compacted > 0)
+    {
+        report.recall_before /= report.shards_compacted;
+        report.recall_after /= report.shards_compacted;
+    }
+    report.memory_after_bytes = getMemoryUsage();
+    report.duration_ms = elapsedNsSince(start) / 1000000;
+
+    std::lock_guard<std::mutex> status_lock(m_compaction_status_mutex);
+    m_compaction_status.running = false;
+    if (report.shards_compacted > 0)
+    {
+        ++m_compaction_status.compactions;
+        m_compaction_status.last = report;
+    }
+    return report;
+}
+
+bool FaissIndex::compactShard(Shard &shard, size_t shard_index, f64 threshold, CompactionReport &report)
+{
+    OmpThreadScope omp_threads(ParallelWork::BULK);
+    i32 dim = getDim();
+    std::vector<i64> labels;
+    std::vector<f32> vectors;
+    {
+        // writers hold the lock exclusively, so none is midway while the live vectors are copied
+        // and the shard starts recording writes; searches go on
+        std::shared_lock lock(shard.mutex);
+        i64 total = shard.index->ntotal;
+        u64 tombstones = roaring_bitmap_get_cardinality(shard.tombstones);
+        if (getIVFIndex(shard.index) != nullptr || tombstones == 0 ||
+            static_cast<f64>(tombstones) < threshold * static_cast<f64>(total))
+        {
+            return false;
+        }
+
+        labels.reserve(shard.positions.size());
+        vectors.resize(shard.positions.size() * dim);
+        for (i64 position = 0; position < total; ++position)
+        {
+            if (!roaring_bitmap_contains(shard.tombstones, static_cast<u32>(position)))
+            {
+                shard.index->index->reconstruct(position, vectors.data() + labels.size() * dim);
+                labels.push_back(shard.index->id_map[position]);
+            }
+        }
+        shard.compacting = true;
+        shard.pending_writes.clear();
+        report.tombstones_removed += tombstones;
+    }
+
+    // queries spread evenly over the live vectors
+    std::vector<f32> queries;
+    size_t step = std::max<size_t>(labels.size() / kRecallQueries, 1);
+    for (size_t i = 0; i < labels.size() && queries.size() < kRecallQueries * dim; i += step)
+    {
+        queries.insert(queries.end(), vectors.begin() + i * dim, vectors.begin() + (i + 1) * dim);
+    }
+    i32 query_num = static_cast<i32>(queries.size() / dim);
+    bool inner_product = shard.index->metric_type == faiss::METRIC_INNER_PRODUCT;
+    std::vector<i64> expected = bruteForceTopK(vectors, labels, queries.data(), query_num, dim, kRecallK,
+                                               inner_product);
+    {
+        // the write buffer is left out, like from the ground truth
+        std::shared_lock lock(shard.mutex);
+        report.recall_before += recallAtK(
+            expected, searchIndex(shard.index, shard.tombstones, query_num, queries.data(), kRecallK, nullptr).first,
+            query_num, kRecallK);
+    }
+
+    faiss::IndexIDMap *rebuilt = nullptr;
+    std::unordered_map<i64, i64> positions;
+    try
+    {
+        rebuilt = asIDMap(m_options.make_shard(shard_index));
+        if (!rebuilt->is_trained)
+        {
+            // PQ and SQ codebooks come from the shard being replaced
+            delete rebuilt;
+            rebuilt = nullptr;
+            std::shared_lock lock(shard.mutex);
+            rebuilt = asIDMap(faiss::clone_index(shard.index));
+            rebuilt->reset();
+        }
+        rebuilt->add_with_ids(static_cast<faiss::idx_t>(labels.size()), vectors.data(), labels.data());
+        positions.reserve(labels.size());
+        for (size_t i = 0; i < labels.size(); ++i)
+        {
+            positions[labels[i]] = static_cast<i64>(i);
+        }
+        report.recall_after += recallAtK(
+            expected, searchIndex(rebuilt, nullptr, query_num, queries.data(), kRecallK, nullptr).first, query_num,
+            kRecallK);
+    }
+    catch (...)
+    {
+        delete rebuilt;
+        std::unique_lock lock(shard.mutex);
+        shard.compacting = false;
+        shard.pending_writes.clear();
+        throw;
+    }
+    report.vectors += labels.size();
+
+    faiss::IndexIDMap *old_index = nullptr;
+    roaring_bitmap_t *old_tombstones = nullptr;
+    {
+        std::unique_lock lock(shard.mutex);
+        roaring_bitmap_t *tombstones = roaring_bitmap_create();
+        for (auto &[label, vector] : shard.pending_writes)
+        {
+            auto it = positions.find(label);
+            if (it != positions.end())
+            {
+                roaring_bitmap_add(tombstones, static_cast<u32>(it->second));
+                positions.erase(it);
+            }
+            if (!vector.empty())
+            {
+                positions[label] = rebuilt->ntotal;
+                rebuilt->add_with_ids(1, vector.data(), &label);
+            }
+        }
+        report.replayed_writes += shard.pending_writes.size();
+
+        old_index = shard.index;
+        old_tombstones = shard.tombstones;
+        shard.index = rebuilt;
+        shard.tombstones = tombstones;
+        shard.positions = std::move(positions);
+        shard.compacting = false;
+        std::vector<std::pair<i64, std::vector<f32>>>().swap(shard.pending_writes);
+    }
+    delete old_index;
+    roaring_bitmap_free(old_tombstones);
+    return true;
+}
+
+CompactionStatus FaissIndex::getCompactionStatus() const
+{
+    std::lock_guard<std::mutex> status_lock(m_compaction_status_mutex);
+    return m_compaction_status;
+}
+
+std::string FaissIndex::shardFilePath(const std::string &file_path, size_t shard) const
+{
+    // a single shard keeps the pre-sharding file name so existing snapshots still load
+    return m_shards.size() == 1 ? file_path : std::format("{}.shard{}", file_path, shard);
 }
 
 void FaissIndex::saveIndex(const std::string &file_path)
 {
-    faiss::write_index(m_index, file_path.c_str());
+    {
+        std::lock_guard<std::mutex> compaction_lock(m_compaction_mutex);
+        for (auto &shard : m_shards)
+        {
+            mergeBuffer(*shard, 1);
+        }
+    }
+
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < m_shards.size(); ++i)
+    {
+        futures.push_back(getShardThreadPool()->submit([this, i, path = shardFilePath(file_path, i)]() {
+            Shard &shard = *m_shards[i];
+            // exclusive: an arena storage is swapped out while the index is written
+            std::unique_lock lock(shard.mutex);
+            faiss::Index **holder = flatStorageHolder(shard.index);
+            auto *storage = m_options.arena ? dynamic_cast<ArenaFlatStorage *>(*holder) : nullptr;
+            if (storage != nullptr)
+            {
+                // faiss cannot serialize arena codes: the index is written around an empty flat
+                // storage, the slots go to their own file and the vectors to the arena's
+                faiss::IndexFlat placeholder(storage->d, storage->metric_type);
+                *holder = &placeholder;
+                try
+                {
+                    faiss::write_index(shard.index, path.c_str());
+                }
+                catch (...)
+                {
+                    *holder = storage;
+                    throw;
+                }
+                *holder = storage;
+                writeSlots(slotsFilePath(path), storage->getSlots());
+            }
+            else
+            {
+                faiss::write_index(shard.index, path.c_str());
+                std::error_code ec;
+                std::filesystem::remove(slotsFilePath(path), ec);
+            }
+            if (!roaring_bitmap_is_empty(shard.tombstones))
+            {
+                writeBitmap(tombstoneFilePath(path), shard.tombstones);
+            }
+            else
+            {
+                // left over from an earlier snapshot
+                std::error_code ec;
+                std::filesystem::remove(tombstoneFilePath(path), ec);
+            }
+        }));
+    }
+    for (auto &future : futures)
+    {
+        future.get();
+    }
+    std::ofstream count_file(shardCountFilePath(file_path), std::ios::trunc);
+    count_file << m_shards.size();
+    if (!count_file)
+    {
+        throw std::runtime_error("<FaissIndex> Failed to write " + shardCountFilePath(file_path));
+    }
 }
 
 void FaissIndex::loadIndex(const std::string &file_path)
 {
-    std::ifstream file(file_path);
-    if (file.good()) // check if a file exists
+    // ids are routed by hash modulo the shard count, so shards saved under another count hold ids
+    // the current routing looks for elsewhere; loading them would hide vectors from deletes and
+    // duplicate them on upserts, skipping them would lose them
+    size_t saved_shards = readShardCount(file_path);
+    if (saved_shards != 0 && saved_shards != m_shards.size())
+    {
+        throw std::runtime_error(std::format("<FaissIndex> Snapshot {} holds {} shards but the index is configured "
+                                             "with {}; restart with the saved shard count",
+                                             file_path, saved_shards, m_shards.size()));
+    }
+    // a merge in flight would swap its copy of the old shard over the loaded one
+    std::lock_guard<std::mutex> compaction_lock(m_compaction_mutex);
+    for (size_t i = 0; i < m_shards.size(); ++i)
     {
-        file.close();
-        if (m_index != nullptr)
+        std::string shard_path = shardFilePath(file_path, i);
+        std::ifstream file(shard_path);
+        if (file.good()) // check if a file exists
+        {
+            file.close();
+            faiss::IndexIDMap *index = asIDMap(faiss::read_index(shard_path.c_str()));
+            std::optional<std::vector<u32>> slots = readSlots(slotsFilePath(shard_path));
+            if (slots.has_value())
+            {
+                if (!m_options.arena || slots->size() != static_cast<size_t>(index->ntotal))
+                {
+                    delete index;
+                    throw std::runtime_error("<FaissIndex> Arena slots of " + shard_path +
+                                             " do not match the index or the collection has no vector arena");
+                }
+                auto *storage = new ArenaFlatStorage(m_options.arena, index->metric_type);
+                try
+                {
+                    storage->assignSlots(*slots);
+                }
+                catch (...)
+                {
+                    delete storage;
+                    delete index;
+                    throw;
+                }
+                faiss::Index **holder = flatStorageHolder(index);
+                delete *holder;
+                *holder = storage;
+            }
+            roaring_bitmap_t *tombstones = readBitmap(tombstoneFilePath(shard_path));
+            if (tombstones == nullptr)
+            {
+                tombstones = roaring_bitmap_create();
+            }
+
+            Shard &shard = *m_shards[i];
+            std::unique_lock lock(shard.mutex);
+            delete shard.index;
+            roaring_bitmap_free(shard.tombstones);
+            shard.index = index;
+            shard.tombstones = tombstones;
+            shard.positions.clear();
+            if (shard.buffer != nullptr)
+            {
+                shard.buffer->reset();
+                shard.buffered.clear();
+            }
+            for (i64 position = 0; position < index->ntotal; ++position)
+            {
+                if (!roaring_bitmap_contains(tombstones, static_cast<u32>(position)))
+                {
+                    shard.positions[index->id_map[position]] = position;
+                }
+            }
+        }
+        else
         {
-            delete m_index;
+            GlobalLogger->warn("<FaissIndex> File not found: {}, Skipping loading index.", shard_path);
         }
-        m_index = faiss::read_index(file_path.c_str());
     }
-    else
+}
+
+std::vector<std::string> FaissIndex::getSnapshotFiles(const std::string &file_path) const
+{
+    std::vector<std::string> files{shardCountFilePath(file_path)};
+    for (size_t i = 0; i < m_shards.size(); ++i)
     {
-        GlobalLogger->warn("<FaissIndex> File not found: {}, Skipping loading index.", file_path);
+        files.push_back(shardFilePath(file_path, i));
+        files.push_back(tombstoneFilePath(shardFilePath(file_path, i)));
+        files.push_back(slotsFilePath(shardFilePath(file_path, i)));
+        std::shared_lock lock(m_shards[i]->mutex);
+        std::string lists_path = onDiskListsPath(m_shards[i]->index);
+        if (!lists_path.empty())
+        {
+            files.push_back(lists_path);
+        }
     }
+    return files;
 }
 
 } // namespace vdb
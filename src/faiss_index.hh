@@ -1,15 +1,30 @@
 #pragma once
 
 #include "faiss/impl/IDSelector.h"
+#include "search_batcher.hh"
 #include "types.hh"
+#include "vector_arena.hh"
 #include <faiss/Index.h>
+#include <condition_variable>
+#include <faiss/IndexHNSW.h>
+#include <faiss/IndexIDMap.h>
+#include <faiss/IndexIVF.h>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <roaring/roaring.h>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 namespace vdb
 {
 
+/// Selects the labels in a bitmap, which holds the 32-bit ordinals VectorDB maps its ids to (see IdMap).
 struct RoaringBitmapIDSelector : faiss::IDSelector
 {
     RoaringBitmapIDSelector(const roaring_bitmap_t *bitmap) : m_bitmap(bitmap)
@@ -24,26 +39,262 @@ struct RoaringBitmapIDSelector : faiss::IDSelector
     const roaring_bitmap_t *m_bitmap;
 };
 
+/// a bitmap in the portable roaring format, as kept in tombstone files
+void writeBitmap(const std::string &file_path, const roaring_bitmap_t *bitmap);
+/// nullptr when the file does not exist, throws std::runtime_error when it is corrupted
+roaring_bitmap_t *readBitmap(const std::string &file_path);
+
+/// Per-search statistics, filled in when a caller asks for them.
+struct SearchStats
+{
+    // faiss keeps HNSW counters in a process-wide hnsw_stats; these are the deltas observed
+    // around this search, so HNSW searches running concurrently on other threads inflate them.
+    u64 hnsw_ndis = 0;
+    u64 hnsw_nhops = 0;
+};
+
+/// Per-search knobs a request may override.
+struct SearchOptions
+{
+    // IVF lists probed, 0 keeps FaissIndexOptions::ivf_nprobe
+    i32 nprobe = 0;
+};
+
+/// Hits of a range search in the layout of faiss::RangeSearchResult: those of query i are
+/// [lims[i], lims[i + 1]), closest first.
+struct RangeSearchResults
+{
+    std::vector<size_t> lims;
+    std::vector<i64> labels;
+    std::vector<f32> distances;
+};
+
+/// Behaviour fixed when the index is created.
+struct FaissIndexOptions
+{
+    // cosine similarity: vectors are L2-normalized on insert and on search, and the underlying
+    // index uses inner product
+    bool normalize = false;
+    // HNSW efSearch passed with every search; 0 keeps the value stored in the index
+    i32 hnsw_ef_search = 0;
+    // IVF nprobe used when a search does not ask for one; 0 keeps the value stored in the index
+    i32 ivf_nprobe = 0;
+    // creates an empty IndexIDMap shard configured like shard `i`; compaction rebuilds into it
+    std::function<faiss::Index *(size_t i)> make_shard;
+    // tiered mode when > 0: new vectors go to a brute-force buffer per shard, which is bulk-added
+    // to the shard once it holds this many vectors
+    i32 write_buffer = 0;
+    // micro-batching when > 0: unfiltered searches arriving within this window are run together,
+    // up to search_batch_max query vectors per batch
+    i32 search_batch_window_us = 0;
+    i32 search_batch_max = 64;
+    // shards store their vectors in this arena (ArenaFlatStorage); snapshots then keep a shard's
+    // slots in `<shard file>.slots` and leave the vectors to the arena's own file
+    std::shared_ptr<VectorArena> arena;
+};
+
+/// Outcome of one FaissIndex::compact call.
+struct CompactionReport
+{
+    u64 shards_compacted = 0;
+    // live vectors re-added to the compacted shards
+    u64 vectors = 0;
+    u64 tombstones_removed = 0;
+    // inserts and removals that arrived while a shard was being rebuilt
+    u64 replayed_writes = 0;
+    u64 memory_before_bytes = 0;
+    u64 memory_after_bytes = 0;
+    // recall@10 against brute force over the shard's live vectors, averaged over compacted shards
+    f64 recall_before = 0.0;
+    f64 recall_after = 0.0;
+    u64 duration_ms = 0;
+};
+
+/// Estimated bytes held by a FaissIndex, by what holds them.
+struct IndexMemoryUsage
+{
+    // full vectors of flat and HNSW storage, codes of PQ and SQ, IVF centroids
+    u64 vectors = 0;
+    // HNSW neighbor lists, offsets and levels
+    u64 graph = 0;
+    // codes and ids of in-memory IVF inverted lists
+    u64 lists = 0;
+    // id maps, label positions and tombstones
+    u64 ids = 0;
+    // tiered mode write buffers, vectors and labels
+    u64 write_buffer = 0;
+
+    u64 total() const
+    {
+        return vectors + graph + lists + ids + write_buffer;
+    }
+};
+
+struct CompactionStatus
+{
+    bool running = false;
+    size_t shards_done = 0;
+    size_t shards_total = 0;
+    u64 compactions = 0;
+    CompactionReport last;
+};
+
+/// A vector index backed by one or more faiss indexes ("shards"), each an IndexIDMap with its
+/// own lock. Ids are hashed to shards, so inserts into different shards run concurrently; a
+/// search fans out over the shards on the shard thread pool and merges the per-shard top-k.
+/// Labels are the u32 ordinals of an IdMap, so filter bitmaps hold them as they are.
+///
+/// Vectors are never removed from a faiss index on the request path: deleting or overwriting an
+/// id marks its position in the shard's tombstone bitmap, and searches skip tombstoned positions.
+/// This works for every index type, HNSW included, and the space is reclaimed by compact(), which
+/// rebuilds a shard from its live vectors in the background and swaps it in.
+///
+/// In tiered mode (FaissIndexOptions::write_buffer) an insert only appends to the shard's write
+/// buffer, an IndexFlat with its own id map, and searches merge the top-k of both. A merger thread
+/// freezes a full buffer, adds it in one batch (which faiss parallelizes) to a clone of the shard
+/// index built off the lock, and swaps the clone in under a short exclusive lock; shards on a
+/// vector arena cannot be cloned and take the batch under that lock. While a merge runs the
+/// process holds a second copy of that shard's graph and vectors, which getMemoryBreakdown(),
+/// /admin/memory and the memory budget do not count.
+///
+/// IVF, PQ and SQ shards have to be trained before vectors are added, usually in bulk through
+/// add_vectors. IVF inverted lists may live in a memory-mapped file; compaction leaves IVF shards
+/// alone, since rebuilding one would need a second list file and decodable vectors.
 class FaissIndex
 {
   public:
-    FaissIndex(faiss::Index *index);
+    /// takes ownership of the shards, which must share dimension and metric
+    FaissIndex(std::vector<faiss::Index *> shards, const FaissIndexOptions &options = {});
     ~FaissIndex();
+    FaissIndex(const FaissIndex &) = delete;
+    FaissIndex &operator=(const FaissIndex &) = delete;
 
     /// modify
+    /// an id that is already present is overwritten: its previous vector becomes a tombstone
     void insert_vectors(const std::vector<f32> &data, u64 label);
-    void remove_vectors(const std::vector<i64> &ids);
+    /// bulk insert of `labels.size()` vectors, one batched add per shard; ids that are already
+    /// present are overwritten like in insert_vectors
+    void add_vectors(const std::vector<f32> &data, const std::vector<i64> &labels);
+    /// train every untrained shard (the IVF coarse quantizer) on `data`
+    void train(const std::vector<f32> &data);
+    /// tombstone the vectors of `ids`, returns how many were present
+    u64 remove_vectors(const std::vector<i64> &ids);
+    /// Rebuild every shard whose tombstones make up at least `threshold` of its vectors (any
+    /// tombstone when 0) from its live vectors. The rebuild runs without the shard lock, faiss
+    /// adds the vectors with OpenMP; writes arriving meanwhile go to the old shard and are
+    /// replayed onto the new one, which is then swapped in under a short exclusive lock.
+    /// Shards are compacted one at a time; concurrent calls wait for each other.
+    CompactionReport compact(f64 threshold);
 
     /// observe
+    /// with micro-batching enabled, searches without a filter bitmap or stats go through the batcher
     std::pair<std::vector<i64>, std::vector<f32>> search_vectors(const std::vector<f32> &query, i32 k,
-                                                                 const roaring_bitmap_t *bitmap = nullptr);
+                                                                 const roaring_bitmap_t *bitmap = nullptr,
+                                                                 SearchStats *stats = nullptr,
+                                                                 const SearchOptions &search_options = {});
+    /// every vector within `radius` of each query: squared L2 distance below it, or inner product
+    /// above it for IP and COSINE; hits with equal distances are ordered by label, so pages
+    /// taken from repeated searches line up as long as the index does not change
+    RangeSearchResults range_search_vectors(const std::vector<f32> &query, f32 radius,
+                                            const roaring_bitmap_t *bitmap = nullptr,
+                                            const SearchOptions &search_options = {});
+    /// false until an IVF index has been trained, always true for the other types
+    bool isTrained() const;
+    /// live vectors, tombstones excluded
+    u64 getVectorCount() const;
+    /// tombstoned vectors still held by the faiss indexes
+    u64 getDeletedCount() const;
+    i32 getDim() const;
+    /// the vector stored for `label`, normalized for COSINE; false when there is none. Needs
+    /// shards that can reconstruct by position: FLAT and HNSW ones, or PQ and SQ approximately
+    bool reconstruct_vector(u64 label, std::vector<f32> &vector) const;
+    /// add the label of every live vector to `labels`
+    void collectLabels(roaring_bitmap_t *labels) const;
+    /// estimated bytes held by the vectors or codes, graph links, in-memory lists and id map
+    u64 getMemoryUsage() const;
+    IndexMemoryUsage getMemoryBreakdown() const;
+    size_t getShardCount() const;
+    CompactionStatus getCompactionStatus() const;
 
     /// Snapshot
+    /// write buffers are merged first, so snapshots only hold the shards;
+    /// a single shard is written to `file_path`, shard i of several to `<file_path>.shard<i>`;
+    /// a shard's tombstones go next to it in `<shard file>.tombstones`
     void saveIndex(const std::string &file_path);
     void loadIndex(const std::string &file_path);
+    /// every file saveIndex may write for `file_path`, plus the on-disk inverted lists
+    std::vector<std::string> getSnapshotFiles(const std::string &file_path) const;
 
   private:
-    faiss::Index *m_index;
+    struct Shard
+    {
+        faiss::IndexIDMap *index;
+        // position of each live label in the wrapped index
+        std::unordered_map<i64, i64> positions;
+        // positions of deleted and overwritten vectors
+        roaring_bitmap_t *tombstones;
+        // searches share it, inserts, removals and loads take it exclusively
+        mutable std::shared_mutex mutex;
+        // while compacting, writes are also recorded for replay onto the rebuilt shard
+        bool compacting = false;
+        // (label, vector) in arrival order, an empty vector marks a removal
+        std::vector<std::pair<i64, std::vector<f32>>> pending_writes;
+        // tiered mode: vectors not merged into `index` yet, and their labels
+        faiss::IndexIDMap *buffer = nullptr;
+        std::unordered_set<i64> buffered;
+        // a full buffer while the merger adds it to a copy of `index`, and its labels not removed or
+        // overwritten since; searched like `buffer` until the copy is swapped in
+        faiss::IndexIDMap *frozen = nullptr;
+        std::unordered_set<i64> frozen_ids;
+    };
+
+    Shard &shardOf(i64 id);
+    std::pair<std::vector<i64>, std::vector<f32>> searchUnbatched(const std::vector<f32> &query, i32 k,
+                                                                  const roaring_bitmap_t *bitmap, SearchStats *stats,
+                                                                  const SearchOptions &search_options);
+    std::string shardFilePath(const std::string &file_path, size_t shard) const;
+    std::pair<std::vector<i64>, std::vector<f32>> searchShard(const Shard &shard, i32 query_num, const f32 *query,
+                                                              i32 k, const roaring_bitmap_t *bitmap,
+                                                              const SearchOptions &search_options) const;
+    /// the caller holds the lock guarding `index` and `tombstones`
+    std::pair<std::vector<i64>, std::vector<f32>> searchIndex(faiss::IndexIDMap *index,
+                                                              const roaring_bitmap_t *tombstones, i32 query_num,
+                                                              const f32 *query, i32 k, const roaring_bitmap_t *bitmap,
+                                                              const SearchOptions &search_options = {}) const;
+    /// (distance, label) hits per query of one shard, write buffer included
+    std::vector<std::vector<std::pair<f32, i64>>> rangeSearchShard(const Shard &shard, i32 query_num,
+                                                                   const f32 *query, f32 radius,
+                                                                   const roaring_bitmap_t *bitmap,
+                                                                   const SearchOptions &search_options) const;
+    /// fill the parameter object matching the type of `index` and return it; flat indexes get
+    /// `hnsw_params`, which they only read `sel` from
+    faiss::SearchParameters *prepareSearchParams(faiss::IndexIDMap *index, const SearchOptions &search_options,
+                                                 faiss::SearchParametersHNSW &hnsw_params,
+                                                 faiss::SearchParametersIVF &ivf_params) const;
+    /// add vectors to the main index of a shard; the caller holds its lock exclusively
+    void addToShard(Shard &shard, i64 n, const f32 *vectors, const i64 *labels);
+    /// returns false when the shard was below the threshold
+    bool compactShard(Shard &shard, size_t shard_index, f64 threshold, CompactionReport &report);
+    /// add the write buffer to the shard if it holds at least `min_size` vectors; the caller holds
+    /// m_compaction_mutex, since compaction does not expect the shard to grow
+    void mergeBuffer(Shard &shard, i64 min_size);
+    void mergeLoop();
+
+  private:
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    FaissIndexOptions m_options;
+    // one compaction at a time
+    std::mutex m_compaction_mutex;
+    mutable std::mutex m_compaction_status_mutex;
+    CompactionStatus m_compaction_status;
+    std::unique_ptr<SearchBatcher> m_batcher;
+
+    // tiered mode: inserts filling a buffer wake the merger thread
+    std::thread m_merge_thread;
+    std::mutex m_merge_mutex;
+    std::condition_variable m_merge_cv;
+    bool m_merge_requested = false;
+    bool m_stop_merger = false;
 };
 
 } // namespace vdb
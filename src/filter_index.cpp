@@ -10,15 +10,29 @@ FilterIndex::FilterIndex()
 {
 }
 
-void FilterIndex::addIntFieldFilter(const std::string &fieldname, i64 value, u64 id)
+FilterIndex::~FilterIndex()
 {
-    roaring_bitmap_t *bitmap = roaring_bitmap_create();
+    for (auto &[field_name, value_map] : m_int_field_filter)
+    {
+        for (auto &[value, bitmap] : value_map)
+        {
+            roaring_bitmap_free(bitmap);
+        }
+    }
+}
+
+void FilterIndex::addIntFieldFilter(const std::string &fieldname, i64 value, u32 id)
+{
+    roaring_bitmap_t *&bitmap = m_int_field_filter[fieldname][value];
+    if (bitmap == nullptr)
+    {
+        bitmap = roaring_bitmap_create();
+    }
     roaring_bitmap_add(bitmap, id);
-    m_int_field_filter[fieldname][value] = bitmap;
     GlobalLogger->debug("Added int field filter: fieldname={}, value={}, id={}", fieldname, value, id);
 }
 
-void FilterIndex::updateIntFieldFilter(const std::string &fieldname, i64 new_value, u64 id,
+void FilterIndex::updateIntFieldFilter(const std::string &fieldname, i64 new_value, u32 id,
                                        std::optional<i64> old_value)
 {
     auto it = m_int_field_filter.find(fieldname);
@@ -31,6 +45,12 @@ void FilterIndex::updateIntFieldFilter(const std::string &fieldname, i64 new_val
         {
             roaring_bitmap_t *old_bitmap = old_bitmap_it->second;
             roaring_bitmap_remove(old_bitmap, id);
+            // like a removal, the last id of a value takes its bitmap along
+            if (roaring_bitmap_is_empty(old_bitmap))
+            {
+                roaring_bitmap_free(old_bitmap);
+                value_map.erase(old_bitmap_it);
+            }
         }
 
         auto new_bitmap_it = value_map.find(new_value);
@@ -50,6 +70,27 @@ void FilterIndex::updateIntFieldFilter(const std::string &fieldname, i64 new_val
     }
 }
 
+void FilterIndex::removeIntFieldFilter(const std::string &fieldname, i64 value, u32 id)
+{
+    auto it = m_int_field_filter.find(fieldname);
+    if (it == m_int_field_filter.end())
+    {
+        return;
+    }
+    auto bitmap_it = it->second.find(value);
+    if (bitmap_it == it->second.end())
+    {
+        return;
+    }
+    roaring_bitmap_remove(bitmap_it->second, id);
+    if (roaring_bitmap_is_empty(bitmap_it->second))
+    {
+        roaring_bitmap_free(bitmap_it->second);
+        it->second.erase(bitmap_it);
+    }
+    GlobalLogger->debug("Removed int field filter: fieldname={}, value={}, id={}", fieldname, value, id);
+}
+
 void FilterIndex::getIntFieldFilterBitmap(const std::string &fieldname, Operation op, i64 value,
                                           roaring_bitmap_t *bitmap)
 {
@@ -81,6 +122,42 @@ void FilterIndex::getIntFieldFilterBitmap(const std::string &fieldname, Operatio
     }
 }
 
+std::map<FilterIndex::filed_t, u64> FilterIndex::getFieldBitmapCounts() const
+{
+    std::map<filed_t, u64> counts;
+    for (const auto &[field_name, value_map] : m_int_field_filter)
+    {
+        counts[field_name] = value_map.size();
+    }
+    return counts;
+}
+
+std::map<FilterIndex::filed_t, FilterFieldMemoryUsage> FilterIndex::getFieldMemoryUsage() const
+{
+    std::map<filed_t, FilterFieldMemoryUsage> usage;
+    for (const auto &[field_name, value_map] : m_int_field_filter)
+    {
+        FilterFieldMemoryUsage &field_usage = usage[field_name];
+        field_usage.bitmaps = value_map.size();
+        for (const auto &[value, bitmap] : value_map)
+        {
+            field_usage.bytes += roaring_bitmap_size_in_bytes(bitmap);
+        }
+    }
+    return usage;
+}
+
+void FilterIndex::collectIds(roaring_bitmap_t *ids) const
+{
+    for (const auto &[field_name, value_map] : m_int_field_filter)
+    {
+        for (const auto &[value, bitmap] : value_map)
+        {
+            roaring_bitmap_or_inplace(ids, bitmap);
+        }
+    }
+}
+
 /// Snap
 std::string FilterIndex::serializeIntFiledFilter()
 {
@@ -127,7 +204,12 @@ void FilterIndex::deserializeIntFiledFilter(const std::string &serialized_data)
 
         roaring_bitmap_t *bitmap = roaring_bitmap_portable_deserialize(serialized_bitmap.data());
 
-        m_int_field_filter[field_name][value] = bitmap;
+        roaring_bitmap_t *&slot = m_int_field_filter[field_name][value];
+        if (slot != nullptr)
+        {
+            roaring_bitmap_free(slot);
+        }
+        slot = bitmap;
     }
 }
 
@@ -9,6 +9,15 @@
 
 namespace vdb
 {
+/// Value bitmaps of one filter field and the bytes they hold.
+struct FilterFieldMemoryUsage
+{
+    u64 bitmaps = 0;
+    u64 bytes = 0;
+};
+
+/// Bitmaps of the ids holding each value of an integer field. Ids are the dense ordinals of an
+/// IdMap, so the 32-bit bitmaps cover any external id.
 class FilterIndex
 {
   public:
@@ -21,13 +30,23 @@ class FilterIndex
     using filed_t = std::string;
 
     FilterIndex();
+    ~FilterIndex();
+    FilterIndex(const FilterIndex &) = delete;
+    FilterIndex &operator=(const FilterIndex &) = delete;
 
     /// Modify
-    void addIntFieldFilter(const std::string &fieldname, i64 value, u64 id);
-    void updateIntFieldFilter(const std::string &fieldname, i64 new_value, u64 id,
+    void addIntFieldFilter(const std::string &fieldname, i64 value, u32 id);
+    void updateIntFieldFilter(const std::string &fieldname, i64 new_value, u32 id,
                               std::optional<i64> old_value = std::nullopt);
+    void removeIntFieldFilter(const std::string &fieldname, i64 value, u32 id);
     /// Observe
     void getIntFieldFilterBitmap(const std::string &fieldname, Operation op, i64 value, roaring_bitmap_t *bitmap);
+    /// number of value bitmaps kept for each field
+    std::map<filed_t, u64> getFieldBitmapCounts() const;
+    /// bitmap bytes as reported by roaring_bitmap_size_in_bytes, map nodes not included
+    std::map<filed_t, FilterFieldMemoryUsage> getFieldMemoryUsage() const;
+    /// add every id present in some bitmap to `ids`
+    void collectIds(roaring_bitmap_t *ids) const;
 
     /// Snapshot
     std::string serializeIntFiledFilter();
@@ -1,45 +1,178 @@
 #include "http_server.hh"
+#include "collection_manager.hh"
+#include "binary_index.hh"
+#include "config.hh"
 #include "constants.hh"
 #include "faiss_index.hh"
+#include "id_map.hh"
 #include "index_factory.hh"
+#include "json_response.hh"
+#include "json_utils.hh"
 #include "logger.hh"
+#include "metrics.hh"
+#include "sparse_index.hh"
 #include "vectordb.hh"
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <exception>
 #include <format>
 #include <rapidjson/document.h>
 #include <rapidjson/rapidjson.h>
 #include <rapidjson/stringbuffer.h>
-#include <rapidjson/writer.h>
 #include <utility>
 #include <vector>
 
 namespace vdb
 {
 
-HttpServer::HttpServer(const std::string &host, i32 port, VectorDB *vdb) : m_host(host), m_port(port), m_vector_db(vdb)
+namespace
 {
-    m_server.Post("/search", [this](const httplib::Request &req, httplib::Response &res) { searchHandler(req, res); });
+/// Wrap a handler with request count, error count and latency metrics for `endpoint`.
+EventServer::Handler instrumented(const std::string &endpoint, EventServer::Handler handler)
+{
+    MetricsRegistry *metrics = getGlobalMetrics();
+    Counter &requests =
+        metrics->counter("vdb_http_requests_total", "HTTP requests received", {{"endpoint", endpoint}});
+    Counter &errors = metrics->counter("vdb_http_request_errors_total", "HTTP requests answered with an error status",
+                                       {{"endpoint", endpoint}});
+    Histogram &latency = metrics->histogram("vdb_http_request_duration_seconds", "HTTP handler latency",
+                                            {{"endpoint", endpoint}});
+
+    return [&requests, &errors, &latency, handler](const httplib::Request &req, httplib::Response &res) {
+        requests.inc();
+        {
+            ScopedTimer timer(latency);
+            handler(req, res);
+        }
+        if (res.status >= 400)
+        {
+            errors.inc();
+        }
+    };
+}
+
+/// the members buildFilterBitmap and the result cache key read, with the types they read them as
+bool isFilterValid(const rapidjson::Value &filter)
+{
+    return filter.IsObject() && filter.HasMember(REQUEST_FILTER_NAME) && filter[REQUEST_FILTER_NAME].IsString() &&
+           filter.HasMember(REQUEST_FILTER_OP) && filter[REQUEST_FILTER_OP].IsString() &&
+           filter.HasMember(REQUEST_FILTER_VALUE) && filter[REQUEST_FILTER_VALUE].IsInt64();
+}
+
+/// an id the id map can assign: a write with any other one would reach the WAL and then fail on every replay
+bool isIdValid(const rapidjson::Document &json_request)
+{
+    return json_request.HasMember(REQUEST_ID) && json_request[REQUEST_ID].IsUint64() &&
+           json_request[REQUEST_ID].GetUint64() != IdMap::kReservedId;
+}
+} // namespace
+
+HttpServer::HttpServer(const std::string &host, i32 port, CollectionManager *collections)
+    : m_host(host), m_port(port), m_collections(collections)
+{
+    // routes without a workload class are interactive reads; writes and admin jobs get their own
+    // workers so that an ingest burst or a snapshot cannot hold up searches
+    m_server.Post("/search", instrumented("/search", [this](const httplib::Request &req, httplib::Response &res) {
+                      searchHandler(req, res);
+                  }));
 
-    m_server.Post("/insert", [this](const httplib::Request &req, httplib::Response &res) { insertHandler(req, res); });
+    m_server.Post("/range_search",
+                  instrumented("/range_search", [this](const httplib::Request &req, httplib::Response &res) {
+                      rangeSearchHandler(req, res);
+                  }));
+    m_server.Post("/hybrid_search",
+                  instrumented("/hybrid_search", [this](const httplib::Request &req, httplib::Response &res) {
+                      hybridSearchHandler(req, res);
+                  }));
+    m_server.Post("/insert", instrumented("/insert", [this](const httplib::Request &req, httplib::Response &res) {
+                      insertHandler(req, res);
+                  }),
+                  WorkloadClass::WRITE);
 
-    m_server.Post("/upsert", [this](const httplib::Request &req, httplib::Response &res) { upsertHandler(req, res); });
+    m_server.Post("/upsert", instrumented("/upsert", [this](const httplib::Request &req, httplib::Response &res) {
+                      upsertHandler(req, res);
+                  }),
+                  WorkloadClass::WRITE);
 
-    m_server.Post("/query", [this](const httplib::Request &req, httplib::Response &res) { queryHandler(req, res); });
+    m_server.Post("/query", instrumented("/query", [this](const httplib::Request &req, httplib::Response &res) {
+                      queryHandler(req, res);
+                  }));
+
+    m_server.Post("/delete", instrumented("/delete", [this](const httplib::Request &req, httplib::Response &res) {
+                      deleteHandler(req, res);
+                  }),
+                  WorkloadClass::WRITE);
 
     m_server.Post("/admin/snapshot",
-                  [this](const httplib::Request &req, httplib::Response &res) { snapshotHandler(req, res); });
+                  instrumented("/admin/snapshot", [this](const httplib::Request &req, httplib::Response &res) {
+                      snapshotHandler(req, res);
+                  }),
+                  WorkloadClass::ADMIN);
+
+    m_server.Post("/admin/build",
+                  instrumented("/admin/build", [this](const httplib::Request &req, httplib::Response &res) {
+                      buildHandler(req, res);
+                  }),
+                  WorkloadClass::ADMIN);
+    m_server.Post("/admin/compact",
+                  instrumented("/admin/compact", [this](const httplib::Request &req, httplib::Response &res) {
+                      compactHandler(req, res);
+                  }),
+                  WorkloadClass::ADMIN);
+
+    m_server.Get("/admin/compaction",
+                 instrumented("/admin/compaction", [this](const httplib::Request &req, httplib::Response &res) {
+                     compactionStatusHandler(req, res);
+                 }),
+                 WorkloadClass::ADMIN);
+
+    m_server.Post("/admin/collections/create",
+                  instrumented("/admin/collections/create", [this](const httplib::Request &req,
+                                                                   httplib::Response &res) {
+                      createCollectionHandler(req, res);
+                  }),
+                  WorkloadClass::ADMIN);
+
+    m_server.Post("/admin/collections/drop",
+                  instrumented("/admin/collections/drop", [this](const httplib::Request &req, httplib::Response &res) {
+                      dropCollectionHandler(req, res);
+                  }),
+                  WorkloadClass::ADMIN);
+
+    m_server.Get("/admin/collections",
+                 instrumented("/admin/collections", [this](const httplib::Request &req, httplib::Response &res) {
+                     listCollectionsHandler(req, res);
+                 }),
+                 WorkloadClass::ADMIN);
+
+    m_server.Get("/admin/memory",
+                 instrumented("/admin/memory", [this](const httplib::Request &req, httplib::Response &res) {
+                     memoryHandler(req, res);
+                 }),
+                 WorkloadClass::ADMIN);
+
+    m_server.Get("/metrics", [this](const httplib::Request &req, httplib::Response &res) { metricsHandler(req, res); });
 }
 
 void HttpServer::start()
 {
-    m_server.listen(m_host.c_str(), m_port);
+    if (!m_server.listen(m_host, m_port))
+    {
+        GlobalLogger->error("<Server> Failed to listen on {}:{}", m_host, m_port);
+    }
 }
 
 void HttpServer::searchHandler(const httplib::Request &req, httplib::Response &res)
 {
     GlobalLogger->debug("<Server> Received search request");
+    auto start = std::chrono::steady_clock::now();
+    SearchProfile profile;
+    std::string request_buffer = req.body;
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    std::vector<f32> query;
+    parseJsonRequest(request_buffer, json_request, &query);
+    profile.json_parse_ns = elapsedNsSince(start);
     GlobalLogger->info("<Server> Search request parameters: {}", req.body);
 
     if (!json_request.IsObject())
@@ -58,11 +191,6 @@ void HttpServer::searchHandler(const httplib::Request &req, httplib::Response &r
         return;
     }
 
-    std::vector<f32> query;
-    for (const auto &q : json_request[REQUEST_VECTORS].GetArray())
-    {
-        query.push_back(q.GetFloat());
-    }
     i32 k = json_request[REQUEST_K].GetInt();
 
     GlobalLogger->debug("<Server> Query parameters: k = {}", k);
@@ -76,9 +204,18 @@ void HttpServer::searchHandler(const httplib::Request &req, httplib::Response &r
         return;
     }
 
-    FaissIndex *index = getGlobalIndexFactory()->getFaissIndex(index_type);
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
 
-    if (index == nullptr)
+    FaissIndex *index = collection->getFaissIndex(index_type);
+    BinaryIndex *binary_index = collection->getBinaryIndex(index_type);
+    SparseIndex *sparse_index =
+        index_type == IndexFactory::IndexType::SPARSE ? collection->getSparseIndex() : nullptr;
+
+    if (index == nullptr && binary_index == nullptr && sparse_index == nullptr)
     {
         std::string error_msg = std::format("Index type {} is not supported", index_type);
 
@@ -88,42 +225,256 @@ void HttpServer::searchHandler(const httplib::Request &req, httplib::Response &r
         return;
     }
 
-    auto results = m_vector_db->search(json_request);
+    bool profile_requested = json_request.HasMember(REQUEST_PROFILE) && json_request[REQUEST_PROFILE].IsBool() &&
+                             json_request[REQUEST_PROFILE].GetBool();
+    profile.collect_search_stats = profile_requested || SlowQueryLogger != nullptr;
 
-    // 将结果转换为JSON格式
-    rapidjson::Document json_response;
-    json_response.SetObject();
-    rapidjson::Document::AllocatorType &allocator = json_response.GetAllocator();
-
-    bool valid_results = false;
-    rapidjson::Value vectors(rapidjson::kArrayType);
-    rapidjson::Value distances(rapidjson::kArrayType);
-    for (size_t i = 0; i < results.first.size(); ++i)
+    std::pair<std::vector<i64>, std::vector<f32>> results;
+    if (binary_index)
     {
-        if (results.first[i] != -1)
+        std::vector<u8> codes;
+        if (!getBinaryVectors(res, binary_index, json_request, true, codes))
         {
-            valid_results = true;
-            vectors.PushBack(results.first[i], allocator);
-            distances.PushBack(results.second[i], allocator);
+            return;
         }
+        results = collection->searchBinary(json_request, codes, &profile);
+    }
+    else if (sparse_index)
+    {
+        std::vector<u32> indices;
+        std::vector<f32> values;
+        if (!getSparseVector(res, json_request, indices, values))
+        {
+            return;
+        }
+        results = collection->searchSparse(json_request, indices, values, &profile);
+    }
+    else
+    {
+        if (!checkVectorDim(res, index, query, true) ||
+            (json_request.HasMember(REQUEST_PREFILTER) &&
+             !checkPrefilter(res, *collection, json_request, index_type, query.size() / index->getDim())))
+        {
+            return;
+        }
+        results = collection->search(json_request, query, &profile);
+    }
+
+    // 将结果直接流式写出为JSON
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writeSearchResults(writer, results, RESPONSE_DISTANCES);
+    if (profile_requested)
+    {
+        profile.total_ns = elapsedNsSince(start);
+        writer.Key(RESPONSE_PROFILE);
+        writeSearchProfile(writer, profile);
+    }
+    auto serialize_start = std::chrono::steady_clock::now();
+    response.finish(res);
+    profile.serialize_ns = elapsedNsSince(serialize_start);
+    profile.total_ns = elapsedNsSince(start);
+
+    if (SlowQueryLogger && profile.total_ns >= m_slow_query_threshold_ns)
+    {
+        logSlowQuery(json_request, collection->getConfig().name, k, profile);
+    }
+}
+
+void HttpServer::hybridSearchHandler(const httplib::Request &req, httplib::Response &res)
+{
+    GlobalLogger->debug("<Server> Received hybrid search request");
+    auto start = std::chrono::steady_clock::now();
+    SearchProfile profile;
+    std::string request_buffer = req.body;
+    rapidjson::Document json_request;
+    std::vector<f32> query;
+    parseJsonRequest(request_buffer, json_request, &query);
+    profile.json_parse_ns = elapsedNsSince(start);
+    GlobalLogger->info("<Server> Hybrid search request parameters: {}", req.body);
+
+    if (!json_request.IsObject())
+    {
+        GlobalLogger->error("<Server> Invalid json request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Invalid JSON request");
+        return;
+    }
+
+    if (!isRequestValid(json_request, CheckType::HYBRID_SEARCH))
+    {
+        GlobalLogger->error("<Server> Missing or invalid hybrid search parameters in the request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR,
+                             "Missing vectors, sparseVector or k parameter, or invalid fusion parameters");
+        return;
+    }
+
+    i32 k = json_request[REQUEST_K].GetInt();
+    IndexFactory::IndexType index_type = getIndexTypeFromJson(json_request);
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
+
+    FaissIndex *index = collection->getFaissIndex(index_type);
+    if (index == nullptr || collection->getSparseIndex() == nullptr)
+    {
+        std::string error_msg =
+            std::format("Hybrid search needs the SPARSE index and a dense index type, got {}", index_type);
+        GlobalLogger->error("<Server> " + error_msg);
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+        return;
+    }
+
+    std::vector<u32> indices;
+    std::vector<f32> values;
+    if (!checkVectorDim(res, index, query, false) || !getSparseVector(res, json_request, indices, values))
+    {
+        return;
+    }
+
+    bool profile_requested = json_request.HasMember(REQUEST_PROFILE) && json_request[REQUEST_PROFILE].IsBool() &&
+                             json_request[REQUEST_PROFILE].GetBool();
+    profile.collect_search_stats = profile_requested || SlowQueryLogger != nullptr;
+    auto results = collection->hybridSearch(json_request, query, indices, values, &profile);
+
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writeSearchResults(writer, results, RESPONSE_SCORES);
+    if (profile_requested)
+    {
+        profile.total_ns = elapsedNsSince(start);
+        writer.Key(RESPONSE_PROFILE);
+        writeSearchProfile(writer, profile);
+    }
+    auto serialize_start = std::chrono::steady_clock::now();
+    response.finish(res);
+    profile.serialize_ns = elapsedNsSince(serialize_start);
+    profile.total_ns = elapsedNsSince(start);
+
+    if (SlowQueryLogger && profile.total_ns >= m_slow_query_threshold_ns)
+    {
+        logSlowQuery(json_request, collection->getConfig().name, k, profile);
+    }
+}
+
+void HttpServer::rangeSearchHandler(const httplib::Request &req, httplib::Response &res)
+{
+    GlobalLogger->debug("<Server> Received range search request");
+    std::string request_buffer = req.body;
+    rapidjson::Document json_request;
+    std::vector<f32> query;
+    parseJsonRequest(request_buffer, json_request, &query);
+    GlobalLogger->info("<Server> Range search request parameters: {}", req.body);
+
+    if (!json_request.IsObject())
+    {
+        GlobalLogger->error("<Server> Invalid json request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Invalid JSON request");
+        return;
+    }
+
+    if (!isRequestValid(json_request, CheckType::RANGE_SEARCH))
+    {
+        GlobalLogger->error("<Server> Missing vectors or radius parameter in the request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Missing vectors or radius parameter in the request");
+        return;
+    }
+
+    IndexFactory::IndexType index_type = getIndexTypeFromJson(json_request);
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
+    FaissIndex *index = collection->getFaissIndex(index_type);
+    if (index == nullptr)
+    {
+        std::string error_msg = std::format("Index type {} is not supported", index_type);
+        GlobalLogger->error("<Server> " + error_msg);
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+        return;
+    }
+    if (!checkVectorDim(res, index, query, true))
+    {
+        return;
     }
 
-    if (valid_results)
+    u64 offset = json_request.HasMember(REQUEST_OFFSET) ? json_request[REQUEST_OFFSET].GetUint64() : 0;
+    u64 limit =
+        json_request.HasMember(REQUEST_LIMIT) ? json_request[REQUEST_LIMIT].GetUint64() : DEFAULT_RANGE_SEARCH_LIMIT;
+
+    RangeSearchResults results;
+    try
     {
-        json_response.AddMember(RESPONSE_VECTORS, vectors, allocator);
-        json_response.AddMember(RESPONSE_DISTANCES, distances, allocator);
+        results = collection->rangeSearch(json_request, query);
+    }
+    catch (const std::exception &e)
+    {
+        GlobalLogger->error("<Server> Range search failed: {}", e.what());
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, e.what());
+        return;
     }
 
-    json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
-    setJsonResponse(json_response, res);
+    // one page per query: hits [offset, offset + limit) of its hit list
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writer.Key(RESPONSE_RESULTS);
+    writer.StartArray();
+    for (size_t q = 0; q + 1 < results.lims.size(); ++q)
+    {
+        u64 total = results.lims[q + 1] - results.lims[q];
+        u64 skipped = std::min(offset, total);
+        u64 count = std::min(limit, total - skipped);
+        size_t begin = results.lims[q] + skipped;
+        size_t end = begin + count;
+        writer.StartObject();
+        writer.Key(RESPONSE_VECTORS);
+        writer.StartArray();
+        for (size_t i = begin; i < end; ++i)
+        {
+            writer.Uint64(static_cast<u64>(results.labels[i]));
+        }
+        writer.EndArray();
+        writer.Key(RESPONSE_DISTANCES);
+        writer.StartArray();
+        for (size_t i = begin; i < end; ++i)
+        {
+            writer.Double(results.distances[i]);
+        }
+        writer.EndArray();
+        writer.Key(RESPONSE_TOTAL);
+        writer.Uint64(total);
+        if (skipped + count < total)
+        {
+            writer.Key(RESPONSE_NEXT_OFFSET);
+            writer.Uint64(skipped + count);
+        }
+        writer.EndObject();
+    }
+    writer.EndArray();
+    response.finish(res);
 }
 
 void HttpServer::insertHandler(const httplib::Request &req, httplib::Response &res)
 {
 
     GlobalLogger->debug("<Server> Received insert request");
+    if (!checkMemoryBudget(res))
+    {
+        return;
+    }
+    std::string request_buffer = req.body;
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    std::vector<f32> data;
+    parseJsonRequest(request_buffer, json_request, &data);
     GlobalLogger->info("<Server> Insert request parameters: {}", req.body);
 
     if (!json_request.IsObject())
@@ -142,11 +493,6 @@ void HttpServer::insertHandler(const httplib::Request &req, httplib::Response &r
         return;
     }
 
-    std::vector<f32> data;
-    for (const auto &d : json_request[REQUEST_VECTORS].GetArray())
-    {
-        data.push_back(d.GetFloat());
-    }
     u64 label = json_request[REQUEST_ID].GetUint64();
 
     GlobalLogger->debug("<Server> Insert parameters: label = {}", label);
@@ -160,9 +506,18 @@ void HttpServer::insertHandler(const httplib::Request &req, httplib::Response &r
         return;
     }
 
-    FaissIndex *index = getGlobalIndexFactory()->getFaissIndex(index_type);
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
 
-    if (index == nullptr)
+    FaissIndex *index = collection->getFaissIndex(index_type);
+    BinaryIndex *binary_index = collection->getBinaryIndex(index_type);
+    SparseIndex *sparse_index =
+        index_type == IndexFactory::IndexType::SPARSE ? collection->getSparseIndex() : nullptr;
+
+    if (index == nullptr && binary_index == nullptr && sparse_index == nullptr)
     {
         std::string error_msg = std::format("Index type {} is not supported", index_type);
 
@@ -172,22 +527,49 @@ void HttpServer::insertHandler(const httplib::Request &req, httplib::Response &r
         return;
     }
 
-    index->insert_vectors(data, label);
-
-    // 将结果转换为JSON格式
-    rapidjson::Document json_response;
-    json_response.SetObject();
-    rapidjson::Document::AllocatorType &allocator = json_response.GetAllocator();
+    if (binary_index)
+    {
+        std::vector<u8> code;
+        if (!getBinaryVectors(res, binary_index, json_request, false, code))
+        {
+            return;
+        }
+        collection->insertBinary(label, code, index_type);
+    }
+    else if (sparse_index)
+    {
+        std::vector<u32> indices;
+        std::vector<f32> values;
+        if (!getSparseVector(res, json_request, indices, values))
+        {
+            return;
+        }
+        collection->insertSparse(label, indices, values);
+    }
+    else
+    {
+        if (!checkVectorDim(res, index, data, false) || !checkWritable(res, index_type, index))
+        {
+            return;
+        }
+        collection->insert(label, data, index_type);
+    }
 
-    json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
-    setJsonResponse(json_response, res);
+    JsonResponseWriter response;
+    response.finish(res);
 }
 
 void HttpServer::upsertHandler(const httplib::Request &req, httplib::Response &res)
 {
     GlobalLogger->debug("<Server> Received upsert request");
+    if (!checkMemoryBudget(res))
+    {
+        return;
+    }
+    std::string request_buffer = req.body;
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    std::vector<f32> data;
+    parseJsonRequest(request_buffer, json_request, &data);
     GlobalLogger->info("<Server> Upsert request parameters: {}", req.body);
 
     if (!json_request.IsObject())
@@ -219,25 +601,69 @@ void HttpServer::upsertHandler(const httplib::Request &req, httplib::Response &r
         return;
     }
 
-    // write log before upsert database
-    m_vector_db->writeWALLog("upsert", json_request);
-    // upsert database
-    m_vector_db->upsert(label, json_request, index_type);
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
+
+    FaissIndex *index = collection->getFaissIndex(index_type);
+    BinaryIndex *binary_index = collection->getBinaryIndex(index_type);
+    SparseIndex *sparse_index =
+        index_type == IndexFactory::IndexType::SPARSE ? collection->getSparseIndex() : nullptr;
+
+    if (index == nullptr && binary_index == nullptr && sparse_index == nullptr)
+    {
+        std::string error_msg = std::format("Index type {} is not supported", index_type);
+
+        GlobalLogger->error("<Server>" + error_msg);
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+        return;
+    }
+
+    std::vector<u8> code;
+    if (binary_index && !getBinaryVectors(res, binary_index, json_request, false, code))
+    {
+        return;
+    }
+    if (index && (!checkVectorDim(res, index, data, false) || !checkWritable(res, index_type, index)))
+    {
+        return;
+    }
+    // any upsert may carry the sparse vector of the document for the SPARSE index
+    std::vector<u32> indices;
+    std::vector<f32> values;
+    if ((sparse_index || json_request.HasMember(REQUEST_SPARSE_VECTOR)) &&
+        !getSparseVector(res, json_request, indices, values))
+    {
+        return;
+    }
+    // a float upsert may carry the binary code of the document for the binary indexes as well
+    if (index && json_request.HasMember(REQUEST_BINARY_VECTORS))
+    {
+        for (IndexFactory::IndexType other_type : collection->getConfig().index_types)
+        {
+            BinaryIndex *other = collection->getBinaryIndex(other_type);
+            if (other && !getBinaryVectors(res, other, json_request, false, code))
+            {
+                return;
+            }
+        }
+    }
 
-    // 将结果转换为JSON格式
-    rapidjson::Document json_response;
-    json_response.SetObject();
-    rapidjson::Document::AllocatorType &allocator = json_response.GetAllocator();
+    collection->upsert(label, json_request, data, index_type);
 
-    json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
-    setJsonResponse(json_response, res);
+    JsonResponseWriter response;
+    response.finish(res);
 }
 
 void HttpServer::queryHandler(const httplib::Request &req, httplib::Response &res)
 {
     GlobalLogger->debug("<Server> Received query request");
+    std::string request_buffer = req.body;
     rapidjson::Document json_request;
-    json_request.Parse(req.body.c_str());
+    parseJsonRequest(request_buffer, json_request);
     GlobalLogger->info("<Server> Query request parameters: {}", req.body);
 
     if (!json_request.IsObject())
@@ -260,53 +686,776 @@ void HttpServer::queryHandler(const httplib::Request &req, httplib::Response &re
 
     GlobalLogger->debug("<Server> Query parameters: id = {}", label);
 
-    rapidjson::Document json_query_data = m_vector_db->query(label);
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
 
-    // 将结果转换为JSON格式
-    rapidjson::Document json_response;
-    json_response.SetObject();
-    rapidjson::Document::AllocatorType &allocator = json_response.GetAllocator();
+    rapidjson::Document json_query_data = collection->query(label);
 
-    if (!json_query_data.IsNull())
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    if (json_query_data.IsObject())
     {
         for (auto it = json_query_data.MemberBegin(); it != json_query_data.MemberEnd(); ++it)
         {
-            json_response.AddMember(it->name, it->value, allocator);
+            writer.Key(it->name.GetString(), it->name.GetStringLength());
+            it->value.Accept(writer);
         }
     }
+    response.finish(res);
+}
 
-    json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
-    setJsonResponse(json_response, res);
+void HttpServer::deleteHandler(const httplib::Request &req, httplib::Response &res)
+{
+    GlobalLogger->debug("<Server> Received delete request");
+    std::string request_buffer = req.body;
+    rapidjson::Document json_request;
+    parseJsonRequest(request_buffer, json_request);
+    GlobalLogger->info("<Server> Delete request parameters: {}", req.body);
+
+    if (!json_request.IsObject())
+    {
+        GlobalLogger->error("<Server> Invalid json request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Invalid JSON request");
+        return;
+    }
+
+    if (!isRequestValid(json_request, CheckType::REMOVE))
+    {
+        GlobalLogger->error("<Server> Missing ids or filter parameter in the request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Request needs either an ids array or a filter");
+        return;
+    }
+
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
+
+    std::vector<u64> ids;
+    if (json_request.HasMember(REQUEST_IDS))
+    {
+        for (const auto &id : json_request[REQUEST_IDS].GetArray())
+        {
+            ids.push_back(id.GetUint64());
+        }
+    }
+    else
+    {
+        try
+        {
+            ids = collection->getFilteredIds(json_request[REQUEST_FILTER]);
+        }
+        catch (const std::exception &e)
+        {
+            GlobalLogger->error("<Server> Failed to resolve delete filter: {}", e.what());
+            res.status = 400;
+            setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, e.what());
+            return;
+        }
+    }
+
+    u64 deleted = collection->remove(ids);
+
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writer.Key(RESPONSE_DELETED);
+    writer.Uint64(deleted);
+    response.finish(res);
 }
 
 void HttpServer::snapshotHandler(const httplib::Request &req, httplib::Response &res)
 {
     GlobalLogger->debug("<Server> Received snap request");
-    m_vector_db->takeSnapshot();
+    std::string request_buffer = req.body;
+    rapidjson::Document json_request;
+    // an empty body snapshots the default collection
+    if (!request_buffer.empty() && (!parseJsonRequest(request_buffer, json_request) || !json_request.IsObject()))
+    {
+        GlobalLogger->error("<Server> Invalid json request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Invalid JSON request");
+        return;
+    }
+
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
+    collection->takeSnapshot();
+
+    JsonResponseWriter response;
+    response.finish(res);
+}
+
+void HttpServer::buildHandler(const httplib::Request &req, httplib::Response &res)
+{
+    GlobalLogger->debug("<Server> Received build request");
+    if (!checkMemoryBudget(res))
+    {
+        return;
+    }
+    std::string request_buffer = req.body;
+    rapidjson::Document json_request;
+    if (!parseJsonRequest(request_buffer, json_request) || !json_request.IsObject())
+    {
+        GlobalLogger->error("<Server> Invalid json request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Invalid JSON request");
+        return;
+    }
+    GlobalLogger->info("<Server> Build request parameters: {}", req.body);
+
+    if (!isRequestValid(json_request, CheckType::BUILD))
+    {
+        GlobalLogger->error("<Server> Missing file or indexType parameter in the request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Missing file or indexType parameter in the request");
+        return;
+    }
+
+    IndexFactory::IndexType index_type = getIndexTypeFromJson(json_request);
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
+    if (collection->getFaissIndex(index_type) == nullptr)
+    {
+        std::string error_msg = std::format("Index type {} is not supported", index_type);
+        GlobalLogger->error("<Server> " + error_msg);
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+        return;
+    }
+
+    u64 start_id = json_request.HasMember(REQUEST_START_ID) ? json_request[REQUEST_START_ID].GetUint64() : 0;
+    u64 count = 0;
+    try
+    {
+        count = collection->buildFromFile(index_type, json_request[REQUEST_FILE].GetString(), start_id);
+    }
+    catch (const std::exception &e)
+    {
+        GlobalLogger->error("<Server> Build failed: {}", e.what());
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, e.what());
+        return;
+    }
+
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writer.Key("vectors");
+    writer.Uint64(count);
+    response.finish(res);
+}
+
+void HttpServer::compactHandler(const httplib::Request &req, httplib::Response &res)
+{
+    GlobalLogger->debug("<Server> Received compact request");
+    std::string request_buffer = req.body;
+    rapidjson::Document json_request;
+    // an empty body compacts every index of the default collection that has tombstones
+    if (!request_buffer.empty() && (!parseJsonRequest(request_buffer, json_request) || !json_request.IsObject()))
+    {
+        GlobalLogger->error("<Server> Invalid json request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Invalid JSON request");
+        return;
+    }
+
+    f64 threshold = 0.0;
+    if (json_request.IsObject() && json_request.HasMember(REQUEST_THRESHOLD))
+    {
+        if (!json_request[REQUEST_THRESHOLD].IsNumber() || json_request[REQUEST_THRESHOLD].GetDouble() < 0.0 ||
+            json_request[REQUEST_THRESHOLD].GetDouble() > 1.0)
+        {
+            GlobalLogger->error("<Server> Invalid compaction threshold");
+            res.status = 400;
+            setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "threshold must be a number within [0, 1]");
+            return;
+        }
+        threshold = json_request[REQUEST_THRESHOLD].GetDouble();
+    }
+
+    std::shared_ptr<VectorDB> collection = getCollection(json_request, res);
+    if (collection == nullptr)
+    {
+        return;
+    }
+    auto reports = collection->compact(threshold);
+
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writer.Key(RESPONSE_COMPACTIONS);
+    writer.StartArray();
+    for (const auto &[index_type, report] : reports)
+    {
+        writer.StartObject();
+        writer.Key(REQUEST_INDEX_TYPE);
+        std::string index_type_str = std::format("{}", index_type);
+        writer.String(index_type_str.c_str(), static_cast<rapidjson::SizeType>(index_type_str.size()));
+        writer.Key("report");
+        writeCompactionReport(writer, report);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    response.finish(res);
+}
+
+void HttpServer::compactionStatusHandler(const httplib::Request &req, httplib::Response &res)
+{
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writer.Key(RESPONSE_COLLECTIONS);
+    writer.StartArray();
+    for (const auto &collection : m_collections->listCollections())
+    {
+        const CollectionConfig &config = collection->getConfig();
+        writer.StartObject();
+        writer.Key(REQUEST_COLLECTION);
+        writer.String(config.name.c_str(), static_cast<rapidjson::SizeType>(config.name.size()));
+        writer.Key(RESPONSE_COMPACTIONS);
+        writer.StartArray();
+        for (IndexFactory::IndexType index_type : config.index_types)
+        {
+            FaissIndex *index = collection->getFaissIndex(index_type);
+            if (index == nullptr)
+            {
+                continue;
+            }
+            CompactionStatus status = index->getCompactionStatus();
+            writer.StartObject();
+            writer.Key(REQUEST_INDEX_TYPE);
+            std::string index_type_str = std::format("{}", index_type);
+            writer.String(index_type_str.c_str(), static_cast<rapidjson::SizeType>(index_type_str.size()));
+            writer.Key("running");
+            writer.Bool(status.running);
+            writer.Key("shardsDone");
+            writer.Uint64(status.shards_done);
+            writer.Key("shardsTotal");
+            writer.Uint64(status.shards_total);
+            writer.Key("deletedVectors");
+            writer.Uint64(index->getDeletedCount());
+            writer.Key("compactions");
+            writer.Uint64(status.compactions);
+            if (status.compactions > 0)
+            {
+                writer.Key("last");
+                writeCompactionReport(writer, status.last);
+            }
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+    }
+    writer.EndArray();
+    response.finish(res);
+}
+
+void HttpServer::createCollectionHandler(const httplib::Request &req, httplib::Response &res)
+{
+    GlobalLogger->debug("<Server> Received create collection request");
+    std::string request_buffer = req.body;
+    rapidjson::Document json_request;
+    parseJsonRequest(request_buffer, json_request);
+    GlobalLogger->info("<Server> Create collection request parameters: {}", req.body);
+
+    if (!json_request.IsObject() || !json_request.HasMember(REQUEST_COLLECTION) ||
+        !json_request[REQUEST_COLLECTION].IsString() || !json_request.HasMember(CONFIG_DIM))
+    {
+        GlobalLogger->error("<Server> Missing collection or dim parameter in the request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Missing collection or dim parameter in the request");
+        return;
+    }
+
+    try
+    {
+        CollectionConfig config;
+        config.name = json_request[REQUEST_COLLECTION].GetString();
+        readCollectionConfig(json_request, config);
+        m_collections->createCollection(config);
+    }
+    catch (const std::exception &e)
+    {
+        GlobalLogger->error("<Server> Failed to create collection: {}", e.what());
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, e.what());
+        return;
+    }
+
+    JsonResponseWriter response;
+    response.finish(res);
+}
+
+void HttpServer::dropCollectionHandler(const httplib::Request &req, httplib::Response &res)
+{
+    GlobalLogger->debug("<Server> Received drop collection request");
+    std::string request_buffer = req.body;
+    rapidjson::Document json_request;
+    parseJsonRequest(request_buffer, json_request);
+    GlobalLogger->info("<Server> Drop collection request parameters: {}", req.body);
+
+    if (!json_request.IsObject() || !json_request.HasMember(REQUEST_COLLECTION) ||
+        !json_request[REQUEST_COLLECTION].IsString())
+    {
+        GlobalLogger->error("<Server> Missing collection parameter in the request");
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Missing collection parameter in the request");
+        return;
+    }
+
+    try
+    {
+        m_collections->dropCollection(json_request[REQUEST_COLLECTION].GetString());
+    }
+    catch (const std::exception &e)
+    {
+        GlobalLogger->error("<Server> Failed to drop collection: {}", e.what());
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, e.what());
+        return;
+    }
+
+    JsonResponseWriter response;
+    response.finish(res);
+}
+
+void HttpServer::listCollectionsHandler(const httplib::Request &req, httplib::Response &res)
+{
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writer.Key(RESPONSE_COLLECTIONS);
+    writer.StartArray();
+    for (const auto &collection : m_collections->listCollections())
+    {
+        const CollectionConfig &config = collection->getConfig();
+        CollectionStats stats = collection->getStats();
+        writer.StartObject();
+        writer.Key(REQUEST_COLLECTION);
+        writer.String(config.name.c_str(), static_cast<rapidjson::SizeType>(config.name.size()));
+        writeCollectionConfig(writer, config);
+
+        u64 index_memory_bytes = 0;
+        writer.Key("vectors");
+        writer.StartObject();
+        for (const auto &[index_type, index_stats] : stats.indexes)
+        {
+            std::string index_type_str = std::format("{}", index_type);
+            writer.Key(index_type_str.c_str(), static_cast<rapidjson::SizeType>(index_type_str.size()));
+            writer.Uint64(index_stats.vectors);
+            index_memory_bytes += index_stats.memory_bytes;
+        }
+        writer.EndObject();
+        writer.Key("deletedVectors");
+        writer.StartObject();
+        for (const auto &[index_type, index_stats] : stats.indexes)
+        {
+            std::string index_type_str = std::format("{}", index_type);
+            writer.Key(index_type_str.c_str(), static_cast<rapidjson::SizeType>(index_type_str.size()));
+            writer.Uint64(index_stats.deleted);
+        }
+        writer.EndObject();
+        writer.Key("indexMemoryBytes");
+        writer.Uint64(index_memory_bytes);
+        writer.Key("storageBytes");
+        writer.Uint64(stats.storage_bytes);
+        writer.Key("walBytesSinceSnapshot");
+        writer.Uint64(stats.wal_bytes_since_snapshot);
+        writer.Key("resultCacheBytes");
+        writer.Uint64(stats.result_cache_bytes);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    response.finish(res);
+}
 
-    rapidjson::Document json_response;
-    json_response.SetObject();
-    rapidjson::Document::AllocatorType &allocator = json_response.GetAllocator();
-    json_response.AddMember(RESPONSE_RETCODE, RESPONSE_RETCODE_SUCCESS, allocator);
-    setJsonResponse(json_response, res);
+void HttpServer::memoryHandler(const httplib::Request &req, httplib::Response &res)
+{
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writer.Key("processRssBytes");
+    writer.Uint64(getProcessRssBytes());
+    writer.Key("memoryBudgetBytes");
+    writer.Uint64(m_collections->getMemoryBudgetBytes());
+    writer.Key("overBudget");
+    writer.Bool(m_collections->isOverMemoryBudget());
+
+    RocksDBMemoryUsage rocksdb_usage = m_collections->getRocksDBMemoryUsage();
+    writer.Key("rocksdb");
+    writer.StartObject();
+    writer.Key("memtableBytes");
+    writer.Uint64(rocksdb_usage.memtables);
+    writer.Key("tableReaderBytes");
+    writer.Uint64(rocksdb_usage.table_readers);
+    writer.Key("blockCacheBytes");
+    writer.Uint64(rocksdb_usage.block_cache);
+    writer.Key("blockCachePinnedBytes");
+    writer.Uint64(rocksdb_usage.block_cache_pinned);
+    writer.EndObject();
+
+    writer.Key(RESPONSE_COLLECTIONS);
+    writer.StartArray();
+    for (const auto &collection : m_collections->listCollections())
+    {
+        const std::string &name = collection->getConfig().name;
+        CollectionMemoryUsage usage = collection->getMemoryUsage();
+        writer.StartObject();
+        writer.Key(REQUEST_COLLECTION);
+        writer.String(name.c_str(), static_cast<rapidjson::SizeType>(name.size()));
+        writer.Key("totalBytes");
+        writer.Uint64(usage.total());
+        writer.Key("indexes");
+        writer.StartObject();
+        for (const auto &[index_type, index_usage] : usage.indexes)
+        {
+            std::string index_type_str = std::format("{}", index_type);
+            writer.Key(index_type_str.c_str(), static_cast<rapidjson::SizeType>(index_type_str.size()));
+            writer.StartObject();
+            writer.Key("vectorBytes");
+            writer.Uint64(index_usage.vectors);
+            writer.Key("graphBytes");
+            writer.Uint64(index_usage.graph);
+            writer.Key("listBytes");
+            writer.Uint64(index_usage.lists);
+            writer.Key("idBytes");
+            writer.Uint64(index_usage.ids);
+            writer.Key("writeBufferBytes");
+            writer.Uint64(index_usage.write_buffer);
+            writer.Key("totalBytes");
+            writer.Uint64(index_usage.total());
+            writer.EndObject();
+        }
+        writer.EndObject();
+        writer.Key("filterFields");
+        writer.StartObject();
+        for (const auto &[field_name, field_usage] : usage.filter_fields)
+        {
+            writer.Key(field_name.c_str(), static_cast<rapidjson::SizeType>(field_name.size()));
+            writer.StartObject();
+            writer.Key("bitmaps");
+            writer.Uint64(field_usage.bitmaps);
+            writer.Key("bytes");
+            writer.Uint64(field_usage.bytes);
+            writer.EndObject();
+        }
+        writer.EndObject();
+        writer.Key("resultCacheBytes");
+        writer.Uint64(usage.result_cache_bytes);
+        writer.Key("vectorArenaBytes");
+        writer.Uint64(usage.vector_arena_bytes);
+        writer.Key("idMapBytes");
+        writer.Uint64(usage.id_map_bytes);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    response.finish(res);
+}
+
+bool HttpServer::checkMemoryBudget(httplib::Response &res)
+{
+    if (!m_collections->isOverMemoryBudget())
+    {
+        return true;
+    }
+    static Counter &rejections =
+        getGlobalMetrics()->counter("vdb_memory_budget_rejections_total", "Writes rejected above the memory budget");
+    rejections.inc();
+    res.status = 503;
+    setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, "Memory budget exceeded, writes are paused");
+    return false;
+}
+
+std::shared_ptr<VectorDB> HttpServer::getCollection(const rapidjson::Document &json_request, httplib::Response &res)
+{
+    std::string name = DEFAULT_COLLECTION_NAME;
+    if (json_request.IsObject() && json_request.HasMember(REQUEST_COLLECTION) &&
+        json_request[REQUEST_COLLECTION].IsString())
+    {
+        name = json_request[REQUEST_COLLECTION].GetString();
+    }
+
+    std::shared_ptr<VectorDB> collection = m_collections->getCollection(name);
+    if (collection == nullptr)
+    {
+        std::string error_msg = std::format("Collection {} does not exist", name);
+        GlobalLogger->error("<Server> " + error_msg);
+        res.status = 404;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+    }
+    return collection;
+}
+
+void HttpServer::setSlowQueryThreshold(u64 threshold_ms)
+{
+    m_slow_query_threshold_ns = threshold_ms * 1000 * 1000;
+}
+
+void HttpServer::setServerOptions(const EventServerOptions &options)
+{
+    m_server.setOptions(options);
+}
+
+void HttpServer::writeSearchResults(JsonResponseWriter::Writer &writer,
+                                    const std::pair<std::vector<i64>, std::vector<f32>> &results,
+                                    const char *value_key)
+{
+    bool valid_results = false;
+    for (i64 label : results.first)
+    {
+        valid_results = valid_results || label != -1;
+    }
+    if (!valid_results)
+    {
+        return;
+    }
+
+    writer.Key(RESPONSE_VECTORS);
+    writer.StartArray();
+    for (i64 label : results.first)
+    {
+        if (label != -1)
+        {
+            // ids are u64 carried in the i64 labels, -1 being IdMap::kReservedId
+            writer.Uint64(static_cast<u64>(label));
+        }
+    }
+    writer.EndArray();
+
+    writer.Key(value_key);
+    writer.StartArray();
+    for (size_t i = 0; i < results.first.size(); ++i)
+    {
+        if (results.first[i] != -1)
+        {
+            writer.Double(results.second[i]);
+        }
+    }
+    writer.EndArray();
+}
+
+void HttpServer::writeSearchProfile(JsonResponseWriter::Writer &writer, const SearchProfile &profile)
+{
+    writer.StartObject();
+    writer.Key(REQUEST_INDEX_TYPE);
+    std::string index_type = std::format("{}", profile.index_type);
+    writer.String(index_type.c_str(), static_cast<rapidjson::SizeType>(index_type.size()));
+    writer.Key("jsonParseUs");
+    writer.Double(profile.json_parse_ns / 1e3);
+    writer.Key("filterBitmapUs");
+    writer.Double(profile.filter_bitmap_ns / 1e3);
+    writer.Key("faissSearchUs");
+    writer.Double(profile.faiss_search_ns / 1e3);
+    if (profile.sparse_search_ns > 0)
+    {
+        writer.Key("sparseSearchUs");
+        writer.Double(profile.sparse_search_ns / 1e3);
+    }
+    if (profile.rerank_candidates > 0)
+    {
+        writer.Key("rerankUs");
+        writer.Double(profile.rerank_ns / 1e3);
+        writer.Key("rerankCandidates");
+        writer.Uint64(profile.rerank_candidates);
+    }
+    writer.Key("totalUs");
+    writer.Double(profile.total_ns / 1e3);
+    writer.Key("filtered");
+    writer.Bool(profile.filtered);
+    writer.Key("filterCardinality");
+    writer.Uint64(profile.filter_cardinality);
+    writer.Key("cacheHit");
+    writer.Bool(profile.cache_hit);
+    if (profile.index_type == IndexFactory::IndexType::HNSW)
+    {
+        writer.Key("hnswNdis");
+        writer.Uint64(profile.search_stats.hnsw_ndis);
+        writer.Key("hnswNhops");
+        writer.Uint64(profile.search_stats.hnsw_nhops);
+    }
+    writer.EndObject();
 }
 
-void HttpServer::setJsonResponse(const rapidjson::Document &json_response, httplib::Response &res)
+void HttpServer::writeCompactionReport(JsonResponseWriter::Writer &writer, const CompactionReport &report)
 {
-    rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    json_response.Accept(writer);
-    res.set_content(buffer.GetString(), RESPONSE_CONTENT_TYPE_JSON);
+    writer.StartObject();
+    writer.Key("shards");
+    writer.Uint64(report.shards_compacted);
+    writer.Key("vectors");
+    writer.Uint64(report.vectors);
+    writer.Key("tombstonesRemoved");
+    writer.Uint64(report.tombstones_removed);
+    writer.Key("replayedWrites");
+    writer.Uint64(report.replayed_writes);
+    writer.Key("memoryBeforeBytes");
+    writer.Uint64(report.memory_before_bytes);
+    writer.Key("memoryAfterBytes");
+    writer.Uint64(report.memory_after_bytes);
+    writer.Key("recallBefore");
+    writer.Double(report.recall_before);
+    writer.Key("recallAfter");
+    writer.Double(report.recall_after);
+    writer.Key("durationMs");
+    writer.Uint64(report.duration_ms);
+    writer.EndObject();
+}
+
+void HttpServer::logSlowQuery(const rapidjson::Document &json_request, const std::string &collection, i32 k,
+                              const SearchProfile &profile)
+{
+    std::string filter = "none";
+    if (json_request.HasMember(REQUEST_FILTER) && json_request[REQUEST_FILTER].IsObject())
+    {
+        rapidjson::StringBuffer buffer;
+        JsonWriter<rapidjson::StringBuffer> writer(buffer);
+        json_request[REQUEST_FILTER].Accept(writer);
+        filter = buffer.GetString();
+    }
+
+    SlowQueryLogger->info("search total_us={:.1f} json_parse_us={:.1f} filter_bitmap_us={:.1f} faiss_search_us={:.1f} "
+                          "rerank_us={:.1f} serialize_us={:.1f} collection={} index={} k={} filter={} "
+                          "filter_cardinality={} rerank_candidates={} hnsw_ndis={} hnsw_nhops={}",
+                          profile.total_ns / 1e3, profile.json_parse_ns / 1e3, profile.filter_bitmap_ns / 1e3,
+                          profile.faiss_search_ns / 1e3, profile.rerank_ns / 1e3, profile.serialize_ns / 1e3,
+                          collection, std::format("{}", profile.index_type), k, filter, profile.filter_cardinality,
+                          profile.rerank_candidates, profile.search_stats.hnsw_ndis, profile.search_stats.hnsw_nhops);
+}
+
+void HttpServer::metricsHandler(const httplib::Request &req, httplib::Response &res)
+{
+    m_collections->updateMetrics();
+    res.set_content(getGlobalMetrics()->exposition(), RESPONSE_CONTENT_TYPE_PROMETHEUS);
 }
 
 void HttpServer::setErrorJsonResponse(httplib::Response &res, i32 error_code, const std::string &error_msg)
 {
-    rapidjson::Document json_response;
-    json_response.SetObject();
-    rapidjson::Document::AllocatorType &allocator = json_response.GetAllocator();
-    json_response.AddMember(RESPONSE_RETCODE, error_code, allocator);
-    json_response.AddMember(RESPONSE_ERROR_MSG, rapidjson::StringRef(error_msg.c_str()), allocator);
-    setJsonResponse(json_response, res);
+    JsonResponseWriter response;
+    auto &writer = response.writer();
+    writer.Key(RESPONSE_ERROR_MSG);
+    writer.String(error_msg.c_str(), static_cast<rapidjson::SizeType>(error_msg.size()));
+    response.finish(res, error_code);
+}
+
+bool HttpServer::checkVectorDim(httplib::Response &res, const FaissIndex *index, const std::vector<f32> &vectors,
+                                bool allow_batch)
+{
+    size_t dim = static_cast<size_t>(index->getDim());
+    bool valid = allow_batch ? !vectors.empty() && vectors.size() % dim == 0 : vectors.size() == dim;
+    if (!valid)
+    {
+        std::string error_msg = std::format("Vector dimension mismatch: got {} values, index dimension is {}",
+                                            vectors.size(), dim);
+        GlobalLogger->error("<Server> " + error_msg);
+        res.status = 400;
+        setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+    }
+    return valid;
+}
+
+bool HttpServer::checkWritable(httplib::Response &res, IndexFactory::IndexType index_type, const FaissIndex *index)
+{
+    std::string error_msg;
+    if (index_type == IndexFactory::IndexType::IVF)
+    {
+        error_msg = "IVF indexes are bulk-built via /admin/build";
+    }
+    else if (!index->isTrained())
+    {
+        error_msg = std::format("Index type {} is not trained yet, bulk-build it via /admin/build first", index_type);
+    }
+    else
+    {
+        return true;
+    }
+    GlobalLogger->error("<Server> " + error_msg);
+    res.status = 400;
+    setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+    return false;
+}
+
+bool HttpServer::getBinaryVectors(httplib::Response &res, const BinaryIndex *index,
+                                  const rapidjson::Document &json_request, bool allow_batch, std::vector<u8> &codes)
+{
+    size_t code_size = static_cast<size_t>(index->getCodeSize());
+    std::string error_msg;
+    if (!json_request.HasMember(REQUEST_BINARY_VECTORS) ||
+        !getBinaryVectorFromJson(json_request[REQUEST_BINARY_VECTORS], codes))
+    {
+        error_msg = "binaryVectors must be a base64 string or an array of byte values";
+    }
+    else if (allow_batch ? codes.empty() || codes.size() % code_size != 0 : codes.size() != code_size)
+    {
+        error_msg = std::format("Binary vector size mismatch: got {} bytes, index code size is {}", codes.size(),
+                                code_size);
+    }
+    else
+    {
+        return true;
+    }
+    GlobalLogger->error("<Server> " + error_msg);
+    res.status = 400;
+    setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+    return false;
+}
+
+bool HttpServer::getSparseVector(httplib::Response &res, const rapidjson::Document &json_request,
+                                 std::vector<u32> &indices, std::vector<f32> &values)
+{
+    if (json_request.HasMember(REQUEST_SPARSE_VECTOR) &&
+        getSparseVectorFromJson(json_request[REQUEST_SPARSE_VECTOR], indices, values))
+    {
+        return true;
+    }
+    std::string error_msg =
+        "sparseVector must hold equally long \"indices\" (term ids) and \"values\" (non-negative weights)";
+    GlobalLogger->error("<Server> " + error_msg);
+    res.status = 400;
+    setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+    return false;
+}
+
+bool HttpServer::checkPrefilter(httplib::Response &res, const VectorDB &collection,
+                                const rapidjson::Document &json_request, IndexFactory::IndexType index_type,
+                                size_t query_num)
+{
+    IndexFactory::IndexType prefilter_type = getIndexTypeFromString(json_request[REQUEST_PREFILTER].GetString());
+    const BinaryIndex *prefilter = collection.getBinaryIndex(prefilter_type);
+    std::string error_msg;
+    std::vector<u8> codes;
+    if (prefilter == nullptr)
+    {
+        error_msg = std::format("Prefilter {} is not a binary index of the collection",
+                                json_request[REQUEST_PREFILTER].GetString());
+    }
+    else if (index_type == IndexFactory::IndexType::IVF)
+    {
+        // IVF keeps no direct map, its vectors cannot be read back for the re-rank
+        error_msg = "A prefiltered search cannot re-rank on an IVF index";
+    }
+    else if (!getBinaryVectors(res, prefilter, json_request, true, codes))
+    {
+        return false;
+    }
+    else if (codes.size() / prefilter->getCodeSize() != query_num)
+    {
+        error_msg = std::format("Prefilter takes one binary vector per query: got {} for {} queries",
+                                codes.size() / prefilter->getCodeSize(), query_num);
+    }
+    else
+    {
+        return true;
+    }
+    GlobalLogger->error("<Server> " + error_msg);
+    res.status = 400;
+    setErrorJsonResponse(res, RESPONSE_RETCODE_ERROR, error_msg);
+    return false;
 }
 
 bool HttpServer::isRequestValid(const rapidjson::Document &json_request, CheckType check_type)
@@ -314,17 +1463,89 @@ bool HttpServer::isRequestValid(const rapidjson::Document &json_request, CheckTy
     switch (check_type)
     {
     case CheckType::SEARCH:
-        return json_request.HasMember(REQUEST_VECTORS) && json_request.HasMember(REQUEST_K) &&
-               (!json_request.HasMember(REQUEST_INDEX_TYPE) || json_request[REQUEST_INDEX_TYPE].IsString());
+        return (json_request.HasMember(REQUEST_VECTORS) || json_request.HasMember(REQUEST_BINARY_VECTORS) ||
+                json_request.HasMember(REQUEST_SPARSE_VECTOR)) &&
+               json_request.HasMember(REQUEST_K) && json_request[REQUEST_K].IsInt() &&
+               json_request[REQUEST_K].GetInt() > 0 &&
+               (!json_request.HasMember(REQUEST_FILTER) || isFilterValid(json_request[REQUEST_FILTER])) &&
+               (!json_request.HasMember(REQUEST_PREFILTER) || json_request[REQUEST_PREFILTER].IsString()) &&
+               (!json_request.HasMember(REQUEST_INDEX_TYPE) || json_request[REQUEST_INDEX_TYPE].IsString()) &&
+               (!json_request.HasMember(REQUEST_NPROBE) ||
+                (json_request[REQUEST_NPROBE].IsInt() && json_request[REQUEST_NPROBE].GetInt() > 0)) &&
+               (!json_request.HasMember(REQUEST_OVERSAMPLE) ||
+                (json_request[REQUEST_OVERSAMPLE].IsInt() && json_request[REQUEST_OVERSAMPLE].GetInt() >= 0));
+    case CheckType::RANGE_SEARCH:
+        return json_request.HasMember(REQUEST_VECTORS) && json_request.HasMember(REQUEST_RADIUS) &&
+               json_request[REQUEST_RADIUS].IsNumber() &&
+               (!json_request.HasMember(REQUEST_FILTER) || isFilterValid(json_request[REQUEST_FILTER])) &&
+               (!json_request.HasMember(REQUEST_INDEX_TYPE) || json_request[REQUEST_INDEX_TYPE].IsString()) &&
+               (!json_request.HasMember(REQUEST_OFFSET) || json_request[REQUEST_OFFSET].IsUint64()) &&
+               (!json_request.HasMember(REQUEST_LIMIT) ||
+                (json_request[REQUEST_LIMIT].IsUint64() && json_request[REQUEST_LIMIT].GetUint64() > 0)) &&
+               (!json_request.HasMember(REQUEST_NPROBE) ||
+                (json_request[REQUEST_NPROBE].IsInt() && json_request[REQUEST_NPROBE].GetInt() > 0));
+    case CheckType::HYBRID_SEARCH:
+        return json_request.HasMember(REQUEST_VECTORS) && json_request.HasMember(REQUEST_SPARSE_VECTOR) &&
+               json_request.HasMember(REQUEST_K) && json_request[REQUEST_K].IsInt() &&
+               json_request[REQUEST_K].GetInt() > 0 && json_request.HasMember(REQUEST_INDEX_TYPE) &&
+               json_request[REQUEST_INDEX_TYPE].IsString() &&
+               (!json_request.HasMember(REQUEST_FILTER) || isFilterValid(json_request[REQUEST_FILTER])) &&
+               (!json_request.HasMember(REQUEST_FUSION) || json_request[REQUEST_FUSION] == FUSION_RRF ||
+                json_request[REQUEST_FUSION] == FUSION_WEIGHTED) &&
+               (!json_request.HasMember(REQUEST_DENSE_WEIGHT) ||
+                (json_request[REQUEST_DENSE_WEIGHT].IsNumber() &&
+                 json_request[REQUEST_DENSE_WEIGHT].GetDouble() >= 0)) &&
+               (!json_request.HasMember(REQUEST_SPARSE_WEIGHT) ||
+                (json_request[REQUEST_SPARSE_WEIGHT].IsNumber() &&
+                 json_request[REQUEST_SPARSE_WEIGHT].GetDouble() >= 0)) &&
+               (!json_request.HasMember(REQUEST_RRF_K) ||
+                (json_request[REQUEST_RRF_K].IsNumber() && json_request[REQUEST_RRF_K].GetDouble() > 0)) &&
+               (!json_request.HasMember(REQUEST_CANDIDATES) ||
+                (json_request[REQUEST_CANDIDATES].IsInt() && json_request[REQUEST_CANDIDATES].GetInt() > 0)) &&
+               (!json_request.HasMember(REQUEST_NPROBE) ||
+                (json_request[REQUEST_NPROBE].IsInt() && json_request[REQUEST_NPROBE].GetInt() > 0)) &&
+               (!json_request.HasMember(REQUEST_OVERSAMPLE) ||
+                (json_request[REQUEST_OVERSAMPLE].IsInt() && json_request[REQUEST_OVERSAMPLE].GetInt() >= 0));
+    case CheckType::BUILD:
+        return json_request.HasMember(REQUEST_FILE) && json_request[REQUEST_FILE].IsString() &&
+               json_request.HasMember(REQUEST_INDEX_TYPE) && json_request[REQUEST_INDEX_TYPE].IsString() &&
+               (!json_request.HasMember(REQUEST_START_ID) || json_request[REQUEST_START_ID].IsUint64());
     case CheckType::INSERT:
-        return json_request.HasMember(REQUEST_VECTORS) && json_request.HasMember(REQUEST_ID) &&
+        return (json_request.HasMember(REQUEST_VECTORS) || json_request.HasMember(REQUEST_BINARY_VECTORS) ||
+                json_request.HasMember(REQUEST_SPARSE_VECTOR)) &&
+               isIdValid(json_request) &&
                (!json_request.HasMember(REQUEST_INDEX_TYPE) || json_request[REQUEST_INDEX_TYPE].IsString());
     case CheckType::UPSERT:
-        return json_request.HasMember(REQUEST_VECTORS) && json_request.HasMember(REQUEST_ID) &&
+        return (json_request.HasMember(REQUEST_VECTORS) || json_request.HasMember(REQUEST_BINARY_VECTORS) ||
+                json_request.HasMember(REQUEST_SPARSE_VECTOR)) &&
+               isIdValid(json_request) &&
                (!json_request.HasMember(REQUEST_INDEX_TYPE) || json_request[REQUEST_INDEX_TYPE].IsString());
     case CheckType::QQUERY:
-        return json_request.HasMember(REQUEST_ID) &&
+        return isIdValid(json_request) &&
                (!json_request.HasMember(REQUEST_INDEX_TYPE) || json_request[REQUEST_INDEX_TYPE].IsString());
+    case CheckType::REMOVE: {
+        // exactly one of an id list and a filter, so a malformed filter never deletes by accident
+        if (json_request.HasMember(REQUEST_IDS) == json_request.HasMember(REQUEST_FILTER))
+        {
+            return false;
+        }
+        if (json_request.HasMember(REQUEST_IDS))
+        {
+            if (!json_request[REQUEST_IDS].IsArray())
+            {
+                return false;
+            }
+            for (const auto &id : json_request[REQUEST_IDS].GetArray())
+            {
+                if (!id.IsUint64())
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        return isFilterValid(json_request[REQUEST_FILTER]);
+    }
     default:
         return false;
     }
@@ -1,6 +1,10 @@
 #pragma once
 
+#include "collection_manager.hh"
+#include "event_server.hh"
+#include "json_response.hh"
 #include "vectordb.hh"
+#include <memory>
 #include <httplib.h>
 #include <rapidjson/document.h>
 #include <string>
@@ -13,28 +17,75 @@ class HttpServer
     enum class CheckType
     {
         SEARCH,
+        RANGE_SEARCH,
         INSERT,
         UPSERT,
-        QQUERY
+        QQUERY,
+        REMOVE,
+        BUILD,
+        HYBRID_SEARCH
     };
 
-    HttpServer(const std::string &host, i32 port, VectorDB *vdb);
+    HttpServer(const std::string &host, i32 port, CollectionManager *collections);
     void start();
+    /// searches slower than this are written to the slow-query log
+    void setSlowQueryThreshold(u64 threshold_ms);
+    /// worker pool size, queue and connection limits and request deadline; set before start()
+    void setServerOptions(const EventServerOptions &options);
 
   private:
     void searchHandler(const httplib::Request &req, httplib::Response &res);
+    void rangeSearchHandler(const httplib::Request &req, httplib::Response &res);
+    void hybridSearchHandler(const httplib::Request &req, httplib::Response &res);
     void insertHandler(const httplib::Request &req, httplib::Response &res);
     void upsertHandler(const httplib::Request &req, httplib::Response &res);
     void queryHandler(const httplib::Request &req, httplib::Response &res);
+    void deleteHandler(const httplib::Request &req, httplib::Response &res);
     void snapshotHandler(const httplib::Request &req, httplib::Response &res);
-    void setJsonResponse(const rapidjson::Document &json_response, httplib::Response &res);
+    void buildHandler(const httplib::Request &req, httplib::Response &res);
+    void compactHandler(const httplib::Request &req, httplib::Response &res);
+    void compactionStatusHandler(const httplib::Request &req, httplib::Response &res);
+    void createCollectionHandler(const httplib::Request &req, httplib::Response &res);
+    void dropCollectionHandler(const httplib::Request &req, httplib::Response &res);
+    void listCollectionsHandler(const httplib::Request &req, httplib::Response &res);
+    void memoryHandler(const httplib::Request &req, httplib::Response &res);
+    void metricsHandler(const httplib::Request &req, httplib::Response &res);
     void setErrorJsonResponse(httplib::Response &res, i32 error_code, const std::string &error_msg);
+    /// the collection named by the request, or the default one; answers 404 when it does not exist
+    std::shared_ptr<VectorDB> getCollection(const rapidjson::Document &json_request, httplib::Response &res);
     bool isRequestValid(const rapidjson::Document &json_request, CheckType check_type);
+    /// search takes one or more concatenated vectors, insert and upsert exactly one
+    bool checkVectorDim(httplib::Response &res, const FaissIndex *index, const std::vector<f32> &vectors,
+                        bool allow_batch);
+    /// IVF indexes are only filled by bulk builds, after training
+    bool checkWritable(httplib::Response &res, IndexFactory::IndexType index_type, const FaissIndex *index);
+    /// answers 503 while the process is above the memory budget
+    bool checkMemoryBudget(httplib::Response &res);
+    /// decode the binaryVectors of the request into `codes`: one or more codes of `index` for a
+    /// search, exactly one for insert and upsert
+    bool getBinaryVectors(httplib::Response &res, const BinaryIndex *index, const rapidjson::Document &json_request,
+                          bool allow_batch, std::vector<u8> &codes);
+    /// decode the sparseVector of the request
+    bool getSparseVector(httplib::Response &res, const rapidjson::Document &json_request, std::vector<u32> &indices,
+                         std::vector<f32> &values);
+    /// a prefilter names a binary index of the collection, carries one code per query and
+    /// re-ranks on an index whose vectors can be read back
+    bool checkPrefilter(httplib::Response &res, const VectorDB &collection, const rapidjson::Document &json_request,
+                        IndexFactory::IndexType index_type, size_t query_num);
+    /// the ids of `results` under "vectors" and their values under `value_key`, -1 labels skipped;
+    /// nothing when no label is valid
+    void writeSearchResults(JsonResponseWriter::Writer &writer,
+                            const std::pair<std::vector<i64>, std::vector<f32>> &results, const char *value_key);
+    void writeSearchProfile(JsonResponseWriter::Writer &writer, const SearchProfile &profile);
+    void writeCompactionReport(JsonResponseWriter::Writer &writer, const CompactionReport &report);
+    void logSlowQuery(const rapidjson::Document &json_request, const std::string &collection, i32 k,
+                      const SearchProfile &profile);
 
   private:
-    httplib::Server m_server;
+    EventServer m_server;
     std::string m_host;
     i32 m_port;
-    VectorDB *m_vector_db;
+    CollectionManager *m_collections;
+    u64 m_slow_query_threshold_ns = 100ull * 1000 * 1000;
 };
 } // namespace vdb
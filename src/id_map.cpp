@@ -0,0 +1,291 @@
+#include "id_map.hh"
+#include "logger.hh"
+#include <cstring>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+
+namespace vdb
+{
+
+namespace
+{
+
+constexpr u32 kIdMapVersion = 1;
+
+template <typename T> void appendValue(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> void appendList(std::string &out, const std::vector<T> &values)
+{
+    appendValue<u64>(out, values.size());
+    out.append(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(T));
+}
+
+/// reads fixed-size values from a serialized map, throwing on truncated data
+class Reader
+{
+  public:
+    explicit Reader(const std::string &data) : m_data(data)
+    {
+    }
+
+    template <typename T> T value()
+    {
+        T result;
+        take(&result, sizeof(T));
+        return result;
+    }
+
+    template <typename T> std::vector<T> list()
+    {
+        u64 count = value<u64>();
+        if (count > (m_data.size() - m_offset) / sizeof(T))
+        {
+            throw std::runtime_error("Truncated id map");
+        }
+        std::vector<T> values(count);
+        take(values.data(), count * sizeof(T));
+        return values;
+    }
+
+  private:
+    void take(void *out, size_t bytes)
+    {
+        if (m_data.size() - m_offset < bytes)
+        {
+            throw std::runtime_error("Truncated id map");
+        }
+        std::memcpy(out, m_data.data() + m_offset, bytes);
+        m_offset += bytes;
+    }
+
+    const std::string &m_data;
+    size_t m_offset = 0;
+};
+
+} // namespace
+
+u32 IdMap::assign(u64 id)
+{
+    if (id == kReservedId)
+    {
+        throw std::invalid_argument(std::format("Id {} is reserved", id));
+    }
+    {
+        std::shared_lock lock(m_mutex);
+        auto it = m_ordinals.find(id);
+        if (it != m_ordinals.end())
+        {
+            return it->second;
+        }
+    }
+
+    std::unique_lock lock(m_mutex);
+    auto it = m_ordinals.find(id);
+    if (it != m_ordinals.end())
+    {
+        return it->second;
+    }
+    u32 ordinal;
+    if (!m_free.empty())
+    {
+        ordinal = m_free.back();
+        m_free.pop_back();
+        m_ids[ordinal] = id;
+    }
+    else if (m_ids.size() <= std::numeric_limits<u32>::max())
+    {
+        ordinal = static_cast<u32>(m_ids.size());
+        m_ids.push_back(id);
+    }
+    else
+    {
+        throw std::length_error("All 2^32 ordinals of the collection are in use");
+    }
+    m_ordinals.emplace(id, ordinal);
+    return ordinal;
+}
+
+std::optional<u32> IdMap::release(u64 id)
+{
+    std::unique_lock lock(m_mutex);
+    auto it = m_ordinals.find(id);
+    if (it == m_ordinals.end())
+    {
+        return std::nullopt;
+    }
+    u32 ordinal = it->second;
+    m_ordinals.erase(it);
+    m_retired.push_back(ordinal);
+    return ordinal;
+}
+
+void IdMap::recycle()
+{
+    std::unique_lock lock(m_mutex);
+    m_free.insert(m_free.end(), m_cooling.begin(), m_cooling.end());
+    m_cooling.swap(m_retired);
+    m_retired.clear();
+}
+
+std::optional<u32> IdMap::find(u64 id) const
+{
+    std::shared_lock lock(m_mutex);
+    auto it = m_ordinals.find(id);
+    if (it == m_ordinals.end())
+    {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+void IdMap::toExternal(std::vector<i64> &labels) const
+{
+    std::shared_lock lock(m_mutex);
+    for (i64 &label : labels)
+    {
+        if (label >= 0 && static_cast<u64>(label) < m_ids.size())
+        {
+            label = static_cast<i64>(m_ids[label]);
+        }
+    }
+}
+
+std::vector<u64> IdMap::toExternal(const roaring_bitmap_t *bitmap) const
+{
+    std::vector<u32> ordinals(roaring_bitmap_get_cardinality(bitmap));
+    roaring_bitmap_to_uint32_array(bitmap, ordinals.data());
+
+    std::vector<u64> ids;
+    ids.reserve(ordinals.size());
+    std::shared_lock lock(m_mutex);
+    for (u32 ordinal : ordinals)
+    {
+        if (ordinal < m_ids.size())
+        {
+            ids.push_back(m_ids[ordinal]);
+        }
+    }
+    return ids;
+}
+
+u64 IdMap::size() const
+{
+    std::shared_lock lock(m_mutex);
+    return m_ordinals.size();
+}
+
+u64 IdMap::getMemoryUsage() const
+{
+    std::shared_lock lock(m_mutex);
+    // hash node per id plus the bucket array
+    u64 bytes = m_ordinals.size() * (sizeof(std::pair<const u64, u32>) + sizeof(void *)) +
+                m_ordinals.bucket_count() * sizeof(void *);
+    bytes += m_ids.capacity() * sizeof(u64);
+    bytes += (m_free.capacity() + m_retired.capacity() + m_cooling.capacity()) * sizeof(u32);
+    return bytes;
+}
+
+void IdMap::saveIndex(ScalarStorage &scalar_storage, const std::string &key) const
+{
+    std::string data;
+    {
+        std::shared_lock lock(m_mutex);
+        data.reserve(sizeof(u32) + 4 * sizeof(u64) + m_ids.size() * sizeof(u64) +
+                     (m_free.size() + m_retired.size() + m_cooling.size()) * sizeof(u32));
+        appendValue(data, kIdMapVersion);
+        appendList(data, m_ids);
+        appendList(data, m_free);
+        appendList(data, m_retired);
+        appendList(data, m_cooling);
+    }
+    scalar_storage.put(key, data);
+}
+
+bool IdMap::loadIndex(ScalarStorage &scalar_storage, const std::string &key)
+{
+    std::string data = scalar_storage.get(key);
+    std::unique_lock lock(m_mutex);
+    clear();
+    if (data.empty())
+    {
+        return false;
+    }
+
+    Reader reader(data);
+    u32 version = reader.value<u32>();
+    if (version != kIdMapVersion)
+    {
+        throw std::runtime_error(std::format("Unsupported id map version {} under {}", version, key));
+    }
+    m_ids = reader.list<u64>();
+    m_free = reader.list<u32>();
+    m_retired = reader.list<u32>();
+    m_cooling = reader.list<u32>();
+
+    // ordinals in none of the lists are the live ones
+    std::vector<bool> unused(m_ids.size(), false);
+    for (const std::vector<u32> *list : {&m_free, &m_retired, &m_cooling})
+    {
+        for (u32 ordinal : *list)
+        {
+            if (ordinal >= m_ids.size())
+            {
+                throw std::runtime_error(std::format("Id map under {} lists unknown ordinal {}", key, ordinal));
+            }
+            unused[ordinal] = true;
+        }
+    }
+    m_ordinals.reserve(m_ids.size());
+    for (size_t ordinal = 0; ordinal < m_ids.size(); ++ordinal)
+    {
+        if (!unused[ordinal])
+        {
+            m_ordinals.emplace(m_ids[ordinal], static_cast<u32>(ordinal));
+        }
+    }
+    GlobalLogger->info("<IdMap> Loaded {} ids over {} ordinals from {}", m_ordinals.size(), m_ids.size(), key);
+    return true;
+}
+
+void IdMap::seedIdentity(const roaring_bitmap_t *ids)
+{
+    std::unique_lock lock(m_mutex);
+    clear();
+    if (roaring_bitmap_is_empty(ids))
+    {
+        return;
+    }
+    std::vector<u32> values(roaring_bitmap_get_cardinality(ids));
+    roaring_bitmap_to_uint32_array(ids, values.data());
+    m_ids.assign(static_cast<size_t>(values.back()) + 1, kReservedId);
+    m_ordinals.reserve(values.size());
+    for (u32 value : values)
+    {
+        m_ids[value] = value;
+        m_ordinals.emplace(value, value);
+    }
+    // the gaps between the old ids are never referenced, new ids fill them first
+    for (size_t ordinal = m_ids.size(); ordinal-- > 0;)
+    {
+        if (m_ids[ordinal] == kReservedId)
+        {
+            m_free.push_back(static_cast<u32>(ordinal));
+        }
+    }
+    GlobalLogger->info("<IdMap> Mapped {} existing ids to themselves", m_ordinals.size());
+}
+
+void IdMap::clear()
+{
+    m_ordinals.clear();
+    m_ids.clear();
+    m_free.clear();
+    m_retired.clear();
+    m_cooling.clear();
+}
+
+} // namespace vdb
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "scalar_storage.hh"
+#include "types.hh"
+#include <limits>
+#include <optional>
+#include <roaring/roaring.h>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vdb
+{
+
+/// External u64 document ids of one collection and the dense u32 ordinals standing for them
+/// inside the faiss and filter indexes, whose labels and bitmaps hold ordinals only. VectorDB
+/// translates at its boundary: ids to ordinals on writes, ordinals back to ids in results.
+///
+/// An ordinal is allocated when an id is first written and retired when it is removed. Retired
+/// ordinals are handed out again two recycle() calls later, one per compaction pass, so a search
+/// that started before the removal never translates a result to the id reusing its ordinal.
+class IdMap
+{
+  public:
+    /// reads as -1, the label faiss and the search results use for "no result"
+    static constexpr u64 kReservedId = std::numeric_limits<u64>::max();
+
+    IdMap() = default;
+    IdMap(const IdMap &) = delete;
+    IdMap &operator=(const IdMap &) = delete;
+
+    /// modify
+    /// ordinal of `id`, allocated if it has none; throws std::invalid_argument for kReservedId and
+    /// std::length_error once all 2^32 ordinals are in use
+    u32 assign(u64 id);
+    /// retire the ordinal of `id`; returns it, or nothing when the id had none
+    std::optional<u32> release(u64 id);
+    /// make the ordinals retired before the previous call available again
+    void recycle();
+
+    /// observe
+    std::optional<u32> find(u64 id) const;
+    /// replace the ordinals in `labels` by their ids, leaving -1 entries alone
+    void toExternal(std::vector<i64> &labels) const;
+    /// ids of the ordinals in `bitmap`
+    std::vector<u64> toExternal(const roaring_bitmap_t *bitmap) const;
+    /// ids holding an ordinal
+    u64 size() const;
+    /// both directions of the map plus the free lists
+    u64 getMemoryUsage() const;
+
+    /// Snapshot
+    void saveIndex(ScalarStorage &scalar_storage, const std::string &key) const;
+    /// returns false when nothing is stored under `key`, leaving the map empty
+    bool loadIndex(ScalarStorage &scalar_storage, const std::string &key);
+    /// Collections written before ids were mapped used their ids as labels and bitmap entries.
+    /// Map each of `ids` to the ordinal of the same value, so those indexes stay valid as loaded;
+    /// new ids get ordinals above the largest one.
+    void seedIdentity(const roaring_bitmap_t *ids);
+
+  private:
+    void clear();
+
+  private:
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<u64, u32> m_ordinals;
+    // id of each ordinal ever allocated; a retired ordinal keeps its last id until reused
+    std::vector<u64> m_ids;
+    std::vector<u32> m_free;
+    // retired since the last recycle(), and retired before it
+    std::vector<u32> m_retired;
+    std::vector<u32> m_cooling;
+};
+
+} // namespace vdb
@@ -2,24 +2,23 @@
 #include "constants.hh"
 #include "filter_index.hh"
 #include "logger.hh"
+#include <faiss/IndexBinaryFlat.h>
+#include <faiss/IndexBinaryHNSW.h>
 #include <faiss/IndexFlat.h>
 #include <faiss/IndexHNSW.h>
 #include <faiss/IndexIDMap.h>
+#include <faiss/IndexIVFFlat.h>
+#include <faiss/IndexIVFPQ.h>
+#include <faiss/IndexPQ.h>
+#include <faiss/IndexScalarQuantizer.h>
+#include <faiss/invlists/OnDiskInvertedLists.h>
+#include <algorithm>
 #include <format>
+#include <stdexcept>
 
 namespace vdb
 {
 
-namespace
-{
-IndexFactory globalIndexFactory;
-}
-
-IndexFactory *getGlobalIndexFactory()
-{
-    return &globalIndexFactory;
-}
-
 IndexFactory::~IndexFactory()
 {
     for (auto [index_type, index_ptr] : m_index_map)
@@ -27,7 +26,11 @@ IndexFactory::~IndexFactory()
         switch (index_type)
         {
         case IndexType::FLAT:
-        case IndexType::HNSW: {
+        case IndexType::HNSW:
+        case IndexType::IVF:
+        case IndexType::PQ:
+        case IndexType::SQ:
+        case IndexType::IVFPQ: {
             delete static_cast<FaissIndex *>(index_ptr);
             break;
         }
@@ -35,15 +38,29 @@ IndexFactory::~IndexFactory()
             delete static_cast<FilterIndex *>(index_ptr);
             break;
         }
+        case IndexType::BINARY_FLAT:
+        case IndexType::BINARY_HNSW: {
+            delete static_cast<BinaryIndex *>(index_ptr);
+            break;
+        }
+        case IndexType::SPARSE: {
+            delete static_cast<SparseIndex *>(index_ptr);
+            break;
+        }
         default:
             break;
         }
     }
 }
 
-void IndexFactory::init(IndexType type, i32 dim, MetricType metric)
+void IndexFactory::init(IndexType type, i32 dim, MetricType metric, const IndexParams &params,
+                        const std::string &data_path)
 {
     faiss::MetricType faiss_metric = (metric == MetricType::L2) ? faiss::METRIC_L2 : faiss::METRIC_INNER_PRODUCT;
+    FaissIndexOptions options;
+    options.normalize = metric == MetricType::COSINE;
+    options.search_batch_window_us = params.search_batch_window_us;
+    options.search_batch_max = params.search_batch_max;
 
     void *index = getIndex(type);
     if (index != nullptr)
@@ -53,23 +70,126 @@ void IndexFactory::init(IndexType type, i32 dim, MetricType metric)
         return;
     }
 
+    // the id map owns the wrapped index so that a shard is freed as a whole, like read_index does
+    auto wrap = [](faiss::Index *index) {
+        auto *id_map = new faiss::IndexIDMap(index);
+        id_map->own_fields = true;
+        return static_cast<faiss::Index *>(id_map);
+    };
+
+    std::shared_ptr<VectorArena> arena;
+    if (params.shared_vectors && (type == IndexType::FLAT || type == IndexType::HNSW))
+    {
+        if (!m_arena)
+        {
+            m_arena = std::make_shared<VectorArena>(dim);
+        }
+        arena = m_arena;
+        options.arena = arena;
+    }
+
     switch (type)
     {
     case IndexType::FLAT: {
-        m_index_map[type] = new FaissIndex(new faiss::IndexIDMap(new faiss::IndexFlat(dim, faiss_metric)));
+        options.make_shard = [=](size_t) {
+            if (arena)
+            {
+                return wrap(new ArenaFlatStorage(arena, faiss_metric));
+            }
+            return wrap(new faiss::IndexFlat(dim, faiss_metric));
+        };
         break;
     }
     case IndexType::HNSW: {
-        m_index_map[type] = new FaissIndex(new faiss::IndexIDMap(new faiss::IndexHNSWFlat(dim, 32, faiss_metric)));
+        options.make_shard = [=](size_t) {
+            auto *hnsw_index = new faiss::IndexHNSWFlat(dim, params.hnsw_m, faiss_metric);
+            if (arena)
+            {
+                // the graph references the shared rows instead of a copy of its own
+                delete hnsw_index->storage;
+                hnsw_index->storage = new ArenaFlatStorage(arena, faiss_metric);
+            }
+            hnsw_index->hnsw.efConstruction = params.hnsw_ef_construction;
+            hnsw_index->hnsw.efSearch = params.hnsw_ef_search;
+            return wrap(hnsw_index);
+        };
+        options.hnsw_ef_search = params.hnsw_ef_search;
+        options.write_buffer = params.hnsw_write_buffer;
+        break;
+    }
+    case IndexType::IVF: {
+        // only the coarse centroids stay in memory; the lists live in one file per shard and are
+        // paged in through mmap. Nothing is written to the file before a build or a snapshot load.
+        std::string lists_path = std::format("{}.{}.ivfdata", data_path, type);
+        i32 shards = std::max(params.shards, 1);
+        options.make_shard = [=](size_t shard) {
+            auto *ivf_index =
+                new faiss::IndexIVFFlat(new faiss::IndexFlat(dim, faiss_metric), dim, params.ivf_nlist, faiss_metric);
+            ivf_index->own_fields = true;
+            ivf_index->nprobe = params.ivf_nprobe;
+            std::string file_path = shards == 1 ? lists_path : std::format("{}.shard{}", lists_path, shard);
+            ivf_index->replace_invlists(
+                new faiss::OnDiskInvertedLists(ivf_index->nlist, ivf_index->code_size, file_path.c_str()), true);
+            return wrap(ivf_index);
+        };
+        options.ivf_nprobe = params.ivf_nprobe;
+        break;
+    }
+    case IndexType::PQ: {
+        options.make_shard = [=](size_t) { return wrap(new faiss::IndexPQ(dim, params.pq_m, 8, faiss_metric)); };
+        break;
+    }
+    case IndexType::SQ: {
+        options.make_shard = [=](size_t) {
+            return wrap(new faiss::IndexScalarQuantizer(dim, faiss::ScalarQuantizer::QT_8bit, faiss_metric));
+        };
+        break;
+    }
+    case IndexType::IVFPQ: {
+        options.make_shard = [=](size_t) {
+            auto *ivf_index = new faiss::IndexIVFPQ(new faiss::IndexFlat(dim, faiss_metric), dim, params.ivf_nlist,
+                                                    params.pq_m, 8, faiss_metric);
+            ivf_index->own_fields = true;
+            ivf_index->nprobe = params.ivf_nprobe;
+            return wrap(ivf_index);
+        };
+        options.ivf_nprobe = params.ivf_nprobe;
         break;
     }
     case IndexType::FILTER: {
         m_index_map[type] = new FilterIndex();
         break;
     }
+    case IndexType::BINARY_FLAT: {
+        m_index_map[type] = new BinaryIndex([=] { return new faiss::IndexBinaryFlat(dim); });
+        break;
+    }
+    case IndexType::BINARY_HNSW: {
+        m_index_map[type] = new BinaryIndex([=] {
+            auto *hnsw_index = new faiss::IndexBinaryHNSW(dim, params.hnsw_m);
+            hnsw_index->hnsw.efConstruction = params.hnsw_ef_construction;
+            hnsw_index->hnsw.efSearch = params.hnsw_ef_search;
+            return hnsw_index;
+        });
+        break;
+    }
+    case IndexType::SPARSE: {
+        m_index_map[type] = new SparseIndex();
+        break;
+    }
     default:
         break;
     }
+
+    if (options.make_shard)
+    {
+        std::vector<faiss::Index *> shards;
+        for (i32 i = 0; i < std::max(params.shards, 1); ++i)
+        {
+            shards.push_back(options.make_shard(i));
+        }
+        m_index_map[type] = new FaissIndex(shards, options);
+    }
 }
 
 void *IndexFactory::getIndex(IndexType type) const
@@ -84,7 +204,8 @@ void *IndexFactory::getIndex(IndexType type) const
 
 FaissIndex *IndexFactory::getFaissIndex(IndexType type) const
 {
-    if (type != IndexType::HNSW && type != IndexType::FLAT)
+    if (type == IndexType::FILTER || type == IndexType::SPARSE || type == IndexType::UNKNOWN ||
+        isBinaryIndexType(type))
     {
         return nullptr;
     }
@@ -96,6 +217,45 @@ FaissIndex *IndexFactory::getFaissIndex(IndexType type) const
     return nullptr;
 }
 
+BinaryIndex *IndexFactory::getBinaryIndex(IndexType type) const
+{
+    if (!isBinaryIndexType(type))
+    {
+        return nullptr;
+    }
+    auto it = m_index_map.find(type);
+    if (it != m_index_map.end())
+    {
+        return static_cast<BinaryIndex *>(it->second);
+    }
+    return nullptr;
+}
+
+SparseIndex *IndexFactory::getSparseIndex() const
+{
+    auto it = m_index_map.find(IndexType::SPARSE);
+    if (it != m_index_map.end())
+    {
+        return static_cast<SparseIndex *>(it->second);
+    }
+    return nullptr;
+}
+
+VectorArena *IndexFactory::getArena() const
+{
+    return m_arena.get();
+}
+
+IdMap &IndexFactory::getIdMap()
+{
+    return m_id_map;
+}
+
+const IdMap &IndexFactory::getIdMap() const
+{
+    return m_id_map;
+}
+
 FilterIndex *IndexFactory::getFilterIndex() const
 {
     auto it = m_index_map.find(IndexType::FILTER);
@@ -111,7 +271,7 @@ void IndexFactory::saveIndex(const std::string folder_path, ScalarStorage &scala
     for (const auto &[index_type, index_ptr] : m_index_map)
     {
         std::string file_path = std::format("{}.{}.index", folder_path, index_type);
-        if (index_type == IndexType::FLAT || index_type == IndexType::HNSW)
+        if (getFaissIndex(index_type) != nullptr)
         {
             static_cast<FaissIndex *>(index_ptr)->saveIndex(file_path);
         }
@@ -119,15 +279,33 @@ void IndexFactory::saveIndex(const std::string folder_path, ScalarStorage &scala
         {
             static_cast<FilterIndex *>(index_ptr)->saveIndex(scalar_storage, file_path);
         }
+        else if (isBinaryIndexType(index_type))
+        {
+            static_cast<BinaryIndex *>(index_ptr)->saveIndex(file_path);
+        }
+        else if (index_type == IndexType::SPARSE)
+        {
+            static_cast<SparseIndex *>(index_ptr)->saveIndex(file_path);
+        }
     }
+    // write buffers were merged into the arena while the indexes were saved
+    if (m_arena)
+    {
+        m_arena->save(folder_path + ".arena");
+    }
+    m_id_map.saveIndex(scalar_storage, folder_path + ".idmap");
 }
 
 void IndexFactory::loadIndex(const std::string folder_path, ScalarStorage &scalar_storage)
 {
+    if (m_arena && !m_arena->load(folder_path + ".arena"))
+    {
+        GlobalLogger->warn("<IndexFactory> File not found: {}.arena, starting with an empty vector arena", folder_path);
+    }
     for (const auto &[index_type, index_ptr] : m_index_map)
     {
         std::string file_path = std::format("{}.{}.index", folder_path, index_type);
-        if (index_type == IndexType::FLAT || index_type == IndexType::HNSW)
+        if (getFaissIndex(index_type) != nullptr)
         {
             static_cast<FaissIndex *>(index_ptr)->loadIndex(file_path);
         }
@@ -135,24 +313,121 @@ void IndexFactory::loadIndex(const std::string folder_path, ScalarStorage &scala
         {
             static_cast<FilterIndex *>(index_ptr)->loadIndex(scalar_storage, file_path);
         }
+        else if (isBinaryIndexType(index_type))
+        {
+            static_cast<BinaryIndex *>(index_ptr)->loadIndex(file_path);
+        }
+        else if (index_type == IndexType::SPARSE)
+        {
+            static_cast<SparseIndex *>(index_ptr)->loadIndex(file_path);
+        }
+    }
+    if (m_arena)
+    {
+        m_arena->finishLoad();
+    }
+    if (m_id_map.loadIndex(scalar_storage, folder_path + ".idmap"))
+    {
+        return;
     }
-}
 
-IndexFactory::IndexType getIndexTypeFromJson(const rapidjson::Document &json_data)
-{
-    if (json_data.HasMember(REQUEST_INDEX_TYPE))
+    // a snapshot from before ids were mapped labels everything with the ids themselves
+    roaring_bitmap_t *ids = roaring_bitmap_create();
+    for (const auto &[index_type, index_ptr] : m_index_map)
     {
-        std::string index_type_str = json_data[REQUEST_INDEX_TYPE].GetString();
-        if (index_type_str == "FLAT")
+        if (getFaissIndex(index_type) != nullptr)
         {
-            return IndexFactory::IndexType::FLAT;
+            static_cast<FaissIndex *>(index_ptr)->collectLabels(ids);
         }
-        if (index_type_str == "HNSW")
+        else if (index_type == IndexType::FILTER)
         {
-            return IndexFactory::IndexType::HNSW;
+            static_cast<FilterIndex *>(index_ptr)->collectIds(ids);
         }
     }
+    m_id_map.seedIdentity(ids);
+    roaring_bitmap_free(ids);
+}
+
+IndexFactory::IndexType getIndexTypeFromJson(const rapidjson::Document &json_data)
+{
+    if (json_data.HasMember(REQUEST_INDEX_TYPE))
+    {
+        return getIndexTypeFromString(json_data[REQUEST_INDEX_TYPE].GetString());
+    }
     return IndexFactory::IndexType::UNKNOWN;
 }
 
+IndexFactory::IndexType getIndexTypeFromString(const std::string &index_type_str)
+{
+    if (index_type_str == INDEX_TYPE_FLAT)
+    {
+        return IndexFactory::IndexType::FLAT;
+    }
+    if (index_type_str == INDEX_TYPE_HNSW)
+    {
+        return IndexFactory::IndexType::HNSW;
+    }
+    if (index_type_str == INDEX_TYPE_FILTER)
+    {
+        return IndexFactory::IndexType::FILTER;
+    }
+    if (index_type_str == INDEX_TYPE_IVF)
+    {
+        return IndexFactory::IndexType::IVF;
+    }
+    if (index_type_str == INDEX_TYPE_PQ)
+    {
+        return IndexFactory::IndexType::PQ;
+    }
+    if (index_type_str == INDEX_TYPE_SQ)
+    {
+        return IndexFactory::IndexType::SQ;
+    }
+    if (index_type_str == INDEX_TYPE_IVFPQ)
+    {
+        return IndexFactory::IndexType::IVFPQ;
+    }
+    if (index_type_str == INDEX_TYPE_BINARY_FLAT)
+    {
+        return IndexFactory::IndexType::BINARY_FLAT;
+    }
+    if (index_type_str == INDEX_TYPE_BINARY_HNSW)
+    {
+        return IndexFactory::IndexType::BINARY_HNSW;
+    }
+    if (index_type_str == INDEX_TYPE_SPARSE)
+    {
+        return IndexFactory::IndexType::SPARSE;
+    }
+    return IndexFactory::IndexType::UNKNOWN;
+}
+
+bool isCompressedIndexType(IndexFactory::IndexType type)
+{
+    return type == IndexFactory::IndexType::PQ || type == IndexFactory::IndexType::SQ ||
+           type == IndexFactory::IndexType::IVFPQ;
+}
+
+bool isBinaryIndexType(IndexFactory::IndexType type)
+{
+    return type == IndexFactory::IndexType::BINARY_FLAT || type == IndexFactory::IndexType::BINARY_HNSW;
+}
+
+IndexFactory::MetricType getMetricTypeFromString(const std::string &metric_str)
+{
+    if (metric_str == METRIC_TYPE_L2)
+    {
+        return IndexFactory::MetricType::L2;
+    }
+    if (metric_str == METRIC_TYPE_IP)
+    {
+        return IndexFactory::MetricType::IP;
+    }
+    if (metric_str == METRIC_TYPE_COSINE)
+    {
+        return IndexFactory::MetricType::COSINE;
+    }
+    throw std::invalid_argument("Unknown metric type " + metric_str);
+}
+
 } // namespace vdb
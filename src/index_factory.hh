@@ -1,7 +1,10 @@
 #pragma once
 
+#include "binary_index.hh"
 #include "faiss_index.hh"
 #include "filter_index.hh"
+#include "id_map.hh"
+#include "sparse_index.hh"
 #include <format>
 #include <map>
 #include <rapidjson/document.h>
@@ -16,33 +19,92 @@ class IndexFactory
         FLAT,
         HNSW,
         FILTER,
+        IVF, // inverted lists in a memory-mapped file, filled by bulk builds
+        // compressed codes, trained by a bulk build; searches re-rank with the exact vectors
+        PQ,
+        SQ,
+        IVFPQ,
+        // bit-packed vectors of `dim` bits under Hamming distance
+        BINARY_FLAT,
+        BINARY_HNSW,
+        // inverted index of sparse term-weight vectors under dot product
+        SPARSE,
         UNKNOWN = -1
     };
 
     enum class MetricType
     {
-        L2, // L2 距离
-        IP  // 内积
+        L2,    // L2 距离
+        IP,    // 内积
+        COSINE // 余弦相似度：写入与查询时归一化后按内积检索
     };
 
+    /// construction parameters, ignored by index types they do not apply to
+    struct IndexParams
+    {
+        i32 hnsw_m = 32;
+        i32 hnsw_ef_construction = 40;
+        i32 hnsw_ef_search = 16;
+        // tiered HNSW: vectors buffered per shard before a batch insert, 0 inserts one by one
+        i32 hnsw_write_buffer = 0;
+        i32 ivf_nlist = 1024;
+        // default lists probed per search, requests may ask for more or fewer
+        i32 ivf_nprobe = 16;
+        // PQ and IVFPQ sub-quantizers of 8 bits each, must divide the dimension
+        i32 pq_m = 16;
+        // compressed indexes fetch k * oversample candidates and re-rank them exactly, 0 disables it;
+        // requests may ask for another factor
+        i32 rerank_oversample = 4;
+        // faiss indexes backing each FLAT/HNSW/IVF index, ids are hashed over them
+        i32 shards = 1;
+        // micro-batching of concurrent unfiltered searches, 0 disables it
+        i32 search_batch_window_us = 0;
+        i32 search_batch_max = 64;
+        // FLAT and HNSW keep their vectors once, in a VectorArena they share
+        bool shared_vectors = false;
+    };
+
+    IndexFactory() = default;
     ~IndexFactory();
-    void init(IndexType type, i32 dim, MetricType metric = MetricType::L2);
+    IndexFactory(const IndexFactory &) = delete;
+    IndexFactory &operator=(const IndexFactory &) = delete;
+    /// `data_path` prefixes files an index keeps outside of snapshots (the IVF inverted lists)
+    void init(IndexType type, i32 dim, MetricType metric = MetricType::L2, const IndexParams &params = {},
+              const std::string &data_path = "vdb");
 
     /// observe
     void *getIndex(IndexType type) const;
     FaissIndex *getFaissIndex(IndexType type) const;
+    BinaryIndex *getBinaryIndex(IndexType type) const;
+    SparseIndex *getSparseIndex() const;
     FilterIndex *getFilterIndex() const;
+    /// null unless FLAT or HNSW were initialized with shared_vectors
+    VectorArena *getArena() const;
+    /// ordinals labelling the vectors and filter bitmaps of every index
+    IdMap &getIdMap();
+    const IdMap &getIdMap() const;
 
     /// snapshot
+    /// the vector arena goes to `<folder_path>.arena`, after the indexes referencing it; the id
+    /// map is stored in `scalar_storage` under `<folder_path>.idmap`
     void saveIndex(const std::string folder_path, ScalarStorage &scalar_storage);
     void loadIndex(const std::string folder_path, ScalarStorage &scalar_storage);
 
   private:
     std::map<IndexType, void *> m_index_map;
+    // shared with the storages of the FLAT and HNSW shards
+    std::shared_ptr<VectorArena> m_arena;
+    IdMap m_id_map;
 };
 
-IndexFactory *getGlobalIndexFactory();
 IndexFactory::IndexType getIndexTypeFromJson(const rapidjson::Document &json_data);
+IndexFactory::IndexType getIndexTypeFromString(const std::string &index_type_str);
+/// PQ, SQ and IVFPQ keep lossy codes only, and their collections keep the exact vectors for re-ranking
+bool isCompressedIndexType(IndexFactory::IndexType type);
+/// BINARY_FLAT and BINARY_HNSW, served by BinaryIndex instead of FaissIndex
+bool isBinaryIndexType(IndexFactory::IndexType type);
+/// "L2", "IP" or "COSINE"; throws std::invalid_argument otherwise
+IndexFactory::MetricType getMetricTypeFromString(const std::string &metric_str);
 
 } // namespace vdb
 
@@ -85,6 +147,27 @@ template <> struct std::formatter<IndexFactory::IndexType>
         case IndexFactory::IndexType::FILTER:
             str = "FILTER";
             break;
+        case IndexFactory::IndexType::IVF:
+            str = "IVF";
+            break;
+        case IndexFactory::IndexType::PQ:
+            str = "PQ";
+            break;
+        case IndexFactory::IndexType::SQ:
+            str = "SQ";
+            break;
+        case IndexFactory::IndexType::IVFPQ:
+            str = "IVFPQ";
+            break;
+        case IndexFactory::IndexType::BINARY_FLAT:
+            str = "BINARY_FLAT";
+            break;
+        case IndexFactory::IndexType::BINARY_HNSW:
+            str = "BINARY_HNSW";
+            break;
+        case IndexFactory::IndexType::SPARSE:
+            str = "SPARSE";
+            break;
         default:
             str = "UNKNOWN";
         }
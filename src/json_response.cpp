@@ -0,0 +1,51 @@
+#include "json_response.hh"
+#include "metrics.hh"
+
+namespace vdb
+{
+
+namespace
+{
+thread_local rapidjson::StringBuffer thread_response_buffer;
+thread_local bool thread_response_buffer_in_use = false;
+
+rapidjson::StringBuffer *acquireBuffer(std::unique_ptr<rapidjson::StringBuffer> &own_buffer)
+{
+    if (thread_response_buffer_in_use)
+    {
+        own_buffer = std::make_unique<rapidjson::StringBuffer>();
+        return own_buffer.get();
+    }
+    thread_response_buffer_in_use = true;
+    thread_response_buffer.Clear(); // keeps capacity
+    return &thread_response_buffer;
+}
+} // namespace
+
+JsonResponseWriter::JsonResponseWriter()
+    : m_buffer(*acquireBuffer(m_own_buffer)), m_writer(m_buffer), m_owns_thread_buffer(m_own_buffer == nullptr),
+      m_start(std::chrono::steady_clock::now())
+{
+    m_writer.StartObject();
+}
+
+JsonResponseWriter::~JsonResponseWriter()
+{
+    if (m_owns_thread_buffer)
+    {
+        thread_response_buffer_in_use = false;
+    }
+}
+
+void JsonResponseWriter::finish(httplib::Response &res, i32 retcode)
+{
+    m_writer.Key(RESPONSE_RETCODE);
+    m_writer.Int(retcode);
+    m_writer.EndObject();
+    res.set_content(m_buffer.GetString(), m_buffer.GetSize(), RESPONSE_CONTENT_TYPE_JSON);
+
+    static Histogram &serialize_histogram = stageHistogram("serialize");
+    serialize_histogram.record(elapsedNsSince(m_start));
+}
+
+} // namespace vdb
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "constants.hh"
+#include "json_utils.hh"
+#include "types.hh"
+#include <chrono>
+#include <httplib.h>
+#include <memory>
+#include <rapidjson/stringbuffer.h>
+
+namespace vdb
+{
+
+/// Streams a JSON object response straight through a JsonWriter, without building a DOM.
+/// The output buffer is thread-local and reused across requests, so once it has grown to the
+/// largest response a worker serves, serialization does no allocation; finish() copies the
+/// bytes into the response body exactly once.
+class JsonResponseWriter
+{
+  public:
+    using Writer = JsonWriter<rapidjson::StringBuffer>;
+
+    JsonResponseWriter();
+    ~JsonResponseWriter();
+    JsonResponseWriter(const JsonResponseWriter &) = delete;
+    JsonResponseWriter &operator=(const JsonResponseWriter &) = delete;
+
+    Writer &writer()
+    {
+        return m_writer;
+    }
+
+    /// Append the retCode member, close the object and hand the bytes to `res`.
+    void finish(httplib::Response &res, i32 retcode = RESPONSE_RETCODE_SUCCESS);
+
+  private:
+    // set when another writer on this thread already owns the shared buffer
+    std::unique_ptr<rapidjson::StringBuffer> m_own_buffer;
+    rapidjson::StringBuffer &m_buffer;
+    Writer m_writer;
+    bool m_owns_thread_buffer;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+} // namespace vdb
@@ -0,0 +1,316 @@
+#include "json_utils.hh"
+#include "constants.hh"
+#include "metrics.hh"
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <rapidjson/reader.h>
+
+namespace vdb
+{
+
+namespace
+{
+
+/// SAX filter between rapidjson::Reader and a Document. The reader runs with
+/// kParseNumbersAsStringsFlag so every number arrives as raw text; elements of the
+/// top-level "vectors" array are converted to f32 once and collected on the side,
+/// everything else is converted with the same integer/double typing rapidjson uses.
+class VectorExtractingHandler
+{
+  public:
+    VectorExtractingHandler(rapidjson::Document &document, std::vector<f32> *vectors)
+        : m_document(document), m_vectors(vectors)
+    {
+    }
+
+    bool Null()
+    {
+        return !m_in_vectors && m_document.Null();
+    }
+
+    bool Bool(bool b)
+    {
+        return !m_in_vectors && m_document.Bool(b);
+    }
+
+    bool Int(int i)
+    {
+        return m_document.Int(i);
+    }
+
+    bool Uint(unsigned u)
+    {
+        return m_document.Uint(u);
+    }
+
+    bool Int64(int64_t i)
+    {
+        return m_document.Int64(i);
+    }
+
+    bool Uint64(uint64_t u)
+    {
+        return m_document.Uint64(u);
+    }
+
+    bool Double(double d)
+    {
+        return m_document.Double(d);
+    }
+
+    bool RawNumber(const char *str, rapidjson::SizeType length, bool)
+    {
+        const char *end = str + length;
+        if (m_in_vectors)
+        {
+            f32 value = 0.0f;
+            auto [ptr, ec] = std::from_chars(str, end, value);
+            if (ec != std::errc() || ptr != end)
+            {
+                return false;
+            }
+            if (m_vectors != nullptr)
+            {
+                m_vectors->push_back(value);
+            }
+            return m_document.Double(value);
+        }
+
+        bool is_integer = std::memchr(str, '.', length) == nullptr && std::memchr(str, 'e', length) == nullptr &&
+                          std::memchr(str, 'E', length) == nullptr;
+        if (is_integer && str[0] == '-')
+        {
+            i64 value = 0;
+            auto [ptr, ec] = std::from_chars(str, end, value);
+            if (ec == std::errc() && ptr == end)
+            {
+                return value >= std::numeric_limits<i32>::min() ? m_document.Int(static_cast<i32>(value))
+                                                                 : m_document.Int64(value);
+            }
+        }
+        else if (is_integer)
+        {
+            u64 value = 0;
+            auto [ptr, ec] = std::from_chars(str, end, value);
+            if (ec == std::errc() && ptr == end)
+            {
+                return value <= std::numeric_limits<u32>::max() ? m_document.Uint(static_cast<u32>(value))
+                                                                 : m_document.Uint64(value);
+            }
+        }
+
+        f64 value = 0.0;
+        auto [ptr, ec] = std::from_chars(str, end, value);
+        if (ec != std::errc() || ptr != end)
+        {
+            return false;
+        }
+        return m_document.Double(value);
+    }
+
+    bool String(const char *str, rapidjson::SizeType length, bool)
+    {
+        // always copy: the in-situ buffer does not outlive the document
+        return !m_in_vectors && m_document.String(str, length, true);
+    }
+
+    bool StartObject()
+    {
+        ++m_depth;
+        return !m_in_vectors && m_document.StartObject();
+    }
+
+    bool Key(const char *str, rapidjson::SizeType length, bool)
+    {
+        m_vectors_key = m_depth == 1 && length == std::strlen(REQUEST_VECTORS) &&
+                        std::memcmp(str, REQUEST_VECTORS, length) == 0;
+        return m_document.Key(str, length, true);
+    }
+
+    bool EndObject(rapidjson::SizeType member_count)
+    {
+        --m_depth;
+        return m_document.EndObject(member_count);
+    }
+
+    bool StartArray()
+    {
+        if (m_in_vectors)
+        {
+            return false;
+        }
+        ++m_depth;
+        m_in_vectors = m_vectors_key && m_depth == 2;
+        m_vectors_key = false;
+        return m_document.StartArray();
+    }
+
+    bool EndArray(rapidjson::SizeType element_count)
+    {
+        --m_depth;
+        m_in_vectors = false;
+        return m_document.EndArray(element_count);
+    }
+
+  private:
+    rapidjson::Document &m_document;
+    std::vector<f32> *m_vectors;
+    i32 m_depth = 0;
+    bool m_vectors_key = false;
+    bool m_in_vectors = false;
+};
+
+} // namespace
+
+bool parseJsonRequest(std::string &buffer, rapidjson::Document &document, std::vector<f32> *vectors)
+{
+    if (vectors != nullptr)
+    {
+        vectors->clear();
+    }
+
+    static Histogram &parse_histogram = stageHistogram("json_parse");
+    ScopedTimer timer(parse_histogram);
+
+    bool ok = false;
+    auto generator = [&](rapidjson::Document &handler) {
+        VectorExtractingHandler filter(handler, vectors);
+        rapidjson::InsituStringStream stream(buffer.data());
+        rapidjson::Reader reader;
+        ok = !reader.Parse<rapidjson::kParseInsituFlag | rapidjson::kParseNumbersAsStringsFlag>(stream, filter)
+                  .IsError();
+        return ok;
+    };
+    document.Populate(generator);
+
+    if (!ok)
+    {
+        document.SetNull();
+        if (vectors != nullptr)
+        {
+            vectors->clear();
+        }
+    }
+    return ok;
+}
+
+void getVectorFromJson(const rapidjson::Value &array, std::vector<f32> &vector)
+{
+    vector.clear();
+    vector.reserve(array.Size());
+    for (const auto &v : array.GetArray())
+    {
+        vector.push_back(v.GetFloat());
+    }
+}
+
+bool getBinaryVectorFromJson(const rapidjson::Value &value, std::vector<u8> &codes)
+{
+    codes.clear();
+    if (value.IsArray())
+    {
+        codes.reserve(value.Size());
+        for (const auto &v : value.GetArray())
+        {
+            if (!v.IsUint() || v.GetUint() > std::numeric_limits<u8>::max())
+            {
+                return false;
+            }
+            codes.push_back(static_cast<u8>(v.GetUint()));
+        }
+        return true;
+    }
+    if (!value.IsString())
+    {
+        return false;
+    }
+
+    const char *text = value.GetString();
+    size_t length = value.GetStringLength();
+    while (length > 0 && text[length - 1] == '=')
+    {
+        --length;
+    }
+    if (length % 4 == 1)
+    {
+        return false;
+    }
+    codes.reserve(length * 3 / 4);
+    u32 bits = 0;
+    i32 bit_count = 0;
+    for (size_t i = 0; i < length; ++i)
+    {
+        char c = text[i];
+        u32 sextet;
+        if (c >= 'A' && c <= 'Z')
+        {
+            sextet = c - 'A';
+        }
+        else if (c >= 'a' && c <= 'z')
+        {
+            sextet = c - 'a' + 26;
+        }
+        else if (c >= '0' && c <= '9')
+        {
+            sextet = c - '0' + 52;
+        }
+        else if (c == '+')
+        {
+            sextet = 62;
+        }
+        else if (c == '/')
+        {
+            sextet = 63;
+        }
+        else
+        {
+            return false;
+        }
+        bits = (bits << 6) | sextet;
+        bit_count += 6;
+        if (bit_count >= 8)
+        {
+            bit_count -= 8;
+            codes.push_back(static_cast<u8>(bits >> bit_count));
+            bits &= (1u << bit_count) - 1;
+        }
+    }
+    return true;
+}
+
+bool getSparseVectorFromJson(const rapidjson::Value &value, std::vector<u32> &indices, std::vector<f32> &values)
+{
+    indices.clear();
+    values.clear();
+    if (!value.IsObject() || !value.HasMember(REQUEST_SPARSE_INDICES) || !value.HasMember(REQUEST_SPARSE_VALUES))
+    {
+        return false;
+    }
+    const rapidjson::Value &index_array = value[REQUEST_SPARSE_INDICES];
+    const rapidjson::Value &value_array = value[REQUEST_SPARSE_VALUES];
+    if (!index_array.IsArray() || !value_array.IsArray() || index_array.Size() != value_array.Size())
+    {
+        return false;
+    }
+    indices.reserve(index_array.Size());
+    values.reserve(value_array.Size());
+    for (rapidjson::SizeType i = 0; i < index_array.Size(); ++i)
+    {
+        if (!index_array[i].IsUint() || !value_array[i].IsNumber())
+        {
+            return false;
+        }
+        f32 weight = value_array[i].GetFloat();
+        if (!std::isfinite(weight) || weight < 0.0f)
+        {
+            return false;
+        }
+        indices.push_back(index_array[i].GetUint());
+        values.push_back(weight);
+    }
+    return true;
+}
+
+} // namespace vdb
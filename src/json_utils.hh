@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.hh"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <string>
+#include <vector>
+
+namespace vdb
+{
+
+/// Parse a JSON request in place. `buffer` is used as the in-situ parse buffer and is clobbered.
+/// Numbers inside the top-level "vectors" array are decoded exactly once, straight to f32 with
+/// std::from_chars (fast_float in libstdc++), and appended to `vectors` so callers do not have
+/// to walk the DOM with GetFloat(). The document still receives every value.
+/// Returns false on malformed JSON or a non-numeric element in "vectors".
+bool parseJsonRequest(std::string &buffer, rapidjson::Document &document, std::vector<f32> *vectors = nullptr);
+
+/// Copy a JSON numeric array into `vector`.
+void getVectorFromJson(const rapidjson::Value &array, std::vector<f32> &vector);
+
+/// Bit-packed vectors given either as a base64 string (standard alphabet, padding optional) or as
+/// an array of byte values. Returns false on anything else, leaving `codes` unspecified.
+bool getBinaryVectorFromJson(const rapidjson::Value &value, std::vector<u8> &codes);
+
+/// Sparse vector given as {"indices": [term ids], "values": [weights]} of equal length, with
+/// non-negative finite weights. Returns false on anything else.
+bool getSparseVectorFromJson(const rapidjson::Value &value, std::vector<u32> &indices, std::vector<f32> &values);
+
+/// rapidjson Writer that prints doubles which are exactly representable as f32 with the
+/// shortest representation that round-trips through f32 (e.g. 0.1 instead of 0.10000000149011612).
+/// Vectors and distances are f32 all the way through, so this keeps responses, WAL entries and
+/// stored documents compact without losing precision. Integral values keep a ".0" so that they
+/// read back as doubles: a document field must not turn into an int (and a filter field) when
+/// the WAL is replayed or the stored document is parsed again.
+template <typename OutputStream>
+class JsonWriter : public rapidjson::Writer<OutputStream>
+{
+  public:
+    using Base = rapidjson::Writer<OutputStream>;
+
+    explicit JsonWriter(OutputStream &os) : Base(os)
+    {
+    }
+
+    bool Double(f64 d)
+    {
+        f32 f = static_cast<f32>(d);
+        if (!std::isfinite(d) || static_cast<f64>(f) != d)
+        {
+            return Base::Double(d);
+        }
+        char buf[32];
+        auto [ptr, ec] = std::to_chars(buf, buf + sizeof(buf) - 2, f);
+        if (std::find_if(buf, ptr, [](char c) { return c == '.' || c == 'e'; }) == ptr)
+        {
+            *ptr++ = '.';
+            *ptr++ = '0';
+        }
+        return Base::RawValue(buf, static_cast<size_t>(ptr - buf), rapidjson::kNumberType);
+    }
+};
+
+} // namespace vdb
@@ -1,16 +1,26 @@
 #include "logger.hh"
+#include <spdlog/async.h>
+#include <spdlog/sinks/basic_file_sink.h>
 #include <spdlog/sinks/stdout_color_sinks.h>
 
 namespace vdb
 {
 
 std::shared_ptr<spdlog::logger> GlobalLogger;
+std::shared_ptr<spdlog::logger> SlowQueryLogger;
 
 void init_global_logger()
 {
     GlobalLogger = spdlog::stdout_color_mt("GlobalLogger");
 }
 
+void init_slow_query_logger(const std::string &file_path)
+{
+    SlowQueryLogger = spdlog::create_async<spdlog::sinks::basic_file_sink_mt>("SlowQueryLogger", file_path);
+    SlowQueryLogger->set_pattern("[%Y-%m-%d %H:%M:%S.%e] %v");
+    SlowQueryLogger->flush_on(spdlog::level::info);
+}
+
 void set_log_level(spdlog::level::level_enum log_level)
 {
     GlobalLogger->set_level(log_level);
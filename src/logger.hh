@@ -1,12 +1,16 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <spdlog/logger.h>
 #include <spdlog/spdlog.h>
 
 namespace vdb
 {
 extern std::shared_ptr<spdlog::logger> GlobalLogger;
+extern std::shared_ptr<spdlog::logger> SlowQueryLogger;
 void init_global_logger();
 void set_log_level(spdlog::level::level_enum log_level);
+/// Slow queries go to their own file through an async sink so logging never blocks a search.
+void init_slow_query_logger(const std::string &file_path);
 } // namespace vdb
@@ -1,31 +1,56 @@
+#include "collection_manager.hh"
+#include "config.hh"
 #include "http_server.hh"
-#include "index_factory.hh"
 #include "logger.hh"
+#include "parallelism.hh"
+#include <exception>
+#include <omp.h>
 #include <spdlog/common.h>
 
 int main(int argc, char **argv)
 {
     using namespace vdb;
     init_global_logger();
-    set_log_level(spdlog::level::debug);
+
+    ServerConfig config;
+    try
+    {
+        config = loadServerConfig(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        GlobalLogger->error("<Config> {}", e.what());
+        return 1;
+    }
+
+    set_log_level(spdlog::level::from_str(config.log_level));
+    init_slow_query_logger(config.slow_query_log_path);
     GlobalLogger->info("Global logger initialized");
 
-    // 初始化全局IndexFactor实例
-    int dim = 1;
-    IndexFactory *globalIndexFactory = getGlobalIndexFactory();
-    globalIndexFactory->init(IndexFactory::IndexType::FLAT, dim);
-    globalIndexFactory->init(IndexFactory::IndexType::HNSW, dim);
-    globalIndexFactory->init(IndexFactory::IndexType::FILTER, dim);
-    GlobalLogger->info("Global IndexFactory initialized");
+    if (config.omp_threads > 0)
+    {
+        omp_set_num_threads(config.omp_threads);
+    }
+    setParallelismPolicy(config.omp_policy, config.omp_threads);
+    GlobalLogger->info("OpenMP policy {} with up to {} threads, {} NUMA nodes",
+                       parallelismPolicyName(config.omp_policy), omp_get_max_threads(), getNumaNodeCpus().size());
 
-    std::string db_path = "VectorDB";
-    std::string wal_path = "WALStorage";
-    VectorDB vector_db(db_path, wal_path);
-    vector_db.reloadDataBase();
-    GlobalLogger->info("VectorDB initialized");
+    // 打开共享的 RocksDB，加载默认集合及目录中记录的所有集合，只构建配置中要求的索引
+    CollectionManager collections(config);
+    GlobalLogger->info("Collections initialized");
 
-    HttpServer server("localhost", 8080, &vector_db);
-    GlobalLogger->info("HttpServer Start");
+    HttpServer server(config.host, config.port, &collections);
+    server.setSlowQueryThreshold(config.slow_query_threshold_ms);
+    EventServerOptions server_options;
+    auto &lanes = server_options.lanes;
+    lanes[static_cast<size_t>(WorkloadClass::SEARCH)] = {config.http_threads, config.max_queued_requests};
+    lanes[static_cast<size_t>(WorkloadClass::WRITE)] = {config.write_threads, config.max_queued_writes};
+    lanes[static_cast<size_t>(WorkloadClass::ADMIN)] = {config.admin_threads, config.max_queued_admin};
+    server_options.request_timeout_ms = config.request_timeout_ms;
+    server_options.max_connections = config.max_connections;
+    server_options.pin_threads = config.pin_threads;
+    server.setServerOptions(server_options);
+    GlobalLogger->info("HttpServer Start on {}:{}", config.host, config.port);
     server.start();
     return 0;
 }
@@ -0,0 +1,333 @@
+#include "metrics.hh"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <format>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace vdb
+{
+
+namespace detail
+{
+u32 metricsStripe()
+{
+    static std::atomic<u32> next_stripe{0};
+    thread_local u32 stripe = next_stripe.fetch_add(1, std::memory_order_relaxed) % 16;
+    return stripe;
+}
+} // namespace detail
+
+u64 Counter::value() const
+{
+    u64 total = 0;
+    for (const auto &cell : m_cells)
+    {
+        total += cell.value.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Counter::reset()
+{
+    for (auto &cell : m_cells)
+    {
+        cell.value.store(0, std::memory_order_relaxed);
+    }
+}
+
+u32 Histogram::bucketIndex(u64 value)
+{
+    if (value < kSubBuckets)
+    {
+        return static_cast<u32>(value);
+    }
+    u32 exponent = 63 - static_cast<u32>(std::countl_zero(value));
+    if (exponent > kMaxExponent)
+    {
+        return kBucketCount - 1;
+    }
+    u32 sub_bucket = static_cast<u32>(value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+    return (exponent - kSubBucketBits + 1) * kSubBuckets + sub_bucket;
+}
+
+u64 Histogram::bucketUpperBound(u32 index)
+{
+    if (index < kSubBuckets)
+    {
+        return index;
+    }
+    u32 exponent = index / kSubBuckets + kSubBucketBits - 1;
+    u64 sub_bucket = index % kSubBuckets;
+    return ((kSubBuckets + sub_bucket + 1) << (exponent - kSubBucketBits)) - 1;
+}
+
+u64 Histogram::count() const
+{
+    u64 total = 0;
+    for (const auto &bucket : m_buckets)
+    {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+u64 Histogram::percentile(f64 q) const
+{
+    u64 total = count();
+    if (total == 0)
+    {
+        return 0;
+    }
+    u64 target = static_cast<u64>(std::ceil(q * static_cast<f64>(total)));
+    target = std::max<u64>(target, 1);
+
+    u64 seen = 0;
+    for (u32 i = 0; i < kBucketCount; ++i)
+    {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target)
+        {
+            return bucketUpperBound(i);
+        }
+    }
+    return bucketUpperBound(kBucketCount - 1);
+}
+
+u64 Histogram::countAtOrBelow(u64 bound_ns) const
+{
+    u64 total = 0;
+    for (u32 i = 0; i < kBucketCount && bucketUpperBound(i) <= bound_ns; ++i)
+    {
+        total += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void Histogram::merge(const Histogram &other)
+{
+    for (u32 i = 0; i < kBucketCount; ++i)
+    {
+        m_buckets[i].fetch_add(other.m_buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    m_sum.inc(other.sum());
+}
+
+void Histogram::reset()
+{
+    for (auto &bucket : m_buckets)
+    {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    m_sum.reset();
+}
+
+namespace
+{
+
+std::string escapeLabelValue(const std::string &value)
+{
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+        {
+            escaped.push_back('\\');
+            escaped.push_back(c);
+        }
+        else if (c == '\n')
+        {
+            escaped += "\\n";
+        }
+        else
+        {
+            escaped.push_back(c);
+        }
+    }
+    return escaped;
+}
+
+std::string renderLabels(const MetricsRegistry::Labels &labels)
+{
+    std::string rendered;
+    for (const auto &[key, value] : labels)
+    {
+        if (!rendered.empty())
+        {
+            rendered.push_back(',');
+        }
+        rendered += std::format("{}=\"{}\"", key, escapeLabelValue(value));
+    }
+    return rendered;
+}
+
+std::string withLabels(const std::string &name, const std::string &labels, const std::string &extra = "")
+{
+    if (labels.empty() && extra.empty())
+    {
+        return name;
+    }
+    if (labels.empty())
+    {
+        return std::format("{}{{{}}}", name, extra);
+    }
+    if (extra.empty())
+    {
+        return std::format("{}{{{}}}", name, labels);
+    }
+    return std::format("{}{{{},{}}}", name, labels, extra);
+}
+
+} // namespace
+
+void *MetricsRegistry::getOrCreate(const std::string &name, const std::string &help, const Labels &labels,
+                                   MetricKind kind)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto [family_it, inserted] = m_families.try_emplace(name, Family{kind, help, {}});
+    Family &family = family_it->second;
+    if (family.kind != kind)
+    {
+        throw std::logic_error(std::format("<Metrics> Metric {} registered with two different types", name));
+    }
+
+    std::string rendered = renderLabels(labels);
+    auto it = family.metrics.find(rendered);
+    if (it != family.metrics.end())
+    {
+        return it->second;
+    }
+
+    void *metric = nullptr;
+    switch (kind)
+    {
+    case MetricKind::COUNTER:
+        metric = m_counters.emplace_back(std::make_unique<Counter>()).get();
+        break;
+    case MetricKind::GAUGE:
+        metric = m_gauges.emplace_back(std::make_unique<Gauge>()).get();
+        break;
+    case MetricKind::HISTOGRAM:
+        metric = m_histograms.emplace_back(std::make_unique<Histogram>()).get();
+        break;
+    }
+    family.metrics.emplace(rendered, metric);
+    return metric;
+}
+
+Counter &MetricsRegistry::counter(const std::string &name, const std::string &help, const Labels &labels)
+{
+    return *static_cast<Counter *>(getOrCreate(name, help, labels, MetricKind::COUNTER));
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name, const std::string &help, const Labels &labels)
+{
+    return *static_cast<Gauge *>(getOrCreate(name, help, labels, MetricKind::GAUGE));
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name, const std::string &help, const Labels &labels)
+{
+    return *static_cast<Histogram *>(getOrCreate(name, help, labels, MetricKind::HISTOGRAM));
+}
+
+void MetricsRegistry::removeSeries(const Labels &labels)
+{
+    std::vector<std::string> rendered_pairs;
+    for (const auto &label : labels)
+    {
+        rendered_pairs.push_back("," + renderLabels({label}) + ",");
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto &[name, family] : m_families)
+    {
+        std::erase_if(family.metrics, [&](const auto &entry) {
+            std::string rendered = "," + entry.first + ",";
+            return std::all_of(rendered_pairs.begin(), rendered_pairs.end(), [&](const std::string &pair) {
+                return rendered.find(pair) != std::string::npos;
+            });
+        });
+    }
+}
+
+std::string MetricsRegistry::exposition() const
+{
+    // le boundaries: powers of two from ~1us to ~17s
+    constexpr u32 kFirstBoundExponent = 10;
+    constexpr u32 kLastBoundExponent = 34;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream oss;
+    for (const auto &[name, family] : m_families)
+    {
+        const char *type = family.kind == MetricKind::COUNTER ? "counter"
+                           : family.kind == MetricKind::GAUGE ? "gauge"
+                                                              : "histogram";
+        oss << "# HELP " << name << " " << family.help << "\n";
+        oss << "# TYPE " << name << " " << type << "\n";
+
+        for (const auto &[labels, metric] : family.metrics)
+        {
+            switch (family.kind)
+            {
+            case MetricKind::COUNTER:
+                oss << withLabels(name, labels) << " " << static_cast<const Counter *>(metric)->value() << "\n";
+                break;
+            case MetricKind::GAUGE:
+                oss << withLabels(name, labels) << " " << static_cast<const Gauge *>(metric)->value() << "\n";
+                break;
+            case MetricKind::HISTOGRAM: {
+                const Histogram *histogram = static_cast<const Histogram *>(metric);
+                for (u32 e = kFirstBoundExponent; e <= kLastBoundExponent; ++e)
+                {
+                    u64 bound_ns = u64{1} << e;
+                    std::string le = std::format("le=\"{}\"", static_cast<f64>(bound_ns) / 1e9);
+                    oss << withLabels(name + "_bucket", labels, le) << " " << histogram->countAtOrBelow(bound_ns)
+                        << "\n";
+                }
+                u64 count = histogram->count();
+                oss << withLabels(name + "_bucket", labels, "le=\"+Inf\"") << " " << count << "\n";
+                oss << withLabels(name + "_sum", labels) << " " << static_cast<f64>(histogram->sum()) / 1e9 << "\n";
+                oss << withLabels(name + "_count", labels) << " " << count << "\n";
+                break;
+            }
+            }
+        }
+    }
+    return oss.str();
+}
+
+namespace
+{
+MetricsRegistry globalMetrics;
+}
+
+MetricsRegistry *getGlobalMetrics()
+{
+    return &globalMetrics;
+}
+
+Histogram &stageHistogram(const std::string &stage)
+{
+    return getGlobalMetrics()->histogram("vdb_stage_duration_seconds", "Time spent in each request-processing stage",
+                                         {{"stage", stage}});
+}
+
+u64 getProcessRssBytes()
+{
+    // statm: total program size, then resident pages
+    std::ifstream statm("/proc/self/statm");
+    u64 size_pages = 0;
+    u64 resident_pages = 0;
+    if (!(statm >> size_pages >> resident_pages))
+    {
+        return 0;
+    }
+    return resident_pages * static_cast<u64>(sysconf(_SC_PAGESIZE));
+}
+
+} // namespace vdb
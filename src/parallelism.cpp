@@ -0,0 +1,181 @@
+#include "parallelism.hh"
+#include "logger.hh"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace vdb
+{
+
+namespace
+{
+
+std::atomic<ParallelismPolicy> g_policy{ParallelismPolicy::WIDE};
+std::atomic<i32> g_max_threads{0};
+// request-path faiss calls in progress, for ADAPTIVE
+std::atomic<i32> g_running{0};
+
+/// parse a sysfs cpulist such as "0-3,8-11"
+std::vector<i32> parseCpuList(const std::string &list)
+{
+    std::vector<i32> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ','))
+    {
+        size_t dash = range.find('-');
+        try
+        {
+            i32 first = std::stoi(range.substr(0, dash));
+            i32 last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (i32 cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        catch (const std::exception &)
+        {
+            // trailing newline or empty list
+        }
+    }
+    return cpus;
+}
+
+std::vector<std::vector<i32>> readNumaNodeCpus()
+{
+    std::vector<std::vector<i32>> nodes;
+    for (size_t node = 0;; ++node)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file)
+        {
+            break;
+        }
+        std::string list;
+        std::getline(file, list);
+        std::vector<i32> cpus = parseCpuList(list);
+        if (!cpus.empty())
+        {
+            nodes.push_back(std::move(cpus));
+        }
+    }
+    if (nodes.empty())
+    {
+        std::vector<i32> cpus(std::max(std::thread::hardware_concurrency(), 1u));
+        for (size_t i = 0; i < cpus.size(); ++i)
+        {
+            cpus[i] = static_cast<i32>(i);
+        }
+        nodes.push_back(std::move(cpus));
+    }
+    return nodes;
+}
+
+} // namespace
+
+ParallelismPolicy getParallelismPolicyFromString(const std::string &policy)
+{
+    if (policy == "wide")
+    {
+        return ParallelismPolicy::WIDE;
+    }
+    if (policy == "single")
+    {
+        return ParallelismPolicy::SINGLE;
+    }
+    if (policy == "adaptive")
+    {
+        return ParallelismPolicy::ADAPTIVE;
+    }
+    throw std::invalid_argument("Unknown parallelism policy " + policy);
+}
+
+const char *parallelismPolicyName(ParallelismPolicy policy)
+{
+    switch (policy)
+    {
+    case ParallelismPolicy::WIDE:
+        return "wide";
+    case ParallelismPolicy::SINGLE:
+        return "single";
+    case ParallelismPolicy::ADAPTIVE:
+        return "adaptive";
+    }
+    return "unknown";
+}
+
+void setParallelismPolicy(ParallelismPolicy policy, i32 max_threads)
+{
+    g_max_threads = max_threads > 0 ? max_threads : omp_get_max_threads();
+    g_policy = policy;
+}
+
+ParallelismPolicy getParallelismPolicy()
+{
+    return g_policy;
+}
+
+OmpThreadScope::OmpThreadScope(ParallelWork work) : m_previous(omp_get_max_threads())
+{
+    i32 max_threads = g_max_threads > 0 ? g_max_threads.load() : m_previous;
+    m_threads = max_threads;
+    if (work == ParallelWork::REQUEST)
+    {
+        switch (g_policy.load())
+        {
+        case ParallelismPolicy::WIDE:
+            break;
+        case ParallelismPolicy::SINGLE:
+            m_threads = 1;
+            break;
+        case ParallelismPolicy::ADAPTIVE:
+            m_counted = true;
+            m_threads = std::max(1, max_threads / (g_running.fetch_add(1) + 1));
+            break;
+        }
+    }
+    omp_set_num_threads(m_threads);
+}
+
+OmpThreadScope::~OmpThreadScope()
+{
+    if (m_counted)
+    {
+        g_running.fetch_sub(1);
+    }
+    omp_set_num_threads(m_previous);
+}
+
+const std::vector<std::vector<i32>> &getNumaNodeCpus()
+{
+    static const std::vector<std::vector<i32>> nodes = readNumaNodeCpus();
+    return nodes;
+}
+
+bool pinCurrentThreadToNode(size_t node)
+{
+    const auto &nodes = getNumaNodeCpus();
+    const std::vector<i32> &cpus = nodes[node % nodes.size()];
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (i32 cpu : cpus)
+    {
+        CPU_SET(cpu, &set);
+    }
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (rc != 0)
+    {
+        GlobalLogger->warn("<Parallelism> Cannot pin thread to NUMA node {}: error {}", node % nodes.size(), rc);
+        return false;
+    }
+    return true;
+}
+
+} // namespace vdb
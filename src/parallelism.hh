@@ -0,0 +1,64 @@
+#pragma once
+
+#include "types.hh"
+#include <string>
+#include <vector>
+
+namespace vdb
+{
+
+/// How the OpenMP threads faiss parallelizes with are shared between concurrent requests.
+enum class ParallelismPolicy
+{
+    // every faiss call may start a team of all OpenMP threads, faiss' own behaviour
+    WIDE,
+    // request-path faiss calls run on their calling thread, bulk work uses all threads
+    SINGLE,
+    // request-path faiss calls split the OpenMP threads between the calls running at the moment
+    ADAPTIVE,
+};
+
+/// Throws std::invalid_argument on unknown names.
+ParallelismPolicy getParallelismPolicyFromString(const std::string &policy);
+const char *parallelismPolicyName(ParallelismPolicy policy);
+
+/// `max_threads` 0 keeps omp_get_max_threads() of the calling thread
+void setParallelismPolicy(ParallelismPolicy policy, i32 max_threads = 0);
+ParallelismPolicy getParallelismPolicy();
+
+enum class ParallelWork
+{
+    // searches and single-vector writes serving a request
+    REQUEST,
+    // bulk adds, training, buffer merges and compaction
+    BULK,
+};
+
+/// Sets the OpenMP thread count of the calling thread for the faiss calls made in its scope,
+/// following the policy, and restores the previous count on exit.
+class OmpThreadScope
+{
+  public:
+    explicit OmpThreadScope(ParallelWork work);
+    ~OmpThreadScope();
+    OmpThreadScope(const OmpThreadScope &) = delete;
+    OmpThreadScope &operator=(const OmpThreadScope &) = delete;
+
+    i32 threads() const
+    {
+        return m_threads;
+    }
+
+  private:
+    i32 m_previous;
+    i32 m_threads;
+    bool m_counted = false;
+};
+
+/// CPUs of each NUMA node as listed in sysfs; one node with every CPU when that is unavailable
+const std::vector<std::vector<i32>> &getNumaNodeCpus();
+/// Restrict the calling thread to the CPUs of `node` (modulo the node count). OpenMP teams the
+/// thread starts inherit the mask, so their threads stay on the same node.
+bool pinCurrentThreadToNode(size_t node);
+
+} // namespace vdb
@@ -1,10 +1,14 @@
 #include "persistence.hh"
 #include "index_factory.hh"
+#include "json_utils.hh"
 #include "logger.hh"
+#include "metrics.hh"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
 #include <cstring>
+#include <format>
 #include <fstream>
+#include <mutex>
 #include <ostream>
 #include <sstream>
 #include <stdexcept>
@@ -13,7 +17,7 @@
 namespace vdb
 {
 
-Persistence::Persistence() : m_increase_id(0), m_last_snapshot_id(0)
+Persistence::Persistence() : m_increase_id(0), m_last_snapshot_id(0), m_wal_bytes_since_snapshot(0)
 {
 }
 
@@ -25,8 +29,9 @@ Persistence::~Persistence()
     }
 }
 
-void Persistence::init(const std::string &local_path)
+void Persistence::init(const std::string &local_path, const std::string &snapshot_path)
 {
+    m_snapshot_path = snapshot_path;
     m_wal_log_file.open(local_path, std::ios::in | std::ios::out | std::ios::app);
     if (!m_wal_log_file.is_open())
     {
@@ -49,13 +54,19 @@ u64 Persistence::getID() const
 void Persistence::writeWALLog(const std::string &operation_type, const rapidjson::Document &json_data,
                               const std::string &version)
 {
-    u64 log_id = increaseID();
-
     rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    JsonWriter<rapidjson::StringBuffer> writer(buffer);
     json_data.Accept(writer);
 
-    m_wal_log_file << log_id << "|" << version << "|" << operation_type << "|" << buffer.GetString() << std::endl;
+    std::lock_guard<std::mutex> lock(m_wal_mutex);
+    u64 log_id = increaseID();
+
+    std::string line = std::format("{}|{}|{}|{}\n", log_id, version, operation_type, buffer.GetString());
+    static Histogram &append_histogram = stageHistogram("wal_append");
+    {
+        ScopedTimer timer(append_histogram);
+        m_wal_log_file.write(line.data(), static_cast<std::streamsize>(line.size()));
+    }
 
     if (m_wal_log_file.fail())
     {
@@ -64,10 +75,20 @@ void Persistence::writeWALLog(const std::string &operation_type, const rapidjson
     }
     else
     {
+        static Histogram &flush_histogram = stageHistogram("wal_flush");
+        ScopedTimer timer(flush_histogram);
         m_wal_log_file.flush();
+        m_wal_bytes_since_snapshot.fetch_add(line.size(), std::memory_order_relaxed);
     }
 }
-void Persistence::readNextWALLog(std::string *operation_type, rapidjson::Document *json_data)
+
+u64 Persistence::getWALBytesSinceSnapshot() const
+{
+    return m_wal_bytes_since_snapshot.load(std::memory_order_relaxed);
+}
+
+void Persistence::readNextWALLog(std::string *operation_type, rapidjson::Document *json_data,
+                                 std::vector<f32> *vectors)
 {
     GlobalLogger->debug("<Persistence> Reading next WAL log entry");
     std::string line;
@@ -88,9 +109,10 @@ void Persistence::readNextWALLog(std::string *operation_type, rapidjson::Documen
 
         if (log_id > m_last_snapshot_id)
         {
-            json_data->Parse(json_data_str.c_str());
+            m_wal_bytes_since_snapshot.fetch_add(line.size() + 1, std::memory_order_relaxed);
             GlobalLogger->debug("<Persistence> Read WAL log entry: log_id={}, operation_type={}, json_data_str={}",
                                 log_id, *operation_type, json_data_str);
+            parseJsonRequest(json_data_str, *json_data, vectors);
             return;
         }
         else
@@ -103,27 +125,25 @@ void Persistence::readNextWALLog(std::string *operation_type, rapidjson::Documen
     GlobalLogger->debug("<Persistence> No more WAL log entries to read");
 }
 
-void Persistence::takeSnapshot(ScalarStorage &scalar_storage)
+void Persistence::takeSnapshot(IndexFactory &index_factory, ScalarStorage &scalar_storage)
 {
     GlobalLogger->debug("<Persistence> Taking Snapshot");
     m_last_snapshot_id = m_increase_id;
-    std::string snapshot_folder_path = "vdb.snapshot";
-    IndexFactory *index_factory = getGlobalIndexFactory();
-    index_factory->saveIndex(snapshot_folder_path, scalar_storage);
+    m_wal_bytes_since_snapshot.store(0, std::memory_order_relaxed);
+    index_factory.saveIndex(m_snapshot_path, scalar_storage);
     saveLastSnapshotID();
 }
 
-void Persistence::loadSnapshot(ScalarStorage &scalar_storage)
+void Persistence::loadSnapshot(IndexFactory &index_factory, ScalarStorage &scalar_storage)
 {
     GlobalLogger->debug("<Persistence> Loading Snapshot");
-    std::string snapshot_folder_path = "vdb.snapshot";
-    IndexFactory *index_factory = getGlobalIndexFactory();
-    index_factory->loadIndex(snapshot_folder_path, scalar_storage);
+    index_factory.loadIndex(m_snapshot_path, scalar_storage);
 }
 
 void Persistence::saveLastSnapshotID()
 {
-    std::ofstream file("vdb.snapshot.maxlogid");
+    std::string file_path = m_snapshot_path + ".maxlogid";
+    std::ofstream file(file_path);
     if (file.is_open())
     {
         file << m_last_snapshot_id;
@@ -131,14 +151,15 @@ void Persistence::saveLastSnapshotID()
     }
     else
     {
-        GlobalLogger->error("<Persistence> Failed to open file vdb.snapshot.maxlogid for writing");
+        GlobalLogger->error("<Persistence> Failed to open file {} for writing", file_path);
     }
     GlobalLogger->debug("<Persistence> Save snapshot Max log ID {}", m_last_snapshot_id);
 }
 
 void Persistence::loadLastSnapshotID()
 {
-    std::ifstream file("vdb.snapshot.maxlogid");
+    std::string file_path = m_snapshot_path + ".maxlogid";
+    std::ifstream file(file_path);
     if (file.is_open())
     {
         file >> m_last_snapshot_id;
@@ -146,7 +167,7 @@ void Persistence::loadLastSnapshotID()
     }
     else
     {
-        GlobalLogger->error("<Persistence> Failed to open file vdb.snapshot.maxlogid for reading");
+        GlobalLogger->error("<Persistence> Failed to open file {} for reading", file_path);
     }
     GlobalLogger->debug("<Persistence> Load snapshot Max log ID {}", m_last_snapshot_id);
 }
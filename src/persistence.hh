@@ -1,10 +1,14 @@
 #pragma once
 
+#include "index_factory.hh"
 #include "scalar_storage.hh"
 #include "types.hh"
+#include <atomic>
 #include <fstream>
+#include <mutex>
 #include <rapidjson/document.h>
 #include <string>
+#include <vector>
 
 namespace vdb
 {
@@ -14,16 +18,18 @@ class Persistence
   public:
     Persistence();
     ~Persistence();
-    void init(const std::string &local_path);
+    void init(const std::string &local_path, const std::string &snapshot_path = "vdb.snapshot");
     u64 increaseID();
     u64 getID() const;
     void writeWALLog(const std::string &operation_type, const rapidjson::Document &json_data,
                      const std::string &version);
-    void readNextWALLog(std::string *operation_type, rapidjson::Document *json_data);
+    /// bytes appended to (or replayed from) the WAL since the last snapshot
+    u64 getWALBytesSinceSnapshot() const;
+    void readNextWALLog(std::string *operation_type, rapidjson::Document *json_data, std::vector<f32> *vectors);
 
     /// Snapshot
-    void takeSnapshot(ScalarStorage &scalar_storage);
-    void loadSnapshot(ScalarStorage &scalar_storage);
+    void takeSnapshot(IndexFactory &index_factory, ScalarStorage &scalar_storage);
+    void loadSnapshot(IndexFactory &index_factory, ScalarStorage &scalar_storage);
     void saveLastSnapshotID();
     void loadLastSnapshotID();
 
@@ -31,6 +37,10 @@ class Persistence
     u64 m_last_snapshot_id;
     u64 m_increase_id;
     std::fstream m_wal_log_file;
+    // serializes appends from concurrent writers
+    std::mutex m_wal_mutex;
+    std::string m_snapshot_path;
+    std::atomic<u64> m_wal_bytes_since_snapshot;
 };
 
 } // namespace vdb
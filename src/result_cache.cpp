@@ -0,0 +1,111 @@
+#include "result_cache.hh"
+#include "metrics.hh"
+#include <functional>
+#include <iterator>
+
+namespace vdb
+{
+
+namespace
+{
+// list node, hash node and bucket of an entry, roughly
+constexpr size_t kEntryOverhead = 128;
+} // namespace
+
+ResultCache::ResultCache(const std::string &name, size_t capacity_bytes, std::chrono::milliseconds ttl)
+    : m_shard_capacity(capacity_bytes / kShards), m_ttl(ttl),
+      m_hits(getGlobalMetrics()->counter("vdb_result_cache_hits_total", "Searches answered from the result cache",
+                                         {{"collection", name}})),
+      m_misses(getGlobalMetrics()->counter("vdb_result_cache_misses_total",
+                                           "Searches that missed the result cache", {{"collection", name}}))
+{
+}
+
+ResultCache::Shard &ResultCache::shardOf(const std::string &key)
+{
+    return m_shards[std::hash<std::string>{}(key) % kShards];
+}
+
+void ResultCache::erase(Shard &shard, std::list<Entry>::iterator it)
+{
+    shard.bytes -= it->bytes;
+    shard.entries.erase(std::string_view(it->key));
+    shard.lru.erase(it);
+}
+
+bool ResultCache::get(const std::string &key, u64 epoch, Results &results)
+{
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.entries.find(std::string_view(key));
+    if (found == shard.entries.end())
+    {
+        m_misses.inc();
+        return false;
+    }
+    auto it = found->second;
+    if (it->epoch != epoch || std::chrono::steady_clock::now() >= it->expires)
+    {
+        erase(shard, it);
+        m_misses.inc();
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it);
+    results = it->results;
+    m_hits.inc();
+    return true;
+}
+
+void ResultCache::put(const std::string &key, u64 epoch, const Results &results)
+{
+    size_t bytes = key.size() + results.first.size() * sizeof(i64) + results.second.size() * sizeof(f32) +
+                   kEntryOverhead;
+    if (bytes > m_shard_capacity)
+    {
+        return;
+    }
+
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.entries.find(std::string_view(key));
+    if (found != shard.entries.end())
+    {
+        // a newer epoch wins; a search that started before a write must not replace its result
+        if (found->second->epoch > epoch)
+        {
+            return;
+        }
+        erase(shard, found->second);
+    }
+    while (!shard.lru.empty() && shard.bytes + bytes > m_shard_capacity)
+    {
+        erase(shard, std::prev(shard.lru.end()));
+    }
+    shard.lru.push_front(Entry{key, epoch, std::chrono::steady_clock::now() + m_ttl, results, bytes});
+    shard.entries.emplace(std::string_view(shard.lru.front().key), shard.lru.begin());
+    shard.bytes += bytes;
+}
+
+void ResultCache::clear()
+{
+    for (Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.entries.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+    }
+}
+
+size_t ResultCache::getMemoryUsage() const
+{
+    size_t bytes = 0;
+    for (const Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        bytes += shard.bytes;
+    }
+    return bytes;
+}
+
+} // namespace vdb
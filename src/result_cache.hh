@@ -0,0 +1,74 @@
+#pragma once
+
+#include "types.hh"
+#include <array>
+#include <chrono>
+#include <list>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vdb
+{
+
+class Counter;
+
+/// Sharded LRU cache of k-NN search results.
+///
+/// Keys are opaque byte strings built by the caller (query vector, k, index and search options).
+/// Every entry carries the write epoch it was computed at: a lookup with another epoch misses and
+/// drops the entry, so bumping the epoch after a write invalidates everything cached before it
+/// without walking the cache. Entries also expire after a TTL, and each shard evicts least
+/// recently used entries beyond its share of the memory bound.
+class ResultCache
+{
+  public:
+    using Results = std::pair<std::vector<i64>, std::vector<f32>>;
+
+    /// `name` labels the hit and miss counters
+    ResultCache(const std::string &name, size_t capacity_bytes, std::chrono::milliseconds ttl);
+
+    bool get(const std::string &key, u64 epoch, Results &results);
+    void put(const std::string &key, u64 epoch, const Results &results);
+    void clear();
+    /// bytes held by keys and results, bookkeeping included
+    size_t getMemoryUsage() const;
+
+  private:
+    struct Entry
+    {
+        std::string key;
+        u64 epoch;
+        std::chrono::steady_clock::time_point expires;
+        Results results;
+        size_t bytes;
+    };
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        // most recently used first
+        std::list<Entry> lru;
+        // keys point into the entries
+        std::unordered_map<std::string_view, std::list<Entry>::iterator> entries;
+        size_t bytes = 0;
+    };
+
+    static constexpr size_t kShards = 16;
+
+    Shard &shardOf(const std::string &key);
+    /// the caller holds the shard lock
+    void erase(Shard &shard, std::list<Entry>::iterator it);
+
+  private:
+    size_t m_shard_capacity;
+    std::chrono::milliseconds m_ttl;
+    std::array<Shard, kShards> m_shards;
+    Counter &m_hits;
+    Counter &m_misses;
+};
+
+} // namespace vdb
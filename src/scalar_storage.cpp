@@ -1,15 +1,30 @@
 #include "scalar_storage.hh"
+#include "json_utils.hh"
 #include "logger.hh"
+#include "metrics.hh"
 #include <rapidjson/document.h>
 #include <rapidjson/writer.h>
 #include <rocksdb/options.h>
 #include <rocksdb/status.h>
+#include <rocksdb/write_batch.h>
+#include <cstring>
 #include <stdexcept>
 #include <string>
 
 namespace vdb
 {
-ScalarStorage::ScalarStorage(const std::string &db_path)
+
+namespace
+{
+
+std::string vectorKey(u64 id)
+{
+    return "vec:" + std::to_string(id);
+}
+
+} // namespace
+
+ScalarStorage::ScalarStorage(const std::string &db_path) : m_owns_db(true)
 {
     rocksdb::Options options;
     options.create_if_missing = true;
@@ -18,30 +33,83 @@ ScalarStorage::ScalarStorage(const std::string &db_path)
     {
         throw std::runtime_error("<RocksDB> Failed to open RocksDB: " + status.ToString());
     }
+    m_column_family = m_db->DefaultColumnFamily();
+}
+
+ScalarStorage::ScalarStorage(rocksdb::DB *db, rocksdb::ColumnFamilyHandle *column_family)
+    : m_db(db), m_column_family(column_family), m_owns_db(false)
+{
 }
 
 ScalarStorage::~ScalarStorage()
 {
-    delete m_db;
+    if (m_owns_db)
+    {
+        delete m_db;
+    }
+    else if (m_column_family != nullptr)
+    {
+        m_db->DestroyColumnFamilyHandle(m_column_family);
+    }
 }
 
-void ScalarStorage::insert_scalar(u64 id, const rapidjson::Document &data)
+void ScalarStorage::insert_scalar(u64 id, const rapidjson::Document &data, const char *skip_member)
 {
     rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-    data.Accept(writer);
+    JsonWriter<rapidjson::StringBuffer> writer(buffer);
+    if (skip_member != nullptr && data.IsObject())
+    {
+        writer.StartObject();
+        for (auto it = data.MemberBegin(); it != data.MemberEnd(); ++it)
+        {
+            if (std::strcmp(it->name.GetString(), skip_member) != 0)
+            {
+                writer.Key(it->name.GetString(), it->name.GetStringLength());
+                it->value.Accept(writer);
+            }
+        }
+        writer.EndObject();
+    }
+    else
+    {
+        data.Accept(writer);
+    }
     std::string value = buffer.GetString();
-    rocksdb::Status status = m_db->Put(rocksdb::WriteOptions(), std::to_string(id), value);
+    static Histogram &put_histogram = stageHistogram("rocksdb_put");
+    rocksdb::Status status;
+    {
+        ScopedTimer timer(put_histogram);
+        status = m_db->Put(rocksdb::WriteOptions(), m_column_family, std::to_string(id), value);
+    }
     if (!status.ok())
     {
         GlobalLogger->error("<RocksDB> Failed to insert scalar: {}", status.ToString());
     }
 }
 
+void ScalarStorage::remove_scalar(u64 id)
+{
+    static Histogram &delete_histogram = stageHistogram("rocksdb_delete");
+    rocksdb::Status status;
+    {
+        ScopedTimer timer(delete_histogram);
+        status = m_db->Delete(rocksdb::WriteOptions(), m_column_family, std::to_string(id));
+    }
+    if (!status.ok())
+    {
+        GlobalLogger->error("<RocksDB> Failed to delete scalar of id {} : {}", id, status.ToString());
+    }
+}
+
 rapidjson::Document ScalarStorage::get_scalar(u64 id)
 {
+    static Histogram &get_histogram = stageHistogram("rocksdb_get");
     std::string value;
-    rocksdb::Status status = m_db->Get(rocksdb::ReadOptions(), std::to_string(id), &value);
+    rocksdb::Status status;
+    {
+        ScopedTimer timer(get_histogram);
+        status = m_db->Get(rocksdb::ReadOptions(), m_column_family, std::to_string(id), &value);
+    }
 
     if (!status.ok())
     {
@@ -50,10 +118,10 @@ rapidjson::Document ScalarStorage::get_scalar(u64 id)
     }
 
     rapidjson::Document data;
-    data.Parse(value.c_str());
+    parseJsonRequest(value, data);
 
     rapidjson::StringBuffer buffer;
-    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    JsonWriter<rapidjson::StringBuffer> writer(buffer);
     data.Accept(writer);
     GlobalLogger->debug("<RocksDB> Data retrieved from ScalarStorage: {} : {}", buffer.GetString(), status.ToString());
     return data;
@@ -61,7 +129,9 @@ rapidjson::Document ScalarStorage::get_scalar(u64 id)
 
 void ScalarStorage::put(const std::string &key, const std::string &value)
 {
-    rocksdb::Status status = m_db->Put(rocksdb::WriteOptions(), key, value);
+    static Histogram &put_histogram = stageHistogram("rocksdb_put");
+    ScopedTimer timer(put_histogram);
+    rocksdb::Status status = m_db->Put(rocksdb::WriteOptions(), m_column_family, key, value);
     if (!status.ok())
     {
         GlobalLogger->error("<RocksDB> Failed to put key {} : {}", key, status.ToString());
@@ -71,8 +141,10 @@ void ScalarStorage::put(const std::string &key, const std::string &value)
 
 std::string ScalarStorage::get(const std::string &key)
 {
+    static Histogram &get_histogram = stageHistogram("rocksdb_get");
+    ScopedTimer timer(get_histogram);
     std::string value;
-    rocksdb::Status status = m_db->Get(rocksdb::ReadOptions(), key, &value);
+    rocksdb::Status status = m_db->Get(rocksdb::ReadOptions(), m_column_family, key, &value);
     if (!status.ok())
     {
         GlobalLogger->error("<RocksDB> Failed to get value for key {} : {}", key, status.ToString());
@@ -81,4 +153,89 @@ std::string ScalarStorage::get(const std::string &key)
     return value;
 }
 
+void ScalarStorage::put_vectors(const std::vector<u64> &ids, const f32 *data, size_t dim)
+{
+    static Histogram &put_histogram = stageHistogram("rocksdb_put");
+    ScopedTimer timer(put_histogram);
+    rocksdb::WriteBatch batch;
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        batch.Put(m_column_family, vectorKey(ids[i]),
+                  rocksdb::Slice(reinterpret_cast<const char *>(data + i * dim), dim * sizeof(f32)));
+    }
+    rocksdb::Status status = m_db->Write(rocksdb::WriteOptions(), &batch);
+    if (!status.ok())
+    {
+        GlobalLogger->error("<RocksDB> Failed to put {} vectors : {}", ids.size(), status.ToString());
+    }
+}
+
+void ScalarStorage::remove_vector(u64 id)
+{
+    static Histogram &delete_histogram = stageHistogram("rocksdb_delete");
+    ScopedTimer timer(delete_histogram);
+    rocksdb::Status status = m_db->Delete(rocksdb::WriteOptions(), m_column_family, vectorKey(id));
+    if (!status.ok())
+    {
+        GlobalLogger->error("<RocksDB> Failed to delete vector of id {} : {}", id, status.ToString());
+    }
+}
+
+std::vector<bool> ScalarStorage::get_vectors(const std::vector<u64> &ids, size_t dim, std::vector<f32> &data)
+{
+    static Histogram &multiget_histogram = stageHistogram("rocksdb_multiget");
+    ScopedTimer timer(multiget_histogram);
+    std::vector<std::string> keys;
+    keys.reserve(ids.size());
+    for (u64 id : ids)
+    {
+        keys.push_back(vectorKey(id));
+    }
+    std::vector<rocksdb::Slice> key_slices(keys.begin(), keys.end());
+    std::vector<rocksdb::PinnableSlice> values(ids.size());
+    std::vector<rocksdb::Status> statuses(ids.size());
+    m_db->MultiGet(rocksdb::ReadOptions(), m_column_family, ids.size(), key_slices.data(), values.data(),
+                   statuses.data());
+
+    data.assign(ids.size() * dim, 0.0f);
+    std::vector<bool> found(ids.size(), false);
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if (statuses[i].ok() && values[i].size() == dim * sizeof(f32))
+        {
+            std::memcpy(data.data() + i * dim, values[i].data(), values[i].size());
+            found[i] = true;
+        }
+        else if (!statuses[i].ok() && !statuses[i].IsNotFound())
+        {
+            GlobalLogger->error("<RocksDB> Failed to get vector of id {} : {}", ids[i], statuses[i].ToString());
+        }
+    }
+    return found;
+}
+
+u64 ScalarStorage::getApproximateSize() const
+{
+    u64 size = 0;
+    if (!m_db->GetIntProperty(m_column_family, rocksdb::DB::Properties::kEstimateLiveDataSize, &size))
+    {
+        return 0;
+    }
+    return size;
+}
+
+void ScalarStorage::dropColumnFamily()
+{
+    if (m_owns_db)
+    {
+        throw std::logic_error("<RocksDB> Cannot drop the column family of a standalone database");
+    }
+    rocksdb::Status status = m_db->DropColumnFamily(m_column_family);
+    if (!status.ok())
+    {
+        GlobalLogger->error("<RocksDB> Failed to drop column family {} : {}", m_column_family->GetName(),
+                            status.ToString());
+    }
+}
+
 } // namespace vdb
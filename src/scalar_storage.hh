@@ -4,25 +4,47 @@
 #include <rapidjson/document.h>
 #include <rocksdb/db.h>
 #include <string>
+#include <vector>
 
 namespace vdb
 {
 class ScalarStorage
 {
   public:
+    /// standalone database, data in the default column family
     ScalarStorage(const std::string &db_path);
+    /// one column family of a database shared between collections; takes ownership of the handle
+    ScalarStorage(rocksdb::DB *db, rocksdb::ColumnFamilyHandle *column_family);
     ~ScalarStorage();
+    ScalarStorage(const ScalarStorage &) = delete;
+    ScalarStorage &operator=(const ScalarStorage &) = delete;
 
     /// modify
-    void insert_scalar(u64 id, const rapidjson::Document &data);
+    /// `skip_member` names a top-level member left out of the stored document
+    void insert_scalar(u64 id, const rapidjson::Document &data, const char *skip_member = nullptr);
+    void remove_scalar(u64 id);
     void put(const std::string &key, const std::string &value);
+    /// exact vectors for re-ranking, `ids.size()` rows of `dim` floats stored as raw bytes under
+    /// "vec:<id>" in one write batch
+    void put_vectors(const std::vector<u64> &ids, const f32 *data, size_t dim);
+    void remove_vector(u64 id);
 
     /// observe
     rapidjson::Document get_scalar(u64 id);
     std::string get(const std::string &key);
+    /// fetch the vectors of `ids` with one MultiGet into `data` (`ids.size() * dim` floats);
+    /// returns which ids had one
+    std::vector<bool> get_vectors(const std::vector<u64> &ids, size_t dim, std::vector<f32> &data);
+    /// estimated on-disk size of the live data
+    u64 getApproximateSize() const;
+
+    /// drop the column family and all data in it
+    void dropColumnFamily();
 
   private:
     rocksdb::DB *m_db;
+    rocksdb::ColumnFamilyHandle *m_column_family;
+    bool m_owns_db;
 };
 
 } // namespace vdb
@@ -0,0 +1,99 @@
+#include "search_batcher.hh"
+#include "faiss_index.hh"
+#include "metrics.hh"
+
+namespace vdb
+{
+
+SearchBatcher::SearchBatcher(i32 dim, std::chrono::microseconds window, size_t max_queries, SearchFn search)
+    : m_dim(dim), m_window(window), m_max_queries(max_queries), m_search(std::move(search))
+{
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> SearchBatcher::search(const std::vector<f32> &query, i32 k,
+                                                                     const SearchOptions &search_options)
+{
+    static Counter &batches = getGlobalMetrics()->counter("vdb_search_batches_total",
+                                                          "Multi-query faiss searches run by the search batcher");
+    static Counter &batched_queries = getGlobalMetrics()->counter(
+        "vdb_search_batched_queries_total", "Query vectors searched through the search batcher");
+
+    size_t query_num = query.size() / m_dim;
+    if (query_num >= m_max_queries)
+    {
+        return m_search(query, k, search_options);
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ++m_active;
+    std::pair<i32, i32> key{k, search_options.nprobe};
+    std::shared_ptr<Batch> batch;
+    size_t offset = 0;
+    auto open = m_open.find(key);
+    if (open != m_open.end() && open->second->query_num + query_num <= m_max_queries)
+    {
+        // follower: append and wait for the leader to run the batch
+        batch = open->second;
+        offset = batch->query_num;
+        batch->queries.insert(batch->queries.end(), query.begin(), query.end());
+        batch->query_num += query_num;
+        if (batch->query_num >= m_max_queries)
+        {
+            m_open.erase(open);
+            batch->cv.notify_all();
+        }
+        batch->cv.wait(lock, [&batch]() { return batch->done; });
+    }
+    else
+    {
+        // leader: a batch too full to take this query keeps running with its own leader
+        batch = std::make_shared<Batch>();
+        batch->queries = query;
+        batch->query_num = query_num;
+        m_open[key] = batch;
+        if (m_active > 1)
+        {
+            batch->cv.wait_until(lock, std::chrono::steady_clock::now() + m_window,
+                                 [this, &batch]() { return batch->query_num >= m_max_queries; });
+        }
+        open = m_open.find(key);
+        if (open != m_open.end() && open->second == batch)
+        {
+            m_open.erase(open);
+        }
+        lock.unlock();
+
+        // closed: nobody appends any more, so the queries are read without the lock
+        std::pair<std::vector<i64>, std::vector<f32>> results;
+        std::exception_ptr error;
+        try
+        {
+            results = m_search(batch->queries, k, search_options);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        batches.inc();
+        batched_queries.inc(batch->query_num);
+
+        lock.lock();
+        batch->results = std::move(results);
+        batch->error = error;
+        batch->done = true;
+        batch->cv.notify_all();
+    }
+    --m_active;
+    if (batch->error)
+    {
+        std::rethrow_exception(batch->error);
+    }
+
+    const auto &[labels, distances] = batch->results;
+    size_t begin = offset * k;
+    size_t end = (offset + query_num) * k;
+    return {std::vector<i64>(labels.begin() + begin, labels.begin() + end),
+            std::vector<f32>(distances.begin() + begin, distances.begin() + end)};
+}
+
+} // namespace vdb
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "types.hh"
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace vdb
+{
+
+struct SearchOptions;
+
+/// Coalesces concurrent k-NN searches of one index into multi-query searches.
+///
+/// There is no batching thread: the first request of a batch becomes its leader, waits up to
+/// `window` for others with the same k and search options to append their queries (or until
+/// `max_queries` are collected), runs the whole batch with one call and hands every request its
+/// slice of the results. A leader that finds no other search in progress runs at once, so
+/// batching only adds latency when there is concurrency to gain from. On FLAT, batches from
+/// faiss' BLAS threshold (20 queries) on are scanned with one GEMM instead of one pass per query.
+class SearchBatcher
+{
+  public:
+    /// runs `queries` (concatenated vectors) as one search and returns k results per query
+    using SearchFn = std::function<std::pair<std::vector<i64>, std::vector<f32>>(
+        const std::vector<f32> &queries, i32 k, const SearchOptions &search_options)>;
+
+    SearchBatcher(i32 dim, std::chrono::microseconds window, size_t max_queries, SearchFn search);
+
+    std::pair<std::vector<i64>, std::vector<f32>> search(const std::vector<f32> &query, i32 k,
+                                                         const SearchOptions &search_options);
+
+  private:
+    struct Batch
+    {
+        std::vector<f32> queries;
+        size_t query_num = 0;
+        bool done = false;
+        std::pair<std::vector<i64>, std::vector<f32>> results;
+        std::exception_ptr error;
+        std::condition_variable cv;
+    };
+
+  private:
+    i32 m_dim;
+    std::chrono::microseconds m_window;
+    size_t m_max_queries;
+    SearchFn m_search;
+
+    std::mutex m_mutex;
+    // batches still accepting queries, by (k, nprobe)
+    std::map<std::pair<i32, i32>, std::shared_ptr<Batch>> m_open;
+    // requests inside search(), leaders and followers alike
+    size_t m_active = 0;
+};
+
+} // namespace vdb
@@ -0,0 +1,644 @@
+#include "sparse_index.hh"
+#include "logger.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+
+namespace vdb
+{
+
+namespace
+{
+
+constexpr u32 kSparseIndexVersion = 1;
+// past every u32 label: the doc of an exhausted cursor
+constexpr u64 kEnd = u64(1) << 32;
+
+using Block = SparseIndex::Block;
+using PostingList = SparseIndex::PostingList;
+
+void putVarint(std::vector<u8> &out, u32 value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<u8>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<u8>(value));
+}
+
+const u8 *getVarint(const u8 *in, u32 &value)
+{
+    value = 0;
+    for (u32 shift = 0;; shift += 7)
+    {
+        u8 byte = *in++;
+        value |= static_cast<u32>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return in;
+        }
+    }
+}
+
+/// `labels` ascending, `weights` positive; drops the exact weights, which the caller restores for
+/// an open block
+void encodeBlock(const u32 *labels, const f32 *weights, size_t count, Block &block)
+{
+    block.exact.clear();
+    block.count = static_cast<u32>(count);
+    block.last = labels[count - 1];
+    block.max_weight = *std::max_element(weights, weights + count);
+    block.data.clear();
+    u32 previous = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        putVarint(block.data, labels[i] - previous);
+        previous = labels[i];
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        // a positive weight never rounds down to nothing
+        long quantized = std::lround(weights[i] / block.max_weight * 255.0f);
+        block.data.push_back(static_cast<u8>(std::clamp(quantized, 1L, 255L)));
+    }
+    block.data.shrink_to_fit();
+}
+
+void decodeBlock(const Block &block, std::vector<u32> &labels, std::vector<f32> &weights)
+{
+    labels.resize(block.count);
+    weights.resize(block.count);
+    const u8 *in = block.data.data();
+    u32 previous = 0;
+    for (u32 i = 0; i < block.count; ++i)
+    {
+        u32 delta;
+        in = getVarint(in, delta);
+        previous += delta;
+        labels[i] = previous;
+    }
+    if (!block.exact.empty())
+    {
+        weights = block.exact;
+        return;
+    }
+    f32 scale = block.max_weight / 255.0f;
+    for (u32 i = 0; i < block.count; ++i)
+    {
+        weights[i] = in[i] * scale;
+    }
+}
+
+/// first block whose labels reach `label`
+std::vector<Block>::const_iterator findBlock(const std::vector<Block> &blocks, size_t from, u32 label)
+{
+    return std::lower_bound(blocks.begin() + from, blocks.end(), label,
+                            [](const Block &block, u32 value) { return block.last < value; });
+}
+
+/// (term, weight) pairs sorted by term, repeated terms summed, zero and negative weights dropped
+std::vector<std::pair<u32, f32>> collectTerms(const std::vector<u32> &terms, const std::vector<f32> &weights)
+{
+    std::vector<std::pair<u32, f32>> pairs;
+    pairs.reserve(terms.size());
+    for (size_t i = 0; i < terms.size() && i < weights.size(); ++i)
+    {
+        pairs.emplace_back(terms[i], weights[i]);
+    }
+    std::sort(pairs.begin(), pairs.end());
+    std::vector<std::pair<u32, f32>> merged;
+    merged.reserve(pairs.size());
+    for (const auto &pair : pairs)
+    {
+        if (!merged.empty() && merged.back().first == pair.first)
+        {
+            merged.back().second += pair.second;
+        }
+        else
+        {
+            merged.push_back(pair);
+        }
+    }
+    std::erase_if(merged, [](const auto &pair) { return !(pair.second > 0.0f); });
+    return merged;
+}
+
+/// Position in one posting list during a search, decoding one block at a time.
+class Cursor
+{
+  public:
+    Cursor(const PostingList &list, f32 query_weight)
+        : m_blocks(&list.blocks), m_query_weight(query_weight), m_upper_bound(query_weight * list.max_weight)
+    {
+        load(0);
+    }
+
+    u64 doc() const
+    {
+        return m_block < m_blocks->size() ? m_labels[m_pos] : kEnd;
+    }
+
+    f32 score() const
+    {
+        return m_query_weight * m_weights[m_pos];
+    }
+
+    f32 upperBound() const
+    {
+        return m_upper_bound;
+    }
+
+    void next()
+    {
+        if (++m_pos == m_labels.size())
+        {
+            load(m_block + 1);
+        }
+    }
+
+    /// move to the first label not below `target`
+    void nextGEQ(u32 target)
+    {
+        if (doc() >= target)
+        {
+            return;
+        }
+        if ((*m_blocks)[m_block].last < target)
+        {
+            load(findBlock(*m_blocks, m_block + 1, target) - m_blocks->begin());
+            if (m_block == m_blocks->size())
+            {
+                return;
+            }
+        }
+        m_pos = std::lower_bound(m_labels.begin() + m_pos, m_labels.end(), target) - m_labels.begin();
+    }
+
+    /// bound of the score at `target` from the block-max of the block holding it, without decoding
+    f32 blockBound(u32 target) const
+    {
+        if (doc() >= target)
+        {
+            return m_block < m_blocks->size() ? m_query_weight * (*m_blocks)[m_block].max_weight : 0.0f;
+        }
+        auto it = findBlock(*m_blocks, m_block, target);
+        return it != m_blocks->end() ? m_query_weight * it->max_weight : 0.0f;
+    }
+
+  private:
+    void load(size_t block)
+    {
+        m_block = block;
+        m_pos = 0;
+        if (m_block < m_blocks->size())
+        {
+            decodeBlock((*m_blocks)[m_block], m_labels, m_weights);
+        }
+    }
+
+    const std::vector<Block> *m_blocks;
+    f32 m_query_weight;
+    f32 m_upper_bound;
+    size_t m_block = 0;
+    size_t m_pos = 0;
+    std::vector<u32> m_labels;
+    std::vector<f32> m_weights;
+};
+
+template <typename T> void appendValue(std::string &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+/// reads fixed-size values from a saved index, throwing on truncated data
+class Reader
+{
+  public:
+    Reader(const std::string &data, const std::string &file_path) : m_data(data), m_file_path(file_path)
+    {
+    }
+
+    template <typename T> T value()
+    {
+        T result;
+        take(&result, sizeof(T));
+        return result;
+    }
+
+    void bytes(std::vector<u8> &out, size_t count)
+    {
+        out.resize(count);
+        take(out.data(), count);
+    }
+
+  private:
+    void take(void *out, size_t bytes)
+    {
+        if (m_data.size() - m_offset < bytes)
+        {
+            throw std::runtime_error("<SparseIndex> Truncated index file " + m_file_path);
+        }
+        std::memcpy(out, m_data.data() + m_offset, bytes);
+        m_offset += bytes;
+    }
+
+    const std::string &m_data;
+    const std::string &m_file_path;
+    size_t m_offset = 0;
+};
+
+} // namespace
+
+void SparseIndex::insert_vector(const std::vector<u32> &terms, const std::vector<f32> &weights, u32 label)
+{
+    std::vector<std::pair<u32, f32>> postings = collectTerms(terms, weights);
+    std::unique_lock lock(m_mutex);
+    removeLabel(label);
+    if (postings.empty())
+    {
+        return;
+    }
+    std::vector<u32> label_terms;
+    label_terms.reserve(postings.size());
+    for (const auto &[term, weight] : postings)
+    {
+        addPosting(m_postings[term], label, weight);
+        label_terms.push_back(term);
+    }
+    m_forward[label] = std::move(label_terms);
+}
+
+u64 SparseIndex::remove_vectors(const std::vector<i64> &ids)
+{
+    std::unique_lock lock(m_mutex);
+    u64 removed = 0;
+    for (i64 id : ids)
+    {
+        if (id >= 0 && id < static_cast<i64>(kEnd) && removeLabel(static_cast<u32>(id)))
+        {
+            ++removed;
+        }
+    }
+    return removed;
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> SparseIndex::search_vector(const std::vector<u32> &terms,
+                                                                         const std::vector<f32> &weights, i32 k,
+                                                                         const roaring_bitmap_t *bitmap) const
+{
+    std::vector<i64> labels(k, -1);
+    std::vector<f32> scores(k, 0.0f);
+    std::vector<std::pair<u32, f32>> query = collectTerms(terms, weights);
+
+    std::shared_lock lock(m_mutex);
+    std::vector<Cursor> cursors;
+    cursors.reserve(query.size());
+    for (const auto &[term, weight] : query)
+    {
+        auto it = m_postings.find(term);
+        if (it != m_postings.end())
+        {
+            cursors.emplace_back(it->second, weight);
+        }
+    }
+    if (cursors.empty() || k <= 0)
+    {
+        return {labels, scores};
+    }
+
+    // MaxScore: cursors[0, first_essential) are the lists whose bounds together cannot beat the
+    // k-th score, so only the others produce candidates
+    std::sort(cursors.begin(), cursors.end(),
+              [](const Cursor &a, const Cursor &b) { return a.upperBound() < b.upperBound(); });
+    std::vector<f32> bounds(cursors.size());
+    f32 sum = 0.0f;
+    for (size_t i = 0; i < cursors.size(); ++i)
+    {
+        sum += cursors[i].upperBound();
+        bounds[i] = sum;
+    }
+
+    using Entry = std::pair<f32, u32>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> top;
+    f32 threshold = 0.0f;
+    size_t first_essential = 0;
+    while (first_essential < cursors.size())
+    {
+        u64 doc = kEnd;
+        for (size_t i = first_essential; i < cursors.size(); ++i)
+        {
+            doc = std::min(doc, cursors[i].doc());
+        }
+        if (doc == kEnd)
+        {
+            break;
+        }
+        u32 label = static_cast<u32>(doc);
+        bool allowed = bitmap == nullptr || roaring_bitmap_contains(bitmap, label);
+        f32 score = 0.0f;
+        for (size_t i = first_essential; i < cursors.size(); ++i)
+        {
+            if (cursors[i].doc() == doc)
+            {
+                score += allowed ? cursors[i].score() : 0.0f;
+                cursors[i].next();
+            }
+        }
+        if (!allowed)
+        {
+            continue;
+        }
+
+        bool full = top.size() == static_cast<size_t>(k);
+        for (size_t i = first_essential; i-- > 0;)
+        {
+            // the block-max of the list is tighter than its list-wide bound
+            if (full && (score + bounds[i] <= threshold ||
+                         score + bounds[i] - cursors[i].upperBound() + cursors[i].blockBound(label) <= threshold))
+            {
+                break;
+            }
+            cursors[i].nextGEQ(label);
+            if (cursors[i].doc() == doc)
+            {
+                score += cursors[i].score();
+            }
+        }
+
+        if (!full)
+        {
+            top.emplace(score, label);
+        }
+        else if (score > threshold)
+        {
+            top.pop();
+            top.emplace(score, label);
+        }
+        else
+        {
+            continue;
+        }
+        if (top.size() == static_cast<size_t>(k))
+        {
+            threshold = top.top().first;
+            while (first_essential < cursors.size() && bounds[first_essential] <= threshold)
+            {
+                ++first_essential;
+            }
+        }
+    }
+
+    for (size_t i = top.size(); i-- > 0;)
+    {
+        scores[i] = top.top().first;
+        labels[i] = top.top().second;
+        top.pop();
+    }
+    return {labels, scores};
+}
+
+u64 SparseIndex::getVectorCount() const
+{
+    std::shared_lock lock(m_mutex);
+    return m_forward.size();
+}
+
+u64 SparseIndex::getTermCount() const
+{
+    std::shared_lock lock(m_mutex);
+    return m_postings.size();
+}
+
+IndexMemoryUsage SparseIndex::getMemoryBreakdown() const
+{
+    IndexMemoryUsage usage;
+    std::shared_lock lock(m_mutex);
+    usage.lists += m_postings.size() * (sizeof(std::pair<const u32, PostingList>) + sizeof(void *)) +
+                   m_postings.bucket_count() * sizeof(void *);
+    for (const auto &[term, list] : m_postings)
+    {
+        usage.lists += list.blocks.capacity() * sizeof(Block);
+        for (const Block &block : list.blocks)
+        {
+            usage.lists += block.data.capacity() + block.exact.capacity() * sizeof(f32);
+        }
+    }
+    usage.ids += m_forward.size() * (sizeof(std::pair<const u32, std::vector<u32>>) + sizeof(void *)) +
+                 m_forward.bucket_count() * sizeof(void *);
+    for (const auto &[label, terms] : m_forward)
+    {
+        usage.ids += terms.capacity() * sizeof(u32);
+    }
+    return usage;
+}
+
+void SparseIndex::saveIndex(const std::string &file_path)
+{
+    std::string data;
+    {
+        std::shared_lock lock(m_mutex);
+        appendValue(data, kSparseIndexVersion);
+        appendValue<u64>(data, m_postings.size());
+        for (const auto &[term, list] : m_postings)
+        {
+            appendValue(data, term);
+            appendValue(data, list.max_weight);
+            appendValue<u64>(data, list.blocks.size());
+            for (const Block &block : list.blocks)
+            {
+                appendValue(data, block.last);
+                appendValue(data, block.max_weight);
+                appendValue(data, block.count);
+                appendValue<u64>(data, block.data.size());
+                data.append(reinterpret_cast<const char *>(block.data.data()), block.data.size());
+            }
+        }
+    }
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    if (!file)
+    {
+        throw std::runtime_error("<SparseIndex> Failed to write " + file_path);
+    }
+}
+
+void SparseIndex::loadIndex(const std::string &file_path)
+{
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file.is_open())
+    {
+        GlobalLogger->warn("<SparseIndex> File not found: {}, Skipping loading index.", file_path);
+        return;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Reader reader(data, file_path);
+    u32 version = reader.value<u32>();
+    if (version != kSparseIndexVersion)
+    {
+        throw std::runtime_error(std::format("<SparseIndex> Unsupported version {} of {}", version, file_path));
+    }
+    std::unordered_map<u32, PostingList> postings;
+    std::unordered_map<u32, std::vector<u32>> forward;
+    std::vector<u32> labels;
+    std::vector<f32> weights;
+    u64 term_count = reader.value<u64>();
+    for (u64 t = 0; t < term_count; ++t)
+    {
+        u32 term = reader.value<u32>();
+        PostingList &list = postings[term];
+        list.max_weight = reader.value<f32>();
+        list.blocks.resize(reader.value<u64>());
+        for (Block &block : list.blocks)
+        {
+            block.last = reader.value<u32>();
+            block.max_weight = reader.value<f32>();
+            block.count = reader.value<u32>();
+            reader.bytes(block.data, reader.value<u64>());
+            if (block.count == 0 || block.count > kBlockSize || block.data.size() < block.count)
+            {
+                throw std::runtime_error("<SparseIndex> Corrupted posting block in " + file_path);
+            }
+            // the forward index is not saved, the postings hold it
+            decodeBlock(block, labels, weights);
+            for (u32 label : labels)
+            {
+                forward[label].push_back(term);
+            }
+            list.size += block.count;
+        }
+    }
+
+    std::unique_lock lock(m_mutex);
+    m_postings = std::move(postings);
+    m_forward = std::move(forward);
+    GlobalLogger->info("<SparseIndex> Loaded {} vectors over {} terms from {}", m_forward.size(), m_postings.size(),
+                       file_path);
+}
+
+std::vector<std::string> SparseIndex::getSnapshotFiles(const std::string &file_path) const
+{
+    return {file_path};
+}
+
+void SparseIndex::addPosting(PostingList &list, u32 label, f32 weight)
+{
+    std::vector<Block> &blocks = list.blocks;
+    ++list.size;
+    list.max_weight = std::max(list.max_weight, weight);
+    auto it = findBlock(blocks, 0, label);
+    if (it == blocks.end())
+    {
+        // appending, the common case for newly allocated ordinals
+        if (blocks.empty() || blocks.back().count >= kBlockSize)
+        {
+            Block block;
+            encodeBlock(&label, &weight, 1, block);
+            block.exact.push_back(weight);
+            blocks.push_back(std::move(block));
+            return;
+        }
+        it = blocks.end() - 1;
+    }
+    size_t index = it - blocks.begin();
+    std::vector<u32> labels;
+    std::vector<f32> weights;
+    decodeBlock(blocks[index], labels, weights);
+    size_t pos = std::lower_bound(labels.begin(), labels.end(), label) - labels.begin();
+    labels.insert(labels.begin() + pos, label);
+    weights.insert(weights.begin() + pos, weight);
+    bool last = index + 1 == blocks.size();
+    if (labels.size() <= kBlockSize)
+    {
+        encodeBlock(labels.data(), weights.data(), labels.size(), blocks[index]);
+        // a sealed or loaded block contributes its quantized weights once, later appends keep them
+        if (last && labels.size() < kBlockSize)
+        {
+            blocks[index].exact = std::move(weights);
+        }
+        return;
+    }
+    // a full block taking a recycled ordinal is split in halves
+    size_t half = labels.size() / 2;
+    Block upper;
+    encodeBlock(labels.data() + half, weights.data() + half, labels.size() - half, upper);
+    if (last)
+    {
+        upper.exact.assign(weights.begin() + half, weights.end());
+    }
+    encodeBlock(labels.data(), weights.data(), half, blocks[index]);
+    blocks.insert(blocks.begin() + index + 1, std::move(upper));
+}
+
+bool SparseIndex::removePosting(PostingList &list, u32 label)
+{
+    std::vector<Block> &blocks = list.blocks;
+    auto it = findBlock(blocks, 0, label);
+    if (it == blocks.end())
+    {
+        return false;
+    }
+    size_t index = it - blocks.begin();
+    std::vector<u32> labels;
+    std::vector<f32> weights;
+    decodeBlock(blocks[index], labels, weights);
+    auto pos = std::lower_bound(labels.begin(), labels.end(), label);
+    if (pos == labels.end() || *pos != label)
+    {
+        return false;
+    }
+    weights.erase(weights.begin() + (pos - labels.begin()));
+    labels.erase(pos);
+    f32 removed_max = blocks[index].max_weight;
+    if (labels.empty())
+    {
+        blocks.erase(blocks.begin() + index);
+    }
+    else
+    {
+        encodeBlock(labels.data(), weights.data(), labels.size(), blocks[index]);
+        if (index + 1 == blocks.size())
+        {
+            blocks[index].exact = std::move(weights);
+        }
+    }
+    --list.size;
+    // only the block holding the largest weight can lower the bound of the list
+    if (removed_max >= list.max_weight)
+    {
+        list.max_weight = 0.0f;
+        for (const Block &block : blocks)
+        {
+            list.max_weight = std::max(list.max_weight, block.max_weight);
+        }
+    }
+    return true;
+}
+
+bool SparseIndex::removeLabel(u32 label)
+{
+    auto it = m_forward.find(label);
+    if (it == m_forward.end())
+    {
+        return false;
+    }
+    for (u32 term : it->second)
+    {
+        auto list = m_postings.find(term);
+        if (list != m_postings.end() && removePosting(list->second, label) && list->second.size == 0)
+        {
+            m_postings.erase(list);
+        }
+    }
+    m_forward.erase(it);
+    return true;
+}
+
+} // namespace vdb
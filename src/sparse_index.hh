@@ -0,0 +1,100 @@
+#pragma once
+
+#include "faiss_index.hh"
+#include "types.hh"
+#include <roaring/roaring.h>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace vdb
+{
+
+/// Inverted index of sparse vectors (SPLADE or BM25-style term weights) scored by dot product.
+/// Each term id maps to a posting list of (label, weight) sorted by label, where labels are IdMap
+/// ordinals like in FaissIndex.
+///
+/// Posting lists are cut into blocks of up to kBlockSize postings. A block stores its labels as
+/// varint deltas and its weights as 8-bit fractions of the block's largest weight, which doubles
+/// as the block-max upper bound. The last block of a list also keeps its f32 weights until it
+/// fills up, so the appends that grow it re-quantize from them rather than from the bytes, which
+/// would compound the rounding each time a larger weight rescales the block.
+///
+/// Searches run MaxScore: lists whose bounds cannot lift a document into the top k are only
+/// probed for documents the other lists produce, and their blocks are skipped without decoding
+/// when the block-max says the document cannot make it.
+///
+/// Deletes and overwrites remove the old postings right away through a forward index of the
+/// terms of each label, so the index has no tombstones to compact.
+class SparseIndex
+{
+  public:
+    static constexpr size_t kBlockSize = 128;
+
+    SparseIndex() = default;
+    SparseIndex(const SparseIndex &) = delete;
+    SparseIndex &operator=(const SparseIndex &) = delete;
+
+    /// modify
+    /// `terms` and `weights` are parallel, weights non-negative; repeated terms are summed and
+    /// zero weights dropped. A label that is already present is overwritten.
+    void insert_vector(const std::vector<u32> &terms, const std::vector<f32> &weights, u32 label);
+    /// returns how many of `ids` were present
+    u64 remove_vectors(const std::vector<i64> &ids);
+
+    /// observe
+    /// k largest dot products with the query among the labels in `bitmap` (all when null); the
+    /// tail is padded with -1 labels when fewer match
+    std::pair<std::vector<i64>, std::vector<f32>> search_vector(const std::vector<u32> &terms,
+                                                                const std::vector<f32> &weights, i32 k,
+                                                                const roaring_bitmap_t *bitmap = nullptr) const;
+    u64 getVectorCount() const;
+    u64 getTermCount() const;
+    /// posting blocks count as lists, the forward index as ids
+    IndexMemoryUsage getMemoryBreakdown() const;
+
+    /// Snapshot
+    void saveIndex(const std::string &file_path);
+    void loadIndex(const std::string &file_path);
+    std::vector<std::string> getSnapshotFiles(const std::string &file_path) const;
+
+  public:
+    struct Block
+    {
+        // largest label, for skipping the block without decoding it
+        u32 last = 0;
+        // largest weight, the scale of the quantized weights
+        f32 max_weight = 0.0f;
+        u32 count = 0;
+        // varint label deltas followed by `count` weight bytes
+        std::vector<u8> data;
+        // exact weights while this is the open last block of its list, empty otherwise
+        std::vector<f32> exact;
+    };
+
+    struct PostingList
+    {
+        std::vector<Block> blocks;
+        u64 size = 0;
+        // upper bound of the weights; may stay above the largest one after removals
+        f32 max_weight = 0.0f;
+    };
+
+  private:
+    void addPosting(PostingList &list, u32 label, f32 weight);
+    /// returns false when `label` is not in the list
+    bool removePosting(PostingList &list, u32 label);
+    /// drop the postings of `label`; the caller holds m_mutex exclusively
+    bool removeLabel(u32 label);
+
+  private:
+    std::unordered_map<u32, PostingList> m_postings;
+    // terms of each label, to find its postings on removal
+    std::unordered_map<u32, std::vector<u32>> m_forward;
+    // searches share it, writes and loads take it exclusively
+    mutable std::shared_mutex m_mutex;
+};
+
+} // namespace vdb
@@ -0,0 +1,61 @@
+#include "thread_pool.hh"
+#include <algorithm>
+
+namespace vdb
+{
+
+ThreadPool::ThreadPool(size_t threads, std::function<void(size_t)> on_start)
+{
+    threads = std::max<size_t>(threads, 1);
+    m_workers.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+    {
+        m_workers.emplace_back([this, i, on_start]() {
+            if (on_start)
+            {
+                on_start(i);
+            }
+            workerLoop();
+        });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto &worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if (m_stop && m_tasks.empty())
+            {
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+ThreadPool *getShardThreadPool()
+{
+    static ThreadPool pool(std::thread::hardware_concurrency());
+    return &pool;
+}
+
+} // namespace vdb
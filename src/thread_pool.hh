@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.hh"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace vdb
+{
+
+/// Fixed-size pool of worker threads running submitted tasks in FIFO order.
+/// Tasks must not block on other tasks of the same pool.
+class ThreadPool
+{
+  public:
+    /// `on_start(i)` runs first on worker i, e.g. to pin it
+    explicit ThreadPool(size_t threads, std::function<void(size_t)> on_start = {});
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    template <typename F> std::future<std::invoke_result_t<F>> submit(F &&task)
+    {
+        using Result = std::invoke_result_t<F>;
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(task));
+        std::future<Result> future = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.emplace_back([packaged]() { (*packaged)(); });
+        }
+        m_cv.notify_one();
+        return future;
+    }
+
+    size_t size() const
+    {
+        return m_workers.size();
+    }
+
+    /// tasks submitted but not picked up by a worker yet
+    size_t queued() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_tasks.size();
+    }
+
+  private:
+    void workerLoop();
+
+  private:
+    std::vector<std::thread> m_workers;
+    std::deque<std::function<void()>> m_tasks;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stop = false;
+};
+
+/// Pool used to fan work out over index shards; one thread per hardware thread.
+ThreadPool *getShardThreadPool();
+
+} // namespace vdb
@@ -0,0 +1,513 @@
+#include "vector_arena.hh"
+#include "logger.hh"
+#include <faiss/impl/AuxIndexStructures.h>
+#include <faiss/impl/DistanceComputer.h>
+#include <faiss/impl/FaissAssert.h>
+#include <faiss/impl/IDSelector.h>
+#include <faiss/utils/Heap.h>
+#include <faiss/utils/distances.h>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vdb
+{
+
+namespace
+{
+
+constexpr char kArenaMagic[8] = {'V', 'D', 'B', 'A', 'R', 'E', 'N', 'A'};
+constexpr u32 kArenaVersion = 1;
+
+/// fixed part of the snapshot file, padded to VectorArena::kHeaderBytes; rows follow, then the
+/// content hash of every slot
+struct ArenaFileHeader
+{
+    char magic[8];
+    u32 version;
+    u32 dim;
+    u64 stride;
+    u64 slots;
+};
+
+f32 rowDistance(const f32 *x, const f32 *y, size_t dim, bool inner_product)
+{
+    return inner_product ? faiss::fvec_inner_product(x, y, dim) : faiss::fvec_L2sqr(x, y, dim);
+}
+
+struct ArenaDistanceComputer : faiss::FlatCodesDistanceComputer
+{
+    explicit ArenaDistanceComputer(const ArenaFlatStorage &storage)
+        : faiss::FlatCodesDistanceComputer(storage.codes.data(), storage.code_size), m_arena(*storage.arena),
+          m_dim(static_cast<size_t>(storage.d)), m_inner_product(storage.metric_type == faiss::METRIC_INNER_PRODUCT)
+    {
+    }
+
+    void set_query(const float *x) override
+    {
+        m_query = x;
+    }
+
+    float distance_to_code(const uint8_t *code) override
+    {
+        return rowDistance(m_query, rowOf(code), m_dim, m_inner_product);
+    }
+
+    float symmetric_dis(faiss::idx_t i, faiss::idx_t j) override
+    {
+        return rowDistance(rowOf(codes + i * code_size), rowOf(codes + j * code_size), m_dim, m_inner_product);
+    }
+
+  private:
+    const f32 *rowOf(const uint8_t *code) const
+    {
+        u32 slot;
+        std::memcpy(&slot, code, sizeof(slot));
+        return m_arena.row(slot);
+    }
+
+    const VectorArena &m_arena;
+    size_t m_dim;
+    bool m_inner_product;
+    const float *m_query = nullptr;
+};
+
+/// exhaustive k-NN over the rows of `storage`; C is CMax for L2 (keep the smallest) and CMin for
+/// inner product
+template <typename C>
+void arenaKnn(const ArenaFlatStorage &storage, faiss::idx_t n, const float *x, faiss::idx_t k, float *distances,
+              faiss::idx_t *labels, const faiss::IDSelector *sel)
+{
+    size_t dim = static_cast<size_t>(storage.d);
+    bool inner_product = storage.metric_type == faiss::METRIC_INNER_PRODUCT;
+#pragma omp parallel for if (n > 1)
+    for (faiss::idx_t i = 0; i < n; ++i)
+    {
+        const float *query = x + i * dim;
+        float *heap_distances = distances + i * k;
+        faiss::idx_t *heap_labels = labels + i * k;
+        faiss::heap_heapify<C>(k, heap_distances, heap_labels);
+        for (faiss::idx_t position = 0; position < storage.ntotal; ++position)
+        {
+            if (sel != nullptr && !sel->is_member(position))
+            {
+                continue;
+            }
+            float distance = rowDistance(query, storage.arena->row(storage.slotAt(position)), dim, inner_product);
+            if (C::cmp(heap_distances[0], distance))
+            {
+                faiss::heap_replace_top<C>(k, heap_distances, heap_labels, distance, position);
+            }
+        }
+        faiss::heap_reorder<C>(k, heap_distances, heap_labels);
+    }
+}
+
+} // namespace
+
+VectorArena::VectorArena(i32 dim)
+    : m_dim(dim), m_stride((static_cast<size_t>(dim) + 15) / 16 * 16),
+      m_chunks(std::make_unique<std::atomic<f32 *>[]>(kMaxChunks))
+{
+}
+
+VectorArena::~VectorArena()
+{
+    for (u32 i = 0; i < m_chunk_count; ++i)
+    {
+        std::free(m_chunks[i].load(std::memory_order_relaxed));
+    }
+    unmap();
+}
+
+u64 VectorArena::hashRow(const f32 *vector) const
+{
+    return std::hash<std::string_view>{}(
+        std::string_view(reinterpret_cast<const char *>(vector), static_cast<size_t>(m_dim) * sizeof(f32)));
+}
+
+f32 *VectorArena::mutableRow(u32 slot)
+{
+    return const_cast<f32 *>(row(slot));
+}
+
+u32 VectorArena::allocate()
+{
+    if (!m_free.empty())
+    {
+        u32 slot = m_free.back();
+        m_free.pop_back();
+        return slot;
+    }
+    u32 index = m_slot_count - m_mapped_rows;
+    if (index / kChunkRows >= m_chunk_count)
+    {
+        if (m_chunk_count == kMaxChunks)
+        {
+            throw std::length_error("<VectorArena> Arena is full");
+        }
+        // left untouched, so the pages of a new chunk are only faulted in as rows are written
+        void *chunk = std::aligned_alloc(64, static_cast<size_t>(kChunkRows) * m_stride * sizeof(f32));
+        if (chunk == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        m_chunks[m_chunk_count].store(static_cast<f32 *>(chunk), std::memory_order_release);
+        ++m_chunk_count;
+    }
+    m_refs.push_back(0);
+    m_hashes.push_back(0);
+    return m_slot_count++;
+}
+
+u32 VectorArena::intern(const f32 *vector)
+{
+    u64 hash = hashRow(vector);
+    size_t row_bytes = static_cast<size_t>(m_dim) * sizeof(f32);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_by_hash.find(hash);
+    if (it != m_by_hash.end() && std::memcmp(row(it->second), vector, row_bytes) == 0)
+    {
+        ++m_refs[it->second];
+        return it->second;
+    }
+
+    u32 slot = allocate();
+    f32 *destination = mutableRow(slot);
+    std::memcpy(destination, vector, row_bytes);
+    std::memset(destination + m_dim, 0, (m_stride - m_dim) * sizeof(f32));
+    m_refs[slot] = 1;
+    m_hashes[slot] = hash;
+    if (it == m_by_hash.end())
+    {
+        m_by_hash.emplace(hash, slot);
+    }
+    ++m_live_rows;
+    return slot;
+}
+
+void VectorArena::retain(u32 slot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (slot >= m_slot_count)
+    {
+        throw std::out_of_range(std::format("<VectorArena> Slot {} is not in the arena of {} rows", slot,
+                                            m_slot_count));
+    }
+    ++m_refs[slot];
+}
+
+void VectorArena::release(u32 slot)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (slot >= m_slot_count || m_refs[slot] == 0 || --m_refs[slot] > 0)
+    {
+        return;
+    }
+    auto it = m_by_hash.find(m_hashes[slot]);
+    if (it != m_by_hash.end() && it->second == slot)
+    {
+        m_by_hash.erase(it);
+    }
+    m_free.push_back(slot);
+    --m_live_rows;
+}
+
+i32 VectorArena::getDim() const
+{
+    return m_dim;
+}
+
+u64 VectorArena::getRowCount() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_live_rows;
+}
+
+u64 VectorArena::getMemoryUsage() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    u64 bytes = m_mapping_bytes;
+    bytes += static_cast<u64>(m_chunk_count) * kChunkRows * m_stride * sizeof(f32);
+    bytes += m_refs.capacity() * sizeof(u32) + m_hashes.capacity() * sizeof(u64) + m_free.capacity() * sizeof(u32);
+    bytes += m_by_hash.size() * (sizeof(std::pair<const u64, u32>) + sizeof(void *)) +
+             m_by_hash.bucket_count() * sizeof(void *);
+    return bytes;
+}
+
+void VectorArena::save(const std::string &file_path) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string tmp_path = file_path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+        char header_bytes[kHeaderBytes] = {};
+        ArenaFileHeader header;
+        std::memcpy(header.magic, kArenaMagic, sizeof(kArenaMagic));
+        header.version = kArenaVersion;
+        header.dim = static_cast<u32>(m_dim);
+        header.stride = m_stride;
+        header.slots = m_slot_count;
+        std::memcpy(header_bytes, &header, sizeof(header));
+        file.write(header_bytes, kHeaderBytes);
+        // free rows are written too, so that slots keep their numbers
+        for (u32 slot = 0; slot < m_slot_count; ++slot)
+        {
+            file.write(reinterpret_cast<const char *>(row(slot)),
+                       static_cast<std::streamsize>(m_stride * sizeof(f32)));
+        }
+        file.write(reinterpret_cast<const char *>(m_hashes.data()),
+                   static_cast<std::streamsize>(m_hashes.size() * sizeof(u64)));
+        if (!file)
+        {
+            throw std::runtime_error("<VectorArena> Failed to write " + tmp_path);
+        }
+    }
+    std::filesystem::rename(tmp_path, file_path);
+}
+
+bool VectorArena::load(const std::string &file_path)
+{
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat file_stat;
+    if (::fstat(fd, &file_stat) != 0 || static_cast<size_t>(file_stat.st_size) < kHeaderBytes)
+    {
+        ::close(fd);
+        throw std::runtime_error("<VectorArena> Truncated arena file " + file_path);
+    }
+    size_t file_bytes = static_cast<size_t>(file_stat.st_size);
+    // private and writable: rows reused after load are copied on write, the file never changes
+    void *mapping = ::mmap(nullptr, file_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("<VectorArena> Failed to map " + file_path);
+    }
+
+    ArenaFileHeader header;
+    std::memcpy(&header, mapping, sizeof(header));
+    size_t row_bytes = m_stride * sizeof(f32);
+    if (std::memcmp(header.magic, kArenaMagic, sizeof(kArenaMagic)) != 0 || header.version != kArenaVersion ||
+        header.dim != static_cast<u32>(m_dim) || header.stride != m_stride ||
+        file_bytes != kHeaderBytes + header.slots * (row_bytes + sizeof(u64)))
+    {
+        ::munmap(mapping, file_bytes);
+        throw std::runtime_error("<VectorArena> Invalid arena file " + file_path);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_live_rows > 0)
+    {
+        ::munmap(mapping, file_bytes);
+        throw std::logic_error("<VectorArena> Cannot load an arena whose rows are referenced");
+    }
+    for (u32 i = 0; i < m_chunk_count; ++i)
+    {
+        std::free(m_chunks[i].exchange(nullptr, std::memory_order_relaxed));
+    }
+    m_chunk_count = 0;
+    unmap();
+
+    m_mapping = mapping;
+    m_mapping_bytes = file_bytes;
+    m_mapped_base = reinterpret_cast<f32 *>(static_cast<char *>(mapping) + kHeaderBytes);
+    m_mapped_rows = static_cast<u32>(header.slots);
+    m_slot_count = m_mapped_rows;
+    m_refs.assign(m_slot_count, 0);
+    m_hashes.resize(m_slot_count);
+    std::memcpy(m_hashes.data(), static_cast<char *>(mapping) + kHeaderBytes + header.slots * row_bytes,
+                header.slots * sizeof(u64));
+    m_free.clear();
+    m_by_hash.clear();
+    GlobalLogger->debug("<VectorArena> Mapped {} rows from {}", m_slot_count, file_path);
+    return true;
+}
+
+void VectorArena::finishLoad()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free.clear();
+    m_by_hash.clear();
+    m_live_rows = 0;
+    for (u32 slot = m_slot_count; slot-- > 0;)
+    {
+        if (m_refs[slot] == 0)
+        {
+            m_free.push_back(slot);
+            continue;
+        }
+        m_by_hash.emplace(m_hashes[slot], slot);
+        ++m_live_rows;
+    }
+}
+
+void VectorArena::unmap()
+{
+    if (m_mapping != nullptr)
+    {
+        ::munmap(m_mapping, m_mapping_bytes);
+    }
+    m_mapping = nullptr;
+    m_mapping_bytes = 0;
+    m_mapped_base = nullptr;
+    m_mapped_rows = 0;
+}
+
+ArenaFlatStorage::ArenaFlatStorage(std::shared_ptr<VectorArena> arena, faiss::MetricType metric)
+    : faiss::IndexFlatCodes(sizeof(u32), arena->getDim(), metric), arena(std::move(arena))
+{
+}
+
+ArenaFlatStorage::~ArenaFlatStorage()
+{
+    releaseAll();
+}
+
+void ArenaFlatStorage::releaseAll()
+{
+    for (faiss::idx_t position = 0; position < ntotal; ++position)
+    {
+        arena->release(slotAt(position));
+    }
+}
+
+u32 ArenaFlatStorage::slotAt(faiss::idx_t position) const
+{
+    u32 slot;
+    std::memcpy(&slot, codes.data() + position * code_size, sizeof(slot));
+    return slot;
+}
+
+void ArenaFlatStorage::add(faiss::idx_t n, const float *x)
+{
+    codes.resize((ntotal + n) * code_size);
+    for (faiss::idx_t i = 0; i < n; ++i)
+    {
+        u32 slot = arena->intern(x + i * d);
+        std::memcpy(codes.data() + (ntotal + i) * code_size, &slot, sizeof(slot));
+    }
+    ntotal += n;
+}
+
+void ArenaFlatStorage::reset()
+{
+    releaseAll();
+    faiss::IndexFlatCodes::reset();
+}
+
+size_t ArenaFlatStorage::remove_ids(const faiss::IDSelector &sel)
+{
+    for (faiss::idx_t position = 0; position < ntotal; ++position)
+    {
+        if (sel.is_member(position))
+        {
+            arena->release(slotAt(position));
+        }
+    }
+    return faiss::IndexFlatCodes::remove_ids(sel);
+}
+
+void ArenaFlatStorage::sa_encode(faiss::idx_t, const float *, uint8_t *) const
+{
+    FAISS_THROW_MSG("ArenaFlatStorage codes are arena slots, vectors are only interned by add");
+}
+
+void ArenaFlatStorage::sa_decode(faiss::idx_t n, const uint8_t *bytes, float *x) const
+{
+    for (faiss::idx_t i = 0; i < n; ++i)
+    {
+        u32 slot;
+        std::memcpy(&slot, bytes + i * code_size, sizeof(slot));
+        std::memcpy(x + i * d, arena->row(slot), static_cast<size_t>(d) * sizeof(f32));
+    }
+}
+
+faiss::FlatCodesDistanceComputer *ArenaFlatStorage::get_FlatCodesDistanceComputer() const
+{
+    return new ArenaDistanceComputer(*this);
+}
+
+void ArenaFlatStorage::search(faiss::idx_t n, const float *x, faiss::idx_t k, float *distances,
+                              faiss::idx_t *labels, const faiss::SearchParameters *params) const
+{
+    const faiss::IDSelector *sel = params != nullptr ? params->sel : nullptr;
+    if (metric_type == faiss::METRIC_INNER_PRODUCT)
+    {
+        arenaKnn<faiss::CMin<float, faiss::idx_t>>(*this, n, x, k, distances, labels, sel);
+    }
+    else
+    {
+        arenaKnn<faiss::CMax<float, faiss::idx_t>>(*this, n, x, k, distances, labels, sel);
+    }
+}
+
+void ArenaFlatStorage::range_search(faiss::idx_t n, const float *x, float radius, faiss::RangeSearchResult *result,
+                                    const faiss::SearchParameters *params) const
+{
+    const faiss::IDSelector *sel = params != nullptr ? params->sel : nullptr;
+    bool inner_product = metric_type == faiss::METRIC_INNER_PRODUCT;
+    size_t dim = static_cast<size_t>(d);
+    faiss::RangeSearchPartialResult partial(result);
+    for (faiss::idx_t i = 0; i < n; ++i)
+    {
+        faiss::RangeQueryResult &query_result = partial.new_result(i);
+        for (faiss::idx_t position = 0; position < ntotal; ++position)
+        {
+            if (sel != nullptr && !sel->is_member(position))
+            {
+                continue;
+            }
+            float distance = rowDistance(x + i * dim, arena->row(slotAt(position)), dim, inner_product);
+            if (inner_product ? distance > radius : distance < radius)
+            {
+                query_result.add(distance, position);
+            }
+        }
+    }
+    partial.finalize();
+}
+
+std::vector<u32> ArenaFlatStorage::getSlots() const
+{
+    std::vector<u32> slots(static_cast<size_t>(ntotal));
+    std::memcpy(slots.data(), codes.data(), slots.size() * sizeof(u32));
+    return slots;
+}
+
+void ArenaFlatStorage::assignSlots(const std::vector<u32> &slots)
+{
+    reset();
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        try
+        {
+            arena->retain(slots[i]);
+        }
+        catch (...)
+        {
+            while (i-- > 0)
+            {
+                arena->release(slots[i]);
+            }
+            throw;
+        }
+    }
+    codes.resize(slots.size() * code_size);
+    std::memcpy(codes.data(), slots.data(), slots.size() * sizeof(u32));
+    ntotal = static_cast<faiss::idx_t>(slots.size());
+}
+
+} // namespace vdb
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "types.hh"
+#include <faiss/IndexFlatCodes.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vdb
+{
+
+/// The vectors of one collection, shared by its FLAT and HNSW indexes. Each distinct vector is
+/// kept once, in a row of `dim` floats padded to a multiple of 64 bytes and addressed by a dense
+/// slot number; indexes hold slots instead of copies, through ArenaFlatStorage. Rows are
+/// reference counted by the storages holding them and reused once no storage does.
+///
+/// Rows are allocated in fixed-size chunks that never move, so searches read them without a lock.
+/// A snapshot is one file, which load() maps copy-on-write: its rows are paged in on demand.
+class VectorArena
+{
+  public:
+    explicit VectorArena(i32 dim);
+    ~VectorArena();
+    VectorArena(const VectorArena &) = delete;
+    VectorArena &operator=(const VectorArena &) = delete;
+
+    /// modify
+    /// slot of the row equal to `vector`, a new one if there is none; takes a reference on it
+    u32 intern(const f32 *vector);
+    /// take a reference on a slot restored from a snapshot; throws std::out_of_range for slots
+    /// the loaded file does not have
+    void retain(u32 slot);
+    void release(u32 slot);
+
+    /// observe
+    const f32 *row(u32 slot) const
+    {
+        if (slot < m_mapped_rows)
+        {
+            return m_mapped_base + static_cast<size_t>(slot) * m_stride;
+        }
+        u32 index = slot - m_mapped_rows;
+        return m_chunks[index / kChunkRows].load(std::memory_order_acquire) +
+               static_cast<size_t>(index % kChunkRows) * m_stride;
+    }
+    i32 getDim() const;
+    /// rows referenced by at least one storage
+    u64 getRowCount() const;
+    /// allocated chunks, mapped snapshot and the dedup table
+    u64 getMemoryUsage() const;
+
+    /// Snapshot
+    /// written to a temporary file renamed over `file_path`, so a mapping of the old one stays valid
+    void save(const std::string &file_path) const;
+    /// Map `file_path` with no row referenced; storages then retain their slots and finishLoad()
+    /// rebuilds the dedup table and the free list. Returns false when the file does not exist,
+    /// throws std::logic_error if rows are still referenced and std::runtime_error on bad files.
+    bool load(const std::string &file_path);
+    void finishLoad();
+
+  private:
+    static constexpr u32 kChunkRows = 4096;
+    static constexpr u32 kMaxChunks = 1 << 16;
+    static constexpr size_t kHeaderBytes = 64;
+
+    f32 *mutableRow(u32 slot);
+    /// a free slot or a new one; the caller holds m_mutex
+    u32 allocate();
+    u64 hashRow(const f32 *vector) const;
+    void unmap();
+
+  private:
+    i32 m_dim;
+    // floats per row, a multiple of 16 so every row starts on a cache line
+    size_t m_stride;
+
+    // rows [0, m_mapped_rows) live in the mapped snapshot, the others in chunks
+    void *m_mapping = nullptr;
+    size_t m_mapping_bytes = 0;
+    f32 *m_mapped_base = nullptr;
+    u32 m_mapped_rows = 0;
+    std::unique_ptr<std::atomic<f32 *>[]> m_chunks;
+    u32 m_chunk_count = 0;
+
+    // guards everything below and the allocation of rows; reading rows needs no lock
+    mutable std::mutex m_mutex;
+    u32 m_slot_count = 0;
+    std::vector<u32> m_refs;
+    std::vector<u64> m_hashes;
+    std::vector<u32> m_free;
+    // content hash -> slot; a colliding vector gets a row of its own, outside the table
+    std::unordered_map<u64, u32> m_by_hash;
+    u64 m_live_rows = 0;
+};
+
+/// Flat storage whose vectors live in a VectorArena: the code of a vector is its 4-byte slot.
+/// Used on its own by FLAT indexes and as the storage of HNSW ones, so both reference the same
+/// rows; searches compute distances on the rows in place. Codes only make sense together with
+/// the arena, so faiss cannot serialize this storage: FaissIndex writes the slots next to the
+/// index and restores them with assignSlots().
+struct ArenaFlatStorage : faiss::IndexFlatCodes
+{
+    ArenaFlatStorage(std::shared_ptr<VectorArena> arena, faiss::MetricType metric);
+    ~ArenaFlatStorage() override;
+
+    void add(faiss::idx_t n, const float *x) override;
+    void reset() override;
+    size_t remove_ids(const faiss::IDSelector &sel) override;
+    /// encoding would take references nobody releases, only add() interns vectors
+    void sa_encode(faiss::idx_t n, const float *x, uint8_t *bytes) const override;
+    void sa_decode(faiss::idx_t n, const uint8_t *bytes, float *x) const override;
+    faiss::FlatCodesDistanceComputer *get_FlatCodesDistanceComputer() const override;
+    void search(faiss::idx_t n, const float *x, faiss::idx_t k, float *distances, faiss::idx_t *labels,
+                const faiss::SearchParameters *params = nullptr) const override;
+    void range_search(faiss::idx_t n, const float *x, float radius, faiss::RangeSearchResult *result,
+                      const faiss::SearchParameters *params = nullptr) const override;
+
+    /// slot of each stored vector, in position order
+    std::vector<u32> getSlots() const;
+    /// replace the contents with `slots`, retaining each of them
+    void assignSlots(const std::vector<u32> &slots);
+
+    u32 slotAt(faiss::idx_t position) const;
+
+    std::shared_ptr<VectorArena> arena;
+
+  private:
+    void releaseAll();
+};
+
+} // namespace vdb
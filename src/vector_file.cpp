@@ -0,0 +1,55 @@
+#include "vector_file.hh"
+#include <format>
+#include <stdexcept>
+
+namespace vdb
+{
+
+FvecsReader::FvecsReader(const std::string &file_path) : m_file_path(file_path), m_file(file_path, std::ios::binary)
+{
+    if (!m_file.is_open())
+    {
+        throw std::runtime_error("<FvecsReader> Failed to open " + file_path);
+    }
+    if (!m_file.read(reinterpret_cast<char *>(&m_dim), sizeof(m_dim)) || m_dim <= 0)
+    {
+        throw std::runtime_error("<FvecsReader> No vectors in " + file_path);
+    }
+    rewind();
+}
+
+i32 FvecsReader::dim() const
+{
+    return m_dim;
+}
+
+size_t FvecsReader::read(std::vector<f32> &data, size_t max_count)
+{
+    size_t count = 0;
+    i32 d = 0;
+    while (count < max_count && m_file.read(reinterpret_cast<char *>(&d), sizeof(d)))
+    {
+        if (d != m_dim)
+        {
+            throw std::runtime_error(std::format("<FvecsReader> Vector of dimension {} in {}, expected {}", d,
+                                                 m_file_path, m_dim));
+        }
+        size_t offset = data.size();
+        data.resize(offset + m_dim);
+        if (!m_file.read(reinterpret_cast<char *>(data.data() + offset),
+                         static_cast<std::streamsize>(m_dim * sizeof(f32))))
+        {
+            throw std::runtime_error("<FvecsReader> Truncated vector in " + m_file_path);
+        }
+        ++count;
+    }
+    return count;
+}
+
+void FvecsReader::rewind()
+{
+    m_file.clear();
+    m_file.seekg(0);
+}
+
+} // namespace vdb
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "types.hh"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace vdb
+{
+/// Streams vectors out of a .fvecs file (SIFT/GIST format: every vector is an i32 dimension
+/// followed by that many floats), so that files larger than memory can be read in batches.
+class FvecsReader
+{
+  public:
+    /// reads the dimension from the first record; throws when the file cannot be opened
+    explicit FvecsReader(const std::string &file_path);
+
+    /// observe
+    i32 dim() const;
+
+    /// modify
+    /// append up to `max_count` vectors to `data` and return how many were read, 0 at the end
+    /// of the file; throws on a truncated record or one of another dimension
+    size_t read(std::vector<f32> &data, size_t max_count);
+    /// back to the first vector
+    void rewind();
+
+  private:
+    std::string m_file_path;
+    std::ifstream m_file;
+    i32 m_dim = 0;
+};
+} // namespace vdb
@@ -1,73 +1,352 @@
 #include "vectordb.hh"
+#include "binary_index.hh"
 #include "constants.hh"
 #include "faiss_index.hh"
 #include "filter_index.hh"
+#include "id_map.hh"
 #include "index_factory.hh"
+#include "json_utils.hh"
 #include "logger.hh"
+#include "metrics.hh"
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
+#include "sparse_index.hh"
+#include "thread_pool.hh"
+#include "vector_file.hh"
+#include <faiss/utils/distances.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace vdb
 {
 
-VectorDB::VectorDB(const std::string &db_path, const std::string &wal_path) : m_scalar_storage(db_path), m_persistence()
+namespace
 {
-    m_persistence.init(wal_path);
-}
 
-void VectorDB::upsert(u64 id, const rapidjson::Document &data, IndexFactory::IndexType index_type)
+/// Result cache key of a search: the query bytes, then everything else that shapes its result.
+/// Only the members buildFilterBitmap reads are taken from the filter, so equal filters written
+/// differently share entries.
+std::string resultCacheKey(const std::vector<f32> &query, i32 k, IndexFactory::IndexType index_type,
+                           const SearchOptions &search_options, i32 oversample, const rapidjson::Value *filter)
 {
-    rapidjson::Document existing_data;
-    try
+    std::string key(reinterpret_cast<const char *>(query.data()), query.size() * sizeof(f32));
+    key += std::format("|{}|{}|{}|{}", k, index_type, search_options.nprobe, oversample);
+    if (filter != nullptr)
     {
-        existing_data = m_scalar_storage.get_scalar(id);
+        key += std::format("|{}|{}|{}", (*filter)[REQUEST_FILTER_NAME].GetString(),
+                           (*filter)[REQUEST_FILTER_OP].GetString(), (*filter)[REQUEST_FILTER_VALUE].GetInt64());
     }
-    catch (const std::runtime_error &e)
+    return key;
+}
+
+// a hybrid search takes this many candidates per result from each side unless told otherwise
+constexpr i32 kHybridCandidateFactor = 4;
+// the usual RRF constant: damps the weight of the first few ranks against the rest
+constexpr f32 kDefaultRrfK = 60.0f;
+
+/// Add one side of a hybrid search to `fused`. `scores` are larger-is-better and `ids` best first;
+/// RRF adds weight / (rrf_k + rank), the weighted sum adds weight times the score min-max
+/// normalized over the side.
+void fuseRanking(const std::vector<i64> &ids, const std::vector<f32> &scores, f32 weight, bool rrf, f32 rrf_k,
+                 std::unordered_map<i64, f32> &fused)
+{
+    f32 min_score = std::numeric_limits<f32>::max();
+    f32 max_score = -std::numeric_limits<f32>::max();
+    for (size_t i = 0; i < ids.size(); ++i)
     {
-        // vector isn't exist, continue to insert
+        if (ids[i] != -1)
+        {
+            min_score = std::min(min_score, scores[i]);
+            max_score = std::max(max_score, scores[i]);
+        }
     }
-
-    if (existing_data.IsObject())
+    u64 rank = 0;
+    for (size_t i = 0; i < ids.size(); ++i)
     {
-        size_t existing_vecotrs_size = existing_data[REQUEST_VECTORS].Size();
-        std::vector<f32> existing_vector(existing_vecotrs_size);
-        for (rapidjson::SizeType i = 0; i < existing_vecotrs_size; ++i)
+        if (ids[i] == -1)
+        {
+            continue;
+        }
+        ++rank;
+        if (rrf)
         {
-            existing_vector[i] = existing_data[REQUEST_VECTORS][i].GetFloat();
+            fused[ids[i]] += weight / (rrf_k + static_cast<f32>(rank));
         }
+        else
+        {
+            f32 normalized = max_score > min_score ? (scores[i] - min_score) / (max_score - min_score) : 1.0f;
+            fused[ids[i]] += weight * normalized;
+        }
+    }
+}
 
-        FaissIndex *index = getGlobalIndexFactory()->getFaissIndex(index_type);
-        if (index)
+} // namespace
+
+VectorDB::VectorDB(const CollectionConfig &config, rocksdb::DB *db, rocksdb::ColumnFamilyHandle *column_family,
+                   const std::string &wal_path, const std::string &snapshot_path)
+    : m_config(config), m_wal_path(wal_path), m_snapshot_path(snapshot_path), m_scalar_storage(db, column_family),
+      m_persistence()
+{
+    for (IndexFactory::IndexType index_type : m_config.index_types)
+    {
+        m_index_factory.init(index_type, m_config.dim, m_config.metric, m_config.index_params, snapshot_path);
+        m_store_vectors = m_store_vectors || isCompressedIndexType(index_type);
+        m_write_epochs[index_type];
+    }
+    if (m_config.result_cache_mb > 0)
+    {
+        m_result_cache = std::make_unique<ResultCache>(m_config.name,
+                                                       static_cast<size_t>(m_config.result_cache_mb) << 20,
+                                                       std::chrono::milliseconds(m_config.result_cache_ttl_ms));
+    }
+    m_persistence.init(wal_path, snapshot_path);
+}
+
+void VectorDB::bumpWriteEpoch(IndexFactory::IndexType index_type)
+{
+    auto it = m_write_epochs.find(index_type);
+    if (it != m_write_epochs.end())
+    {
+        it->second.fetch_add(1);
+    }
+}
+
+void VectorDB::bumpWriteEpochs()
+{
+    for (auto &[index_type, epoch] : m_write_epochs)
+    {
+        epoch.fetch_add(1);
+    }
+}
+
+u64 VectorDB::getWriteEpoch(IndexFactory::IndexType index_type, bool filtered) const
+{
+    u64 epoch = 0;
+    auto it = m_write_epochs.find(index_type);
+    if (it != m_write_epochs.end())
+    {
+        epoch += it->second.load();
+    }
+    it = m_write_epochs.find(IndexFactory::IndexType::FILTER);
+    if (filtered && it != m_write_epochs.end())
+    {
+        epoch += it->second.load();
+    }
+    return epoch;
+}
+
+std::mutex &VectorDB::idLock(u64 id)
+{
+    return m_id_locks[id % m_id_locks.size()];
+}
+
+std::vector<std::unique_lock<std::mutex>> VectorDB::lockIds(const std::vector<u64> &ids)
+{
+    std::vector<size_t> stripes;
+    for (u64 id : ids)
+    {
+        stripes.push_back(id % m_id_locks.size());
+    }
+    std::sort(stripes.begin(), stripes.end());
+    stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+
+    std::vector<std::unique_lock<std::mutex>> locks;
+    for (size_t stripe : stripes)
+    {
+        locks.emplace_back(m_id_locks[stripe]);
+    }
+    return locks;
+}
+
+void VectorDB::upsert(u64 id, const rapidjson::Document &data, const std::vector<f32> &vector,
+                      IndexFactory::IndexType index_type)
+{
+    std::shared_lock lock(m_mutex);
+    // WAL order and apply order agree for any one id
+    std::lock_guard<std::mutex> id_lock(idLock(id));
+    // an id the id map refuses would be logged and then fail again on every replay
+    if (id == IdMap::kReservedId)
+    {
+        throw std::invalid_argument(std::format("Id {} is reserved", id));
+    }
+    // write log before upsert database
+    m_persistence.writeWALLog("upsert", data, "1.0");
+    applyUpsert(id, data, vector, index_type);
+}
+
+void VectorDB::insert(u64 id, const std::vector<f32> &vector, IndexFactory::IndexType index_type)
+{
+    std::shared_lock lock(m_mutex);
+    std::lock_guard<std::mutex> id_lock(idLock(id));
+    FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+    if (index)
+    {
+        index->insert_vectors(vector, m_index_factory.getIdMap().assign(id));
+        if (isCompressedIndexType(index_type))
         {
-            index->remove_vectors({static_cast<i64>(id)});
+            storeVectors({id}, vector);
         }
+        bumpWriteEpoch(index_type);
     }
+}
 
-    size_t new_vectors_size = data[REQUEST_VECTORS].Size();
-    std::vector<f32> new_vector(new_vectors_size);
-    for (rapidjson::SizeType i = 0; i < new_vectors_size; ++i)
+void VectorDB::insertBinary(u64 id, const std::vector<u8> &code, IndexFactory::IndexType index_type)
+{
+    std::shared_lock lock(m_mutex);
+    std::lock_guard<std::mutex> id_lock(idLock(id));
+    BinaryIndex *index = m_index_factory.getBinaryIndex(index_type);
+    if (index)
     {
-        new_vector[i] = data[REQUEST_VECTORS][i].GetFloat();
+        index->insert_vectors(code, m_index_factory.getIdMap().assign(id));
+        bumpWriteEpoch(index_type);
     }
+}
 
-    GlobalLogger->debug("<VectorDB> Add new id={} to index", id);
-    FaissIndex *index = getGlobalIndexFactory()->getFaissIndex(index_type);
+void VectorDB::insertSparse(u64 id, const std::vector<u32> &indices, const std::vector<f32> &values)
+{
+    std::shared_lock lock(m_mutex);
+    std::lock_guard<std::mutex> id_lock(idLock(id));
+    SparseIndex *index = m_index_factory.getSparseIndex();
     if (index)
     {
-        index->insert_vectors(new_vector, id);
+        index->insert_vector(indices, values, m_index_factory.getIdMap().assign(id));
+        bumpWriteEpoch(IndexFactory::IndexType::SPARSE);
+    }
+}
+
+u64 VectorDB::remove(const std::vector<u64> &ids)
+{
+    if (ids.empty())
+    {
+        return 0;
+    }
+    std::shared_lock lock(m_mutex);
+    auto id_locks = lockIds(ids);
+
+    rapidjson::Document data;
+    data.SetObject();
+    rapidjson::Value id_array(rapidjson::kArrayType);
+    for (u64 id : ids)
+    {
+        id_array.PushBack(id, data.GetAllocator());
+    }
+    data.AddMember(REQUEST_IDS, id_array, data.GetAllocator());
+    m_persistence.writeWALLog("delete", data, "1.0");
+    return applyRemove(ids);
+}
+
+u64 VectorDB::applyRemove(const std::vector<u64> &ids)
+{
+    FilterIndex *filter_index = m_index_factory.getFilterIndex();
+    IdMap &id_map = m_index_factory.getIdMap();
+    u64 removed = 0;
+    for (u64 id : ids)
+    {
+        bool existed = false;
+        // the ordinal is retired here but only reused after compaction, see IdMap
+        std::optional<u32> ordinal = id_map.release(id);
+        for (IndexFactory::IndexType index_type : m_config.index_types)
+        {
+            FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+            if (ordinal && index && index->remove_vectors({static_cast<i64>(*ordinal)}) > 0)
+            {
+                existed = true;
+            }
+            BinaryIndex *binary_index = m_index_factory.getBinaryIndex(index_type);
+            if (ordinal && binary_index && binary_index->remove_vectors({static_cast<i64>(*ordinal)}) > 0)
+            {
+                existed = true;
+            }
+        }
+        SparseIndex *sparse_index = m_index_factory.getSparseIndex();
+        if (ordinal && sparse_index && sparse_index->remove_vectors({static_cast<i64>(*ordinal)}) > 0)
+        {
+            existed = true;
+        }
+
+        rapidjson::Document existing_data = m_scalar_storage.get_scalar(id);
+        if (existing_data.IsObject())
+        {
+            existed = true;
+            if (filter_index && ordinal)
+            {
+                std::unique_lock filter_lock(m_filter_mutex);
+                for (auto it = existing_data.MemberBegin(); it != existing_data.MemberEnd(); ++it)
+                {
+                    std::string field_name = it->name.GetString();
+                    if (it->value.IsInt() && field_name != REQUEST_ID)
+                    {
+                        filter_index->removeIntFieldFilter(field_name, it->value.GetInt64(), *ordinal);
+                    }
+                }
+            }
+            m_scalar_storage.remove_scalar(id);
+        }
+        if (m_store_vectors)
+        {
+            m_scalar_storage.remove_vector(id);
+        }
+
+        if (existed)
+        {
+            ++removed;
+        }
+    }
+    bumpWriteEpochs();
+    GlobalLogger->debug("<VectorDB> Removed {} of {} ids from collection {}", removed, ids.size(), m_config.name);
+    return removed;
+}
+
+void VectorDB::applyUpsert(u64 id, const rapidjson::Document &data, const std::vector<f32> &vector,
+                           IndexFactory::IndexType index_type)
+{
+    rapidjson::Document existing_data = m_scalar_storage.get_scalar(id);
+    u32 ordinal = m_index_factory.getIdMap().assign(id);
+    bool in_arena = false;
+
+    // an existing vector of the id is tombstoned by the index itself
+    GlobalLogger->debug("<VectorDB> Add new id={} to index", id);
+    FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+    if (index && vector.size() != static_cast<size_t>(index->getDim()))
+    {
+        // e.g. replaying a WAL written with another configured dimension
+        GlobalLogger->error("<VectorDB> Skip vector of id={}: {} values, index dimension is {}", id, vector.size(),
+                            index->getDim());
+    }
+    else if (index)
+    {
+        index->insert_vectors(vector, ordinal);
+        if (isCompressedIndexType(index_type))
+        {
+            storeVectors({id}, vector);
+        }
+        // query() reads the vector back from the arena, so the document does not repeat it; cosine
+        // indexes hold the normalized vector, so there the document keeps the one the client sent
+        in_arena = m_index_factory.getArena() != nullptr && m_config.metric != IndexFactory::MetricType::COSINE &&
+                   (index_type == IndexFactory::IndexType::FLAT || index_type == IndexFactory::IndexType::HNSW);
     }
+    applyBinaryUpsert(id, ordinal, data, index_type);
+    applySparseUpsert(id, ordinal, data);
 
     GlobalLogger->debug("<VectorDB> Try to add new filter");
-    FilterIndex *filter_index = getGlobalIndexFactory()->getFilterIndex();
+    FilterIndex *filter_index = m_index_factory.getFilterIndex();
     if (filter_index)
     {
+        std::unique_lock filter_lock(m_filter_mutex);
         for (auto it = data.MemberBegin(); it != data.MemberEnd(); ++it)
         {
             std::string field_name = it->name.GetString();
@@ -75,121 +354,1051 @@ void VectorDB::upsert(u64 id, const rapidjson::Document &data, IndexFactory::Ind
             {
                 i64 field_value = it->value.GetInt64();
 
+                // only int members of the old document were indexed; one the old document lacks or
+                // held as another type has no bitmap entry to move
                 std::optional<i64> old_field_value = std::nullopt;
-                if (existing_data.IsObject())
+                if (existing_data.IsObject() && existing_data.HasMember(field_name.c_str()) &&
+                    existing_data[field_name.c_str()].IsInt())
                 {
                     old_field_value.emplace(existing_data[field_name.c_str()].GetInt64());
                 }
-                filter_index->updateIntFieldFilter(field_name, field_value, id, old_field_value);
+                filter_index->updateIntFieldFilter(field_name, field_value, ordinal, old_field_value);
             }
         }
     }
 
-    m_scalar_storage.insert_scalar(id, data);
+    m_scalar_storage.insert_scalar(id, data, in_arena ? REQUEST_VECTORS : nullptr);
+    bumpWriteEpoch(index_type);
+    bumpWriteEpoch(IndexFactory::IndexType::FILTER);
 }
 
-rapidjson::Document VectorDB::query(u64 id)
+void VectorDB::applyBinaryUpsert(u64 id, u32 ordinal, const rapidjson::Document &data,
+                                 IndexFactory::IndexType index_type)
 {
-    return m_scalar_storage.get_scalar(id);
+    if (!data.HasMember(REQUEST_BINARY_VECTORS))
+    {
+        return;
+    }
+    std::vector<u8> code;
+    if (!getBinaryVectorFromJson(data[REQUEST_BINARY_VECTORS], code))
+    {
+        GlobalLogger->error("<VectorDB> Skip malformed binary vector of id={}", id);
+        return;
+    }
+    for (IndexFactory::IndexType binary_type : m_config.index_types)
+    {
+        BinaryIndex *index = m_index_factory.getBinaryIndex(binary_type);
+        if (index == nullptr || (isBinaryIndexType(index_type) && binary_type != index_type))
+        {
+            continue;
+        }
+        if (code.size() != static_cast<size_t>(index->getCodeSize()))
+        {
+            GlobalLogger->error("<VectorDB> Skip binary vector of id={}: {} bytes, the {} index takes {}", id,
+                                code.size(), std::format("{}", binary_type), index->getCodeSize());
+            continue;
+        }
+        index->insert_vectors(code, ordinal);
+        bumpWriteEpoch(binary_type);
+    }
 }
 
-std::pair<std::vector<i64>, std::vector<f32>> VectorDB::search(const rapidjson::Document &json_request)
+void VectorDB::applySparseUpsert(u64 id, u32 ordinal, const rapidjson::Document &data)
 {
-    std::vector<f32> query;
-    for (const auto &q : json_request[REQUEST_VECTORS].GetArray())
+    SparseIndex *index = m_index_factory.getSparseIndex();
+    if (index == nullptr || !data.HasMember(REQUEST_SPARSE_VECTOR))
     {
-        query.push_back(q.GetFloat());
+        return;
     }
+    std::vector<u32> indices;
+    std::vector<f32> values;
+    if (!getSparseVectorFromJson(data[REQUEST_SPARSE_VECTOR], indices, values))
+    {
+        GlobalLogger->error("<VectorDB> Skip malformed sparse vector of id={}", id);
+        return;
+    }
+    index->insert_vector(indices, values, ordinal);
+    bumpWriteEpoch(IndexFactory::IndexType::SPARSE);
+}
+
+rapidjson::Document VectorDB::query(u64 id)
+{
+    std::shared_lock lock(m_mutex);
+    rapidjson::Document data = m_scalar_storage.get_scalar(id);
+    if (m_index_factory.getArena() == nullptr || !data.IsObject() || data.HasMember(REQUEST_VECTORS) ||
+        !data.HasMember(REQUEST_INDEX_TYPE) || !data[REQUEST_INDEX_TYPE].IsString())
+    {
+        return data;
+    }
+
+    FaissIndex *index = m_index_factory.getFaissIndex(getIndexTypeFromString(data[REQUEST_INDEX_TYPE].GetString()));
+    std::optional<u32> ordinal = m_index_factory.getIdMap().find(id);
+    std::vector<f32> vector;
+    if (index && ordinal && index->reconstruct_vector(*ordinal, vector))
+    {
+        rapidjson::Value vector_array(rapidjson::kArrayType);
+        for (f32 value : vector)
+        {
+            vector_array.PushBack(static_cast<f64>(value), data.GetAllocator());
+        }
+        data.AddMember(REQUEST_VECTORS, vector_array, data.GetAllocator());
+    }
+    return data;
+}
+
+const CollectionConfig &VectorDB::getConfig() const
+{
+    return m_config;
+}
+
+FaissIndex *VectorDB::getFaissIndex(IndexFactory::IndexType index_type) const
+{
+    return m_index_factory.getFaissIndex(index_type);
+}
+
+BinaryIndex *VectorDB::getBinaryIndex(IndexFactory::IndexType index_type) const
+{
+    return m_index_factory.getBinaryIndex(index_type);
+}
+
+SparseIndex *VectorDB::getSparseIndex() const
+{
+    return m_index_factory.getSparseIndex();
+}
 
+std::pair<std::vector<i64>, std::vector<f32>> VectorDB::search(const rapidjson::Document &json_request,
+                                                               const std::vector<f32> &query,
+                                                               SearchProfile *profile)
+{
+    std::shared_lock lock(m_mutex);
     i32 k = json_request[REQUEST_K].GetInt();
 
     IndexFactory::IndexType index_type = IndexFactory::IndexType::UNKNOWN;
     if (json_request.HasMember(REQUEST_INDEX_TYPE) && json_request[REQUEST_INDEX_TYPE].IsString())
     {
-        std::string index_type_str = json_request[REQUEST_INDEX_TYPE].GetString();
-        if (index_type_str == INDEX_TYPE_FLAT)
+        index_type = getIndexTypeFromString(json_request[REQUEST_INDEX_TYPE].GetString());
+    }
+    SearchOptions search_options;
+    if (json_request.HasMember(REQUEST_NPROBE) && json_request[REQUEST_NPROBE].IsInt())
+    {
+        search_options.nprobe = json_request[REQUEST_NPROBE].GetInt();
+    }
+    i32 oversample = m_config.index_params.rerank_oversample;
+    if (json_request.HasMember(REQUEST_OVERSAMPLE) && json_request[REQUEST_OVERSAMPLE].IsInt())
+    {
+        oversample = json_request[REQUEST_OVERSAMPLE].GetInt();
+    }
+    BinaryIndex *prefilter = nullptr;
+    if (json_request.HasMember(REQUEST_PREFILTER) && json_request[REQUEST_PREFILTER].IsString())
+    {
+        prefilter = m_index_factory.getBinaryIndex(getIndexTypeFromString(json_request[REQUEST_PREFILTER].GetString()));
+    }
+    bool rerank_results = isCompressedIndexType(index_type) && oversample > 0 && prefilter == nullptr;
+    i32 candidates = rerank_results ? k * oversample : k;
+    bool has_filter = json_request.HasMember(REQUEST_FILTER) && json_request[REQUEST_FILTER].IsObject();
+    // the cache key does not cover the binary queries of a prefiltered search
+    bool use_cache = m_result_cache && prefilter == nullptr;
+
+    // the epoch is read before searching: a write applied meanwhile bumps it, which leaves the
+    // entry stored below stale from the start
+    std::string cache_key;
+    u64 epoch = 0;
+    if (use_cache)
+    {
+        epoch = getWriteEpoch(index_type, has_filter);
+        cache_key = resultCacheKey(query, k, index_type, search_options, rerank_results ? oversample : 0,
+                                   has_filter ? &json_request[REQUEST_FILTER] : nullptr);
+        ResultCache::Results cached;
+        if (m_result_cache->get(cache_key, epoch, cached))
         {
-            index_type = IndexFactory::IndexType::FLAT;
+            if (profile)
+            {
+                profile->index_type = index_type;
+                profile->cache_hit = true;
+            }
+            return cached;
+        }
+    }
+
+    roaring_bitmap_t *filter_bitmap = nullptr;
+    if (has_filter)
+    {
+        static Histogram &filter_histogram = stageHistogram("filter_bitmap");
+        ScopedTimer timer(filter_histogram, profile ? &profile->filter_bitmap_ns : nullptr);
+        filter_bitmap = buildFilterBitmap(json_request[REQUEST_FILTER]);
+    }
+
+    if (profile)
+    {
+        profile->index_type = index_type;
+        profile->filtered = filter_bitmap != nullptr;
+        profile->filter_cardinality = filter_bitmap ? roaring_bitmap_get_cardinality(filter_bitmap) : 0;
+    }
+
+    FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+    std::pair<std::vector<i64>, std::vector<f32>> results;
+    try
+    {
+        if (index && prefilter)
+        {
+            std::vector<u8> binary_query;
+            getBinaryVectorFromJson(json_request[REQUEST_BINARY_VECTORS], binary_query);
+            i32 prefilter_candidates = k * std::max(oversample, 1);
+            auto start = std::chrono::steady_clock::now();
+            auto prefiltered = prefilter->search_vectors(binary_query, prefilter_candidates, filter_bitmap);
+            if (profile)
+            {
+                profile->faiss_search_ns = elapsedNsSince(start);
+            }
+            static Histogram &rerank_histogram = stageHistogram("rerank");
+            ScopedTimer timer(rerank_histogram, profile ? &profile->rerank_ns : nullptr);
+            results = rerankPrefiltered(query, k, prefilter_candidates, prefiltered.first, index_type);
+            if (profile)
+            {
+                profile->rerank_candidates = prefiltered.first.size();
+            }
         }
-        else if (index_type_str == INDEX_TYPE_HNSW)
+        else if (index)
         {
-            index_type = IndexFactory::IndexType::HNSW;
+            SearchStats *stats = profile && profile->collect_search_stats ? &profile->search_stats : nullptr;
+            auto start = std::chrono::steady_clock::now();
+            results = index->search_vectors(query, candidates, filter_bitmap, stats, search_options);
+            // re-ranking fetches the exact vectors by id, and cached results hold ids too
+            m_index_factory.getIdMap().toExternal(results.first);
+            if (profile)
+            {
+                profile->faiss_search_ns = elapsedNsSince(start);
+            }
+            if (rerank_results)
+            {
+                static Histogram &rerank_histogram = stageHistogram("rerank");
+                ScopedTimer timer(rerank_histogram, profile ? &profile->rerank_ns : nullptr);
+                results = rerank(query, k, candidates, results);
+                if (profile)
+                {
+                    profile->rerank_candidates = static_cast<u64>(candidates) * (query.size() / m_config.dim);
+                }
+            }
+            if (use_cache)
+            {
+                m_result_cache->put(cache_key, epoch, results);
+            }
         }
     }
+    catch (...)
+    {
+        roaring_bitmap_free(filter_bitmap);
+        throw;
+    }
+    // created by roaring_bitmap_create, so `delete` would leak its containers
+    roaring_bitmap_free(filter_bitmap);
+    return results;
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> VectorDB::searchBinary(const rapidjson::Document &json_request,
+                                                                     const std::vector<u8> &query,
+                                                                     SearchProfile *profile)
+{
+    std::shared_lock lock(m_mutex);
+    i32 k = json_request[REQUEST_K].GetInt();
+    IndexFactory::IndexType index_type = getIndexTypeFromJson(json_request);
 
     roaring_bitmap_t *filter_bitmap = nullptr;
     if (json_request.HasMember(REQUEST_FILTER) && json_request[REQUEST_FILTER].IsObject())
     {
-        const auto &filter = json_request[REQUEST_FILTER];
-        // TODO: 检查下列字段合法性
-        std::string field_name = filter[REQUEST_FILTER_NAME].GetString();
-        std::string op_str = filter[REQUEST_FILTER_OP].GetString();
-        i64 value = filter[REQUEST_FILTER_VALUE].GetInt64();
+        static Histogram &filter_histogram = stageHistogram("filter_bitmap");
+        ScopedTimer timer(filter_histogram, profile ? &profile->filter_bitmap_ns : nullptr);
+        filter_bitmap = buildFilterBitmap(json_request[REQUEST_FILTER]);
+    }
+    if (profile)
+    {
+        profile->index_type = index_type;
+        profile->filtered = filter_bitmap != nullptr;
+        profile->filter_cardinality = filter_bitmap ? roaring_bitmap_get_cardinality(filter_bitmap) : 0;
+    }
+
+    BinaryIndex *index = m_index_factory.getBinaryIndex(index_type);
+    std::pair<std::vector<i64>, std::vector<f32>> results;
+    try
+    {
+        if (index)
+        {
+            auto start = std::chrono::steady_clock::now();
+            results = index->search_vectors(query, k, filter_bitmap);
+            m_index_factory.getIdMap().toExternal(results.first);
+            if (profile)
+            {
+                profile->faiss_search_ns = elapsedNsSince(start);
+            }
+        }
+    }
+    catch (...)
+    {
+        roaring_bitmap_free(filter_bitmap);
+        throw;
+    }
+    roaring_bitmap_free(filter_bitmap);
+    return results;
+}
 
-        FilterIndex::Operation op = (op_str == "=") ? FilterIndex::Operation::EQUAL : FilterIndex::Operation::NOT_EQUAL;
+std::pair<std::vector<i64>, std::vector<f32>> VectorDB::searchSparse(const rapidjson::Document &json_request,
+                                                                     const std::vector<u32> &indices,
+                                                                     const std::vector<f32> &values,
+                                                                     SearchProfile *profile)
+{
+    std::shared_lock lock(m_mutex);
+    i32 k = json_request[REQUEST_K].GetInt();
 
-        FilterIndex *filter_index = getGlobalIndexFactory()->getFilterIndex();
+    roaring_bitmap_t *filter_bitmap = nullptr;
+    if (json_request.HasMember(REQUEST_FILTER) && json_request[REQUEST_FILTER].IsObject())
+    {
+        static Histogram &filter_histogram = stageHistogram("filter_bitmap");
+        ScopedTimer timer(filter_histogram, profile ? &profile->filter_bitmap_ns : nullptr);
+        filter_bitmap = buildFilterBitmap(json_request[REQUEST_FILTER]);
+    }
+    if (profile)
+    {
+        profile->index_type = IndexFactory::IndexType::SPARSE;
+        profile->filtered = filter_bitmap != nullptr;
+        profile->filter_cardinality = filter_bitmap ? roaring_bitmap_get_cardinality(filter_bitmap) : 0;
+    }
 
-        if (filter_index)
+    SparseIndex *index = m_index_factory.getSparseIndex();
+    std::pair<std::vector<i64>, std::vector<f32>> results;
+    try
+    {
+        if (index)
         {
-            filter_bitmap = roaring_bitmap_create();
-            filter_index->getIntFieldFilterBitmap(field_name, op, value, filter_bitmap);
+            auto start = std::chrono::steady_clock::now();
+            results = index->search_vector(indices, values, k, filter_bitmap);
+            m_index_factory.getIdMap().toExternal(results.first);
+            if (profile)
+            {
+                profile->sparse_search_ns = elapsedNsSince(start);
+            }
         }
     }
+    catch (...)
+    {
+        roaring_bitmap_free(filter_bitmap);
+        throw;
+    }
+    roaring_bitmap_free(filter_bitmap);
+    return results;
+}
 
-    FaissIndex *index = getGlobalIndexFactory()->getFaissIndex(index_type);
+std::pair<std::vector<i64>, std::vector<f32>> VectorDB::hybridSearch(const rapidjson::Document &json_request,
+                                                                     const std::vector<f32> &query,
+                                                                     const std::vector<u32> &indices,
+                                                                     const std::vector<f32> &values,
+                                                                     SearchProfile *profile)
+{
+    std::shared_lock lock(m_mutex);
+    i32 k = json_request[REQUEST_K].GetInt();
+    IndexFactory::IndexType index_type = getIndexTypeFromJson(json_request);
+    i32 candidates = k * kHybridCandidateFactor;
+    if (json_request.HasMember(REQUEST_CANDIDATES) && json_request[REQUEST_CANDIDATES].IsInt())
+    {
+        candidates = std::max(json_request[REQUEST_CANDIDATES].GetInt(), k);
+    }
+    SearchOptions search_options;
+    if (json_request.HasMember(REQUEST_NPROBE) && json_request[REQUEST_NPROBE].IsInt())
+    {
+        search_options.nprobe = json_request[REQUEST_NPROBE].GetInt();
+    }
+    i32 oversample = m_config.index_params.rerank_oversample;
+    if (json_request.HasMember(REQUEST_OVERSAMPLE) && json_request[REQUEST_OVERSAMPLE].IsInt())
+    {
+        oversample = json_request[REQUEST_OVERSAMPLE].GetInt();
+    }
+    bool rerank_results = isCompressedIndexType(index_type) && oversample > 0;
+    bool rrf = !(json_request.HasMember(REQUEST_FUSION) && json_request[REQUEST_FUSION] == FUSION_WEIGHTED);
+    f32 dense_weight = 1.0f;
+    f32 sparse_weight = 1.0f;
+    f32 rrf_k = kDefaultRrfK;
+    if (json_request.HasMember(REQUEST_DENSE_WEIGHT) && json_request[REQUEST_DENSE_WEIGHT].IsNumber())
+    {
+        dense_weight = json_request[REQUEST_DENSE_WEIGHT].GetFloat();
+    }
+    if (json_request.HasMember(REQUEST_SPARSE_WEIGHT) && json_request[REQUEST_SPARSE_WEIGHT].IsNumber())
+    {
+        sparse_weight = json_request[REQUEST_SPARSE_WEIGHT].GetFloat();
+    }
+    if (json_request.HasMember(REQUEST_RRF_K) && json_request[REQUEST_RRF_K].IsNumber())
+    {
+        rrf_k = json_request[REQUEST_RRF_K].GetFloat();
+    }
+
+    // built once, both sides are restricted by it
+    roaring_bitmap_t *filter_bitmap = nullptr;
+    if (json_request.HasMember(REQUEST_FILTER) && json_request[REQUEST_FILTER].IsObject())
+    {
+        static Histogram &filter_histogram = stageHistogram("filter_bitmap");
+        ScopedTimer timer(filter_histogram, profile ? &profile->filter_bitmap_ns : nullptr);
+        filter_bitmap = buildFilterBitmap(json_request[REQUEST_FILTER]);
+    }
+    if (profile)
+    {
+        profile->index_type = index_type;
+        profile->filtered = filter_bitmap != nullptr;
+        profile->filter_cardinality = filter_bitmap ? roaring_bitmap_get_cardinality(filter_bitmap) : 0;
+    }
+
+    FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+    SparseIndex *sparse_index = m_index_factory.getSparseIndex();
     std::pair<std::vector<i64>, std::vector<f32>> results;
-    if (index)
+    if (index == nullptr || sparse_index == nullptr)
+    {
+        roaring_bitmap_free(filter_bitmap);
+        return results;
+    }
+
+    // the sparse side runs on the shard pool while this thread searches the dense index; it
+    // reads the bitmap, so the future is always waited for before the bitmap is freed
+    std::future<std::pair<std::vector<i64>, std::vector<f32>>> sparse_future =
+        getShardThreadPool()->submit([&, candidates]() {
+            auto start = std::chrono::steady_clock::now();
+            auto sparse_results = sparse_index->search_vector(indices, values, candidates, filter_bitmap);
+            if (profile)
+            {
+                profile->sparse_search_ns = elapsedNsSince(start);
+            }
+            return sparse_results;
+        });
+    std::pair<std::vector<i64>, std::vector<f32>> dense_results;
+    std::pair<std::vector<i64>, std::vector<f32>> sparse_results;
+    try
+    {
+        i32 dense_candidates = rerank_results ? candidates * oversample : candidates;
+        SearchStats *stats = profile && profile->collect_search_stats ? &profile->search_stats : nullptr;
+        auto start = std::chrono::steady_clock::now();
+        dense_results = index->search_vectors(query, dense_candidates, filter_bitmap, stats, search_options);
+        m_index_factory.getIdMap().toExternal(dense_results.first);
+        if (profile)
+        {
+            profile->faiss_search_ns = elapsedNsSince(start);
+        }
+        if (rerank_results)
+        {
+            static Histogram &rerank_histogram = stageHistogram("rerank");
+            ScopedTimer timer(rerank_histogram, profile ? &profile->rerank_ns : nullptr);
+            dense_results = rerank(query, candidates, dense_candidates, dense_results);
+            if (profile)
+            {
+                profile->rerank_candidates = static_cast<u64>(dense_candidates);
+            }
+        }
+        sparse_results = sparse_future.get();
+    }
+    catch (...)
     {
-        results = index->search_vectors(query, k, filter_bitmap);
+        if (sparse_future.valid())
+        {
+            sparse_future.wait();
+        }
+        roaring_bitmap_free(filter_bitmap);
+        throw;
     }
+    roaring_bitmap_free(filter_bitmap);
+    m_index_factory.getIdMap().toExternal(sparse_results.first);
 
-    if (filter_bitmap != nullptr)
+    // distances of an L2 index grow with dissimilarity, so the fused side takes their negation
+    if (m_config.metric == IndexFactory::MetricType::L2)
+    {
+        for (f32 &distance : dense_results.second)
+        {
+            distance = -distance;
+        }
+    }
+    std::unordered_map<i64, f32> fused;
+    fuseRanking(dense_results.first, dense_results.second, dense_weight, rrf, rrf_k, fused);
+    fuseRanking(sparse_results.first, sparse_results.second, sparse_weight, rrf, rrf_k, fused);
+
+    std::vector<std::pair<f32, i64>> ranked;
+    ranked.reserve(fused.size());
+    for (const auto &[id, score] : fused)
+    {
+        ranked.emplace_back(score, id);
+    }
+    size_t keep = std::min(ranked.size(), static_cast<size_t>(k));
+    std::partial_sort(ranked.begin(), ranked.begin() + keep, ranked.end(), [](const auto &a, const auto &b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    results.first.assign(k, -1);
+    results.second.assign(k, 0.0f);
+    for (size_t i = 0; i < keep; ++i)
+    {
+        results.first[i] = ranked[i].second;
+        results.second[i] = ranked[i].first;
+    }
+    return results;
+}
+
+RangeSearchResults VectorDB::rangeSearch(const rapidjson::Document &json_request, const std::vector<f32> &query)
+{
+    std::shared_lock lock(m_mutex);
+    f32 radius = static_cast<f32>(json_request[REQUEST_RADIUS].GetDouble());
+    IndexFactory::IndexType index_type = getIndexTypeFromJson(json_request);
+    SearchOptions search_options;
+    if (json_request.HasMember(REQUEST_NPROBE) && json_request[REQUEST_NPROBE].IsInt())
+    {
+        search_options.nprobe = json_request[REQUEST_NPROBE].GetInt();
+    }
+
+    roaring_bitmap_t *filter_bitmap = nullptr;
+    if (json_request.HasMember(REQUEST_FILTER) && json_request[REQUEST_FILTER].IsObject())
+    {
+        static Histogram &filter_histogram = stageHistogram("filter_bitmap");
+        ScopedTimer timer(filter_histogram);
+        filter_bitmap = buildFilterBitmap(json_request[REQUEST_FILTER]);
+    }
+
+    RangeSearchResults results;
+    FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+    try
+    {
+        if (index)
+        {
+            results = index->range_search_vectors(query, radius, filter_bitmap, search_options);
+            m_index_factory.getIdMap().toExternal(results.labels);
+        }
+    }
+    catch (...)
     {
-        delete filter_bitmap;
+        // faiss throws for index types without range search
+        roaring_bitmap_free(filter_bitmap);
+        throw;
     }
+    roaring_bitmap_free(filter_bitmap);
     return results;
 }
 
-void VectorDB::writeWALLog(const std::string &operation_type, const rapidjson::Document &json_data)
+void VectorDB::storeVectors(const std::vector<u64> &ids, const std::vector<f32> &data)
+{
+    if (m_config.metric != IndexFactory::MetricType::COSINE)
+    {
+        m_scalar_storage.put_vectors(ids, data.data(), m_config.dim);
+        return;
+    }
+    std::vector<f32> normalized = data;
+    faiss::fvec_renorm_L2(m_config.dim, ids.size(), normalized.data());
+    m_scalar_storage.put_vectors(ids, normalized.data(), m_config.dim);
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> VectorDB::rerank(
+    const std::vector<f32> &query, i32 k, i32 candidates, const std::pair<std::vector<i64>, std::vector<f32>> &results)
+{
+    size_t dim = m_config.dim;
+    size_t query_num = query.size() / dim;
+    const auto &[labels, distances] = results;
+
+    std::vector<f32> queries = query;
+    if (m_config.metric == IndexFactory::MetricType::COSINE)
+    {
+        faiss::fvec_renorm_L2(dim, query_num, queries.data());
+    }
+    bool larger_is_better = m_config.metric != IndexFactory::MetricType::L2;
+
+    // one MultiGet for the candidates of all queries; the labels are external ids already, so only -1 means no
+    // result and ids at or above 2^63 show up negative here
+    std::vector<u64> ids;
+    std::unordered_map<i64, size_t> rows;
+    for (i64 label : labels)
+    {
+        if (label != -1 && rows.emplace(label, ids.size()).second)
+        {
+            ids.push_back(static_cast<u64>(label));
+        }
+    }
+    std::vector<f32> vectors;
+    std::vector<bool> found = m_scalar_storage.get_vectors(ids, dim, vectors);
+
+    std::vector<i64> reranked_labels(query_num * k, -1);
+    std::vector<f32> reranked_distances(query_num * k, larger_is_better ? -std::numeric_limits<f32>::max()
+                                                                        : std::numeric_limits<f32>::max());
+    std::vector<std::pair<f32, i64>> scored;
+    for (size_t q = 0; q < query_num; ++q)
+    {
+        const f32 *query_vector = queries.data() + q * dim;
+        scored.clear();
+        for (size_t c = q * candidates; c < (q + 1) * candidates; ++c)
+        {
+            if (labels[c] == -1)
+            {
+                continue;
+            }
+            size_t row = rows[labels[c]];
+            // a candidate without a stored vector keeps its approximate distance
+            f32 distance = distances[c];
+            if (found[row])
+            {
+                const f32 *vector = vectors.data() + row * dim;
+                distance = larger_is_better ? faiss::fvec_inner_product(query_vector, vector, dim)
+                                            : faiss::fvec_L2sqr(query_vector, vector, dim);
+            }
+            scored.emplace_back(distance, labels[c]);
+        }
+        size_t keep = std::min(scored.size(), static_cast<size_t>(k));
+        std::partial_sort(scored.begin(), scored.begin() + keep, scored.end(), [&](const auto &a, const auto &b) {
+            return larger_is_better ? a.first > b.first : a.first < b.first;
+        });
+        for (size_t i = 0; i < keep; ++i)
+        {
+            reranked_distances[q * k + i] = scored[i].first;
+            reranked_labels[q * k + i] = scored[i].second;
+        }
+    }
+    return {reranked_labels, reranked_distances};
+}
+
+std::pair<std::vector<i64>, std::vector<f32>> VectorDB::rerankPrefiltered(const std::vector<f32> &query, i32 k,
+                                                                          i32 candidates,
+                                                                          const std::vector<i64> &ordinals,
+                                                                          IndexFactory::IndexType index_type)
+{
+    size_t dim = m_config.dim;
+    size_t query_num = query.size() / dim;
+    std::vector<f32> queries = query;
+    if (m_config.metric == IndexFactory::MetricType::COSINE)
+    {
+        faiss::fvec_renorm_L2(dim, query_num, queries.data());
+    }
+    bool larger_is_better = m_config.metric != IndexFactory::MetricType::L2;
+
+    // the float vector of each distinct candidate, fetched once for all queries
+    std::vector<i64> distinct;
+    std::unordered_map<i64, size_t> rows;
+    for (i64 ordinal : ordinals)
+    {
+        if (ordinal >= 0 && rows.emplace(ordinal, distinct.size()).second)
+        {
+            distinct.push_back(ordinal);
+        }
+    }
+    std::vector<f32> vectors(distinct.size() * dim);
+    std::vector<bool> found(distinct.size(), false);
+    FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+    if (isCompressedIndexType(index_type))
+    {
+        // the codes are lossy, the exact vectors are stored by id next to them
+        std::vector<i64> ids = distinct;
+        m_index_factory.getIdMap().toExternal(ids);
+        found = m_scalar_storage.get_vectors(std::vector<u64>(ids.begin(), ids.end()), dim, vectors);
+    }
+    else if (index)
+    {
+        std::vector<f32> vector;
+        for (size_t row = 0; row < distinct.size(); ++row)
+        {
+            if (index->reconstruct_vector(distinct[row], vector))
+            {
+                std::copy(vector.begin(), vector.end(), vectors.begin() + row * dim);
+                found[row] = true;
+            }
+        }
+    }
+
+    std::vector<i64> reranked_labels(query_num * k, -1);
+    std::vector<f32> reranked_distances(query_num * k, larger_is_better ? -std::numeric_limits<f32>::max()
+                                                                        : std::numeric_limits<f32>::max());
+    std::vector<std::pair<f32, i64>> scored;
+    for (size_t q = 0; q < query_num; ++q)
+    {
+        const f32 *query_vector = queries.data() + q * dim;
+        scored.clear();
+        for (size_t c = q * candidates; c < (q + 1) * candidates; ++c)
+        {
+            if (ordinals[c] < 0 || !found[rows[ordinals[c]]])
+            {
+                continue;
+            }
+            const f32 *vector = vectors.data() + rows[ordinals[c]] * dim;
+            f32 distance = larger_is_better ? faiss::fvec_inner_product(query_vector, vector, dim)
+                                            : faiss::fvec_L2sqr(query_vector, vector, dim);
+            scored.emplace_back(distance, ordinals[c]);
+        }
+        size_t keep = std::min(scored.size(), static_cast<size_t>(k));
+        std::partial_sort(scored.begin(), scored.begin() + keep, scored.end(), [&](const auto &a, const auto &b) {
+            return larger_is_better ? a.first > b.first : a.first < b.first;
+        });
+        for (size_t i = 0; i < keep; ++i)
+        {
+            reranked_distances[q * k + i] = scored[i].first;
+            reranked_labels[q * k + i] = scored[i].second;
+        }
+    }
+    m_index_factory.getIdMap().toExternal(reranked_labels);
+    return {reranked_labels, reranked_distances};
+}
+
+roaring_bitmap_t *VectorDB::buildFilterBitmap(const rapidjson::Value &filter)
+{
+    FilterIndex *filter_index = m_index_factory.getFilterIndex();
+    if (filter_index == nullptr)
+    {
+        return nullptr;
+    }
+
+    // TODO: 检查下列字段合法性
+    std::string field_name = filter[REQUEST_FILTER_NAME].GetString();
+    std::string op_str = filter[REQUEST_FILTER_OP].GetString();
+    i64 value = filter[REQUEST_FILTER_VALUE].GetInt64();
+
+    FilterIndex::Operation op = (op_str == "=") ? FilterIndex::Operation::EQUAL : FilterIndex::Operation::NOT_EQUAL;
+
+    std::shared_lock filter_lock(m_filter_mutex);
+    roaring_bitmap_t *filter_bitmap = roaring_bitmap_create();
+    filter_index->getIntFieldFilterBitmap(field_name, op, value, filter_bitmap);
+    return filter_bitmap;
+}
+
+std::vector<u64> VectorDB::getFilteredIds(const rapidjson::Value &filter)
 {
-    std::string version = "1.0";
-    m_persistence.writeWALLog(operation_type, json_data, version);
+    std::shared_lock lock(m_mutex);
+    roaring_bitmap_t *filter_bitmap = buildFilterBitmap(filter);
+    if (filter_bitmap == nullptr)
+    {
+        throw std::invalid_argument("Filter index is not configured for collection " + m_config.name);
+    }
+
+    std::vector<u64> ids = m_index_factory.getIdMap().toExternal(filter_bitmap);
+    roaring_bitmap_free(filter_bitmap);
+    return ids;
 }
 
 void VectorDB::reloadDataBase()
 {
-    GlobalLogger->info("<VectorDB> Entering VectorDB::reloadDataBase()");
-    m_persistence.loadSnapshot(m_scalar_storage);
+    GlobalLogger->info("<VectorDB> Entering VectorDB::reloadDataBase() of collection {}", m_config.name);
+    std::unique_lock lock(m_mutex);
+    m_persistence.loadSnapshot(m_index_factory, m_scalar_storage);
+    bumpWriteEpochs();
     std::string operator_type;
     rapidjson::Document json_data;
-    m_persistence.readNextWALLog(&operator_type, &json_data);
+    std::vector<f32> vector;
+    m_persistence.readNextWALLog(&operator_type, &json_data, &vector);
 
     while (!operator_type.empty())
     {
         GlobalLogger->debug("<VectorDB> Operation Type: {}", operator_type);
 
         rapidjson::StringBuffer buffer;
-        rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+        JsonWriter<rapidjson::StringBuffer> writer(buffer);
         json_data.Accept(writer);
         GlobalLogger->info("<VectorDB> Read Line: {}", buffer.GetString());
 
-        if (operator_type == "upsert")
+        // an entry that cannot be applied is skipped, so one bad write does not keep the collection from loading
+        try
         {
-            u64 id = json_data[REQUEST_ID].GetUint64();
-            IndexFactory::IndexType index_type = getIndexTypeFromJson(json_data);
-            upsert(id, json_data, index_type);
+            if (operator_type == "upsert")
+            {
+                u64 id = json_data[REQUEST_ID].GetUint64();
+                IndexFactory::IndexType index_type = getIndexTypeFromJson(json_data);
+                applyUpsert(id, json_data, vector, index_type);
+            }
+            else if (operator_type == "delete")
+            {
+                std::vector<u64> ids;
+                for (const auto &id : json_data[REQUEST_IDS].GetArray())
+                {
+                    ids.push_back(id.GetUint64());
+                }
+                applyRemove(ids);
+            }
+        }
+        catch (const std::exception &e)
+        {
+            GlobalLogger->error("<VectorDB> Skipping WAL entry {} of collection {}: {}", buffer.GetString(),
+                                m_config.name, e.what());
         }
 
         rapidjson::Document().Swap(json_data);
         operator_type.clear();
-        m_persistence.readNextWALLog(&operator_type, &json_data);
+        m_persistence.readNextWALLog(&operator_type, &json_data, &vector);
+    }
+}
+
+u64 VectorDB::buildFromFile(IndexFactory::IndexType index_type, const std::string &file_path, u64 start_id)
+{
+    // vectors from one batch at a time are held in memory
+    constexpr size_t kBatchSize = 65536;
+    // k-means wants a few dozen points per IVF centroid, and PQ codebooks 256 centroids each
+    constexpr size_t kTrainPointsPerList = 64;
+
+    std::shared_lock lock(m_mutex);
+    FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+    if (index == nullptr)
+    {
+        throw std::invalid_argument(std::format("No {} index in collection {}", index_type, m_config.name));
+    }
+    FvecsReader reader(file_path);
+    if (reader.dim() != index->getDim())
+    {
+        throw std::invalid_argument(
+            std::format("Vectors in {} have dimension {}, expected {}", file_path, reader.dim(), index->getDim()));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<f32> data;
+    if (!index->isTrained())
+    {
+        size_t train_count =
+            std::max(static_cast<size_t>(m_config.index_params.ivf_nlist) * kTrainPointsPerList, kBatchSize);
+        size_t count = reader.read(data, train_count);
+        GlobalLogger->info("<VectorDB> Training {} index of collection {} on {} vectors",
+                           std::format("{}", index_type), m_config.name, count);
+        index->train(data);
+        reader.rewind();
+    }
+
+    IdMap &id_map = m_index_factory.getIdMap();
+    u64 total = 0;
+    std::vector<u64> ids;
+    std::vector<i64> labels;
+    while (true)
+    {
+        data.clear();
+        size_t count = reader.read(data, kBatchSize);
+        if (count == 0)
+        {
+            break;
+        }
+        ids.resize(count);
+        labels.resize(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            ids[i] = start_id + total + i;
+            labels[i] = id_map.assign(ids[i]);
+        }
+        index->add_vectors(data, labels);
+        if (isCompressedIndexType(index_type))
+        {
+            storeVectors(ids, data);
+        }
+        total += count;
+        bumpWriteEpoch(index_type);
+        GlobalLogger->debug("<VectorDB> Added {} vectors to the {} index of collection {}", total,
+                            std::format("{}", index_type), m_config.name);
     }
+
+    // the vectors are not in the WAL, so they are persisted right away, through a full snapshot: the
+    // shard files, their arena slots, the arena, the id map and .maxlogid have to describe the same state
+    lock.unlock();
+    takeSnapshot();
+    GlobalLogger->info("<VectorDB> Built {} index of collection {} from {}: {} vectors in {} ms",
+                       std::format("{}", index_type), m_config.name, file_path, total,
+                       elapsedNsSince(start) / 1000000);
+    return total;
 }
 
 void VectorDB::takeSnapshot()
 {
-    m_persistence.takeSnapshot(m_scalar_storage);
+    std::unique_lock lock(m_mutex);
+    m_persistence.takeSnapshot(m_index_factory, m_scalar_storage);
+}
+
+std::map<IndexFactory::IndexType, CompactionReport> VectorDB::compact(f64 threshold)
+{
+    // shared: requests keep flowing, snapshots and drops wait for the compaction
+    std::shared_lock lock(m_mutex);
+    std::map<IndexFactory::IndexType, CompactionReport> reports;
+    if (m_dropped)
+    {
+        return reports;
+    }
+
+    for (IndexFactory::IndexType index_type : m_config.index_types)
+    {
+        CompactionReport report;
+        if (FaissIndex *index = m_index_factory.getFaissIndex(index_type))
+        {
+            report = index->compact(threshold);
+        }
+        else if (BinaryIndex *binary_index = m_index_factory.getBinaryIndex(index_type))
+        {
+            report = binary_index->compact(threshold);
+        }
+        if (report.shards_compacted == 0)
+        {
+            continue;
+        }
+
+        GlobalLogger->info("<VectorDB> Compacted {} index of collection {}: {} shards, {} vectors, {} tombstones "
+                           "removed, {} writes replayed, memory {} -> {} bytes, recall@10 {:.3f} -> {:.3f}, {} ms",
+                           std::format("{}", index_type), m_config.name, report.shards_compacted, report.vectors,
+                           report.tombstones_removed, report.replayed_writes, report.memory_before_bytes,
+                           report.memory_after_bytes, report.recall_before, report.recall_after,
+                           report.duration_ms);
+        getGlobalMetrics()
+            ->counter("vdb_compactions_total", "Index compactions that rebuilt at least one shard",
+                      {{"collection", m_config.name}, {"index_type", std::format("{}", index_type)}})
+            .inc();
+        reports[index_type] = report;
+    }
+    m_index_factory.getIdMap().recycle();
+    return reports;
+}
+
+void VectorDB::drop()
+{
+    std::unique_lock lock(m_mutex);
+    m_dropped = true;
+    GlobalLogger->info("<VectorDB> Dropping collection {}", m_config.name);
+    m_scalar_storage.dropColumnFamily();
+
+    std::vector<std::string> files = {m_wal_path, m_snapshot_path + ".maxlogid", m_snapshot_path + ".arena"};
+    for (IndexFactory::IndexType index_type : m_config.index_types)
+    {
+        FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+        if (index)
+        {
+            std::vector<std::string> index_files =
+                index->getSnapshotFiles(std::format("{}.{}.index", m_snapshot_path, index_type));
+            files.insert(files.end(), index_files.begin(), index_files.end());
+        }
+        BinaryIndex *binary_index = m_index_factory.getBinaryIndex(index_type);
+        if (binary_index)
+        {
+            std::vector<std::string> index_files =
+                binary_index->getSnapshotFiles(std::format("{}.{}.index", m_snapshot_path, index_type));
+            files.insert(files.end(), index_files.begin(), index_files.end());
+        }
+        SparseIndex *sparse_index =
+            index_type == IndexFactory::IndexType::SPARSE ? m_index_factory.getSparseIndex() : nullptr;
+        if (sparse_index)
+        {
+            std::vector<std::string> index_files =
+                sparse_index->getSnapshotFiles(std::format("{}.{}.index", m_snapshot_path, index_type));
+            files.insert(files.end(), index_files.begin(), index_files.end());
+        }
+    }
+    for (const std::string &file : files)
+    {
+        std::error_code ec;
+        std::filesystem::remove(file, ec);
+        if (ec)
+        {
+            GlobalLogger->warn("<VectorDB> Failed to remove {}: {}", file, ec.message());
+        }
+    }
+    getGlobalMetrics()->removeSeries({{"collection", m_config.name}});
+}
+
+CollectionStats VectorDB::getStats() const
+{
+    std::shared_lock lock(m_mutex);
+    CollectionStats stats;
+    for (IndexFactory::IndexType index_type : m_config.index_types)
+    {
+        FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+        if (index)
+        {
+            stats.indexes[index_type] = {index->getVectorCount(), index->getDeletedCount(), index->getMemoryUsage()};
+        }
+        BinaryIndex *binary_index = m_index_factory.getBinaryIndex(index_type);
+        if (binary_index)
+        {
+            stats.indexes[index_type] = {binary_index->getVectorCount(), binary_index->getDeletedCount(),
+                                         binary_index->getMemoryBreakdown().total()};
+        }
+        SparseIndex *sparse_index = m_index_factory.getSparseIndex();
+        if (index_type == IndexFactory::IndexType::SPARSE && sparse_index)
+        {
+            // deletes drop postings right away, nothing is left tombstoned
+            stats.indexes[index_type] = {sparse_index->getVectorCount(), 0, sparse_index->getMemoryBreakdown().total()};
+        }
+    }
+    FilterIndex *filter_index = m_index_factory.getFilterIndex();
+    if (filter_index)
+    {
+        std::shared_lock filter_lock(m_filter_mutex);
+        stats.filter_bitmaps = filter_index->getFieldBitmapCounts();
+    }
+    stats.storage_bytes = m_scalar_storage.getApproximateSize();
+    stats.wal_bytes_since_snapshot = m_persistence.getWALBytesSinceSnapshot();
+    stats.result_cache_bytes = m_result_cache ? m_result_cache->getMemoryUsage() : 0;
+    return stats;
+}
+
+u64 CollectionMemoryUsage::total() const
+{
+    u64 bytes = result_cache_bytes + vector_arena_bytes + id_map_bytes;
+    for (const auto &[index_type, usage] : indexes)
+    {
+        bytes += usage.total();
+    }
+    for (const auto &[field_name, usage] : filter_fields)
+    {
+        bytes += usage.bytes;
+    }
+    return bytes;
+}
+
+CollectionMemoryUsage VectorDB::getMemoryUsage() const
+{
+    std::shared_lock lock(m_mutex);
+    CollectionMemoryUsage usage;
+    for (IndexFactory::IndexType index_type : m_config.index_types)
+    {
+        FaissIndex *index = m_index_factory.getFaissIndex(index_type);
+        if (index)
+        {
+            usage.indexes[index_type] = index->getMemoryBreakdown();
+        }
+        BinaryIndex *binary_index = m_index_factory.getBinaryIndex(index_type);
+        if (binary_index)
+        {
+            usage.indexes[index_type] = binary_index->getMemoryBreakdown();
+        }
+        SparseIndex *sparse_index = m_index_factory.getSparseIndex();
+        if (index_type == IndexFactory::IndexType::SPARSE && sparse_index)
+        {
+            usage.indexes[index_type] = sparse_index->getMemoryBreakdown();
+        }
+    }
+    FilterIndex *filter_index = m_index_factory.getFilterIndex();
+    if (filter_index)
+    {
+        std::shared_lock filter_lock(m_filter_mutex);
+        usage.filter_fields = filter_index->getFieldMemoryUsage();
+    }
+    usage.result_cache_bytes = m_result_cache ? m_result_cache->getMemoryUsage() : 0;
+    VectorArena *arena = m_index_factory.getArena();
+    usage.vector_arena_bytes = arena ? arena->getMemoryUsage() : 0;
+    usage.id_map_bytes = m_index_factory.getIdMap().getMemoryUsage();
+    return usage;
+}
+
+void VectorDB::updateMetrics()
+{
+    CollectionStats stats = getStats();
+    MetricsRegistry *metrics = getGlobalMetrics();
+    for (const auto &[index_type, index_stats] : stats.indexes)
+    {
+        MetricsRegistry::Labels labels = {{"collection", m_config.name},
+                                          {"index_type", std::format("{}", index_type)}};
+        metrics->gauge("vdb_index_vectors", "Vectors stored per index type", labels)
+            .set(static_cast<i64>(index_stats.vectors));
+        metrics->gauge("vdb_index_deleted_vectors", "Tombstoned vectors awaiting compaction per index type", labels)
+            .set(static_cast<i64>(index_stats.deleted));
+        metrics->gauge("vdb_index_memory_bytes", "Estimated memory held per index type", labels)
+            .set(static_cast<i64>(index_stats.memory_bytes));
+    }
+
+    for (const auto &[field_name, count] : stats.filter_bitmaps)
+    {
+        metrics
+            ->gauge("vdb_filter_bitmaps", "Value bitmaps kept per filter field",
+                    {{"collection", m_config.name}, {"field", field_name}})
+            .set(static_cast<i64>(count));
+    }
+
+    metrics->gauge("vdb_wal_bytes_since_snapshot", "WAL bytes written since the last snapshot",
+                   {{"collection", m_config.name}})
+        .set(static_cast<i64>(stats.wal_bytes_since_snapshot));
+    metrics->gauge("vdb_storage_bytes", "Estimated live data size in RocksDB", {{"collection", m_config.name}})
+        .set(static_cast<i64>(stats.storage_bytes));
+    metrics->gauge("vdb_result_cache_bytes", "Memory held by cached search results", {{"collection", m_config.name}})
+        .set(static_cast<i64>(stats.result_cache_bytes));
 }
 
 } // namespace vdb
@@ -1,35 +1,215 @@
 #pragma once
+#include "config.hh"
 #include "index_factory.hh"
 #include "persistence.hh"
+#include "result_cache.hh"
 #include "scalar_storage.hh"
 #include <rapidjson/document.h>
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <rocksdb/db.h>
+#include <shared_mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
 namespace vdb
 {
+
+/// Breakdown of one search request: returned with "profile": true and written to the
+/// slow-query log for requests above the threshold.
+struct SearchProfile
+{
+    IndexFactory::IndexType index_type = IndexFactory::IndexType::UNKNOWN;
+    u64 json_parse_ns = 0;
+    u64 filter_bitmap_ns = 0;
+    u64 faiss_search_ns = 0;
+    // SPARSE index, run next to the dense search by a hybrid search
+    u64 sparse_search_ns = 0;
+    // compressed indexes: fetching the exact vectors of the candidates and re-ranking them
+    u64 rerank_ns = 0;
+    u64 rerank_candidates = 0;
+    u64 serialize_ns = 0;
+    u64 total_ns = 0;
+    bool filtered = false;
+    u64 filter_cardinality = 0;
+    // answered from the result cache, no stage below the JSON parse ran
+    bool cache_hit = false;
+    // only filled when set: a query asking for HNSW counters is kept out of the micro-batcher
+    bool collect_search_stats = false;
+    SearchStats search_stats;
+};
+
+/// Size figures of one collection, reported by /admin/collections and /metrics.
+struct CollectionStats
+{
+    struct IndexStats
+    {
+        u64 vectors = 0;
+        u64 deleted = 0;
+        u64 memory_bytes = 0;
+    };
+    std::map<IndexFactory::IndexType, IndexStats> indexes;
+    std::map<std::string, u64> filter_bitmaps;
+    u64 storage_bytes = 0;
+    u64 wal_bytes_since_snapshot = 0;
+    u64 result_cache_bytes = 0;
+};
+
+/// Estimated memory of one collection, reported by /admin/memory.
+struct CollectionMemoryUsage
+{
+    std::map<IndexFactory::IndexType, IndexMemoryUsage> indexes;
+    std::map<std::string, FilterFieldMemoryUsage> filter_fields;
+    u64 result_cache_bytes = 0;
+    // rows shared by the FLAT and HNSW indexes, which then only count 4 bytes per vector
+    u64 vector_arena_bytes = 0;
+    // external ids and the ordinals standing for them in the indexes
+    u64 id_map_bytes = 0;
+
+    u64 total() const;
+};
+
+/// One collection: its own indexes, RocksDB column family, WAL stream and snapshot files.
+/// Reads and writes share the collection lock, writes to the same id serialize on a striped id
+/// lock and the vector indexes lock per shard; snapshots, reloads and drops take the collection
+/// lock exclusively, so a busy collection never blocks another one.
+///
+/// Ids are u64 at this interface; the indexes label vectors and filter bitmaps with the dense
+/// ordinals of the IdMap kept by the index factory, and results are translated back.
 class VectorDB
 {
   public:
-    VectorDB(const std::string &db_path, const std::string &wal_path);
+    VectorDB(const CollectionConfig &config, rocksdb::DB *db, rocksdb::ColumnFamilyHandle *column_family,
+             const std::string &wal_path, const std::string &snapshot_path);
 
     /// Modify
-    void upsert(u64 id, const rapidjson::Document &data, IndexFactory::IndexType index_type);
+    /// append to the WAL, then apply
+    void upsert(u64 id, const rapidjson::Document &data, const std::vector<f32> &vector,
+                IndexFactory::IndexType index_type);
+    /// add a vector to one index only, without WAL entry or scalar data
+    void insert(u64 id, const std::vector<f32> &vector, IndexFactory::IndexType index_type);
+    /// the same for a bit-packed vector and a binary index
+    void insertBinary(u64 id, const std::vector<u8> &code, IndexFactory::IndexType index_type);
+    /// the same for a sparse vector and the SPARSE index
+    void insertSparse(u64 id, const std::vector<u32> &indices, const std::vector<f32> &values);
+    /// append to the WAL, then tombstone the ids in every index and drop their scalar data and
+    /// filter entries; returns how many of them existed
+    u64 remove(const std::vector<u64> &ids);
+    /// Bulk-load the vectors of a .fvecs file into one index, the i-th getting id `start_id + i`,
+    /// without WAL entries or scalar data; an untrained index is first trained on a sample from the
+    /// head of the file, and compressed indexes also keep the exact vectors. The index is
+    /// snapshotted once loaded. Returns the number of vectors.
+    u64 buildFromFile(IndexFactory::IndexType index_type, const std::string &file_path, u64 start_id);
 
     /// Observe
+    /// with a vector arena, the vector of a FLAT or HNSW document is read back from its index
     rapidjson::Document query(u64 id);
-    std::pair<std::vector<i64>, std::vector<f32>> search(const rapidjson::Document &json_request);
+    /// with a "prefilter" binary index type, candidates come from that index (queried with the
+    /// request's binary vectors) and are re-ranked by exact distance to `query`
+    std::pair<std::vector<i64>, std::vector<f32>> search(const rapidjson::Document &json_request,
+                                                         const std::vector<f32> &query,
+                                                         SearchProfile *profile = nullptr);
+    /// k-NN search of a binary index; distances are in bits and results are not cached
+    std::pair<std::vector<i64>, std::vector<f32>> searchBinary(const rapidjson::Document &json_request,
+                                                               const std::vector<u8> &query,
+                                                               SearchProfile *profile = nullptr);
+    /// top-k dot products of one sparse query in the SPARSE index; scores are larger first and
+    /// results are not cached
+    std::pair<std::vector<i64>, std::vector<f32>> searchSparse(const rapidjson::Document &json_request,
+                                                               const std::vector<u32> &indices,
+                                                               const std::vector<f32> &values,
+                                                               SearchProfile *profile = nullptr);
+    /// Search the dense index of the request with `query` and the SPARSE index with the sparse
+    /// query under the same filter, the sparse side on the shard pool in parallel, and fuse the
+    /// two rankings by reciprocal rank ("fusion": "rrf", the default) or by a weighted sum of
+    /// min-max normalized scores ("weighted"). Returns ids and fused scores, larger first.
+    std::pair<std::vector<i64>, std::vector<f32>> hybridSearch(const rapidjson::Document &json_request,
+                                                               const std::vector<f32> &query,
+                                                               const std::vector<u32> &indices,
+                                                               const std::vector<f32> &values,
+                                                               SearchProfile *profile = nullptr);
+    /// every vector within the request's radius of each query, see FaissIndex::range_search_vectors
+    RangeSearchResults rangeSearch(const rapidjson::Document &json_request, const std::vector<f32> &query);
+    const CollectionConfig &getConfig() const;
+    FaissIndex *getFaissIndex(IndexFactory::IndexType index_type) const;
+    BinaryIndex *getBinaryIndex(IndexFactory::IndexType index_type) const;
+    SparseIndex *getSparseIndex() const;
+    /// ids whose scalar fields match a search filter; requires the FILTER index
+    std::vector<u64> getFilteredIds(const rapidjson::Value &filter);
+    CollectionStats getStats() const;
+    CollectionMemoryUsage getMemoryUsage() const;
 
     /// WAL
-    void writeWALLog(const std::string &operation_type, const rapidjson::Document &json_data);
     void reloadDataBase();
 
     /// Snapshot
     void takeSnapshot();
 
+    /// Compaction
+    /// compact the FLAT/HNSW indexes with shards at or above `threshold` tombstones; the reports of
+    /// indexes where no shard qualified are left out
+    std::map<IndexFactory::IndexType, CompactionReport> compact(f64 threshold);
+
+    /// delete the column family, WAL and snapshot files; nothing may be called afterwards
+    void drop();
+
+    /// Metrics
+    /// refresh the index size, memory, filter and WAL gauges before an exposition
+    void updateMetrics();
+
+  private:
+    void applyUpsert(u64 id, const rapidjson::Document &data, const std::vector<f32> &vector,
+                     IndexFactory::IndexType index_type);
+    u64 applyRemove(const std::vector<u64> &ids);
+    /// Add the "binaryVectors" code of a document to the binary index named by `index_type`, or to
+    /// every binary index when `index_type` is a float one, so that they can prefilter it
+    void applyBinaryUpsert(u64 id, u32 ordinal, const rapidjson::Document &data, IndexFactory::IndexType index_type);
+    /// add the "sparseVector" of a document to the SPARSE index, whatever index the upsert names
+    void applySparseUpsert(u64 id, u32 ordinal, const rapidjson::Document &data);
+    /// nullptr without a FILTER index; the caller frees the bitmap
+    roaring_bitmap_t *buildFilterBitmap(const rapidjson::Value &filter);
+    /// keep the exact vectors of `ids` (rows of `data`) for re-ranking, normalized for COSINE
+    void storeVectors(const std::vector<u64> &ids, const std::vector<f32> &data);
+    /// order the `candidates` results per query of a compressed index by exact distance and keep k
+    std::pair<std::vector<i64>, std::vector<f32>> rerank(const std::vector<f32> &query, i32 k, i32 candidates,
+                                                         const std::pair<std::vector<i64>, std::vector<f32>> &results);
+    /// order the `candidates` ordinals per query found by a binary prefilter by exact distance to
+    /// the float vectors kept for `index_type` and keep k; candidates without one are dropped
+    std::pair<std::vector<i64>, std::vector<f32>> rerankPrefiltered(const std::vector<f32> &query, i32 k,
+                                                                    i32 candidates, const std::vector<i64> &ordinals,
+                                                                    IndexFactory::IndexType index_type);
+    /// mark cached results of `index_type` stale; called after a write is applied
+    void bumpWriteEpoch(IndexFactory::IndexType index_type);
+    void bumpWriteEpochs();
+    /// epoch a search result of `index_type` is cached under; a filtered one also depends on the
+    /// FILTER index. Both epochs only grow, so their sum changes with either.
+    u64 getWriteEpoch(IndexFactory::IndexType index_type, bool filtered) const;
+    std::mutex &idLock(u64 id);
+    /// the id locks of all `ids`, taken in a fixed order
+    std::vector<std::unique_lock<std::mutex>> lockIds(const std::vector<u64> &ids);
+
   private:
+    CollectionConfig m_config;
+    std::string m_wal_path;
+    std::string m_snapshot_path;
+    IndexFactory m_index_factory;
     ScalarStorage m_scalar_storage;
     Persistence m_persistence;
+    mutable std::shared_mutex m_mutex;
+    // FilterIndex is not thread-safe: bitmap builds share it, updates take it exclusively
+    mutable std::shared_mutex m_filter_mutex;
+    std::array<std::mutex, 64> m_id_locks;
+    // set by drop() so a compaction scheduled just before finds nothing to do
+    bool m_dropped = false;
+    // a compressed index is configured, so exact vectors are kept in the scalar storage
+    bool m_store_vectors = false;
+    // null unless the collection configures a result cache
+    std::unique_ptr<ResultCache> m_result_cache;
+    // one per configured index type, filled in the constructor
+    std::map<IndexFactory::IndexType, std::atomic<u64>> m_write_epochs;
 };
 } // namespace vdb
@@ -5,24 +5,59 @@ add_requires("rapidjson")
 add_requires("croaring")
 add_requires("conda::rocksdb", { alias = "rocksdb" })
 
-target("vectordb")
-set_kind("binary")
-add_files("src/*.cpp")
+-- 服务端核心代码，供 vectordb 及各基准测试程序共用
+target("vdb_core")
+set_kind("static")
+add_files("src/*.cpp|main.cpp")
 set_languages("c++20")
-add_packages("cpp-httplib", "spdlog", "rapidjson", "rocksdb", "croaring")
+add_packages("cpp-httplib", "spdlog", "rapidjson", "rocksdb", "croaring", { public = true })
+add_includedirs("src", { public = true })
 -- 使用环境变量动态获取路径
-add_includedirs(os.getenv("CONDA_PREFIX") .. "/include")
-add_linkdirs(os.getenv("CONDA_PREFIX") .. "/lib")
+add_includedirs(os.getenv("CONDA_PREFIX") .. "/include", { public = true })
+add_linkdirs(os.getenv("CONDA_PREFIX") .. "/lib", { public = true })
 
-add_links("faiss", "openblas", "spdlog")
+add_links("faiss", "openblas", "spdlog", { public = true })
 add_cxflags("-fopenmp")
 
 -- 设置运行时库路径（Linux/macOS）
 if is_plat("linux", "macosx") then
-	add_links("pthread")
-	add_rpathdirs(os.getenv("CONDA_PREFIX") .. "/lib")
+	add_links("pthread", { public = true })
+	add_rpathdirs(os.getenv("CONDA_PREFIX") .. "/lib", { public = true })
 end
 
+target("vectordb")
+set_kind("binary")
+add_files("src/main.cpp")
+set_languages("c++20")
+add_deps("vdb_core")
+add_cxflags("-fopenmp")
+add_ldflags("-fopenmp")
+
+-- 请求解码吞吐对比：rapidjson 默认解析 vs 原地解析 + from_chars
+target("json_decode_bench")
+set_kind("binary")
+set_default(false)
+add_files("bench/json_decode_bench.cpp")
+set_languages("c++20")
+add_deps("vdb_core")
+
+-- 进程内基准测试：索引、过滤、WAL 与快照，结果以 JSON 输出
+target("vectordb_bench")
+set_kind("binary")
+set_default(false)
+add_files("bench/vectordb_bench.cpp")
+set_languages("c++20")
+add_deps("vdb_core")
+add_cxflags("-fopenmp")
+
+-- HTTP 压测工具：开环（固定到达率）或闭环（固定并发）驱动本地服务
+target("vectordb_loadgen")
+set_kind("binary")
+set_default(false)
+add_files("bench/vectordb_loadgen.cpp")
+set_languages("c++20")
+add_deps("vdb_core")
+
 --
 -- If you want to known more usage about xmake, please see https://xmake.io
 --